@@ -42,6 +42,8 @@ core.features = {
 	node_interaction_actor = true,
 	moveresult_new_pos = true,
 	override_item_remove_fields = true,
+	voxelmanip_data_string = true,
+	voxelmanip_bulk_ops = true,
 }
 
 function core.has_feature(arg)
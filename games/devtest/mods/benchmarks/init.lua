@@ -154,3 +154,42 @@ minetest.register_chatcommand("bench_bulk_get_node", {
 		return true, msg
 	end,
 })
+
+minetest.register_chatcommand("bench_voxelmanip_data", {
+	params = "",
+	description = "Benchmark: Read and write the data of an 80×80×80 VoxelManip as tables and as strings",
+	func = function(name, param)
+		local player = minetest.get_player_by_name(name)
+		if not player then
+			return false, "No player."
+		end
+		local pos = player:get_pos():round()
+		local vm = VoxelManip(pos, pos:offset(79, 79, 79))
+		local buf = {}
+		local function bench()
+			local start_time = minetest.get_us_time()
+			for i = 1, 10 do
+				vm:get_data(buf)
+				vm:set_data(buf)
+				vm:get_param2_data(buf)
+				vm:set_param2_data(buf)
+			end
+			local middle_time = minetest.get_us_time()
+			for i = 1, 10 do
+				vm:set_data_string(vm:get_data_string())
+				vm:set_param2_data_string(vm:get_param2_data_string())
+			end
+			local end_time = minetest.get_us_time()
+			return middle_time - start_time, end_time - middle_time
+		end
+
+		minetest.chat_send_player(name, "Benchmarking VoxelManip data access. Warming up ...")
+		bench()
+
+		minetest.chat_send_player(name, "Warming up finished, now benchmarking ...")
+		local table_us, string_us = bench()
+		local msg = string.format("Benchmark results (10 passes): tables: %.2f ms; strings: %.2f ms",
+			table_us / 1000, string_us / 1000)
+		return true, msg
+	end,
+})
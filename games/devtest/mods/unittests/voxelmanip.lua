@@ -0,0 +1,69 @@
+local function test_voxelmanip_data_string(_, pos)
+	local vm = VoxelManip(pos, pos)
+	local data = vm:get_data()
+	local volume = #data
+
+	-- Content IDs
+	local s = vm:get_data_string()
+	assert(#s == 2 * volume)
+	local old = data[1]
+	local c_new = old == core.CONTENT_AIR and core.get_content_id("basenodes:stone")
+		or core.CONTENT_AIR
+	data[1] = c_new
+	vm:set_data(data)
+	local s2 = vm:get_data_string()
+	assert(s2 ~= s)
+	vm:set_data_string(s)
+	assert(vm:get_data()[1] == old)
+	vm:set_data_string(s2)
+	assert(vm:get_data()[1] == c_new)
+
+	-- Light and param2, one byte per node
+	local light = vm:get_light_data()
+	local ls = vm:get_light_data_string()
+	assert(#ls == volume)
+	for i = 1, volume do
+		assert(ls:byte(i) == light[i])
+	end
+	vm:set_light_data_string(string.rep("\15", volume))
+	assert(vm:get_light_data()[volume] == 15)
+
+	local p2s = string.rep("\7", volume)
+	vm:set_param2_data_string(p2s)
+	assert(vm:get_param2_data()[1] == 7)
+	assert(vm:get_param2_data_string() == p2s)
+
+	-- Length must match the volume
+	assert(not pcall(vm.set_data_string, vm, "xyz"))
+	assert(not pcall(vm.set_param2_data_string, vm, p2s .. "x"))
+end
+unittests.register("test_voxelmanip_data_string", test_voxelmanip_data_string, {map=true})
+
+local function test_voxelmanip_bulk(_, pos)
+	local vm = VoxelManip(pos, pos)
+	local emin, emax = vm:get_emerged_area()
+	local c_stone = core.get_content_id("basenodes:stone")
+	local c_dirt = core.get_content_id("basenodes:dirt")
+	local p1, p2 = emin:offset(1, 1, 1), emin:offset(3, 2, 4)
+
+	assert(vm:fill(emin, emax, core.CONTENT_AIR, 0) == #vm:get_data())
+	assert(vm:fill(p1, p2, c_stone, 3) == 24)
+	local counts = vm:count_contents(p1, p2:offset(1, 0, 0))
+	assert(counts[c_stone] == 24 and counts[core.CONTENT_AIR] == 8)
+
+	-- Only where param2 matches
+	assert(vm:fill(emin, emax, c_dirt, nil, 7) == 0)
+	assert(vm:fill(emin, emax, c_dirt, nil, 3) == 24)
+	assert(vm:get_node_at(p2).name == "basenodes:dirt")
+	assert(vm:get_node_at(p2).param2 == 3)
+
+	assert(vm:replace(emin, emax, {c_dirt, c_stone}, c_stone) == 24)
+	local found = vm:find_contents(emin, emax, c_stone)
+	assert(#found == 24)
+	for _, p in ipairs(found) do
+		assert(p.x >= p1.x and p.x <= p2.x and p.z >= p1.z and p.z <= p2.z)
+	end
+
+	assert(not pcall(vm.fill, vm, emin, emax:offset(1, 0, 0), c_stone))
+end
+unittests.register("test_voxelmanip_bulk", test_voxelmanip_bulk, {map=true})
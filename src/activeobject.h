@@ -46,15 +46,27 @@ enum ActiveObjectType {
 
 struct ActiveObjectMessage
 {
-	ActiveObjectMessage(u16 id_, bool reliable_=true, std::string_view data_ = "") :
+	ActiveObjectMessage(u16 id_, bool reliable_=true, std::string_view data_ = "",
+			std::string_view legacy_data_ = "") :
 		id(id_),
 		reliable(reliable_),
-		datastring(data_)
+		datastring(data_),
+		legacy_datastring(legacy_data_)
 	{}
 
+	// What a client of `protocol_version` gets
+	const std::string &getData(u16 protocol_version) const
+	{
+		if (protocol_version < 45 && !legacy_datastring.empty())
+			return legacy_datastring;
+		return datastring;
+	}
+
 	u16 id;
 	bool reliable;
 	std::string datastring;
+	// For clients before protocol 45, if they need something else
+	std::string legacy_datastring;
 };
 
 enum ActiveObjectCommand {
@@ -71,7 +83,10 @@ enum ActiveObjectCommand {
 	AO_CMD_OBSOLETE1,
 	// ^ UPDATE_NAMETAG_ATTRIBUTES deprecated since 0.4.14, removed in 5.3.0
 	AO_CMD_SPAWN_INFANT,
-	AO_CMD_SET_ANIMATION_SPEED
+	AO_CMD_SET_ANIMATION_SPEED,
+	// See object_position.h
+	AO_CMD_POSITION_KEYFRAME,
+	AO_CMD_POSITION_DELTA
 };
 
 struct BoneOverride
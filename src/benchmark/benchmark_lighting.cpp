@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "voxelalgorithms.h"
 #include "dummygamedef.h"
 #include "dummymap.h"
+#include <optional>
 
 TEST_CASE("benchmark_lighting")
 {
@@ -72,6 +73,41 @@ TEST_CASE("benchmark_lighting")
 		});
 	};
 
+	// Sets the nodes of an area to a content, as a single bulk_set_node would
+	auto set_area = [&] (v3s16 p1, v3s16 p2, s16 step, content_t c, bool batched) {
+		std::map<v3s16, MapBlock*> modified_blocks;
+		std::optional<MapLightingBatch> batch;
+		if (batched)
+			batch.emplace(&map);
+		for (s16 z = p1.Z; z <= p2.Z; z += step)
+		for (s16 y = p1.Y; y <= p2.Y; y += step)
+		for (s16 x = p1.X; x <= p2.X; x += step)
+			map.addNodeAndUpdate(v3s16(x, y, z), MapNode(c), modified_blocks);
+	};
+
+	// Each run places the nodes in one call and clears them in another, so
+	// that no node is changed twice within a batch
+#define BENCH_BULK_SET(_label, _p1, _p2, _step, _content) \
+	BENCHMARK_ADVANCED(_label "_per_node")(Catch::Benchmark::Chronometer meter) { \
+		meter.measure([&] { \
+			set_area(_p1, _p2, _step, _content, false); \
+			set_area(_p1, _p2, _step, CONTENT_AIR, false); \
+		}); \
+	}; \
+	BENCHMARK_ADVANCED(_label "_batch")(Catch::Benchmark::Chronometer meter) { \
+		meter.measure([&] { \
+			set_area(_p1, _p2, _step, _content, true); \
+			set_area(_p1, _p2, _step, CONTENT_AIR, true); \
+		}); \
+	};
+
+	// A grid of 81 lights below the platform
+	BENCH_BULK_SET("bulk_set_light_grid", v3s16(-8, -1, -8), v3s16(8, -1, 8), 2, content_light)
+	// A 16x2x16 solid slab shadowing the light
+	BENCH_BULK_SET("bulk_set_solid_slab", v3s16(-8, -3, -8), v3s16(7, -2, 7), 1, content_wall)
+
+#undef BENCH_BULK_SET
+
 	BENCHMARK_ADVANCED("voxalgo::blit_back_with_light")(Catch::Benchmark::Chronometer meter) {
 		std::map<v3s16, MapBlock*> modified_blocks;
 		MMVManip vm(&map);
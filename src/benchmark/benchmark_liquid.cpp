@@ -0,0 +1,80 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "catch.h"
+#include "dummygamedef.h"
+#include "dummymap.h"
+#include "server/liquid_transform.h"
+#include "threading/worker_pool.h"
+
+// Floods a floor of 4x4 blocks from a grid of sources, then removes the
+// sources and lets the liquid drain away again
+static void flood_and_drain(DummyMap &map, const NodeDefManager *ndef,
+		content_t c_source, WorkerPool *pool)
+{
+	LiquidTransformer transformer(&map, ndef, pool, nullptr);
+	UniqueQueue<v3s16> queue;
+	std::map<v3s16, MapBlock *> modified_blocks;
+	std::vector<std::pair<v3s16, MapNode>> changed_nodes;
+	std::vector<v3s16> check_for_falling;
+
+	for (int pass = 0; pass < 2; pass++) {
+		MapNode n(pass == 0 ? c_source : CONTENT_AIR);
+		for (s16 z = 4; z < 64; z += 8)
+		for (s16 x = 4; x < 64; x += 8) {
+			map.setNode(v3s16(x, 1, z), n);
+			queue.push_back(v3s16(x, 1, z));
+		}
+		while (queue.size() > 0) {
+			transformer.transform(queue, 100000, modified_blocks,
+					changed_nodes, check_for_falling);
+			changed_nodes.clear();
+		}
+	}
+}
+
+TEST_CASE("benchmark_liquid")
+{
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+
+	content_t content_stone;
+	{
+		ContentFeatures f;
+		f.name = "stone";
+		content_stone = ndef->set(f.name, f);
+	}
+
+	content_t content_source;
+	for (int i = 0; i < 2; i++) {
+		ContentFeatures f;
+		f.name = i == 0 ? "water_source" : "water_flowing";
+		f.walkable = false;
+		f.buildable_to = true;
+		f.liquid_type = i == 0 ? LIQUID_SOURCE : LIQUID_FLOWING;
+		f.liquid_alternative_source = "water_source";
+		f.liquid_alternative_flowing = "water_flowing";
+		f.liquid_renewable = false;
+		content_t c = ndef->set(f.name, f);
+		if (i == 0)
+			content_source = c;
+	}
+	ndef->resolveCrossrefs();
+
+	DummyMap map(&gamedef, v3s16(0, 0, 0), v3s16(3, 0, 3));
+	for (s16 z = 0; z < 64; z++)
+	for (s16 y = 0; y < 16; y++)
+	for (s16 x = 0; x < 64; x++)
+		map.setNode(v3s16(x, y, z), MapNode(y == 0 ? content_stone : CONTENT_AIR));
+
+	BENCHMARK("flood_serial") {
+		flood_and_drain(map, ndef, content_source, nullptr);
+	};
+
+	for (unsigned int threads : {1, 2, 4}) {
+		WorkerPool pool("LiquidBench", threads);
+		BENCHMARK("flood_threads_" + std::to_string(threads)) {
+			flood_and_drain(map, ndef, content_source, &pool);
+		};
+	}
+}
@@ -19,6 +19,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "catch.h"
 #include "mapblock.h"
+#include "database/database-sqlite3.h"
+#include "filesys.h"
+#include "noise.h"
 #include <vector>
 
 typedef std::vector<MapBlock*> MBContainer;
@@ -180,8 +183,52 @@ static u32 workOnBoth(const MBContainer &vec)
 		freeAll(vec); \
 	};
 
+// Blobs of a typical size for serialized, compressed blocks
+static std::vector<std::string> makeBlobs(u32 n)
+{
+	PcgRandom rand(n);
+	std::vector<std::string> blobs(n);
+	for (auto &blob : blobs) {
+		blob.resize(rand.range(500, 3000));
+		rand.bytes(&blob[0], blob.size());
+	}
+	return blobs;
+}
+
+// usage patterns inspired by ServerMap::save()
+static void saveAll(MapDatabase *db, const std::vector<std::string> &blobs)
+{
+	db->beginSave();
+	for (u32 i = 0; i < blobs.size(); i++)
+		db->saveBlock(v3s16(i & 0xff, 0, i >> 8), blobs[i]);
+	db->endSave();
+}
+
+#define BENCH_SAVE(_count) \
+	BENCHMARK_ADVANCED("saveBlocks_sqlite_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		const std::string dir = fs::CreateTempDir(); \
+		auto blobs = makeBlobs(_count); \
+		{ \
+			MapDatabaseSQLite3 db(dir); \
+			meter.measure([&] { saveAll(&db, blobs); }); \
+		} \
+		fs::RecursiveDelete(dir); \
+	}; \
+	BENCHMARK_ADVANCED("saveBlocks_sqlite_write_behind_" #_count)(Catch::Benchmark::Chronometer meter) { \
+		const std::string dir = fs::CreateTempDir(); \
+		auto blobs = makeBlobs(_count); \
+		{ \
+			MapDatabaseSQLite3 db(dir, true); \
+			/* only the time the caller spends, the writer finishes afterwards */ \
+			meter.measure([&] { saveAll(&db, blobs); }); \
+			db.flush(); \
+		} \
+		fs::RecursiveDelete(dir); \
+	};
+
 TEST_CASE("benchmark_mapblock") {
 	BENCH1(900)
 	BENCH1(2200)
 	BENCH1(7500) // <- default client_mapblock_limit
+	BENCH_SAVE(10000)
 }
@@ -0,0 +1,33 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "catch.h"
+#include "noise.h"
+
+// Chunk-sized maps, like the ones MapgenV7 and MapgenValleys use
+static NoiseParams np_2d(0, 1, v3f(600, 600, 600), 5934, 6, 0.6, 2.0);
+static NoiseParams np_3d(0, 1, v3f(384, 192, 384), 5333, 5, 0.63, 2.0);
+
+// Skipped if the CPU doesn't support the implementation
+#define BENCH_NOISE(_label, _impl) \
+	if (setNoiseSimd(_impl)) { \
+		BENCHMARK_ADVANCED("perlinMap2D_" _label)(Catch::Benchmark::Chronometer meter) { \
+			Noise noise(&np_2d, 42, 80, 80); \
+			meter.measure([&] { return noise.perlinMap2D(-32, -32); }); \
+		}; \
+		BENCHMARK_ADVANCED("perlinMap3D_" _label)(Catch::Benchmark::Chronometer meter) { \
+			Noise noise(&np_3d, 42, 80, 82, 80); \
+			meter.measure([&] { return noise.perlinMap3D(-32, -33, -32); }); \
+		}; \
+	}
+
+TEST_CASE("benchmark_noise")
+{
+	const NoiseSimd orig = getNoiseSimd();
+
+	BENCH_NOISE("scalar", NoiseSimd::Scalar)
+	BENCH_NOISE("sse2", NoiseSimd::SSE2)
+	BENCH_NOISE("avx2", NoiseSimd::AVX2)
+
+	setNoiseSimd(orig);
+}
@@ -0,0 +1,40 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "catch.h"
+#include "network/mtp/internal.h"
+#include "network/networkpacket.h"
+
+using namespace con;
+
+// Everything the send thread does to a reliable packet before the socket
+static size_t make_packets(NetworkPacket &pkt)
+{
+	auto c = ConnectionCommand::send(2, 0, &pkt, true);
+	std::list<OutgoingChunk> originals;
+	u16 split_seqnum = 0;
+	makeAutoSplitPacket(c->data, 512 - BASE_HEADER_SIZE - RELIABLE_HEADER_SIZE,
+		split_seqnum, &originals);
+
+	size_t total = 0;
+	u16 seqnum = 100;
+	for (auto &original : originals) {
+		makeReliablePacket(original, seqnum++);
+		auto p = makePacket(Address(127, 0, 0, 1, 30000), original,
+			PROTOCOL_ID, 1, 0);
+		total += p->size();
+	}
+	return total;
+}
+
+TEST_CASE("benchmark_packetpath")
+{
+	// Typical sizes of TOCLIENT_BLOCKDATA and of media
+	for (u32 size : {16 * 1024, 256 * 1024}) {
+		NetworkPacket pkt(0x20, size);
+		pkt.putRawString(std::string(size, 'x'));
+		BENCHMARK("packet_" + std::to_string(size / 1024) + "k") {
+			return make_packets(pkt);
+		};
+	}
+}
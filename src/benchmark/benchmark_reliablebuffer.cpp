@@ -0,0 +1,73 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "catch.h"
+#include "network/mtp/internal.h"
+
+using namespace con;
+
+#define WINDOW MAX_RELIABLE_WINDOW_SIZE
+
+static std::vector<BufferedPacketPtr> make_packets(u16 start)
+{
+	std::vector<BufferedPacketPtr> packets;
+	const u8 buf[64] = {};
+	const PacketData data(buf, sizeof(buf));
+	for (u32 i = 0; i < WINDOW - 1; i++) {
+		OutgoingChunk chunk(data);
+		makeReliablePacket(chunk, start + i);
+		packets.push_back(makePacket(Address(127, 0, 0, 1, 30000),
+			chunk, PROTOCOL_ID, 1, 0));
+	}
+	return packets;
+}
+
+// Fills the whole window like a map transfer does, then acks every packet
+static void fill_and_ack(ReliablePacketBuffer &buf,
+		std::vector<BufferedPacketPtr> &packets, u16 start, bool reverse)
+{
+	for (auto &p : packets)
+		buf.insert(p, start - 1);
+	for (u32 i = 0; i < packets.size(); i++) {
+		u32 j = reverse ? packets.size() - 1 - i : i;
+		buf.popSeqnum(start + j);
+	}
+}
+
+TEST_CASE("benchmark_reliablebuffer")
+{
+	const u16 start = 60000;
+	auto packets = make_packets(start);
+
+	BENCHMARK_ADVANCED("insert_ack_in_order")(Catch::Benchmark::Chronometer meter) {
+		ReliablePacketBuffer buf;
+		meter.measure([&] { fill_and_ack(buf, packets, start, false); });
+	};
+
+	BENCHMARK_ADVANCED("insert_ack_reverse")(Catch::Benchmark::Chronometer meter) {
+		ReliablePacketBuffer buf;
+		meter.measure([&] { fill_and_ack(buf, packets, start, true); });
+	};
+
+	// Everything is due every time
+	BENCHMARK_ADVANCED("resend_full_window")(Catch::Benchmark::Chronometer meter) {
+		ReliablePacketBuffer buf;
+		for (auto &p : packets)
+			buf.insert(p, start - 1);
+		meter.measure([&] {
+			buf.incrementTimeouts(0.1f);
+			return buf.getResend(0.0f, WINDOW).size();
+		});
+	};
+
+	// Only few packets are due, as usual
+	BENCHMARK_ADVANCED("resend_check")(Catch::Benchmark::Chronometer meter) {
+		ReliablePacketBuffer buf;
+		for (auto &p : packets)
+			buf.insert(p, start - 1);
+		meter.measure([&] {
+			buf.incrementTimeouts(0.01f);
+			return buf.getResend(1.0f, 1024).size();
+		});
+	};
+}
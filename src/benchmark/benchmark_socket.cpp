@@ -0,0 +1,71 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "catch.h"
+#include "network/socket.h"
+#include <vector>
+
+// Typical size of a reliable MTP packet
+#define DATAGRAM_SIZE 512
+#define DATAGRAMS 64
+#define PORT 30011
+
+// Sends a batch of datagrams over loopback and receives all of them again
+static int roundtrip(UDPSocket &socket, const Address &dest, bool batched,
+		std::vector<UDPSocket::Datagram> &send, std::vector<UDPSocket::Datagram> &recv,
+		std::vector<char> &recv_buffer)
+{
+	if (batched) {
+		socket.SendMany(send.data(), send.size());
+	} else {
+		for (const auto &d : send)
+			socket.Send(dest, d.data, d.size);
+	}
+
+	int received = 0;
+	while (received < DATAGRAMS) {
+		if (batched) {
+			for (int i = received; i < DATAGRAMS; i++)
+				recv[i] = {Address(), &recv_buffer[i * DATAGRAM_SIZE], DATAGRAM_SIZE};
+			int n = socket.ReceiveMany(&recv[received], DATAGRAMS - received);
+			if (n == 0)
+				break;
+			received += n;
+		} else {
+			Address sender;
+			if (socket.Receive(sender, &recv_buffer[received * DATAGRAM_SIZE],
+					DATAGRAM_SIZE) < 0)
+				break;
+			received++;
+		}
+	}
+	return received;
+}
+
+static void bench_socket(Catch::Benchmark::Chronometer &meter, bool batched)
+{
+	UDPSocket socket(false);
+	const Address dest(127, 0, 0, 1, PORT);
+	socket.Bind(dest);
+	socket.setTimeoutMs(100);
+
+	std::vector<char> payload(DATAGRAM_SIZE, 'x');
+	std::vector<UDPSocket::Datagram> send(DATAGRAMS, {dest, payload.data(), DATAGRAM_SIZE});
+	std::vector<UDPSocket::Datagram> recv(DATAGRAMS);
+	std::vector<char> recv_buffer(DATAGRAMS * DATAGRAM_SIZE);
+
+	meter.measure([&] {
+		return roundtrip(socket, dest, batched, send, recv, recv_buffer);
+	});
+}
+
+TEST_CASE("benchmark_socket")
+{
+	BENCHMARK_ADVANCED("loopback_64_single")(Catch::Benchmark::Chronometer meter) {
+		bench_socket(meter, false);
+	};
+
+	BENCHMARK_ADVANCED("loopback_64_batched")(Catch::Benchmark::Chronometer meter) {
+		bench_socket(meter, true);
+	};
+}
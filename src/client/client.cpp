@@ -859,6 +859,20 @@ bool Client::loadMedia(const std::string &data, const std::string &filename,
 		return true;
 	}
 
+	if (filename == BLOCK_DICTIONARY_NAME) {
+		// Blocks sent after TOSERVER_CLIENT_READY use it
+		if (from_media_push)
+			return false;
+		try {
+			m_block_dictionary = std::make_unique<ZstdDictionary>(data);
+		} catch (SerializationError &e) {
+			errorstream << "Client: Invalid block dictionary: " << e.what()
+					<< std::endl;
+			return false;
+		}
+		return true;
+	}
+
 	errorstream << "Client: Don't know how to load file \""
 		<< filename << "\"" << std::endl;
 	return false;
@@ -1376,13 +1390,14 @@ void Client::sendRespawn()
 void Client::sendReady()
 {
 	NetworkPacket pkt(TOSERVER_CLIENT_READY,
-			1 + 1 + 1 + 1 + 2 + sizeof(char) * strlen(g_version_hash) + 2);
+			1 + 1 + 1 + 1 + 2 + sizeof(char) * strlen(g_version_hash) + 2 + 4);
 
 	pkt << (u8) VERSION_MAJOR << (u8) VERSION_MINOR << (u8) VERSION_PATCH
 		<< (u8) 0 << (u16) strlen(g_version_hash);
 
 	pkt.putRawString(g_version_hash, (u16) strlen(g_version_hash));
 	pkt << (u16)FORMSPEC_API_VERSION;
+	pkt << (u32)(m_block_dictionary ? m_block_dictionary->getId() : 0);
 	Send(&pkt);
 }
 
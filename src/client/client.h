@@ -67,6 +67,7 @@ class Minimap;
 struct MinimapMapblock;
 class MeshUpdateManager;
 class ParticleManager;
+class ZstdDictionary;
 class Camera;
 struct PlayerControl;
 class NetworkPacket;
@@ -501,6 +502,8 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 
 	// Server serialization version
 	u8 m_server_ser_ver;
+	// Blocks are compressed with this if we have it. May be null.
+	std::unique_ptr<ZstdDictionary> m_block_dictionary;
 
 	// Used version of the protocol with server
 	// Values smaller than 25 only mean they are smaller than 25,
@@ -1677,6 +1677,34 @@ bool GenericCAO::visualExpiryRequired(const ObjectProperties &new_) const
 		(uses_legacy_texture && old.textures != new_.textures);
 }
 
+void GenericCAO::updatePosition(const ObjectPosition &pos)
+{
+	// Not sent by the server if this object is an attachment.
+	// We might however get here if the server notices the object being detached before the client.
+	m_position = pos.position;
+	m_velocity = pos.velocity;
+	m_acceleration = pos.acceleration;
+	m_rotation = wrapDegrees_0_360_v3f(pos.rotation);
+
+	// Place us a bit higher if we're physical, to not sink into
+	// the ground due to sucky collision detection...
+	if(m_prop.physical)
+		m_position += v3f(0,0.002,0);
+
+	if(getParent() != NULL) // Just in case
+		return;
+
+	if(pos.do_interpolate)
+	{
+		if(!m_prop.physical)
+			pos_translator.update(m_position, pos.is_movement_end, pos.update_interval);
+	} else {
+		pos_translator.init(m_position);
+	}
+	rot_translator.update(m_rotation, false, pos.update_interval);
+	updateNodePos();
+}
+
 void GenericCAO::processMessage(const std::string &data)
 {
 	//infostream<<"GenericCAO: Got message"<<std::endl;
@@ -1735,35 +1763,17 @@ void GenericCAO::processMessage(const std::string &data)
 			updateMarker();
 		}
 	} else if (cmd == AO_CMD_UPDATE_POSITION) {
-		// Not sent by the server if this object is an attachment.
-		// We might however get here if the server notices the object being detached before the client.
-		m_position = readV3F32(is);
-		m_velocity = readV3F32(is);
-		m_acceleration = readV3F32(is);
-		m_rotation = readV3F32(is);
-
-		m_rotation = wrapDegrees_0_360_v3f(m_rotation);
-		bool do_interpolate = readU8(is);
-		bool is_end_position = readU8(is);
-		float update_interval = readF32(is);
-
-		// Place us a bit higher if we're physical, to not sink into
-		// the ground due to sucky collision detection...
-		if(m_prop.physical)
-			m_position += v3f(0,0.002,0);
-
-		if(getParent() != NULL) // Just in case
-			return;
-
-		if(do_interpolate)
-		{
-			if(!m_prop.physical)
-				pos_translator.update(m_position, is_end_position, update_interval);
-		} else {
-			pos_translator.init(m_position);
-		}
-		rot_translator.update(m_rotation, false, update_interval);
-		updateNodePos();
+		updatePosition(readObjectPosition(is));
+	} else if (cmd == AO_CMD_POSITION_KEYFRAME) {
+		m_pos_keyframe_id = readU8(is);
+		m_pos_keyframe = readObjectPosition(is);
+		m_has_pos_keyframe = true;
+		updatePosition(m_pos_keyframe);
+	} else if (cmd == AO_CMD_POSITION_DELTA) {
+		// The keyframe is sent reliably, deltas aren't and may overtake it
+		u8 keyframe_id = readU8(is);
+		if (m_has_pos_keyframe && keyframe_id == m_pos_keyframe_id)
+			updatePosition(readObjectPositionDelta(is, m_pos_keyframe));
 	} else if (cmd == AO_CMD_SET_TEXTURE_MOD) {
 		std::string mod = deSerializeString16(is);
 
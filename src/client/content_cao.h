@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <map>
 #include "irrlichttypes_extrabloated.h"
 #include "clientobject.h"
+#include "object_position.h"
 #include "object_properties.h"
 #include "itemgroup.h"
 #include "constants.h"
@@ -94,6 +95,10 @@ class GenericCAO : public ClientActiveObject
 	u16 m_hp = 1;
 	SmoothTranslator<v3f> pos_translator;
 	SmoothTranslatorWrappedv3f rot_translator;
+	// What position deltas refer to
+	ObjectPosition m_pos_keyframe;
+	u8 m_pos_keyframe_id = 0;
+	bool m_has_pos_keyframe = false;
 	// Spritesheet/animation stuff
 	v2f m_tx_size = v2f(1,1);
 	v2s16 m_tx_basepos;
@@ -262,6 +267,8 @@ class GenericCAO : public ClientActiveObject
 
 	void updateNodePos();
 
+	void updatePosition(const ObjectPosition &pos);
+
 	void step(float dtime, ClientEnvironment *env) override;
 
 	void updateTexturePos();
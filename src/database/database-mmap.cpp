@@ -0,0 +1,364 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "database-mmap.h"
+
+#include <algorithm>
+#include <cstring>
+#include "database-sqlite3.h"
+#include "exceptions.h"
+#include "filesys.h"
+#include "irrlicht_changes/printing.h"
+#include "log.h"
+#include "util/serialize.h"
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#define MMAP_MAGIC "MTBLOCKS"
+#define MMAP_VERSION 1
+#define MMAP_HEADER_SIZE 32
+#define MMAP_ENTRY_SIZE 20
+
+// One byte is never a valid block, so this marks deleted blocks in the overlay
+static const std::string_view TOMBSTONE("\0", 1);
+
+/*
+	Read-only mapping of a whole file
+*/
+class MapDatabaseMmap::MappedFile
+{
+public:
+	MappedFile(const std::string &path);
+	~MappedFile();
+	DISABLE_CLASS_COPY(MappedFile)
+
+	const u8 *data() const { return m_data; }
+	u64 size() const { return m_size; }
+
+private:
+	const u8 *m_data = nullptr;
+	u64 m_size = 0;
+#ifdef _WIN32
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = NULL;
+#endif
+};
+
+#ifdef _WIN32
+
+MapDatabaseMmap::MappedFile::MappedFile(const std::string &path)
+{
+	m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_file == INVALID_HANDLE_VALUE)
+		throw DatabaseException("Failed to open " + path);
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size)) {
+		CloseHandle(m_file);
+		throw DatabaseException("Failed to get the size of " + path);
+	}
+	m_size = size.QuadPart;
+	if (m_size == 0)
+		return;
+
+	m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mapping)
+		m_data = (const u8 *)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!m_data) {
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		CloseHandle(m_file);
+		throw DatabaseException("Failed to map " + path);
+	}
+}
+
+MapDatabaseMmap::MappedFile::~MappedFile()
+{
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	CloseHandle(m_file);
+}
+
+#else
+
+MapDatabaseMmap::MappedFile::MappedFile(const std::string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw DatabaseException("Failed to open " + path + ": " + strerror(errno));
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		throw DatabaseException("Failed to stat " + path + ": " + strerror(errno));
+	}
+	m_size = st.st_size;
+	if (m_size == 0) {
+		close(fd);
+		return;
+	}
+	if (m_size > SIZE_MAX) {
+		close(fd);
+		throw DatabaseException(path + " is too large to be mapped");
+	}
+
+	void *p = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+	// The mapping stays valid without the descriptor
+	close(fd);
+	if (p == MAP_FAILED)
+		throw DatabaseException("Failed to map " + path + ": " + strerror(errno));
+	m_data = (const u8 *)p;
+
+	// Block lookups are random
+	madvise(p, m_size, MADV_RANDOM);
+}
+
+MapDatabaseMmap::MappedFile::~MappedFile()
+{
+	if (m_data)
+		munmap((void *)m_data, m_size);
+}
+
+#endif
+
+/*
+	MapDatabaseMmap
+*/
+
+MapDatabaseMmap::MapDatabaseMmap(const std::string &savedir)
+{
+	const std::string path = getFilePath(savedir);
+	if (fs::PathExists(path)) {
+		m_file = std::make_unique<MappedFile>(path);
+
+		const u8 *data = m_file->data();
+		const u64 size = m_file->size();
+		if (size < MMAP_HEADER_SIZE || memcmp(data, MMAP_MAGIC, 8) != 0)
+			throw DatabaseException(path + " is not a map block file");
+		if (readU32(data + 8) != MMAP_VERSION)
+			throw DatabaseException(path + " has an unsupported version");
+
+		m_index_offset = readU64(data + 16);
+		m_count = readU64(data + 24);
+		if (m_index_offset < MMAP_HEADER_SIZE || m_index_offset > size ||
+				m_count > (size - m_index_offset) / MMAP_ENTRY_SIZE)
+			throw DatabaseException(path + " is truncated or corrupt");
+		m_index = data + m_index_offset;
+	} else {
+		infostream << "MapDatabaseMmap: " << path
+			<< " does not exist, starting with an empty map" << std::endl;
+	}
+
+	m_overlay = std::make_unique<MapDatabaseSQLite3>(getOverlayPath(savedir));
+}
+
+MapDatabaseMmap::~MapDatabaseMmap() = default;
+
+std::string MapDatabaseMmap::getFilePath(const std::string &savedir)
+{
+	return savedir + DIR_DELIM + "map.blocks";
+}
+
+std::string MapDatabaseMmap::getOverlayPath(const std::string &savedir)
+{
+	return savedir + DIR_DELIM + "map_overlay";
+}
+
+std::string_view MapDatabaseMmap::findBlock(s64 pos) const
+{
+	// Binary search in the sorted index
+	u64 lo = 0, hi = m_count;
+	while (lo < hi) {
+		u64 mid = lo + (hi - lo) / 2;
+		const u8 *entry = m_index + mid * MMAP_ENTRY_SIZE;
+		s64 key = readS64(entry);
+		if (key < pos) {
+			lo = mid + 1;
+		} else if (key > pos) {
+			hi = mid;
+		} else {
+			u64 offset = readU64(entry + 8);
+			u32 size = readU32(entry + 16);
+			if (offset < MMAP_HEADER_SIZE || offset > m_index_offset ||
+					size > m_index_offset - offset) {
+				errorstream << "MapDatabaseMmap: invalid index entry for "
+					<< getIntegerAsBlock(pos) << std::endl;
+				return {};
+			}
+			return std::string_view((const char *)m_file->data() + offset, size);
+		}
+	}
+	return {};
+}
+
+bool MapDatabaseMmap::saveBlock(const v3s16 &pos, std::string_view data)
+{
+	return m_overlay->saveBlock(pos, data);
+}
+
+void MapDatabaseMmap::loadBlock(const v3s16 &pos, std::string *block)
+{
+	m_overlay->loadBlock(pos, block);
+	if (!block->empty()) {
+		if (*block == TOMBSTONE)
+			block->clear();
+		return;
+	}
+
+	std::string_view data = findBlock(getBlockAsInteger(pos));
+	block->assign(data.data(), data.size());
+}
+
+bool MapDatabaseMmap::deleteBlock(const v3s16 &pos)
+{
+	// The mapped file is never changed, so blocks in it have to be hidden
+	if (!findBlock(getBlockAsInteger(pos)).empty())
+		return m_overlay->saveBlock(pos, TOMBSTONE);
+	return m_overlay->deleteBlock(pos);
+}
+
+void MapDatabaseMmap::listAllLoadableBlocks(std::vector<v3s16> &dst)
+{
+	std::vector<v3s16> overlay;
+	m_overlay->listAllLoadableBlocks(overlay);
+
+	// Blocks that are in both only appear once, deleted ones not at all
+	std::vector<s64> hidden;
+	hidden.reserve(overlay.size());
+	std::string data;
+	for (v3s16 pos : overlay) {
+		s64 key = getBlockAsInteger(pos);
+		hidden.push_back(key);
+		m_overlay->loadBlock(pos, &data);
+		if (data != TOMBSTONE)
+			dst.push_back(pos);
+	}
+	std::sort(hidden.begin(), hidden.end());
+
+	dst.reserve(dst.size() + m_count);
+	for (u64 i = 0; i < m_count; i++) {
+		s64 key = readS64(m_index + i * MMAP_ENTRY_SIZE);
+		if (!std::binary_search(hidden.begin(), hidden.end(), key))
+			dst.push_back(getIntegerAsBlock(key));
+	}
+}
+
+void MapDatabaseMmap::beginSave()
+{
+	m_overlay->beginSave();
+}
+
+void MapDatabaseMmap::endSave()
+{
+	m_overlay->endSave();
+}
+
+/*
+	MapDatabaseMmapWriter
+*/
+
+MapDatabaseMmapWriter::MapDatabaseMmapWriter(const std::string &savedir) :
+	m_path(MapDatabaseMmap::getFilePath(savedir)),
+	m_tmp_path(m_path + ".tmp")
+{
+	// Blocks in an old overlay would hide the ones written here
+	const std::string overlay = MapDatabaseMmap::getOverlayPath(savedir);
+	if (fs::PathExists(overlay + DIR_DELIM + "map.sqlite")) {
+		throw DatabaseException("Refusing to write " + m_path +
+			" while " + overlay + " exists, please remove it first");
+	}
+
+	if (!fs::CreateAllDirs(savedir))
+		throw DatabaseException("Failed to create directory " + savedir);
+
+	m_fp = fopen(m_tmp_path.c_str(), "wb");
+	if (!m_fp)
+		throw DatabaseException("Failed to open " + m_tmp_path);
+
+	// Placeholder until finish() knows the index
+	char header[MMAP_HEADER_SIZE] = {};
+	if (fwrite(header, 1, sizeof(header), m_fp) != sizeof(header)) {
+		fclose(m_fp);
+		throw DatabaseException("Failed to write to " + m_tmp_path);
+	}
+	m_offset = MMAP_HEADER_SIZE;
+}
+
+MapDatabaseMmapWriter::~MapDatabaseMmapWriter()
+{
+	if (m_fp) {
+		// Unfinished
+		fclose(m_fp);
+		fs::DeleteSingleFileOrEmptyDirectory(m_tmp_path);
+	}
+}
+
+bool MapDatabaseMmapWriter::saveBlock(const v3s16 &pos, std::string_view data)
+{
+	if (!m_fp || data.size() > U32_MAX)
+		return false;
+	if (fwrite(data.data(), 1, data.size(), m_fp) != data.size()) {
+		errorstream << "MapDatabaseMmapWriter: failed to write to "
+			<< m_tmp_path << std::endl;
+		return false;
+	}
+	m_entries.push_back({getBlockAsInteger(pos), m_offset, (u32)data.size()});
+	m_offset += data.size();
+	return true;
+}
+
+bool MapDatabaseMmapWriter::finish()
+{
+	if (!m_fp)
+		return false;
+
+	// The last save of a block wins
+	std::stable_sort(m_entries.begin(), m_entries.end(),
+		[] (const Entry &a, const Entry &b) { return a.pos < b.pos; });
+	auto last = std::unique(m_entries.rbegin(), m_entries.rend(),
+		[] (const Entry &a, const Entry &b) { return a.pos == b.pos; });
+	m_entries.erase(m_entries.begin(), last.base());
+
+	bool ok = true;
+	u8 buf[MMAP_ENTRY_SIZE];
+	for (const Entry &e : m_entries) {
+		writeS64(buf, e.pos);
+		writeU64(buf + 8, e.offset);
+		writeU32(buf + 16, e.size);
+		ok &= fwrite(buf, 1, sizeof(buf), m_fp) == sizeof(buf);
+	}
+
+	u8 header[MMAP_HEADER_SIZE] = {};
+	memcpy(header, MMAP_MAGIC, 8);
+	writeU32(header + 8, MMAP_VERSION);
+	writeU64(header + 16, m_offset);
+	writeU64(header + 24, m_entries.size());
+	ok &= fseek(m_fp, 0, SEEK_SET) == 0;
+	ok &= fwrite(header, 1, sizeof(header), m_fp) == sizeof(header);
+	ok &= fflush(m_fp) == 0;
+	ok &= fclose(m_fp) == 0;
+	m_fp = nullptr;
+
+#ifdef _WIN32
+	// rename() doesn't replace existing files here
+	if (ok && fs::PathExists(m_path))
+		ok = fs::DeleteSingleFileOrEmptyDirectory(m_path);
+#endif
+	if (ok)
+		ok = fs::Rename(m_tmp_path, m_path);
+	if (!ok) {
+		errorstream << "MapDatabaseMmapWriter: failed to write " << m_path << std::endl;
+		fs::DeleteSingleFileOrEmptyDirectory(m_tmp_path);
+	}
+	return ok;
+}
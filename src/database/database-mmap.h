@@ -0,0 +1,105 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "database.h"
+#include "irrlichttypes.h"
+#include "util/basic_macros.h"
+
+class MapDatabaseSQLite3;
+
+/*
+	Map database for worlds that are mostly read: the blocks live in one
+	file ("map.blocks") that is memory-mapped, so loading a block only
+	touches the pages of that block and nothing is cached twice.
+	The file is written by --migrate (see MapDatabaseMmapWriter) and is never
+	modified afterwards. Saved and deleted blocks go to a small SQLite3
+	database in "map_overlay/", which takes precedence over the file.
+
+	File format (all numbers big-endian):
+		u8[8] magic "MTBLOCKS"
+		u32 format version (1)
+		u32 unused
+		u64 offset of the index
+		u64 number of blocks
+		block data...
+		index: for every block, sorted by position
+			s64 position (as in MapDatabase::getBlockAsInteger)
+			u64 offset of the data
+			u32 size of the data
+*/
+class MapDatabaseMmap : public MapDatabase
+{
+public:
+	MapDatabaseMmap(const std::string &savedir);
+	~MapDatabaseMmap();
+	DISABLE_CLASS_COPY(MapDatabaseMmap)
+
+	bool saveBlock(const v3s16 &pos, std::string_view data) override;
+	void loadBlock(const v3s16 &pos, std::string *block) override;
+	bool deleteBlock(const v3s16 &pos) override;
+	void listAllLoadableBlocks(std::vector<v3s16> &dst) override;
+
+	void beginSave() override;
+	void endSave() override;
+
+	static std::string getFilePath(const std::string &savedir);
+	static std::string getOverlayPath(const std::string &savedir);
+
+private:
+	class MappedFile;
+
+	// Data of the block in the mapped file; empty if it isn't there
+	std::string_view findBlock(s64 pos) const;
+
+	std::unique_ptr<MappedFile> m_file;
+	const u8 *m_index = nullptr;
+	u64 m_count = 0;
+	u64 m_index_offset = 0;
+
+	std::unique_ptr<MapDatabaseSQLite3> m_overlay;
+};
+
+/*
+	Writes a new map.blocks file. Blocks can be added in any order.
+	The file only replaces an existing one once finish() succeeds.
+*/
+class MapDatabaseMmapWriter : public MapDatabase
+{
+public:
+	MapDatabaseMmapWriter(const std::string &savedir);
+	~MapDatabaseMmapWriter();
+	DISABLE_CLASS_COPY(MapDatabaseMmapWriter)
+
+	bool saveBlock(const v3s16 &pos, std::string_view data) override;
+	// Blocks can't be read back before the file is finished
+	void loadBlock(const v3s16 &pos, std::string *block) override {}
+	bool deleteBlock(const v3s16 &pos) override { return false; }
+	void listAllLoadableBlocks(std::vector<v3s16> &dst) override {}
+
+	void beginSave() override {}
+	void endSave() override {}
+
+	// Writes the index and moves the file into place
+	bool finish();
+
+private:
+	struct Entry
+	{
+		s64 pos;
+		u64 offset;
+		u32 size;
+	};
+
+	std::string m_path;
+	std::string m_tmp_path;
+	FILE *m_fp = nullptr;
+	u64 m_offset = 0;
+	std::vector<Entry> m_entries;
+};
@@ -37,7 +37,9 @@ SQLite format specification:
 #include "irrlicht_changes/printing.h"
 #include "server/player_sao.h"
 
+#include <algorithm>
 #include <cassert>
+#include <unordered_set>
 
 // When to print messages when the database is being held locked by another process
 // Note: I've seen occasional delays of over 250ms while running minetestmapper.
@@ -186,6 +188,30 @@ void Database_SQLite3::verifyDatabase()
 	m_initialized = true;
 }
 
+sqlite3 *Database_SQLite3::openExtraConnection(s64 *busy_handler_data)
+{
+	assert(m_database); // Pre-condition
+
+	std::string dbp = m_savedir + DIR_DELIM + m_dbname + ".sqlite";
+
+	sqlite3 *conn = nullptr;
+	int res = sqlite3_open_v2(dbp.c_str(), &conn, SQLITE_OPEN_READWRITE, NULL);
+	if (res == SQLITE_OK)
+		res = sqlite3_busy_handler(conn, Database_SQLite3::busyHandler, busy_handler_data);
+	if (res == SQLITE_OK) {
+		std::string query_str = std::string("PRAGMA synchronous = ")
+				+ itos(g_settings->getU16("sqlite_synchronous"));
+		res = sqlite3_exec(conn, query_str.c_str(), NULL, NULL, NULL);
+	}
+	if (res != SQLITE_OK) {
+		std::string msg = std::string("Failed to open SQLite3 database connection to ")
+				+ dbp + ": " + (conn ? sqlite3_errmsg(conn) : sqlite3_errstr(res));
+		sqlite3_close(conn);
+		throw DatabaseException(msg);
+	}
+	return conn;
+}
+
 Database_SQLite3::~Database_SQLite3()
 {
 	FINALIZE_STATEMENT(m_stmt_begin)
@@ -198,21 +224,43 @@ Database_SQLite3::~Database_SQLite3()
  * Map database
  */
 
-MapDatabaseSQLite3::MapDatabaseSQLite3(const std::string &savedir):
+MapDatabaseSQLite3::MapDatabaseSQLite3(const std::string &savedir, bool write_behind):
 	Database_SQLite3(savedir, "map"),
-	MapDatabase()
+	MapDatabase(),
+	m_write_behind(write_behind)
 {
 }
 
 MapDatabaseSQLite3::~MapDatabaseSQLite3()
 {
+	if (m_writer) {
+		try {
+			if (!m_batch.empty())
+				queueBatch();
+		} catch (std::exception &e) {
+			errorstream << "MapDatabaseSQLite3: " << e.what() << std::endl;
+		}
+		{
+			// The writer finishes the queue before it stops
+			std::lock_guard<std::mutex> lock(m_pending_mutex);
+			m_writer->stop();
+		}
+		m_queue_cv.notify_all();
+		m_writer->wait();
+		m_writer.reset();
+		if (m_writer_error) {
+			errorstream << "MapDatabaseSQLite3: Failed to write "
+				<< m_pending.size() << " blocks" << std::endl;
+		}
+	}
+
 	FINALIZE_STATEMENT(m_stmt_read)
 	FINALIZE_STATEMENT(m_stmt_write)
+	FINALIZE_STATEMENT(m_stmt_write_multi)
 	FINALIZE_STATEMENT(m_stmt_list)
 	FINALIZE_STATEMENT(m_stmt_delete)
 }
 
-
 void MapDatabaseSQLite3::createDatabase()
 {
 	assert(m_database); // Pre-condition
@@ -229,13 +277,252 @@ void MapDatabaseSQLite3::createDatabase()
 void MapDatabaseSQLite3::initStatements()
 {
 	PREPARE_STATEMENT(read, "SELECT `data` FROM `blocks` WHERE `pos` = ? LIMIT 1");
-	PREPARE_STATEMENT(write, "REPLACE INTO `blocks` (`pos`, `data`) VALUES (?, ?)");
+	prepareWriteStatements(m_database, &m_stmt_write, &m_stmt_write_multi);
 	PREPARE_STATEMENT(delete, "DELETE FROM `blocks` WHERE `pos` = ?");
 	PREPARE_STATEMENT(list, "SELECT `pos` FROM `blocks`");
 
+	if (m_write_behind) {
+		// The writer gets its own connection so that reads aren't held up
+		// (or made part of its transactions)
+		sqlite3 *conn = openExtraConnection(m_writer_busy_handler_data);
+		m_writer = std::make_unique<WriterThread>(this, conn);
+		m_writer->start();
+	}
+
 	verbosestream << "ServerMap: SQLite3 database opened." << std::endl;
 }
 
+void MapDatabaseSQLite3::prepareWriteStatements(sqlite3 *conn,
+		sqlite3_stmt **single, sqlite3_stmt **multi)
+{
+	std::string query = "REPLACE INTO `blocks` (`pos`, `data`) VALUES (?, ?)";
+	int res = sqlite3_prepare_v2(conn, query.c_str(), -1, single, NULL);
+
+	for (size_t i = 1; i < WRITE_BATCH_ROWS; i++)
+		query.append(", (?, ?)");
+	if (res == SQLITE_OK)
+		res = sqlite3_prepare_v2(conn, query.c_str(), -1, multi, NULL);
+
+	if (res != SQLITE_OK) {
+		throw DatabaseException(std::string("Failed to prepare block write query: ")
+				+ sqlite3_errmsg(conn));
+	}
+}
+
+void MapDatabaseSQLite3::writeRows(sqlite3 *conn, sqlite3_stmt *single,
+		sqlite3_stmt *multi, const WriteBatch &rows)
+{
+	auto bind_row = [&] (sqlite3_stmt *stmt, int index, const WriteBatch::value_type &row) {
+		if (sqlite3_bind_int64(stmt, index, row.first) != SQLITE_OK ||
+				sqlite3_bind_blob(stmt, index + 1, row.second->data(),
+					row.second->size(), NULL) != SQLITE_OK) {
+			throw DatabaseException(std::string("Failed to bind block write query: ")
+					+ sqlite3_errmsg(conn));
+		}
+	};
+	auto step = [&] (sqlite3_stmt *stmt) {
+		int res = sqlite3_step(stmt);
+		sqlite3_reset(stmt);
+		if (res != SQLITE_DONE) {
+			throw DatabaseException(std::string("Failed to save block: ")
+					+ sqlite3_errmsg(conn));
+		}
+	};
+
+	size_t i = 0;
+	for (; i + WRITE_BATCH_ROWS <= rows.size(); i += WRITE_BATCH_ROWS) {
+		for (size_t j = 0; j < WRITE_BATCH_ROWS; j++)
+			bind_row(multi, 2 * j + 1, rows[i + j]);
+		step(multi);
+	}
+	for (; i < rows.size(); i++) {
+		bind_row(single, 1, rows[i]);
+		step(single);
+	}
+}
+
+MapDatabaseSQLite3::WriterThread::WriterThread(MapDatabaseSQLite3 *db, sqlite3 *conn) :
+	Thread("SQLiteWriter"),
+	m_db(db),
+	m_conn(conn)
+{
+	int res = sqlite3_prepare_v2(m_conn, "BEGIN;", -1, &m_stmt_begin, NULL);
+	if (res == SQLITE_OK)
+		res = sqlite3_prepare_v2(m_conn, "COMMIT;", -1, &m_stmt_end, NULL);
+	if (res == SQLITE_OK)
+		res = sqlite3_prepare_v2(m_conn, "ROLLBACK;", -1, &m_stmt_rollback, NULL);
+	if (res != SQLITE_OK) {
+		throw DatabaseException(std::string("Failed to prepare query: ")
+				+ sqlite3_errmsg(m_conn));
+	}
+	prepareWriteStatements(m_conn, &m_stmt_write, &m_stmt_write_multi);
+}
+
+MapDatabaseSQLite3::WriterThread::~WriterThread()
+{
+	for (sqlite3_stmt *stmt : {m_stmt_begin, m_stmt_end, m_stmt_rollback,
+			m_stmt_write, m_stmt_write_multi}) {
+		if (sqlite3_finalize(stmt) != SQLITE_OK) {
+			errorstream << "Failed to finalize statement: "
+				<< sqlite3_errmsg(m_conn) << std::endl;
+		}
+	}
+	if (sqlite3_close(m_conn) != SQLITE_OK) {
+		errorstream << "Failed to close database: "
+			<< sqlite3_errmsg(m_conn) << std::endl;
+	}
+}
+
+void *MapDatabaseSQLite3::WriterThread::run()
+{
+	while (true) {
+		WriteBatch batch;
+		{
+			std::unique_lock<std::mutex> lock(m_db->m_pending_mutex);
+			m_db->m_queue_cv.wait(lock, [&] {
+				return !m_db->m_queue.empty() || stopRequested();
+			});
+			// Finish the queue before stopping
+			if (m_db->m_queue.empty())
+				break;
+			batch = std::move(m_db->m_queue.front());
+			m_db->m_queue.pop_front();
+			m_db->m_writer_busy = true;
+		}
+
+		std::exception_ptr error;
+		try {
+			write(batch);
+		} catch (...) {
+			error = std::current_exception();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_db->m_pending_mutex);
+			// Failed rows stay pending so that they can still be loaded
+			if (error) {
+				if (!m_db->m_writer_error)
+					m_db->m_writer_error = error;
+			} else {
+				m_db->forgetPendingNoLock(batch);
+			}
+			m_db->m_writer_busy = false;
+		}
+		m_db->m_idle_cv.notify_all();
+	}
+
+	return nullptr;
+}
+
+void MapDatabaseSQLite3::WriterThread::write(const WriteBatch &batch)
+{
+	if (sqlite3_step(m_stmt_begin) != SQLITE_DONE) {
+		sqlite3_reset(m_stmt_begin);
+		throw DatabaseException(std::string("Failed to start SQLite3 transaction: ")
+				+ sqlite3_errmsg(m_conn));
+	}
+	sqlite3_reset(m_stmt_begin);
+
+	try {
+		writeRows(m_conn, m_stmt_write, m_stmt_write_multi, batch);
+	} catch (...) {
+		sqlite3_step(m_stmt_rollback);
+		sqlite3_reset(m_stmt_rollback);
+		throw;
+	}
+
+	int res = sqlite3_step(m_stmt_end);
+	sqlite3_reset(m_stmt_end);
+	if (res != SQLITE_DONE) {
+		std::string msg = std::string("Failed to commit SQLite3 transaction: ")
+				+ sqlite3_errmsg(m_conn);
+		sqlite3_step(m_stmt_rollback);
+		sqlite3_reset(m_stmt_rollback);
+		throw DatabaseException(msg);
+	}
+}
+
+void MapDatabaseSQLite3::beginSave()
+{
+	checkWriterError();
+	if (!m_write_behind)
+		Database_SQLite3::beginSave();
+	else
+		verifyDatabase();
+	m_in_save = true;
+}
+
+void MapDatabaseSQLite3::endSave()
+{
+	m_in_save = false;
+	if (m_writer) {
+		queueBatch();
+	} else {
+		writeBatch();
+		Database_SQLite3::endSave();
+	}
+}
+
+void MapDatabaseSQLite3::writeBatch()
+{
+	if (m_batch.empty())
+		return;
+	writeRows(m_database, m_stmt_write, m_stmt_write_multi, m_batch);
+
+	std::lock_guard<std::mutex> lock(m_pending_mutex);
+	forgetPendingNoLock(m_batch);
+	m_batch.clear();
+}
+
+void MapDatabaseSQLite3::queueBatch()
+{
+	checkWriterError();
+	if (m_batch.empty())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(m_pending_mutex);
+		m_queue.emplace_back(std::move(m_batch));
+	}
+	m_batch.clear();
+	m_queue_cv.notify_one();
+}
+
+void MapDatabaseSQLite3::forgetPendingNoLock(const WriteBatch &batch)
+{
+	for (auto &row : batch) {
+		auto it = m_pending.find(row.first);
+		if (it != m_pending.end() && it->second == row.second)
+			m_pending.erase(it);
+	}
+}
+
+void MapDatabaseSQLite3::checkWriterError()
+{
+	if (!m_writer)
+		return;
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> lock(m_pending_mutex);
+		std::swap(error, m_writer_error);
+	}
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void MapDatabaseSQLite3::flush()
+{
+	if (!m_writer)
+		return;
+	{
+		std::unique_lock<std::mutex> lock(m_pending_mutex);
+		m_idle_cv.wait(lock, [&] {
+			return m_queue.empty() && !m_writer_busy;
+		});
+	}
+	checkWriterError();
+}
+
+
 inline void MapDatabaseSQLite3::bindPos(sqlite3_stmt *stmt, const v3s16 &pos, int index)
 {
 	SQLOK(sqlite3_bind_int64(stmt, index, getBlockAsInteger(pos)),
@@ -246,6 +533,19 @@ bool MapDatabaseSQLite3::deleteBlock(const v3s16 &pos)
 {
 	verifyDatabase();
 
+	const s64 key = getBlockAsInteger(pos);
+	if (!m_batch.empty()) {
+		m_batch.erase(std::remove_if(m_batch.begin(), m_batch.end(),
+			[&] (const WriteBatch::value_type &row) { return row.first == key; }),
+			m_batch.end());
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_pending_mutex);
+		m_pending.erase(key);
+	}
+	// An older version might still be on its way to the database
+	flush();
+
 	bindPos(m_stmt_delete, pos);
 
 	bool good = sqlite3_step(m_stmt_delete) == SQLITE_DONE;
@@ -262,12 +562,31 @@ bool MapDatabaseSQLite3::saveBlock(const v3s16 &pos, std::string_view data)
 {
 	verifyDatabase();
 
-	bindPos(m_stmt_write, pos);
-	SQLOK(sqlite3_bind_blob(m_stmt_write, 2, data.data(), data.size(), NULL),
-		"Internal error: failed to bind query at " __FILE__ ":" TOSTRING(__LINE__));
+	// Outside of a save, write directly (unless that could overtake
+	// older data that is still queued)
+	if (!m_in_save && !m_writer) {
+		bindPos(m_stmt_write, pos);
+		SQLOK(sqlite3_bind_blob(m_stmt_write, 2, data.data(), data.size(), NULL),
+			"Internal error: failed to bind query at " __FILE__ ":" TOSTRING(__LINE__));
 
-	SQLRES(sqlite3_step(m_stmt_write), SQLITE_DONE, "Failed to save block")
-	sqlite3_reset(m_stmt_write);
+		SQLRES(sqlite3_step(m_stmt_write), SQLITE_DONE, "Failed to save block")
+		sqlite3_reset(m_stmt_write);
+
+		return true;
+	}
+
+	const s64 key = getBlockAsInteger(pos);
+	auto blob = std::make_shared<const std::string>(data);
+	{
+		std::lock_guard<std::mutex> lock(m_pending_mutex);
+		m_pending[key] = blob;
+	}
+	m_batch.emplace_back(key, std::move(blob));
+
+	if (!m_in_save)
+		queueBatch();
+	else if (!m_writer && m_batch.size() >= WRITE_BATCH_ROWS)
+		writeBatch();
 
 	return true;
 }
@@ -276,6 +595,15 @@ void MapDatabaseSQLite3::loadBlock(const v3s16 &pos, std::string *block)
 {
 	verifyDatabase();
 
+	{
+		std::lock_guard<std::mutex> lock(m_pending_mutex);
+		auto it = m_pending.find(getBlockAsInteger(pos));
+		if (it != m_pending.end()) {
+			*block = *it->second;
+			return;
+		}
+	}
+
 	bindPos(m_stmt_read, pos);
 
 	if (sqlite3_step(m_stmt_read) != SQLITE_ROW) {
@@ -295,10 +623,28 @@ void MapDatabaseSQLite3::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
 	verifyDatabase();
 
+	if (m_writer)
+		flush();
+	else
+		writeBatch();
+
+	size_t old_size = dst.size();
 	while (sqlite3_step(m_stmt_list) == SQLITE_ROW)
 		dst.push_back(getIntegerAsBlock(sqlite3_column_int64(m_stmt_list, 0)));
 
 	sqlite3_reset(m_stmt_list);
+
+	// Only unqueued blocks of the current save can be left over here
+	std::lock_guard<std::mutex> lock(m_pending_mutex);
+	if (m_pending.empty())
+		return;
+	std::unordered_set<s64> known;
+	for (size_t i = old_size; i < dst.size(); i++)
+		known.insert(getBlockAsInteger(dst[i]));
+	for (auto &it : m_pending) {
+		if (known.count(it.first) == 0)
+			dst.push_back(getIntegerAsBlock(it.first));
+	}
 }
 
 /*
@@ -19,10 +19,17 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <condition_variable>
 #include <cstring>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include "database.h"
 #include "exceptions.h"
+#include "threading/thread.h"
 
 extern "C" {
 #include "sqlite3.h"
@@ -43,6 +50,10 @@ class Database_SQLite3 : public Database
 	// Open and initialize the database if needed
 	void verifyDatabase();
 
+	// Opens another connection to the (already opened) database file,
+	// e.g. for use on another thread. The caller has to close it.
+	sqlite3 *openExtraConnection(s64 *busy_handler_data);
+
 	// Convertors
 	inline void str_to_sqlite(sqlite3_stmt *s, int iCol, std::string_view str) const
 	{
@@ -156,10 +167,18 @@ class Database_SQLite3 : public Database
 	static int busyHandler(void *data, int count);
 };
 
+/*
+	Blocks saved between beginSave() and endSave() are collected and written
+	with multi-row statements. With write_behind they are instead handed to
+	a background thread, which writes and commits them using its own
+	connection, so endSave() doesn't wait for the disk.
+	Blocks that were saved but aren't written yet are kept in memory, so
+	loadBlock() always returns the latest data.
+*/
 class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 {
 public:
-	MapDatabaseSQLite3(const std::string &savedir);
+	MapDatabaseSQLite3(const std::string &savedir, bool write_behind = false);
 	virtual ~MapDatabaseSQLite3();
 
 	bool saveBlock(const v3s16 &pos, std::string_view data);
@@ -167,20 +186,86 @@ class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 	bool deleteBlock(const v3s16 &pos);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
-	void beginSave() { Database_SQLite3::beginSave(); }
-	void endSave() { Database_SQLite3::endSave(); }
+	void beginSave();
+	void endSave();
+
+	// Waits until the background thread has written everything handed to it
+	void flush();
+
+	// Number of rows per multi-row statement
+	static constexpr size_t WRITE_BATCH_ROWS = 64;
+
 protected:
 	virtual void createDatabase();
 	virtual void initStatements();
 
 private:
+	typedef std::shared_ptr<const std::string> BlockData;
+	typedef std::vector<std::pair<s64, BlockData>> WriteBatch;
+
+	class WriterThread : public Thread
+	{
+	public:
+		WriterThread(MapDatabaseSQLite3 *db, sqlite3 *conn);
+		~WriterThread();
+
+	protected:
+		void *run() override;
+
+	private:
+		void write(const WriteBatch &batch);
+
+		MapDatabaseSQLite3 *m_db;
+		sqlite3 *m_conn;
+		sqlite3_stmt *m_stmt_begin = nullptr;
+		sqlite3_stmt *m_stmt_end = nullptr;
+		sqlite3_stmt *m_stmt_rollback = nullptr;
+		sqlite3_stmt *m_stmt_write = nullptr;
+		sqlite3_stmt *m_stmt_write_multi = nullptr;
+	};
+
 	void bindPos(sqlite3_stmt *stmt, const v3s16 &pos, int index = 1);
 
+	// Writes the current batch on the main connection
+	void writeBatch();
+	// Hands the current batch to the writer thread
+	void queueBatch();
+	// Removes the rows from m_pending unless they have been saved again since
+	void forgetPendingNoLock(const WriteBatch &batch);
+	// Rethrows an error that happened on the writer thread
+	void checkWriterError();
+
+	static void prepareWriteStatements(sqlite3 *conn,
+			sqlite3_stmt **single, sqlite3_stmt **multi);
+	static void writeRows(sqlite3 *conn, sqlite3_stmt *single,
+			sqlite3_stmt *multi, const WriteBatch &rows);
+
+	const bool m_write_behind;
+
 	// Map
 	sqlite3_stmt *m_stmt_read = nullptr;
 	sqlite3_stmt *m_stmt_write = nullptr;
+	sqlite3_stmt *m_stmt_write_multi = nullptr;
 	sqlite3_stmt *m_stmt_list = nullptr;
 	sqlite3_stmt *m_stmt_delete = nullptr;
+
+	bool m_in_save = false;
+	// Rows saved since beginSave() that haven't been written or queued yet
+	WriteBatch m_batch;
+
+	std::unique_ptr<WriterThread> m_writer;
+	s64 m_writer_busy_handler_data[2];
+
+	// Protects everything below
+	std::mutex m_pending_mutex;
+	// Latest data of all saved blocks that aren't written yet
+	std::unordered_map<s64, BlockData> m_pending;
+	// Batches waiting for the writer thread
+	std::deque<WriteBatch> m_queue;
+	bool m_writer_busy = false;
+	std::exception_ptr m_writer_error;
+	std::condition_variable m_queue_cv;
+	std::condition_variable m_idle_cv;
 };
 
 class PlayerDatabaseSQLite3 : private Database_SQLite3, public PlayerDatabase
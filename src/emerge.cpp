@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "emerge_internal.h"
 
+#include <algorithm>
 #include <iostream>
 
 #include "util/container.h"
@@ -124,8 +125,18 @@ EmergeManager::EmergeManager(Server *server, MetricsBackend *mb)
 	m_qlimit_diskonly = rangelim(m_qlimit_diskonly, 1, 1000000);
 	m_qlimit_generate = rangelim(m_qlimit_generate, 1, 1000000);
 
-	for (s16 i = 0; i < nthreads; i++)
-		m_threads.push_back(new EmergeThread(server, i));
+	for (s16 i = 0; i < nthreads; i++) {
+		EmergeThread *thread = new EmergeThread(server, i);
+		thread->m_queue_depth_gauge = mb->addGauge(
+			"minetest_emerge_queue_depth",
+			"Number of blocks queued for an emerge thread",
+			{{"thread", itos(i)}});
+		thread->m_steal_counter = mb->addCounter(
+			"minetest_emerge_steals",
+			"Number of blocks an emerge thread took from another thread's queue",
+			{{"thread", itos(i)}});
+		m_threads.push_back(thread);
+	}
 
 	infostream << "EmergeManager: using " << nthreads << " threads" << std::endl;
 }
@@ -422,11 +433,16 @@ EmergeThread *EmergeManager::getOptimalThread()
 
 	FATAL_ERROR_IF(nthreads == 0, "No emerge threads!");
 
+	// Count the block that is being worked on, so that idle threads win ties
+	auto load = [] (const EmergeThread *t) {
+		return t->m_block_queue.size() + (t->m_busy ? 1 : 0);
+	};
+
 	size_t index = 0;
-	size_t nitems_lowest = m_threads[0]->m_block_queue.size();
+	size_t nitems_lowest = load(m_threads[0]);
 
 	for (size_t i = 1; i < nthreads; i++) {
-		size_t nitems = m_threads[i]->m_block_queue.size();
+		size_t nitems = load(m_threads[i]);
 		if (nitems < nitems_lowest) {
 			index = i;
 			nitems_lowest = nitems;
@@ -436,6 +452,29 @@ EmergeThread *EmergeManager::getOptimalThread()
 	return m_threads[index];
 }
 
+bool EmergeManager::isChunkBusy(v3s16 chunk, const EmergeThread *except) const
+{
+	for (const EmergeThread *t : m_threads) {
+		if (t != except && t->m_busy && t->m_busy_chunk == chunk)
+			return true;
+	}
+	return false;
+}
+
+void EmergeManager::wakeIdleThreads(const EmergeThread *except)
+{
+	bool have_work = false;
+	for (const EmergeThread *t : m_threads)
+		have_work |= !t->m_block_queue.empty();
+	if (!have_work)
+		return;
+
+	for (EmergeThread *t : m_threads) {
+		if (t != except && t->m_idle)
+			t->signal();
+	}
+}
+
 void EmergeManager::reportCompletedEmerge(EmergeAction action)
 {
 	assert((size_t)action < ARRLEN(m_completed_emerge_counter));
@@ -468,7 +507,8 @@ void EmergeThread::signal()
 
 bool EmergeThread::pushBlock(const v3s16 &pos)
 {
-	m_block_queue.push(pos);
+	m_block_queue.push_back(pos);
+	m_queue_depth_gauge->set(m_block_queue.size());
 	return true;
 }
 
@@ -477,17 +517,21 @@ void EmergeThread::cancelPendingItems()
 {
 	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
 
+	m_busy = false;
+	m_idle = false;
+
 	while (!m_block_queue.empty()) {
 		BlockEmergeData bedata;
 		v3s16 pos;
 
 		pos = m_block_queue.front();
-		m_block_queue.pop();
+		m_block_queue.pop_front();
 
 		m_emerge->popBlockEmergeData(pos, &bedata);
 
 		runCompletionCallbacks(pos, EMERGE_CANCELLED, bedata.callbacks);
 	}
+	m_queue_depth_gauge->set(0);
 }
 
 
@@ -512,11 +556,21 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 {
 	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
 
-	if (m_block_queue.empty())
+	if (m_busy) {
+		// Blocks that were left alone because of our chunk can be taken now
+		m_busy = false;
+		m_emerge->wakeIdleThreads(this);
+	}
+
+	if (!takeBlock(this, pos) && !stealBlock(pos)) {
+		m_idle = true;
 		return false;
+	}
 
-	*pos = m_block_queue.front();
-	m_block_queue.pop();
+	m_idle = false;
+	m_busy = true;
+	m_busy_chunk = EmergeManager::getContainingChunk(*pos,
+		m_emerge->mgparams->chunksize);
 
 	m_emerge->popBlockEmergeData(*pos, bedata);
 
@@ -524,23 +578,89 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 }
 
 
+bool EmergeThread::takeBlock(EmergeThread *from, v3s16 *pos)
+{
+	auto &queue = from->m_block_queue;
+	const s16 chunksize = m_emerge->mgparams->chunksize;
+
+	// Blocks of a chunk that another thread is working on are skipped: only
+	// one thread may generate a chunk at a time, and they are cheap to get
+	// once it is done.
+	auto is_free = [&] (v3s16 p) {
+		return !m_emerge->isChunkBusy(
+			EmergeManager::getContainingChunk(p, chunksize), this);
+	};
+
+	// Own blocks are taken oldest first, stolen ones newest first
+	if (from == this) {
+		auto it = std::find_if(queue.begin(), queue.end(), is_free);
+		if (it == queue.end())
+			return false;
+		*pos = *it;
+		queue.erase(it);
+	} else {
+		auto it = std::find_if(queue.rbegin(), queue.rend(), is_free);
+		if (it == queue.rend())
+			return false;
+		*pos = *it;
+		queue.erase(std::next(it).base());
+	}
+
+	from->m_queue_depth_gauge->set(queue.size());
+	return true;
+}
+
+
+bool EmergeThread::stealBlock(v3s16 *pos)
+{
+	const auto &threads = m_emerge->m_threads;
+
+	for (size_t i = 1; i < threads.size(); i++) {
+		EmergeThread *victim = threads[(id + i) % threads.size()];
+		if (takeBlock(victim, pos)) {
+			m_steal_counter->increment();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
 EmergeAction EmergeThread::getBlockOrStartGen(
 	const v3s16 &pos, bool allow_gen, MapBlock **block, BlockMakeData *bmdata)
 {
+	{
+		MutexAutoLock envlock(m_server->m_env_mutex);
+
+		// 1). Attempt to fetch block from memory
+		*block = m_map->getBlockNoCreateNoEx(pos);
+		if (*block) {
+			if ((*block)->isGenerated())
+				return EMERGE_FROM_MEMORY;
+			return startGen(pos, allow_gen, bmdata);
+		}
+	}
+
+	// 2). Attempt to load block from disk if it was not in the memory.
+	// Reading and decompressing it is slow, so only the insertion into the
+	// map is done under the lock.
+	ServerMap::ReadBlockData data;
+	m_map->readBlock(pos, data);
+
 	MutexAutoLock envlock(m_server->m_env_mutex);
 
-	// 1). Attempt to fetch block from memory
-	*block = m_map->getBlockNoCreateNoEx(pos);
-	if (*block) {
-		if ((*block)->isGenerated())
-			return EMERGE_FROM_MEMORY;
-	} else {
-		// 2). Attempt to load block from disk if it was not in the memory
-		*block = m_map->loadBlock(pos);
-		if (*block && (*block)->isGenerated())
-			return EMERGE_FROM_DISK;
-	}
+	*block = m_map->finishLoadBlock(data);
+	if (*block && (*block)->isGenerated())
+		return EMERGE_FROM_DISK;
+
+	return startGen(pos, allow_gen, bmdata);
+}
+
 
+EmergeAction EmergeThread::startGen(
+	const v3s16 &pos, bool allow_gen, BlockMakeData *bmdata)
+{
 	// 3). Attempt to start generation
 	if (allow_gen && m_map->initBlockMake(pos, bmdata))
 		return EMERGE_GENERATED;
@@ -227,6 +227,10 @@ class EmergeManager {
 
 	// Requires m_queue_mutex held
 	EmergeThread *getOptimalThread();
+	// Requires m_queue_mutex held
+	bool isChunkBusy(v3s16 chunk, const EmergeThread *except) const;
+	// Requires m_queue_mutex held
+	void wakeIdleThreads(const EmergeThread *except);
 
 	bool pushBlockEmergeData(
 		v3s16 pos,
@@ -25,7 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "emerge.h"
 
-#include <queue>
+#include <deque>
 
 #include "util/thread.h"
 #include "threading/event.h"
@@ -73,14 +73,30 @@ class EmergeThread : public Thread {
 	UniqueQueue<v3s16> *m_trans_liquid; //< non-null only when generating a mapblock
 
 	Event m_queue_event;
-	std::queue<v3s16> m_block_queue;
+
+	// Protected by EmergeManager::m_queue_mutex.
+	// The thread takes blocks from the front, others steal from the back.
+	std::deque<v3s16> m_block_queue;
+	// Set while a block is being emerged, with the chunk that it belongs to
+	bool m_busy = false;
+	v3s16 m_busy_chunk;
+	// Set while waiting for work
+	bool m_idle = false;
+
+	MetricGaugePtr m_queue_depth_gauge;
+	MetricCounterPtr m_steal_counter;
 
 	bool initScripting();
 
 	bool popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata);
+	// Require queue mutex held
+	bool takeBlock(EmergeThread *from, v3s16 *pos);
+	bool stealBlock(v3s16 *pos);
 
 	EmergeAction getBlockOrStartGen(
 		const v3s16 &pos, bool allow_gen, MapBlock **block, BlockMakeData *data);
+	// Requires env lock held
+	EmergeAction startGen(const v3s16 &pos, bool allow_gen, BlockMakeData *data);
 	MapBlock *finishGen(v3s16 pos, BlockMakeData *bmdata,
 		std::map<v3s16, MapBlock *> *modified_blocks);
 
@@ -35,11 +35,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "httpfetch.h"
 #include "gameparams.h"
 #include "database/database.h"
+#include "database/database-mmap.h"
 #include "config.h"
 #include "player.h"
 #include "porting.h"
 #include "network/socket.h"
 #include "mapblock.h"
+#include "serialization.h"
 #if USE_CURSES
 	#include "terminal_chat_console.h"
 #endif
@@ -125,6 +127,7 @@ static bool determine_subgame(GameParams *game_params);
 static bool run_dedicated_server(const GameParams &game_params, const Settings &cmd_args);
 static bool migrate_map_database(const GameParams &game_params, const Settings &cmd_args);
 static bool recompress_map_database(const GameParams &game_params, const Settings &cmd_args);
+static bool train_block_dictionary(const GameParams &game_params, const Settings &cmd_args);
 
 /**********************************************************************/
 
@@ -376,6 +379,8 @@ static void set_allowed_options(OptionList *allowed_options)
 			_("Feature an interactive terminal (Only works when using minetestserver or with --server)"))));
 	allowed_options->insert(std::make_pair("recompress", ValueSpec(VALUETYPE_FLAG,
 			_("Recompress the blocks of the given map database."))));
+	allowed_options->insert(std::make_pair("train-block-dictionary", ValueSpec(VALUETYPE_FLAG,
+			_("Train a dictionary from the blocks of the given map database, to compress them for clients."))));
 #ifndef SERVER
 	allowed_options->insert(std::make_pair("address", ValueSpec(VALUETYPE_STRING,
 			_("Address to connect to. ('' = local game)"))));
@@ -1073,6 +1078,9 @@ static bool run_dedicated_server(const GameParams &game_params, const Settings &
 	if (cmd_args.getFlag("recompress"))
 		return recompress_map_database(game_params, cmd_args);
 
+	if (cmd_args.getFlag("train-block-dictionary"))
+		return train_block_dictionary(game_params, cmd_args);
+
 	// Bind address
 	std::string bind_str = g_settings->get("bind_address");
 	Address bind_addr(0, 0, 0, 0, game_params.socket_port);
@@ -1185,7 +1193,7 @@ static bool migrate_map_database(const GameParams &game_params, const Settings &
 	if (!world_mt.exists("backend")) {
 		errorstream << "Please specify your current backend in world.mt:"
 			<< std::endl
-			<< "	backend = {sqlite3|leveldb|redis|dummy|postgresql}"
+			<< "	backend = {sqlite3|leveldb|redis|dummy|postgresql|mmap}"
 			<< std::endl;
 		return false;
 	}
@@ -1197,8 +1205,14 @@ static bool migrate_map_database(const GameParams &game_params, const Settings &
 		return false;
 	}
 
-	MapDatabase *old_db = ServerMap::createDatabase(backend, game_params.world_path, world_mt),
-		*new_db = ServerMap::createDatabase(migrate_to, game_params.world_path, world_mt);
+	MapDatabase *old_db = ServerMap::createDatabase(backend, game_params.world_path, world_mt);
+	// The memory-mapped backend is read-only, its block file is built here
+	MapDatabaseMmapWriter *mmap_writer = nullptr;
+	MapDatabase *new_db;
+	if (migrate_to == "mmap")
+		new_db = mmap_writer = new MapDatabaseMmapWriter(game_params.world_path);
+	else
+		new_db = ServerMap::createDatabase(migrate_to, game_params.world_path, world_mt);
 
 	u32 count = 0;
 	time_t last_update_time = 0;
@@ -1227,8 +1241,13 @@ static bool migrate_map_database(const GameParams &game_params, const Settings &
 	}
 	std::cerr << std::endl;
 	new_db->endSave();
+	bool ok = !mmap_writer || mmap_writer->finish();
 	delete old_db;
 	delete new_db;
+	if (!ok) {
+		errorstream << "Failed to write the new map database" << std::endl;
+		return false;
+	}
 
 	actionstream << "Successfully migrated " << count << " blocks" << std::endl;
 	world_mt.set("backend", migrate_to);
@@ -1305,3 +1324,88 @@ static bool recompress_map_database(const GameParams &game_params, const Setting
 	actionstream << "Done, " << count << " blocks were recompressed." << std::endl;
 	return true;
 }
+
+static bool train_block_dictionary(const GameParams &game_params, const Settings &cmd_args)
+{
+	// The mods are loaded so that the blocks carry the node ids of a
+	// running server, which is what the dictionary has to learn
+	Server server(game_params.world_path, game_params.game_spec, false, Address(), false);
+	try {
+		server.init();
+	} catch (const ModError &e) {
+		errorstream << "ModError: " << e.what() << std::endl;
+		return false;
+	} catch (const ServerError &e) {
+		errorstream << "ServerError: " << e.what() << std::endl;
+		return false;
+	}
+	ServerMap &map = server.getEnv().getServerMap();
+
+	// zstd recommends about 100 times the dictionary size in samples, and
+	// training needs about 10 times their size in memory
+	const size_t max_dict_size = 112640;
+	const size_t max_samples = 2000;
+	bool &kill = *porting::signal_handler_killstatus();
+	const u8 ver = SER_FMT_VER_HIGHEST_WRITE;
+
+	std::vector<v3s16> blocks;
+	map.listAllLoadableBlocks(blocks);
+	// Spread the samples over the whole map
+	const size_t step = std::max<size_t>(blocks.size() / max_samples, 1);
+
+	std::vector<std::string> samples;
+	std::ostringstream oss(std::ios_base::binary);
+	for (size_t i = 0; i < blocks.size(); i += step) {
+		if (kill) return false;
+
+		oss.str("");
+		oss.clear();
+		try {
+			// Loading maps the stored node names to the ids of the game
+			MapBlock *block = map.loadBlock(blocks[i]);
+			if (!block)
+				continue;
+			block->serialize(oss, ver, false, -1);
+
+			// zstd learns from the data as it is before compressing
+			std::istringstream compressed(oss.str(), std::ios_base::binary);
+			std::ostringstream raw(std::ios_base::binary);
+			decompress(compressed, raw, ver);
+			samples.push_back(raw.str());
+		} catch (SerializationError &e) {
+			warningstream << "Skipping block " << blocks[i] << ": "
+					<< e.what() << std::endl;
+		}
+	}
+
+	std::string dict_data = ZstdDictionary::train(samples, max_dict_size);
+	if (dict_data.empty()) {
+		errorstream << "Could not train a dictionary from " << samples.size()
+				<< " blocks, the map may be too small" << std::endl;
+		return false;
+	}
+
+	// Tell how much it helps
+	ZstdDictionary dict(dict_data);
+	size_t size_plain = 0, size_dict = 0;
+	for (const std::string &sample : samples) {
+		oss.str("");
+		compress(sample, oss, ver, -1);
+		size_plain += oss.tellp();
+		oss.str("");
+		compress(sample, oss, ver, -1, &dict);
+		size_dict += oss.tellp();
+	}
+
+	const std::string path = game_params.world_path + DIR_DELIM BLOCK_DICTIONARY_NAME;
+	if (!fs::safeWriteToFile(path, dict_data)) {
+		errorstream << "Cannot write " << path << std::endl;
+		return false;
+	}
+
+	actionstream << "Trained from " << samples.size() << " blocks, wrote "
+		<< dict_data.size() << " bytes to " << path << ". With it, blocks compress to "
+		<< (100.0f * size_dict / std::max<size_t>(size_plain, 1))
+		<< "% of their size without it." << std::endl;
+	return true;
+}
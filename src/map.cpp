@@ -31,6 +31,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/directiontables.h"
 #include "rollback_interface.h"
 #include "environment.h"
+#include "noise.h"
 #include "irrlicht_changes/printing.h"
 
 /*
@@ -106,6 +107,14 @@ MapBlock *Map::getBlockNoCreateNoEx(v3s16 p3d)
 	return block;
 }
 
+MapBlock *Map::getBlockNoCreateNoExNoCache(v3s16 p3d) const
+{
+	auto it = m_sectors.find(v2s16(p3d.X, p3d.Z));
+	if (it == m_sectors.end())
+		return nullptr;
+	return it->second->getBlockNoCreateNoExNoCache(p3d.Y);
+}
+
 MapBlock *Map::getBlockNoCreate(v3s16 p3d)
 {
 	MapBlock *block = getBlockNoCreateNoEx(p3d);
@@ -199,10 +208,17 @@ void Map::addNodeAndUpdate(v3s16 p, MapNode n,
 		n.setLight(LIGHTBANK_NIGHT, 0, f);
 		set_node_in_block(m_gamedef->ndef(), block, relpos, n);
 
-		// Update lighting
-		std::vector<std::pair<v3s16, MapNode> > oldnodes;
-		oldnodes.emplace_back(p, oldnode);
-		voxalgo::update_lighting_nodes(this, oldnodes, modified_blocks);
+		if (m_lighting_batch_depth > 0) {
+			// Keep the first old node, it holds the light the map had
+			// before the batch
+			m_lighting_batch.emplace(p, oldnode);
+			modified_blocks[blockpos] = block;
+		} else {
+			// Update lighting
+			std::vector<std::pair<v3s16, MapNode> > oldnodes;
+			oldnodes.emplace_back(p, oldnode);
+			voxalgo::update_lighting_nodes(this, oldnodes, modified_blocks);
+		}
 	}
 
 	if (n.getContent() != oldnode.getContent() &&
@@ -270,6 +286,30 @@ bool Map::removeNodeWithEvent(v3s16 p)
 	return succeeded;
 }
 
+void Map::beginLightingBatch()
+{
+	m_lighting_batch_depth++;
+}
+
+void Map::endLightingBatch()
+{
+	assert(m_lighting_batch_depth > 0);
+	if (--m_lighting_batch_depth > 0 || m_lighting_batch.empty())
+		return;
+
+	std::vector<std::pair<v3s16, MapNode>> oldnodes(
+			m_lighting_batch.begin(), m_lighting_batch.end());
+	m_lighting_batch.clear();
+
+	std::map<v3s16, MapBlock*> modified_blocks;
+	voxalgo::update_lighting_nodes(this, oldnodes, modified_blocks);
+
+	MapEditEvent event;
+	event.type = MEET_OTHER;
+	event.setModifiedBlocks(modified_blocks);
+	dispatchEvent(event);
+}
+
 struct TimeOrderedMapBlock {
 	MapSector *sect;
 	MapBlock *block;
@@ -601,7 +641,7 @@ void Map::removeNodeTimer(v3s16 p)
 }
 
 bool Map::determineAdditionalOcclusionCheck(const v3s16 pos_camera,
-	const core::aabbox3d<s16> &block_bounds, v3s16 &check)
+	const core::aabbox3d<s16> &block_bounds, v3s16 &check) const
 {
 	/*
 		This functions determines the node inside the target block that is
@@ -665,7 +705,7 @@ bool Map::determineAdditionalOcclusionCheck(const v3s16 pos_camera,
 }
 
 bool Map::isOccluded(const v3s16 pos_camera, const v3s16 pos_target,
-	float step, float stepfac, float offset, float end_offset, u32 needed_count)
+	float step, float stepfac, float offset, float end_offset, u32 needed_count) const
 {
 	v3f direction = intToFloat(pos_target - pos_camera, BS);
 	float distance = direction.getLength();
@@ -676,16 +716,24 @@ bool Map::isOccluded(const v3s16 pos_camera, const v3s16 pos_target,
 
 	v3f pos_origin_f = intToFloat(pos_camera, BS);
 	u32 count = 0;
-	bool is_valid_position;
+	// Consecutive steps mostly stay in the same block
+	MapBlock *block = nullptr;
+	v3s16 block_pos;
+	bool have_block = false;
 
 	for (; offset < distance + end_offset; offset += step) {
 		v3f pos_node_f = pos_origin_f + direction * offset;
 		v3s16 pos_node = floatToInt(pos_node_f, BS);
 
-		MapNode node = getNode(pos_node, &is_valid_position);
+		v3s16 bp = getNodeBlockPos(pos_node);
+		if (!have_block || bp != block_pos) {
+			block = getBlockNoCreateNoExNoCache(bp);
+			block_pos = bp;
+			have_block = true;
+		}
 
-		if (is_valid_position &&
-				!m_nodedef->getLightingFlags(node).light_propagates) {
+		if (block && !m_nodedef->getLightingFlags(
+				block->getNodeNoCheck(pos_node - bp * MAP_BLOCKSIZE)).light_propagates) {
 			// Cannot see through light-blocking nodes --> occluded
 			count++;
 			if (count >= needed_count)
@@ -696,7 +744,8 @@ bool Map::isOccluded(const v3s16 pos_camera, const v3s16 pos_target,
 	return false;
 }
 
-bool Map::isBlockOccluded(v3s16 pos_relative, v3s16 cam_pos_nodes, bool simple_check)
+bool Map::isBlockOccluded(v3s16 pos_relative, v3s16 cam_pos_nodes,
+	bool simple_check, PcgRandom *rand) const
 {
 	// Check occlusion for center and all 8 corners of the mapblock
 	// Overshoot a little for less flickering
@@ -738,7 +787,11 @@ bool Map::isBlockOccluded(v3s16 pos_relative, v3s16 cam_pos_nodes, bool simple_c
 	// The client recalculates the complete drawlist periodically,
 	// and random sampling could lead to visible flicker.
 	if (simple_check) {
-		v3s16 random_point(myrand_range(-bs2, bs2), myrand_range(-bs2, bs2), myrand_range(-bs2, bs2));
+		v3s16 random_point;
+		if (rand)
+			random_point = v3s16(rand->range(-bs2, bs2), rand->range(-bs2, bs2), rand->range(-bs2, bs2));
+		else
+			random_point = v3s16(myrand_range(-bs2, bs2), myrand_range(-bs2, bs2), myrand_range(-bs2, bs2));
 		return isOccluded(cam_pos_nodes, pos_blockcenter + random_point, step, stepfac,
 					start_offset, end_offset, 1);
 	}
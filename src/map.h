@@ -37,6 +37,7 @@ class MapSector;
 class NodeMetadata;
 class IGameDef;
 class IRollbackManager;
+class PcgRandom;
 
 /*
 	MapEditEvent
@@ -140,6 +141,9 @@ class Map /*: public NodeContainer*/
 	MapBlock * getBlockNoCreate(v3s16 p);
 	// Returns NULL if not found
 	MapBlock * getBlockNoCreateNoEx(v3s16 p);
+	// Same as above, but doesn't use the sector and block caches.
+	// Safe to call from several threads while nobody modifies the map.
+	MapBlock *getBlockNoCreateNoExNoCache(v3s16 p) const;
 
 	/* Server overrides */
 	virtual MapBlock * emergeBlock(v3s16 p, bool create_blank=true)
@@ -174,6 +178,17 @@ class Map /*: public NodeContainer*/
 	bool addNodeWithEvent(v3s16 p, MapNode n, bool remove_metadata = true);
 	bool removeNodeWithEvent(v3s16 p);
 
+	/*
+		Lighting batches, for setting many nodes one by one.
+		Within a batch, addNodeAndUpdate() only remembers which nodes need
+		new light. When the outermost batch ends, all of them are relit in
+		one pass per light bank and a MEET_OTHER event with the blocks this
+		touched is emitted. Until then the light of the map is stale.
+		Use MapLightingBatch rather than calling these directly.
+	*/
+	void beginLightingBatch();
+	void endLightingBatch();
+
 	// Call these before and after saving of many blocks
 	virtual void beginSave() {}
 	virtual void endSave() {}
@@ -283,11 +298,18 @@ class Map /*: public NodeContainer*/
 		}
 	}
 
-	bool isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes)
+	/*
+		The occlusion checks only read the map (without using the lookup
+		caches), so they may run on several threads while nobody modifies it.
+		`rand` is used to pick the sample point for simple checks; the global
+		random number generator is used if it is null.
+	*/
+	bool isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes) const
 	{
 		return isBlockOccluded(block->getPosRelative(), cam_pos_nodes, false);
 	}
-	bool isBlockOccluded(v3s16 pos_relative, v3s16 cam_pos_nodes, bool simple_check = false);
+	bool isBlockOccluded(v3s16 pos_relative, v3s16 cam_pos_nodes,
+		bool simple_check = false, PcgRandom *rand = nullptr) const;
 
 protected:
 	IGameDef *m_gamedef;
@@ -303,14 +325,32 @@ class Map /*: public NodeContainer*/
 	// This stores the properties of the nodes on the map.
 	const NodeDefManager *m_nodedef;
 
+	// Nesting depth of lighting batches
+	u32 m_lighting_batch_depth = 0;
+	// Nodes waiting for a light update, mapped to the node they replaced
+	// first within the batch
+	std::map<v3s16, MapNode> m_lighting_batch;
+
 	// Can be implemented by child class
 	virtual void reportMetrics(u64 save_time_us, u32 saved_blocks, u32 all_blocks) {}
 
 	bool determineAdditionalOcclusionCheck(v3s16 pos_camera,
-		const core::aabbox3d<s16> &block_bounds, v3s16 &to_check);
+		const core::aabbox3d<s16> &block_bounds, v3s16 &to_check) const;
 	bool isOccluded(v3s16 pos_camera, v3s16 pos_target,
 		float step, float stepfac, float start_offset, float end_offset,
-		u32 needed_count);
+		u32 needed_count) const;
+};
+
+// Defers the light updates of a map for its lifetime
+class MapLightingBatch
+{
+public:
+	MapLightingBatch(Map *map) : m_map(map) { m_map->beginLightingBatch(); }
+	~MapLightingBatch() { m_map->endLightingBatch(); }
+	DISABLE_CLASS_COPY(MapLightingBatch)
+
+private:
+	Map *m_map;
 };
 
 #define VMANIP_BLOCK_DATA_INEXIST     1
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "mapblock.h"
 
+#include <atomic>
 #include <sstream>
 #include "map.h"
 #include "light.h"
@@ -65,11 +66,15 @@ static const char *modified_reason_strings[] = {
 	MapBlock
 */
 
+// Upper 32 bits of the modification counter, unique per MapBlock object
+static std::atomic<u32> next_block_serial(0);
+
 MapBlock::MapBlock(v3s16 pos, IGameDef *gamedef):
 		m_pos(pos),
 		m_pos_relative(pos * MAP_BLOCKSIZE),
 		data(new MapNode[nodecount]),
-		m_gamedef(gamedef)
+		m_gamedef(gamedef),
+		m_modification_counter((u64)next_block_serial.fetch_add(1) << 32)
 {
 	reallocate();
 	assert(m_modified > MOD_STATE_CLEAN);
@@ -193,17 +198,17 @@ void MapBlock::actuallyUpdateIsAir()
 	// Running this function un-expires m_is_air
 	m_is_air_expired = false;
 
-	bool only_air = true;
+	// Set member variable
+	m_is_air = computeIsAir();
+}
+
+bool MapBlock::computeIsAir() const
+{
 	for (u32 i = 0; i < nodecount; i++) {
-		MapNode &n = data[i];
-		if (n.getContent() != CONTENT_AIR) {
-			only_air = false;
-			break;
-		}
+		if (data[i].getContent() != CONTENT_AIR)
+			return false;
 	}
-
-	// Set member variable
-	m_is_air = only_air;
+	return true;
 }
 
 void MapBlock::expireIsAirCache()
@@ -211,6 +216,55 @@ void MapBlock::expireIsAirCache()
 	m_is_air_expired = true;
 }
 
+// Limits for the per-content position index
+#define CONTENT_POSITIONS_MAX_TYPES 64
+#define CONTENT_POSITIONS_MAX_INDICES (MapBlock::nodecount / 16)
+
+const std::vector<MapBlock::ContentPositions> *MapBlock::getContentPositions()
+{
+	if (m_content_positions_state == CONTENT_POSITIONS_VALID)
+		return &m_content_positions;
+	if (m_content_positions_state == CONTENT_POSITIONS_TOO_MANY)
+		return nullptr;
+
+	m_content_positions.clear();
+	size_t k = 0;
+	for (u32 i = 0; i < nodecount; i++) {
+		content_t c = data[i].getContent();
+		// Same content as the previous node is the common case
+		if (k >= m_content_positions.size() || m_content_positions[k].content != c) {
+			for (k = 0; k < m_content_positions.size(); k++) {
+				if (m_content_positions[k].content == c)
+					break;
+			}
+			if (k == m_content_positions.size()) {
+				if (k >= CONTENT_POSITIONS_MAX_TYPES) {
+					m_content_positions.clear();
+					m_content_positions.shrink_to_fit();
+					m_content_positions_state = CONTENT_POSITIONS_TOO_MANY;
+					return nullptr;
+				}
+				m_content_positions.emplace_back();
+				m_content_positions[k].content = c;
+			}
+		}
+
+		ContentPositions &cp = m_content_positions[k];
+		if (cp.dense)
+			continue;
+		if (cp.indices.size() >= CONTENT_POSITIONS_MAX_INDICES) {
+			cp.dense = true;
+			cp.indices.clear();
+			cp.indices.shrink_to_fit();
+			continue;
+		}
+		cp.indices.push_back(i);
+	}
+
+	m_content_positions_state = CONTENT_POSITIONS_VALID;
+	return &m_content_positions;
+}
+
 /*
 	Serialization
 */
@@ -320,16 +374,37 @@ static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 	}
 }
 
-void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int compression_level)
+void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int compression_level,
+		const ZstdDictionary *dict)
 {
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
 
 	FATAL_ERROR_IF(version < SER_FMT_VER_LOWEST_WRITE, "Serialization version error");
 
+	if (version < 29) {
+		serializeContents(os_compressed, version, disk, compression_level);
+		return;
+	}
+
 	std::ostringstream os_raw(std::ios_base::binary);
-	std::ostream &os = version >= 29 ? os_raw : os_compressed;
+	serializeContents(os_raw, version, disk, compression_level);
+	// now compress the whole thing
+	compress(os_raw.str(), os_compressed, version, compression_level, dict);
+}
+
+void MapBlock::serializeUncompressed(std::ostream &os, u8 version, bool disk)
+{
+	if(!ser_ver_supported(version))
+		throw VersionMismatchException("ERROR: MapBlock format not supported");
+
+	FATAL_ERROR_IF(version < 29, "Serialization version error");
 
+	serializeContents(os, version, disk, -1);
+}
+
+void MapBlock::serializeContents(std::ostream &os, u8 version, bool disk, int compression_level)
+{
 	// First byte
 	u8 flags = 0;
 	if(is_underground)
@@ -393,7 +468,7 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 	if (version >= 29) {
 		m_node_metadata.serialize(os, version, disk);
 	} else {
-		// use os_raw from above to avoid allocating another stream object
+		std::ostringstream os_raw(std::ios_base::binary);
 		m_node_metadata.serialize(os_raw, version, disk);
 		// prior to 29 node data was compressed individually
 		compress(os_raw.str(), os, version, compression_level);
@@ -424,11 +499,6 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 			m_node_timers.serialize(os, version);
 		}
 	}
-
-	if (version >= 29) {
-		// now compress the whole thing
-		compress(os_raw.str(), os_compressed, version, compression_level);
-	}
 }
 
 void MapBlock::serializeNetworkSpecific(std::ostream &os)
@@ -436,10 +506,13 @@ void MapBlock::serializeNetworkSpecific(std::ostream &os)
 	writeU8(os, 2); // version
 }
 
-void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
+void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk,
+		NameIdMapping *nimap_out, const ZstdDictionary *dict)
 {
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
+	// The legacy conversions in deSerialize_pre22() need the final ids
+	sanity_check(!nimap_out || (disk && version > 21));
 
 	TRACESTREAM(<<"MapBlock::deSerialize "<<getPos()<<std::endl);
 
@@ -454,7 +527,7 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 	// Decompress the whole block (version >= 29)
 	std::stringstream in_raw(std::ios_base::binary | std::ios_base::in | std::ios_base::out);
 	if (version >= 29)
-		decompress(in_compressed, in_raw, version);
+		decompress(in_compressed, in_raw, version, dict);
 	std::istream &is = version >= 29 ? in_raw : in_compressed;
 
 	u8 flags = readU8(is);
@@ -564,7 +637,10 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 		}
 
 		// Dynamically re-set ids based on node names
-		correctBlockNodeIds(&nimap, data, m_gamedef);
+		if (nimap_out)
+			*nimap_out = nimap;
+		else
+			correctBlockNodeIds(&nimap, data, m_gamedef);
 
 		if(version >= 25){
 			TRACESTREAM(<<"MapBlock::deSerialize "<<getPos()
@@ -581,6 +657,11 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 			<<": Done."<<std::endl);
 }
 
+void MapBlock::correctNodeIds(const NameIdMapping &nimap)
+{
+	correctBlockNodeIds(&nimap, data, m_gamedef);
+}
+
 void MapBlock::deSerializeNetworkSpecific(std::istream &is)
 {
 	try {
@@ -33,9 +33,15 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 class Map;
 class NodeMetadataList;
+class NameIdMapping;
 class IGameDef;
 class MapBlockMesh;
 class VoxelManipulator;
+class ZstdDictionary;
+
+// Dictionary for sending blocks, in the world directory and sent as media.
+// See --train-block-dictionary.
+#define BLOCK_DICTIONARY_NAME "block_dictionary.zstdict"
 
 #define BLOCK_TIMESTAMP_UNDEFINED 0xffffffff
 
@@ -113,8 +119,19 @@ class MapBlock
 		} else if (mod == m_modified) {
 			m_modified_reason |= reason;
 		}
-		if (mod == MOD_STATE_WRITE_NEEDED)
+		if (mod == MOD_STATE_WRITE_NEEDED) {
 			contents.clear();
+			m_content_positions.clear();
+			m_content_positions_state = CONTENT_POSITIONS_NONE;
+		}
+		m_modification_counter++;
+	}
+
+	// Changes whenever the block may have been modified. Never repeats,
+	// even for different MapBlock objects at the same position.
+	inline u64 getModificationCounter() const
+	{
+		return m_modification_counter;
 	}
 
 	inline u32 getModified()
@@ -313,6 +330,7 @@ class MapBlock
 	// Update is air flag.
 	// Sets m_is_air to appropriate value.
 	void actuallyUpdateIsAir();
+	bool computeIsAir() const;
 
 	// Call this to schedule what the previous function does to be done
 	// when the value is actually needed.
@@ -325,6 +343,13 @@ class MapBlock
 		return m_is_air;
 	}
 
+	// Same as isAir(), but leaves the cached flag alone, so it is safe to
+	// call from several threads while nobody modifies the block
+	inline bool isAirNoCacheUpdate() const
+	{
+		return m_is_air_expired ? computeIsAir() : m_is_air;
+	}
+
 	bool onObjectsActivation();
 	bool saveStaticObject(u16 id, const StaticObject &obj, u32 reason);
 
@@ -428,10 +453,21 @@ class MapBlock
 	// These don't write or read version by itself
 	// Set disk to true for on-disk format, false for over-the-network format
 	// Precondition: version >= SER_FMT_VER_LOWEST_WRITE
-	void serialize(std::ostream &result, u8 version, bool disk, int compression_level);
+	// A dictionary (version 29 and newer) must also be used to deserialize
+	void serialize(std::ostream &result, u8 version, bool disk, int compression_level,
+			const ZstdDictionary *dict = nullptr);
+	// Version 29 and newer compress the whole block at the end. This writes
+	// it before that, so it can be compressed later (and elsewhere).
+	void serializeUncompressed(std::ostream &os, u8 version, bool disk);
 	// If disk == true: In addition to doing other things, will add
 	// unknown blocks from id-name mapping to wndef
-	void deSerialize(std::istream &is, u8 version, bool disk);
+	// If nimap_out is given (disk format newer than 21 only), the node ids
+	// are left as stored and the id-name mapping is returned instead. The
+	// node definitions aren't touched then, so this can run on any thread.
+	// correctNodeIds() must be called before the block is used.
+	void deSerialize(std::istream &is, u8 version, bool disk,
+			NameIdMapping *nimap_out = nullptr, const ZstdDictionary *dict = nullptr);
+	void correctNodeIds(const NameIdMapping &nimap);
 
 	void serializeNetworkSpecific(std::ostream &os);
 	void deSerializeNetworkSpecific(std::istream &is);
@@ -451,6 +487,8 @@ class MapBlock
 	*/
 
 	void deSerialize_pre22(std::istream &is, u8 version, bool disk);
+	// Everything but the final compression of version 29 and newer
+	void serializeContents(std::ostream &os, u8 version, bool disk, int compression_level);
 
 	/*
 	 * PLEASE NOTE: When adding something here be mindful of position and size
@@ -514,11 +552,34 @@ class MapBlock
 	// Can be empty, in which case nothing was cached yet.
 	std::vector<content_t> contents;
 
+	struct ContentPositions
+	{
+		content_t content;
+		// Too common in this block to be listed, `indices` is empty then
+		bool dense = false;
+		// Node indices (see getNodeNoCheck) in ascending order
+		std::vector<u16> indices;
+	};
+
+	// Node positions grouped by content. Built lazily and dropped whenever
+	// the content cache is. Returns nullptr if the block has too many
+	// different contents to be indexed.
+	const std::vector<ContentPositions> *getContentPositions();
+
 private:
+	enum : u8 {
+		CONTENT_POSITIONS_NONE,
+		CONTENT_POSITIONS_VALID,
+		CONTENT_POSITIONS_TOO_MANY,
+	};
+
 	// Whether day and night lighting differs
 	bool m_is_air = false;
 	bool m_is_air_expired = true;
 
+	u8 m_content_positions_state = CONTENT_POSITIONS_NONE;
+	std::vector<ContentPositions> m_content_positions;
+
 	/*
 		- On the server, this is used for telling whether the
 		  block has been modified from the one on disk.
@@ -526,6 +587,7 @@ class MapBlock
 	*/
 	u16 m_modified = MOD_STATE_CLEAN;
 	u32 m_modified_reason = 0;
+	u64 m_modification_counter;
 
 	/*
 		When block is removed from active blocks, this is set to gametime.
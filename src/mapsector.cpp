@@ -67,6 +67,12 @@ MapBlock *MapSector::getBlockNoCreateNoEx(s16 y)
 	return getBlockBuffered(y);
 }
 
+MapBlock *MapSector::getBlockNoCreateNoExNoCache(s16 y) const
+{
+	auto it = m_blocks.find(y);
+	return it != m_blocks.end() ? it->second.get() : nullptr;
+}
+
 std::unique_ptr<MapBlock> MapSector::createBlankBlockNoInsert(s16 y)
 {
 	assert(getBlockBuffered(y) == nullptr); // Pre-condition
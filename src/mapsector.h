@@ -51,6 +51,9 @@ class MapSector
 	}
 
 	MapBlock *getBlockNoCreateNoEx(s16 y);
+	// Doesn't use the block cache, so this is safe to call from several
+	// threads as long as the sector isn't modified.
+	MapBlock *getBlockNoCreateNoExNoCache(s16 y) const;
 	std::unique_ptr<MapBlock> createBlankBlockNoInsert(s16 y);
 	MapBlock *createBlankBlock(s16 y);
 
@@ -335,7 +335,8 @@ void Client::handleCommand_BlockData(NetworkPacket* pkt)
 		/*
 			Update an existing block
 		*/
-		block->deSerialize(istr, m_server_ser_ver, false);
+		block->deSerialize(istr, m_server_ser_ver, false, nullptr,
+				m_block_dictionary.get());
 		block->deSerializeNetworkSpecific(istr);
 	}
 	else {
@@ -343,7 +344,8 @@ void Client::handleCommand_BlockData(NetworkPacket* pkt)
 			Create a new block
 		*/
 		block = sector->createBlankBlock(p.Y);
-		block->deSerialize(istr, m_server_ser_ver, false);
+		block->deSerialize(istr, m_server_ser_ver, false, nullptr,
+				m_block_dictionary.get());
 		block->deSerializeNetworkSpecific(istr);
 	}
 
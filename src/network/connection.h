@@ -19,7 +19,11 @@ enum rtt_stat_type {
 	AVG_RTT,
 	MIN_JITTER,
 	MAX_JITTER,
-	AVG_JITTER
+	AVG_JITTER,
+	// Congestion control: total window of all channels, and the loss of the
+	// worst channel (0 to 1)
+	CWND,
+	PACKET_LOSS,
 };
 
 enum rate_stat_type {
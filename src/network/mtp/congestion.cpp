@@ -0,0 +1,410 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "network/mtp/congestion.h"
+
+#include <algorithm>
+#include <cmath>
+#include "network/mtp/internal.h"
+
+namespace con
+{
+
+static float clamp_window(float window)
+{
+	return rangelim(window, (float)MIN_RELIABLE_WINDOW_SIZE,
+		(float)MAX_RELIABLE_WINDOW_SIZE);
+}
+
+/*
+	The original algorithm: once per second, the window is changed in steps
+	depending on the ratio of lost to acknowledged packets.
+*/
+class LegacyCongestion : public CongestionControl
+{
+public:
+	void onAck(float rtt, u32 bytes) override
+	{
+		m_packets_successful++;
+		m_bytes_transfered += bytes;
+	}
+
+	void onLoss(u32 count) override
+	{
+		m_packet_loss += count;
+	}
+
+	void step(float dtime, u32 in_flight) override
+	{
+		m_loss_timer += dtime;
+		m_bytes_timer += dtime;
+
+		if (m_loss_timer > 1.0f) {
+			m_loss_timer -= 1.0f;
+			update();
+		}
+
+		// Same period as the transfer rate statistics of the channel
+		if (m_bytes_timer > 10.0f) {
+			m_bytes_timer = 0.0f;
+			m_bytes_transfered = 0;
+		}
+	}
+
+	u32 getWindow() const override { return m_window_size; }
+
+	const char *getName() const override { return "legacy"; }
+
+private:
+	void setWindowSize(long size)
+	{
+		m_window_size = (u16)rangelim(size, MIN_RELIABLE_WINDOW_SIZE, MAX_RELIABLE_WINDOW_SIZE);
+	}
+
+	void update()
+	{
+		const unsigned int packet_loss = m_packet_loss;
+		const unsigned int packets_successful = m_packets_successful;
+		const bool reasonable_amount_of_data_transmitted =
+			m_bytes_transfered > (unsigned int) (m_window_size*512/2);
+		m_packet_loss = 0;
+		m_packets_successful = 0;
+
+		/* dynamic window size */
+		float successful_to_lost_ratio = 0.0f;
+
+		if (packets_successful > 0) {
+			successful_to_lost_ratio = packet_loss/packets_successful;
+		} else if (packet_loss > 0) {
+			setWindowSize(m_window_size - 10);
+			return;
+		}
+
+		if (successful_to_lost_ratio < 0.01f) {
+			/* don't even think about increasing if we didn't even
+			 * use major parts of our window */
+			if (reasonable_amount_of_data_transmitted)
+				setWindowSize(m_window_size + 100);
+		} else if (successful_to_lost_ratio < 0.05f) {
+			/* don't even think about increasing if we didn't even
+			 * use major parts of our window */
+			if (reasonable_amount_of_data_transmitted)
+				setWindowSize(m_window_size + 50);
+		} else if (successful_to_lost_ratio > 0.15f) {
+			setWindowSize(m_window_size - 100);
+		} else if (successful_to_lost_ratio > 0.1f) {
+			setWindowSize(m_window_size - 50);
+		}
+	}
+
+	u16 m_window_size = START_RELIABLE_WINDOW_SIZE;
+	unsigned int m_packet_loss = 0;
+	unsigned int m_packets_successful = 0;
+	unsigned int m_bytes_transfered = 0;
+	float m_loss_timer = 0.0f;
+	float m_bytes_timer = 0.0f;
+};
+
+/*
+	CUBIC (RFC 9438), in packets: after a loss the window shrinks to 70% and
+	then grows along a cubic curve that flattens out near the window at the
+	time of the loss. Slow start is left early if the RTT starts to grow
+	(HyStart), which avoids filling up the queues of slow links.
+*/
+class CubicCongestion : public CongestionControl
+{
+public:
+	void onAck(float rtt, u32 bytes) override
+	{
+		if (rtt >= 0) {
+			m_srtt = m_srtt < 0 ? rtt : m_srtt * 0.875f + rtt * 0.125f;
+			if (m_min_rtt < 0 || rtt < m_min_rtt)
+				m_min_rtt = rtt;
+		}
+
+		// Don't grow a window that isn't used
+		if (!m_window_limited)
+			return;
+
+		if (m_cwnd < m_ssthresh) {
+			m_cwnd += 1.0f;
+			if (rtt >= 0 && m_cwnd >= HYSTART_MIN_WINDOW &&
+					rtt > m_min_rtt + rangelim(m_min_rtt / 8, 0.004f, 0.016f)) {
+				// The queue at the bottleneck starts filling up
+				m_ssthresh = m_cwnd;
+				startEpoch(m_cwnd);
+			}
+		} else {
+			if (m_epoch_start < 0)
+				startEpoch(m_cwnd);
+			const float rtt_est = m_srtt > 0 ? m_srtt : DEFAULT_RTT;
+			const float t = m_time - m_epoch_start;
+
+			float target = CUBIC_C * std::pow(t - m_k, 3.0f) + m_w_origin;
+			// Grow at least as fast as Reno would
+			const float w_est = m_w_epoch +
+				3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) * t / rtt_est;
+			target = std::max(target, w_est);
+
+			if (target > m_cwnd)
+				m_cwnd += std::min(target - m_cwnd, m_cwnd) / m_cwnd;
+			else
+				m_cwnd += 0.01f / m_cwnd;
+		}
+		m_cwnd = clamp_window(m_cwnd);
+	}
+
+	void onLoss(u32 count) override
+	{
+		// Only react once per round trip, timeouts come in bursts
+		const float rtt_est = m_srtt > 0 ? m_srtt : DEFAULT_RTT;
+		if (m_time - m_last_reduction < rtt_est)
+			return;
+		m_last_reduction = m_time;
+
+		// Fast convergence: give up bandwidth if the window didn't recover
+		const float w_max = m_cwnd < m_w_max ?
+			m_cwnd * (1 + CUBIC_BETA) / 2 : m_cwnd;
+		m_w_max = m_cwnd;
+		m_cwnd = clamp_window(m_cwnd * CUBIC_BETA);
+		m_ssthresh = m_cwnd;
+		startEpoch(w_max);
+	}
+
+	void step(float dtime, u32 in_flight) override
+	{
+		m_time += dtime;
+		m_window_limited = in_flight * 2 >= m_cwnd;
+	}
+
+	u32 getWindow() const override { return m_cwnd; }
+
+	float getPacingRate() const override
+	{
+		if (m_srtt <= 0)
+			return 0;
+		// Like Linux: twice the window per RTT in slow start, a bit more
+		// than the window afterwards
+		return (m_cwnd < m_ssthresh ? 2.0f : 1.2f) * m_cwnd / m_srtt;
+	}
+
+	const char *getName() const override { return "cubic"; }
+
+private:
+	static constexpr float CUBIC_C = 0.4f;
+	static constexpr float CUBIC_BETA = 0.7f;
+	static constexpr float HYSTART_MIN_WINDOW = 16;
+	static constexpr float DEFAULT_RTT = 0.1f;
+
+	// The curve goes through `w_origin` at m_k seconds
+	void startEpoch(float w_origin)
+	{
+		m_epoch_start = m_time;
+		m_w_origin = w_origin;
+		m_w_epoch = m_cwnd;
+		m_k = std::cbrt(std::max(0.0f, w_origin - m_cwnd) / CUBIC_C);
+	}
+
+	float m_cwnd = START_RELIABLE_WINDOW_SIZE;
+	float m_ssthresh = MAX_RELIABLE_WINDOW_SIZE;
+	float m_w_max = 0;
+	float m_w_origin = 0;
+	float m_w_epoch = 0;
+	float m_k = 0;
+	double m_time = 0;
+	double m_epoch_start = -1;
+	double m_last_reduction = -1e9;
+	float m_srtt = -1;
+	float m_min_rtt = -1;
+	bool m_window_limited = true;
+};
+
+/*
+	Model based, after BBR: the bottleneck bandwidth is the highest delivery
+	rate of the last rounds, and the round trip is the lowest RTT of the
+	last seconds. Packets are paced at about that bandwidth and the window
+	is twice the bandwidth-delay product, so random loss doesn't throttle
+	the transfer and the queues of the path stay short.
+	If the lowest RTT wasn't seen again for a while, the window is shrunk
+	for a moment to empty the queues and measure it again (ProbeRTT).
+*/
+class BbrCongestion : public CongestionControl
+{
+public:
+	void onAck(float rtt, u32 bytes) override
+	{
+		m_delivered++;
+		if (rtt < 0)
+			return;
+		if (m_min_rtt < 0 || rtt <= m_min_rtt) {
+			m_min_rtt = rtt;
+			m_min_rtt_stamp = m_time;
+		}
+		if (m_mode == ProbeRTT && (m_probe_rtt_min < 0 || rtt < m_probe_rtt_min))
+			m_probe_rtt_min = rtt;
+	}
+
+	void onLoss(u32 count) override
+	{
+		// Loss is not a congestion signal here
+	}
+
+	void step(float dtime, u32 in_flight) override
+	{
+		m_time += dtime;
+		m_round_time += dtime;
+		m_round_max_in_flight = std::max(m_round_max_in_flight, in_flight);
+
+		if (m_mode != ProbeRTT && m_min_rtt > 0 &&
+				m_time - m_min_rtt_stamp > MIN_RTT_WINDOW) {
+			m_mode = ProbeRTT;
+			m_probe_rtt_min = -1;
+			// Time to drain the queues, then to take samples
+			m_probe_rtt_end = m_time + m_min_rtt + std::max(PROBE_RTT_TIME, m_min_rtt);
+		} else if (m_mode == ProbeRTT && m_time >= m_probe_rtt_end) {
+			// Accept a higher RTT only now, the path may have changed
+			if (m_probe_rtt_min > 0)
+				m_min_rtt = m_probe_rtt_min;
+			m_min_rtt_stamp = m_time;
+			m_mode = m_full_bw_rounds >= 3 ? ProbeBW : Startup;
+			m_cycle_index = 0;
+		}
+
+		const float round = m_min_rtt > 0 ? std::max(m_min_rtt, MIN_ROUND) : DEFAULT_RTT;
+		if (m_round_time < round)
+			return;
+
+		// Samples from rounds where not much was sent say nothing about
+		// the bandwidth, unless they are higher than what is known
+		const float bw = m_delivered / m_round_time;
+		const bool app_limited = m_mode == ProbeRTT ||
+			m_round_max_in_flight * 4 < getWindow();
+		if (!app_limited || bw > m_btl_bw) {
+			m_bw_samples[m_bw_index] = bw;
+			m_bw_index = (m_bw_index + 1) % BW_WINDOW_ROUNDS;
+			m_btl_bw = *std::max_element(m_bw_samples, m_bw_samples + BW_WINDOW_ROUNDS);
+		}
+		m_delivered = 0;
+		m_round_time = 0;
+		m_round_max_in_flight = 0;
+
+		switch (m_mode) {
+		case Startup:
+			// Leave once the bandwidth stops growing
+			if (m_btl_bw >= m_full_bw * 1.25f) {
+				m_full_bw = m_btl_bw;
+				m_full_bw_rounds = 0;
+			} else if (!app_limited && ++m_full_bw_rounds >= 3) {
+				m_mode = Drain;
+			}
+			break;
+		case ProbeRTT:
+			break;
+		case Drain:
+			// Until the queue built up during startup is gone
+			if (in_flight <= getBdp()) {
+				m_mode = ProbeBW;
+				m_cycle_index = 0;
+			}
+			break;
+		case ProbeBW:
+			// Stay in the draining phase until the probing queue is gone
+			if (PROBE_GAINS[m_cycle_index] < 1 && in_flight > getBdp() &&
+					!m_drain_extended) {
+				m_drain_extended = true;
+				break;
+			}
+			m_drain_extended = false;
+			m_cycle_index = (m_cycle_index + 1) % ARRLEN(PROBE_GAINS);
+			break;
+		}
+	}
+
+	u32 getWindow() const override
+	{
+		if (m_mode == ProbeRTT)
+			return MIN_RELIABLE_WINDOW_SIZE;
+		if (m_btl_bw <= 0 || m_min_rtt <= 0)
+			return START_RELIABLE_WINDOW_SIZE;
+		const float gain = m_mode == Startup ? HIGH_GAIN : CWND_GAIN;
+		// A few more packets for acks that arrive in bunches
+		return clamp_window(gain * getBdp() + 4);
+	}
+
+	float getPacingRate() const override
+	{
+		if (m_btl_bw <= 0)
+			return 0;
+		float gain = 1.0f;
+		switch (m_mode) {
+		case Startup:
+			gain = HIGH_GAIN;
+			break;
+		case Drain:
+			gain = 1.0f / HIGH_GAIN;
+			break;
+		case ProbeBW:
+			gain = PROBE_GAINS[m_cycle_index];
+			break;
+		case ProbeRTT:
+			break;
+		}
+		return gain * m_btl_bw;
+	}
+
+	const char *getName() const override { return "bbr"; }
+
+private:
+	static constexpr float HIGH_GAIN = 2.885f; // 2/ln(2)
+	static constexpr float CWND_GAIN = 2.0f;
+	static constexpr float PROBE_GAINS[8] = {1.25f, 0.75f, 1, 1, 1, 1, 1, 1};
+	static constexpr float MIN_RTT_WINDOW = 10.0f;
+	static constexpr float PROBE_RTT_TIME = 0.2f;
+	static constexpr float MIN_ROUND = 0.02f;
+	static constexpr float DEFAULT_RTT = 0.1f;
+	static constexpr int BW_WINDOW_ROUNDS = 10;
+
+	enum Mode {
+		Startup,
+		Drain,
+		ProbeBW,
+		ProbeRTT,
+	};
+
+	float getBdp() const { return m_btl_bw * m_min_rtt; }
+
+	Mode m_mode = Startup;
+	double m_time = 0;
+
+	float m_min_rtt = -1;
+	double m_min_rtt_stamp = 0;
+	float m_probe_rtt_min = -1;
+	double m_probe_rtt_end = 0;
+
+	// Packets per second
+	float m_bw_samples[BW_WINDOW_ROUNDS] = {};
+	int m_bw_index = 0;
+	float m_btl_bw = 0;
+
+	u32 m_delivered = 0;
+	float m_round_time = 0;
+	u32 m_round_max_in_flight = 0;
+
+	float m_full_bw = 0;
+	int m_full_bw_rounds = 0;
+	u32 m_cycle_index = 0;
+	bool m_drain_extended = false;
+};
+
+std::unique_ptr<CongestionControl> CongestionControl::create(const std::string &name)
+{
+	if (name == "cubic")
+		return std::make_unique<CubicCongestion>();
+	if (name == "bbr")
+		return std::make_unique<BbrCongestion>();
+	if (name == "legacy")
+		return std::make_unique<LegacyCongestion>();
+	return nullptr;
+}
+
+}
@@ -0,0 +1,46 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+/********************************************/
+/* may only be included from in src/network */
+/********************************************/
+
+#include <memory>
+#include <string>
+#include "irrlichttypes.h"
+
+namespace con
+{
+
+/*
+	Decides how many reliable packets of a channel may be unacknowledged
+	at once, and how fast new ones may be sent.
+
+	All times are in seconds. Calls are serialized by the channel.
+*/
+class CongestionControl
+{
+public:
+	virtual ~CongestionControl() = default;
+
+	// A reliable packet was acknowledged. `rtt` is negative if unknown.
+	virtual void onAck(float rtt, u32 bytes) = 0;
+	// `count` reliable packets timed out and are being resent
+	virtual void onLoss(u32 count) = 0;
+	// Called regularly, `in_flight` is the number of unacknowledged packets
+	virtual void step(float dtime, u32 in_flight) = 0;
+
+	// Maximum number of unacknowledged reliable packets
+	virtual u32 getWindow() const = 0;
+	// New reliable packets per second, 0 if sending isn't paced
+	virtual float getPacingRate() const { return 0; }
+
+	virtual const char *getName() const = 0;
+
+	// Known names are "legacy", "cubic" and "bbr", returns null otherwise
+	static std::unique_ptr<CongestionControl> create(const std::string &name);
+};
+
+}
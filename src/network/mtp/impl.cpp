@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <algorithm>
 #include <cmath>
 #include "network/mtp/internal.h"
+#include "network/mtp/congestion.h"
 #include "serialization.h"
 #include "log.h"
 #include "porting.h"
@@ -73,7 +74,8 @@ BufferedPacketPtr makePacket(const Address &address, const SharedBuffer<u8> &dat
 {
 	u32 packet_size = data.getSize() + BASE_HEADER_SIZE;
 
-	auto p = std::make_shared<BufferedPacket>(packet_size);
+	auto p = std::allocate_shared<BufferedPacket>(PoolAllocator<BufferedPacket>(),
+		packet_size);
 	p->address = address;
 
 	writeU32(&p->data[0], protocol_id);
@@ -85,167 +87,288 @@ BufferedPacketPtr makePacket(const Address &address, const SharedBuffer<u8> &dat
 	return p;
 }
 
-SharedBuffer<u8> makeOriginalPacket(const SharedBuffer<u8> &data)
+BufferedPacketPtr makePacket(const Address &address, OutgoingChunk chunk,
+		u32 protocol_id, session_t sender_peer_id, u8 channel)
 {
-	u32 header_size = 1;
-	u32 packet_size = data.getSize() + header_size;
-	SharedBuffer<u8> b(packet_size);
+	u8 *header = chunk.prepend(BASE_HEADER_SIZE);
+	writeU32(&header[0], protocol_id);
+	writeU16(&header[4], sender_peer_id);
+	writeU8(&header[6], channel);
 
-	writeU8(&(b[0]), PACKET_TYPE_ORIGINAL);
-	if (data.getSize() > 0) {
-		memcpy(&(b[header_size]), *data, data.getSize());
-	}
-	return b;
+	auto p = std::allocate_shared<BufferedPacket>(PoolAllocator<BufferedPacket>(),
+		chunk);
+	p->address = address;
+	return p;
 }
 
-// Split data in chunks and add TYPE_SPLIT headers to them
-void makeSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max, u16 seqnum,
-		std::list<SharedBuffer<u8>> *chunks)
+void makeAutoSplitPacket(const PacketData &data, u32 chunksize_max,
+		u16 &split_seqnum, std::list<OutgoingChunk> *list)
 {
-	// Chunk packets, containing the TYPE_SPLIT header
-	const u32 chunk_header_size = 7;
-	const u32 maximum_data_size = chunksize_max - chunk_header_size;
-	u32 start = 0, end = 0;
-	u16 chunk_num = 0;
-	do {
-		end = start + maximum_data_size - 1;
-		if (end > data.getSize() - 1)
-			end = data.getSize() - 1;
+	if (data.size() + ORIGINAL_HEADER_SIZE <= chunksize_max) {
+		OutgoingChunk &original = list->emplace_back(data);
+		writeU8(original.prepend(ORIGINAL_HEADER_SIZE), PACKET_TYPE_ORIGINAL);
+		return;
+	}
 
-		u32 payload_size = end - start + 1;
-		u32 packet_size = chunk_header_size + payload_size;
+	// The chunks are slices of the data, with TYPE_SPLIT headers
+	const u32 maximum_data_size = chunksize_max - SPLIT_HEADER_SIZE;
+	const u32 chunk_count = (data.size() + maximum_data_size - 1) / maximum_data_size;
+	sanity_check(chunk_count <= 0xFFFF); // overflow
 
-		SharedBuffer<u8> chunk(packet_size);
+	for (u32 chunk_num = 0; chunk_num < chunk_count; chunk_num++) {
+		const u32 start = chunk_num * maximum_data_size;
+		const u32 payload_size = MYMIN(maximum_data_size, data.size() - start);
 
-		writeU8(&chunk[0], PACKET_TYPE_SPLIT);
-		writeU16(&chunk[1], seqnum);
-		// [3] u16 chunk_count is written at next stage
-		writeU16(&chunk[5], chunk_num);
-		memcpy(&chunk[chunk_header_size], &data[start], payload_size);
+		OutgoingChunk &chunk = list->emplace_back(data.slice(start, payload_size));
+		u8 *header = chunk.prepend(SPLIT_HEADER_SIZE);
+		writeU8(&header[0], PACKET_TYPE_SPLIT);
+		writeU16(&header[1], split_seqnum);
+		writeU16(&header[3], chunk_count);
+		writeU16(&header[5], chunk_num);
+	}
+	split_seqnum++;
+}
 
-		chunks->push_back(chunk);
+void makeReliablePacket(OutgoingChunk &chunk, u16 seqnum)
+{
+	u8 *header = chunk.prepend(RELIABLE_HEADER_SIZE);
+	writeU8(&header[0], PACKET_TYPE_RELIABLE);
+	writeU16(&header[1], seqnum);
+}
 
-		start = end + 1;
-		sanity_check(chunk_num < 0xFFFF); // overflow
-		chunk_num++;
-	}
-	while (end != data.getSize() - 1);
+/*
+	PacketData
+*/
 
-	for (auto &chunk : *chunks) {
-		// Write chunk_count
-		writeU16(&chunk[3], chunk_num);
+PacketData::PacketData(Buffer<u8> &&buffer) :
+	m_size(buffer.getSize())
+{
+	if (m_size > 0) {
+		auto holder = std::allocate_shared<Buffer<u8>>(PoolAllocator<Buffer<u8>>(),
+			std::move(buffer));
+		m_buffer = std::shared_ptr<const u8>(holder, **holder);
 	}
 }
 
-void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
-		u16 &split_seqnum, std::list<SharedBuffer<u8>> *list)
+PacketData::PacketData(const u8 *data, u32 size)
 {
-	u32 original_header_size = 1;
+	if (size > 0)
+		memcpy(allocate(size), data, size);
+}
 
-	if (data.getSize() + original_header_size > chunksize_max) {
-		makeSplitPacket(data, chunksize_max, split_seqnum, list);
-		split_seqnum++;
+PacketData::PacketData(const NetworkPacket &pkt)
+{
+	// this is the dummy packet used to first contact the server
+	if (pkt.getCommand() == 0) {
+		assert(pkt.getSize() == 0);
 		return;
 	}
 
-	list->push_back(makeOriginalPacket(data));
+	u8 *data = allocate(pkt.getSize() + 2);
+	writeU16(data, pkt.getCommand());
+	if (pkt.getSize() > 0)
+		memcpy(data + 2, pkt.getString(0), pkt.getSize());
 }
 
-SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum)
+u8 *PacketData::allocate(u32 size)
 {
-	u32 header_size = 3;
-	u32 packet_size = data.getSize() + header_size;
-	SharedBuffer<u8> b(packet_size);
+	u8 *data = static_cast<u8 *>(poolAllocate(size));
+	// The control block comes from the pool too
+	m_buffer = std::shared_ptr<const u8>(data,
+		[size] (const u8 *data) { poolFree((void *)data, size); },
+		PoolAllocator<u8>());
+	m_offset = 0;
+	m_size = size;
+	return data;
+}
 
-	writeU8(&b[0], PACKET_TYPE_RELIABLE);
-	writeU16(&b[1], seqnum);
+PacketData PacketData::slice(u32 offset, u32 size) const
+{
+	assert(offset + size <= m_size);
+	PacketData ret;
+	ret.m_buffer = m_buffer;
+	ret.m_offset = m_offset + offset;
+	ret.m_size = size;
+	return ret;
+}
 
-	memcpy(&b[header_size], *data, data.getSize());
+/*
+	OutgoingChunk
+*/
+
+OutgoingChunk OutgoingChunk::copy(const u8 *data, u32 size)
+{
+	// There must still be room for the base and reliable headers
+	if (size + BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE > PACKET_HEADER_ROOM)
+		return OutgoingChunk(PacketData(data, size));
+
+	OutgoingChunk chunk;
+	if (size > 0)
+		memcpy(chunk.prepend(size), data, size);
+	return chunk;
+}
 
-	return b;
+u8 *OutgoingChunk::prepend(u32 size)
+{
+	FATAL_ERROR_IF(size > m_headers_start, "No room for packet headers");
+	m_headers_start -= size;
+	return m_headers + m_headers_start;
 }
 
 /*
 	ReliablePacketBuffer
 */
 
+// Initial size of the ring
+#define RELIABLE_RING_MIN_SIZE 64
+
 void ReliablePacketBuffer::print()
 {
 	MutexAutoLock listlock(m_list_mutex);
 	LOG(dout_con<<"Dump of ReliablePacketBuffer:" << std::endl);
+	if (m_count == 0)
+		return;
 	unsigned int index = 0;
-	for (BufferedPacketPtr &packet : m_list) {
-		LOG(dout_con<<index<< ":" << packet->getSeqnum() << std::endl);
-		index++;
+	for (u16 s = m_first; ; s++) {
+		if (findSlotNoLock(s)) {
+			LOG(dout_con<<index<< ":" << s << std::endl);
+			index++;
+		}
+		if (s == m_last)
+			break;
 	}
 }
 
 bool ReliablePacketBuffer::empty()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	return m_list.empty();
+	return m_count == 0;
 }
 
 u32 ReliablePacketBuffer::size()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	return m_list.size();
+	return m_count;
 }
 
-ReliablePacketBuffer::FindResult ReliablePacketBuffer::findPacketNoLock(u16 seqnum)
+ReliablePacketBuffer::Slot *ReliablePacketBuffer::findSlotNoLock(u16 seqnum)
 {
-	for (auto it = m_list.begin(); it != m_list.end(); ++it) {
-		if ((*it)->getSeqnum() == seqnum)
-			return it;
+	if (m_slots.empty())
+		return nullptr;
+	Slot &slot = m_slots[seqnum & (m_slots.size() - 1)];
+	if (!slot.packet || slot.seqnum != seqnum)
+		return nullptr;
+	return &slot;
+}
+
+BufferedPacketPtr ReliablePacketBuffer::removeNoLock(Slot &slot)
+{
+	BufferedPacketPtr p = std::move(slot.packet);
+	const u16 seqnum = slot.seqnum;
+	m_count--;
+
+	// Users of the packet expect the timers in it
+	p->time = m_time - slot.sent_at;
+	p->totaltime = m_time - slot.buffered_at;
+
+	if (m_count == 0) {
+		// Nothing can be left in the timers that is still valid
+		m_buffered.clear();
+		for (auto &queue : m_resend_wheel)
+			queue.clear();
+		m_timer_entries = 0;
+		return p;
+	}
+
+	// Seqnums in the buffer span less than the size of the ring, so the
+	// next free slot in either direction is never searched for long
+	const size_t mask = m_slots.size() - 1;
+	if (seqnum == m_first) {
+		do
+			m_first++;
+		while (!m_slots[m_first & mask].packet);
+	} else if (seqnum == m_last) {
+		do
+			m_last--;
+		while (!m_slots[m_last & mask].packet);
+	}
+	return p;
+}
+
+void ReliablePacketBuffer::growNoLock(u32 span)
+{
+	size_t new_size = std::max<size_t>(m_slots.size(), RELIABLE_RING_MIN_SIZE);
+	while (new_size < span)
+		new_size *= 2;
+	if (new_size == m_slots.size())
+		return;
+
+	std::vector<Slot> slots(new_size);
+	for (Slot &slot : m_slots) {
+		if (slot.packet)
+			slots[slot.seqnum & (new_size - 1)] = std::move(slot);
+	}
+	m_slots = std::move(slots);
+}
+
+bool ReliablePacketBuffer::isBufferedNoLock(const TimerEntry &e)
+{
+	Slot *slot = findSlotNoLock(e.seqnum);
+	return slot && slot->buffered_at == e.time;
+}
+
+bool ReliablePacketBuffer::isWaitingNoLock(const TimerEntry &e, u32 resend_count)
+{
+	Slot *slot = findSlotNoLock(e.seqnum);
+	return slot && slot->sent_at == e.time &&
+		slot->packet->resend_count == resend_count;
+}
+
+void ReliablePacketBuffer::compactTimersNoLock()
+{
+	auto compact = [] (std::deque<TimerEntry> &queue, auto keep) {
+		queue.erase(std::remove_if(queue.begin(), queue.end(),
+			[&] (const TimerEntry &e) { return !keep(e); }), queue.end());
+		return queue.size();
+	};
+
+	m_timer_entries = compact(m_buffered,
+		[this] (const TimerEntry &e) { return isBufferedNoLock(e); });
+	for (u32 i = 0; i < m_resend_wheel.size(); i++) {
+		m_timer_entries += compact(m_resend_wheel[i],
+			[this, i] (const TimerEntry &e) { return isWaitingNoLock(e, i); });
 	}
-	return m_list.end();
 }
 
 bool ReliablePacketBuffer::getFirstSeqnum(u16& result)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	if (m_list.empty())
+	if (m_count == 0)
 		return false;
-	result = m_list.front()->getSeqnum();
+	result = m_first;
 	return true;
 }
 
 BufferedPacketPtr ReliablePacketBuffer::popFirst()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	if (m_list.empty())
+	if (m_count == 0)
 		throw NotFoundException("Buffer is empty");
 
-	BufferedPacketPtr p(m_list.front());
-	m_list.pop_front();
-
-	if (m_list.empty()) {
-		m_oldest_non_answered_ack = 0;
-	} else {
-		m_oldest_non_answered_ack = m_list.front()->getSeqnum();
-	}
-	return p;
+	return removeNoLock(*findSlotNoLock(m_first));
 }
 
 BufferedPacketPtr ReliablePacketBuffer::popSeqnum(u16 seqnum)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	auto r = findPacketNoLock(seqnum);
-	if (r == m_list.end()) {
+	Slot *slot = findSlotNoLock(seqnum);
+	if (!slot) {
 		LOG(dout_con<<"Sequence number: " << seqnum
 				<< " not found in reliable buffer"<<std::endl);
 		throw NotFoundException("seqnum not found in buffer");
 	}
 
-	BufferedPacketPtr p(*r);
-	m_list.erase(r);
-
-	if (m_list.empty()) {
-		m_oldest_non_answered_ack = 0;
-	} else {
-		m_oldest_non_answered_ack = m_list.front()->getSeqnum();
-	}
-	return p;
+	return removeNoLock(*slot);
 }
 
 void ReliablePacketBuffer::insert(BufferedPacketPtr &p_ptr, u16 next_expected)
@@ -277,47 +400,11 @@ void ReliablePacketBuffer::insert(BufferedPacketPtr &p_ptr, u16 next_expected)
 		return;
 	}
 
-	sanity_check(m_list.size() <= SEQNUM_MAX); // FIXME: Handle the error?
-
-	// Find the right place for the packet and insert it there
-	// If list is empty, just add it
-	if (m_list.empty()) {
-		m_list.push_back(p_ptr);
-		m_oldest_non_answered_ack = seqnum;
-		// Done.
-		return;
-	}
-
-	// Otherwise find the right place
-	auto it = m_list.begin();
-	// Find the first packet in the list which has a higher seqnum
-	u16 s = (*it)->getSeqnum();
-
-	/* case seqnum is smaller then next_expected seqnum */
-	/* this is true e.g. on wrap around */
-	if (seqnum < next_expected) {
-		while(((s < seqnum) || (s >= next_expected)) && (it != m_list.end())) {
-			++it;
-			if (it != m_list.end())
-				s = (*it)->getSeqnum();
-		}
-	}
-	/* non wrap around case (at least for incoming and next_expected */
-	else
-	{
-		while(((s < seqnum) && (s >= next_expected)) && (it != m_list.end())) {
-			++it;
-			if (it != m_list.end())
-				s = (*it)->getSeqnum();
-		}
-	}
-
-	if (s == seqnum) {
+	if (Slot *slot = findSlotNoLock(seqnum)) {
 		/* nothing to do this seems to be a resent packet */
 		/* for paranoia reason data should be compared */
-		auto &i = *it;
+		auto &i = slot->packet;
 		if (
-			(i->getSeqnum() != seqnum) ||
 			(i->size() != p.size()) ||
 			(i->address != p.address)
 			)
@@ -340,33 +427,68 @@ void ReliablePacketBuffer::insert(BufferedPacketPtr &p_ptr, u16 next_expected)
 			warningstream << buf << std::flush;
 			throw IncomingDataCorruption("duplicated packet isn't same as original one");
 		}
+		return;
 	}
-	/* insert or push back */
-	else if (it != m_list.end()) {
-		m_list.insert(it, p_ptr);
-	} else {
-		m_list.push_back(p_ptr);
+
+	// Find the new first and last packet
+	u16 first = seqnum, last = seqnum;
+	if (m_count > 0) {
+		first = m_first;
+		last = m_last;
+		if ((u16)(seqnum - first) >= MAX_RELIABLE_WINDOW_SIZE)
+			first = seqnum;
+		else if ((u16)(seqnum - first) > (u16)(last - first))
+			last = seqnum;
 	}
 
-	/* update last packet number */
-	m_oldest_non_answered_ack = m_list.front()->getSeqnum();
+	const u32 span = (u16)(last - first) + 1;
+	if (span > MAX_RELIABLE_WINDOW_SIZE) {
+		errorstream << "ReliablePacketBuffer::insert(): too many packets "
+			"in flight" << std::endl;
+		return;
+	}
+	growNoLock(span);
+	m_first = first;
+	m_last = last;
+
+	Slot &slot = m_slots[seqnum & (m_slots.size() - 1)];
+	sanity_check(!slot.packet);
+	slot.packet = p_ptr;
+	slot.seqnum = seqnum;
+	slot.buffered_at = m_time;
+	slot.sent_at = m_time;
+	m_count++;
+
+	m_buffered.push_back({seqnum, m_time});
+	if (m_resend_wheel.size() <= p.resend_count)
+		m_resend_wheel.resize(p.resend_count + 1);
+	m_resend_wheel[p.resend_count].push_back({seqnum, m_time});
+	m_timer_entries += 2;
+
+	// Buffers that are never asked for timeouts have to be cleaned here
+	if (m_timer_entries > 4 * m_count + 64)
+		compactTimersNoLock();
 }
 
 void ReliablePacketBuffer::incrementTimeouts(float dtime)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	for (auto &packet : m_list) {
-		packet->time += dtime;
-		packet->totaltime += dtime;
-	}
+	m_time += dtime;
 }
 
 u32 ReliablePacketBuffer::getTimedOuts(float timeout)
 {
 	MutexAutoLock listlock(m_list_mutex);
+	while (!m_buffered.empty() && !isBufferedNoLock(m_buffered.front())) {
+		m_buffered.pop_front();
+		m_timer_entries--;
+	}
+
 	u32 count = 0;
-	for (auto &packet : m_list) {
-		if (packet->totaltime >= timeout)
+	for (const TimerEntry &e : m_buffered) {
+		if (m_time - e.time < timeout)
+			break;
+		if (isBufferedNoLock(e))
 			count++;
 	}
 	return count;
@@ -377,21 +499,41 @@ std::vector<ConstSharedPtr<BufferedPacket>>
 {
 	MutexAutoLock listlock(m_list_mutex);
 	std::vector<ConstSharedPtr<BufferedPacket>> timed_outs;
-	for (auto &packet : m_list) {
-		// resend time scales exponentially with each cycle
-		const float pkt_timeout = timeout * powf(RESEND_SCALE_BASE, packet->resend_count);
+	if (m_count == 0)
+		return timed_outs;
 
-		if (packet->time < pkt_timeout)
-			continue;
+	// Room for the packets moving up
+	if (m_resend_wheel.empty() || !m_resend_wheel.back().empty())
+		m_resend_wheel.emplace_back();
+
+	// The packets that have waited longest go first
+	for (u32 k = m_resend_wheel.size() - 1; k-- > 0; ) {
+		// resend time scales exponentially with each cycle
+		const float pkt_timeout = timeout * powf(RESEND_SCALE_BASE, k);
+
+		auto &queue = m_resend_wheel[k];
+		while (!queue.empty()) {
+			const TimerEntry e = queue.front();
+			if (!isWaitingNoLock(e, k)) {
+				queue.pop_front();
+				m_timer_entries--;
+				continue;
+			}
+			if (m_time - e.time < pkt_timeout)
+				break;
 
-		// caller will resend packet so reset time and increase counter
-		packet->time = 0.0f;
-		packet->resend_count++;
+			// caller will resend packet so reset time and increase counter
+			queue.pop_front();
+			Slot *slot = findSlotNoLock(e.seqnum);
+			slot->sent_at = m_time;
+			slot->packet->resend_count++;
+			m_resend_wheel[k + 1].push_back({e.seqnum, m_time});
 
-		timed_outs.emplace_back(packet);
+			timed_outs.emplace_back(slot->packet);
 
-		if (timed_outs.size() >= max_packets)
-			break;
+			if (timed_outs.size() >= max_packets)
+				return timed_outs;
+		}
 	}
 	return timed_outs;
 }
@@ -591,7 +733,7 @@ ConnectionCommandPtr ConnectionCommand::send(session_t peer_id, u8 channelnum,
 	c->peer_id = peer_id;
 	c->channelnum = channelnum;
 	c->reliable = reliable;
-	c->data = pkt->oldForgePacket();
+	c->data = PacketData(*pkt);
 	return c;
 }
 
@@ -601,7 +743,7 @@ ConnectionCommandPtr ConnectionCommand::ack(session_t peer_id, u8 channelnum, co
 	c->peer_id = peer_id;
 	c->channelnum = channelnum;
 	c->reliable = false;
-	data.copyTo(c->data);
+	c->data = PacketData(*data, data.getSize());
 	return c;
 }
 
@@ -612,7 +754,7 @@ ConnectionCommandPtr ConnectionCommand::createPeer(session_t peer_id, const Buff
 	c->channelnum = 0;
 	c->reliable = true;
 	c->raw = true;
-	data.copyTo(c->data);
+	c->data = PacketData(*data, data.getSize());
 	return c;
 }
 
@@ -620,6 +762,18 @@ ConnectionCommandPtr ConnectionCommand::createPeer(session_t peer_id, const Buff
 	Channel
 */
 
+Channel::Channel() :
+	m_congestion(CongestionControl::create("legacy"))
+{
+}
+
+void Channel::setCongestionControl(std::unique_ptr<CongestionControl> congestion)
+{
+	MutexAutoLock internal(m_internal_mutex);
+	m_congestion = std::move(congestion);
+	updateCongestionNoLock();
+}
+
 u16 Channel::readNextIncomingSeqNum()
 {
 	MutexAutoLock internal(m_internal_mutex);
@@ -723,6 +877,10 @@ void Channel::UpdatePacketLossCounter(unsigned int count)
 {
 	MutexAutoLock internal(m_internal_mutex);
 	current_packet_loss += count;
+	if (count > 0) {
+		m_congestion->onLoss(count);
+		updateCongestionNoLock();
+	}
 }
 
 void Channel::UpdatePacketTooLateCounter()
@@ -731,62 +889,84 @@ void Channel::UpdatePacketTooLateCounter()
 	current_packet_too_late++;
 }
 
-void Channel::UpdateTimers(float dtime)
+void Channel::UpdateAck(float rtt, unsigned int bytes)
 {
-	bpm_counter += dtime;
-	packet_loss_counter += dtime;
+	MutexAutoLock internal(m_internal_mutex);
+	m_congestion->onAck(rtt, bytes);
+	updateCongestionNoLock();
+}
 
-	if (packet_loss_counter > 1.0f) {
-		packet_loss_counter -= 1.0f;
+// Pacing may send this many seconds worth of packets at once
+#define PACING_BURST_TIME 0.005f
+#define PACING_BURST_MIN 8.0f
 
-		unsigned int packet_loss = 11; /* use a neutral value for initialization */
-		unsigned int packets_successful = 0;
-		//unsigned int packet_too_late = 0;
+void Channel::refillPacingNoLock()
+{
+	const u64 now = porting::getTimeUs();
+	const float dtime = (now - m_pacing_last_us) / 1e6f;
+	m_pacing_last_us = now;
 
-		bool reasonable_amount_of_data_transmitted = false;
+	const float burst = MYMAX(PACING_BURST_MIN, m_pacing_rate * PACING_BURST_TIME);
+	m_pacing_tokens = MYMIN(m_pacing_tokens + m_pacing_rate * dtime, burst);
+}
 
-		{
-			MutexAutoLock internal(m_internal_mutex);
-			packet_loss = current_packet_loss;
-			//packet_too_late = current_packet_too_late;
-			packets_successful = current_packet_successful;
+bool Channel::takePacingToken()
+{
+	MutexAutoLock internal(m_internal_mutex);
+	if (m_pacing_rate <= 0)
+		return true;
+	refillPacingNoLock();
+	if (m_pacing_tokens < 1.0f)
+		return false;
+	m_pacing_tokens -= 1.0f;
+	return true;
+}
 
-			if (current_bytes_transfered > (unsigned int) (m_window_size*512/2)) {
-				reasonable_amount_of_data_transmitted = true;
-			}
-			current_packet_loss = 0;
-			current_packet_too_late = 0;
-			current_packet_successful = 0;
-		}
+float Channel::getPacingDelay()
+{
+	MutexAutoLock internal(m_internal_mutex);
+	if (m_pacing_rate <= 0)
+		return 0;
+	refillPacingNoLock();
+	if (m_pacing_tokens >= 1.0f)
+		return 0;
+	return (1.0f - m_pacing_tokens) / m_pacing_rate;
+}
 
-		/* dynamic window size */
-		float successful_to_lost_ratio = 0.0f;
-		bool done = false;
+void Channel::updateCongestionNoLock()
+{
+	m_window_size = m_congestion->getWindow();
+	const float rate = m_congestion->getPacingRate();
+	if (rate > 0 && m_pacing_rate <= 0) {
+		// Starts with a full burst
+		m_pacing_last_us = porting::getTimeUs();
+		m_pacing_tokens = MYMAX(PACING_BURST_MIN, rate * PACING_BURST_TIME);
+	}
+	m_pacing_rate = rate;
+}
 
-		if (packets_successful > 0) {
-			successful_to_lost_ratio = packet_loss/packets_successful;
-		} else if (packet_loss > 0) {
-			setWindowSize(m_window_size - 10);
-			done = true;
-		}
+void Channel::UpdateTimers(float dtime)
+{
+	const u32 in_flight = outgoing_reliables_sent.size();
 
-		if (!done) {
-			if (successful_to_lost_ratio < 0.01f) {
-				/* don't even think about increasing if we didn't even
-				 * use major parts of our window */
-				if (reasonable_amount_of_data_transmitted)
-					setWindowSize(m_window_size + 100);
-			} else if (successful_to_lost_ratio < 0.05f) {
-				/* don't even think about increasing if we didn't even
-				 * use major parts of our window */
-				if (reasonable_amount_of_data_transmitted)
-					setWindowSize(m_window_size + 50);
-			} else if (successful_to_lost_ratio > 0.15f) {
-				setWindowSize(m_window_size - 100);
-			} else if (successful_to_lost_ratio > 0.1f) {
-				setWindowSize(m_window_size - 50);
-			}
-		}
+	{
+		MutexAutoLock internal(m_internal_mutex);
+		m_congestion->step(dtime, in_flight);
+		updateCongestionNoLock();
+	}
+
+	bpm_counter += dtime;
+	packet_loss_counter += dtime;
+
+	if (packet_loss_counter > 1.0f) {
+		packet_loss_counter -= 1.0f;
+
+		MutexAutoLock internal(m_internal_mutex);
+		const unsigned int total = current_packet_loss + current_packet_successful;
+		m_packet_loss_ratio = total > 0 ? (float)current_packet_loss / total : 0.0f;
+		current_packet_loss = 0;
+		current_packet_too_late = 0;
+		current_packet_successful = 0;
 	}
 
 	if (bpm_counter > 10.0f) {
@@ -965,8 +1145,10 @@ void Peer::Drop()
 UDPPeer::UDPPeer(session_t id, const Address &address, Connection *connection) :
 	Peer(id, address, connection)
 {
-	for (Channel &channel : channels)
-		channel.setWindowSize(START_RELIABLE_WINDOW_SIZE);
+	for (Channel &channel : channels) {
+		channel.setCongestionControl(
+			CongestionControl::create(connection->getCongestionControl()));
+	}
 }
 
 bool UDPPeer::isTimedOut(float timeout, std::string &reason)
@@ -987,6 +1169,26 @@ bool UDPPeer::isTimedOut(float timeout, std::string &reason)
 	return false;
 }
 
+float UDPPeer::getStat(rtt_stat_type type) const
+{
+	switch (type) {
+		case CWND: {
+			float window = 0;
+			for (const Channel &channel : channels)
+				window += channel.getWindowSize();
+			return window;
+		}
+		case PACKET_LOSS: {
+			float loss = 0;
+			for (const Channel &channel : channels)
+				loss = MYMAX(loss, channel.getPacketLoss());
+			return loss;
+		}
+		default:
+			return Peer::getStat(type);
+	}
+}
+
 void UDPPeer::reportRTT(float rtt)
 {
 	if (rtt < 0.0) {
@@ -1031,13 +1233,13 @@ void UDPPeer::PutReliableSendCommand(ConnectionCommandPtr &c,
 			(chan.queued_reliables.size() + 1 < chan.getWindowSize() / 2)) {
 		LOG(dout_con<<m_connection->getDesc()
 				<<" processing reliable command for peer id: " << c->peer_id
-				<<" data size: " << c->data.getSize() << std::endl);
+				<<" data size: " << c->data.size() << std::endl);
 		if (processReliableSendCommand(c, max_packet_size))
 			return;
 	} else {
 		LOG(dout_con<<m_connection->getDesc()
 				<<" Queueing reliable command for peer id: " << c->peer_id
-				<<" data size: " << c->data.getSize() <<std::endl);
+				<<" data size: " << c->data.size() <<std::endl);
 
 		if (chan.queued_commands.size() + 1 >= chan.getWindowSize() / 2) {
 			LOG(derr_con << m_connection->getDesc()
@@ -1063,7 +1265,7 @@ bool UDPPeer::processReliableSendCommand(
 							- BASE_HEADER_SIZE
 							- RELIABLE_HEADER_SIZE;
 
-	std::list<SharedBuffer<u8>> originals;
+	std::list<OutgoingChunk> originals;
 
 	if (c.raw) {
 		originals.emplace_back(c.data);
@@ -1080,7 +1282,7 @@ bool UDPPeer::processReliableSendCommand(
 	std::queue<BufferedPacketPtr> toadd;
 	u16 initial_sequence_number = 0;
 
-	for (SharedBuffer<u8> &original : originals) {
+	for (OutgoingChunk &original : originals) {
 		u16 seqnum = chan.getOutgoingSequenceNumber(have_sequence_number);
 
 		/* oops, we don't have enough sequence numbers to send this packet */
@@ -1093,10 +1295,10 @@ bool UDPPeer::processReliableSendCommand(
 			have_initial_sequence_number = true;
 		}
 
-		SharedBuffer<u8> reliable = makeReliablePacket(original, seqnum);
+		makeReliablePacket(original, seqnum);
 
 		// Add base headers and make a packet
-		BufferedPacketPtr p = con::makePacket(address, reliable,
+		BufferedPacketPtr p = con::makePacket(address, original,
 				m_connection->GetProtocolID(), m_connection->GetPeerID(),
 				c.channelnum);
 
@@ -1140,7 +1342,7 @@ bool UDPPeer::processReliableSendCommand(
 
 	LOG(dout_con<<m_connection->getDesc()
 			<< " Windowsize exceeded on reliable sending "
-			<< c.data.getSize() << " bytes"
+			<< c.data.size() << " bytes"
 			<< std::endl << "\t\tinitial_sequence_number: "
 			<< initial_sequence_number
 			<< std::endl << "\t\tgot at most            : "
@@ -1173,7 +1375,7 @@ void UDPPeer::RunCommandQueues(
 				} else {
 					LOG(dout_con << m_connection->getDesc()
 							<< " Failed to queue packets for peer_id: " << c->peer_id
-							<< ", delaying sending of " << c->data.getSize()
+							<< ", delaying sending of " << c->data.size()
 							<< " bytes" << std::endl);
 				}
 			}
@@ -1277,10 +1479,31 @@ Connection::Connection(u32 max_packet_size, float timeout,
 	 * from the connection timeout */
 	m_udpSocket.setTimeoutMs(500);
 
+	m_congestion_control = g_settings->get("congestion_control");
+	if (!CongestionControl::create(m_congestion_control)) {
+		warningstream << "Unknown congestion_control \"" << m_congestion_control
+			<< "\", using \"legacy\"" << std::endl;
+		m_congestion_control = "legacy";
+	}
+
+	const u32 receive_threads = rangelim(g_settings->getU16("receive_threads"), 1, 16);
+	if (receive_threads > 1) {
+		std::vector<ConnectionReceiveThread *> workers;
+		for (u32 i = 0; i < receive_threads; i++) {
+			auto &worker = m_receiveWorkers.emplace_back(
+				new ConnectionReceiveThread(i, receive_threads));
+			worker->setParent(this);
+			workers.push_back(worker.get());
+		}
+		m_receiveThread->setWorkers(workers);
+	}
+
 	m_sendThread->setParent(this);
 	m_receiveThread->setParent(this);
 
 	m_sendThread->start();
+	for (auto &worker : m_receiveWorkers)
+		worker->start();
 	m_receiveThread->start();
 }
 
@@ -1291,6 +1514,8 @@ Connection::~Connection()
 	// request threads to stop
 	m_sendThread->stop();
 	m_receiveThread->stop();
+	for (auto &worker : m_receiveWorkers)
+		worker->stop();
 
 	//TODO for some unkonwn reason send/receive threads do not exit as they're
 	// supposed to be but wait on peer timeout. To speed up shutdown we reduce
@@ -1300,6 +1525,8 @@ Connection::~Connection()
 	// wait for threads to finish
 	m_sendThread->wait();
 	m_receiveThread->wait();
+	for (auto &worker : m_receiveWorkers)
+		worker->wait();
 
 	// Delete peers
 	for (auto &peer : m_peers) {
@@ -167,6 +167,8 @@ class Peer : public IPeer {
 					return m_rtt.jitter_max;
 				case AVG_JITTER:
 					return m_rtt.jitter_avg;
+				default:
+					break;
 			}
 			return -1;
 		}
@@ -265,6 +267,11 @@ class Connection : public IConnection
 	const std::string getDesc();
 	void DisconnectPeer(session_t peer_id);
 
+	// Name of the congestion control of new peers
+	const std::string &getCongestionControl() const { return m_congestion_control; }
+	// For testing: drop a fraction of the sent packets
+	void setSimulatedPacketLoss(float loss) { m_udpSocket.setSimulatedPacketLoss(loss); }
+
 protected:
 	PeerHelper getPeerNoEx(session_t peer_id);
 	session_t   lookupPeer(const Address& sender);
@@ -312,6 +319,10 @@ class Connection : public IConnection
 
 	std::unique_ptr<ConnectionSendThread> m_sendThread;
 	std::unique_ptr<ConnectionReceiveThread> m_receiveThread;
+	// Process what m_receiveThread receives if there are more receive threads
+	std::vector<std::unique_ptr<ConnectionReceiveThread>> m_receiveWorkers;
+
+	std::string m_congestion_control;
 
 	mutable std::mutex m_info_mutex;
 
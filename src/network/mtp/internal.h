@@ -20,6 +20,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include "network/mtp/impl.h"
+#include "network/mtp/congestion.h"
+#include "network/mtp/pool.h"
+#include <deque>
 
 // Constant that differentiates the protocol from random data and other protocols
 #define PROTOCOL_ID 0x4f457403
@@ -96,6 +99,7 @@ data.
 	[5] u16 chunk_num
 */
 //#define TYPE_SPLIT 2
+#define SPLIT_HEADER_SIZE 7
 
 /*
 RELIABLE: Delivery of all RELIABLE packets shall be forced by ACKs,
@@ -187,23 +191,106 @@ class IncomingDataCorruption : public BaseException
 };
 
 
+/*
+	Outgoing data. It is never changed once made, so copies and slices of it
+	share the memory: the chunks of a split packet, the packets of a
+	CONNCMD_SEND_TO_ALL and the packets waiting for an ACK all point into
+	the same buffer. Unlike SharedBuffer this can be shared between threads.
+	Data that is copied lives in the packet pool.
+*/
+class PacketData
+{
+public:
+	PacketData() = default;
+	// Takes over the buffer, doesn't copy it
+	PacketData(Buffer<u8> &&buffer);
+	// Copies the data
+	PacketData(const u8 *data, u32 size);
+	// Same as NetworkPacket::oldForgePacket()
+	explicit PacketData(const NetworkPacket &pkt);
+
+	const u8 *data() const { return m_buffer ? m_buffer.get() + m_offset : nullptr; }
+	u32 size() const { return m_size; }
+
+	PacketData slice(u32 offset, u32 size) const;
+
+private:
+	// Returns the memory to fill
+	u8 *allocate(u32 size);
+
+	std::shared_ptr<const u8> m_buffer;
+	u32 m_offset = 0;
+	u32 m_size = 0;
+};
+
+// Enough for the base, reliable and split headers, or a whole control packet
+#define PACKET_HEADER_ROOM (BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE + SPLIT_HEADER_SIZE)
+
+/*
+	Outgoing packet that is being made: the headers are written back to
+	front into room that is reserved for them, and are sent together with
+	the data without copying it (see UDPSocket::Datagram).
+*/
+class OutgoingChunk
+{
+public:
+	OutgoingChunk() = default;
+	explicit OutgoingChunk(const PacketData &data) : m_data(data) {}
+	// Small data like control packets is put into the header room
+	static OutgoingChunk copy(const u8 *data, u32 size);
+
+	// Returns the place for `size` more bytes in front of the headers
+	u8 *prepend(u32 size);
+
+	const u8 *getHeaders() const { return m_headers + m_headers_start; }
+	u32 getHeadersSize() const { return PACKET_HEADER_ROOM - m_headers_start; }
+	const PacketData &getData() const { return m_data; }
+	u32 size() const { return getHeadersSize() + m_data.size(); }
+
+private:
+	u8 m_headers[PACKET_HEADER_ROOM];
+	u8 m_headers_start = PACKET_HEADER_ROOM;
+	PacketData m_data;
+};
+
 /*
 	Struct for all kinds of packets. Includes following data:
 		BASE_HEADER
-		u8[] packet data (usually copied from SharedBuffer<u8>)
+		u8[] packet data
+	Received packets are contiguous. Outgoing ones only keep their headers
+	at `data`, which are followed by the data of the chunk on the wire.
 */
 struct BufferedPacket {
 	BufferedPacket(u32 a_size)
 	{
-		m_data.resize(a_size);
-		data = &m_data[0];
+		m_data = static_cast<u8 *>(poolAllocate(a_size));
+		data = m_data;
+		m_headers_size = a_size;
+	}
+
+	BufferedPacket(const OutgoingChunk &chunk) :
+		m_payload(chunk.getData())
+	{
+		m_headers_size = chunk.getHeadersSize();
+		memcpy(m_headers, chunk.getHeaders(), m_headers_size);
+		data = m_headers;
+	}
+
+	~BufferedPacket()
+	{
+		poolFree(m_data, m_headers_size);
 	}
 
 	DISABLE_CLASS_COPY(BufferedPacket)
 
 	u16 getSeqnum() const;
 
-	inline size_t size() const { return m_data.size(); }
+	inline size_t size() const { return m_headers_size + m_payload.size(); }
+
+	// Bytes at `data`, all of them for received packets
+	inline u32 getHeadersSize() const { return m_headers_size; }
+	// What follows the headers of an outgoing packet
+	inline const PacketData &getPayload() const { return m_payload; }
 
 	u8 *data; // Direct memory access
 	float time = 0.0f; // Seconds from buffering the packet or re-sending
@@ -213,21 +300,27 @@ struct BufferedPacket {
 	unsigned int resend_count = 0;
 
 private:
-	std::vector<u8> m_data; // Data of the packet, including headers
+	u8 *m_data = nullptr; // Data of a received packet, including headers
+	u8 m_headers[PACKET_HEADER_ROOM]; // Headers of an outgoing packet
+	u32 m_headers_size = 0;
+	PacketData m_payload;
 };
 
 
 // This adds the base headers to the data and makes a packet out of it
 BufferedPacketPtr makePacket(const Address &address, const SharedBuffer<u8> &data,
 		u32 protocol_id, session_t sender_peer_id, u8 channel);
+// Same for outgoing packets, the data isn't copied
+BufferedPacketPtr makePacket(const Address &address, OutgoingChunk chunk,
+		u32 protocol_id, session_t sender_peer_id, u8 channel);
 
 // Depending on size, make a TYPE_ORIGINAL or TYPE_SPLIT packet
 // Increments split_seqnum if a split packet is made
-void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
-		u16 &split_seqnum, std::list<SharedBuffer<u8>> *list);
+void makeAutoSplitPacket(const PacketData &data, u32 chunksize_max,
+		u16 &split_seqnum, std::list<OutgoingChunk> *list);
 
-// Add the TYPE_RELIABLE header to the data
-SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum);
+// Add the TYPE_RELIABLE header to the chunk
+void makeReliablePacket(OutgoingChunk &chunk, u16 seqnum);
 
 struct IncomingSplitPacket
 {
@@ -255,6 +348,15 @@ struct IncomingSplitPacket
 /*
 	A buffer which stores reliable packets and sorts them internally
 	for fast access to the smallest one.
+
+	Packets are kept in a ring indexed by seqnum, which only needs to be as
+	large as the span of seqnums in it (at most the reliable window size),
+	so lookups and acks are O(1).
+	Instead of updating the timers of all packets, the buffer has its own
+	clock and remembers when each packet was buffered and last sent. Resends
+	are found through a timer wheel with one queue per resend count: all
+	packets in a queue have the same timeout, so the due ones are at the
+	front.
 */
 
 class ReliablePacketBuffer
@@ -277,13 +379,43 @@ class ReliablePacketBuffer
 
 
 private:
-	typedef std::list<BufferedPacketPtr>::iterator FindResult;
-
-	FindResult findPacketNoLock(u16 seqnum);
-
-	std::list<BufferedPacketPtr> m_list;
-
-	u16 m_oldest_non_answered_ack;
+	struct Slot
+	{
+		BufferedPacketPtr packet; // null if free
+		u16 seqnum = 0;
+		double buffered_at = 0; // m_time when inserted
+		double sent_at = 0; // m_time when inserted or last resent
+	};
+
+	// Entry of m_buffered or the timer wheel. Removed packets leave their
+	// entries behind, these are dropped when found or by compactTimersNoLock().
+	struct TimerEntry
+	{
+		u16 seqnum;
+		double time;
+	};
+
+	Slot *findSlotNoLock(u16 seqnum);
+	BufferedPacketPtr removeNoLock(Slot &slot);
+	void growNoLock(u32 span);
+
+	bool isBufferedNoLock(const TimerEntry &e);
+	bool isWaitingNoLock(const TimerEntry &e, u32 resend_count);
+	void compactTimersNoLock();
+
+	// Size is a power of two (or zero before the first insert)
+	std::vector<Slot> m_slots;
+	u32 m_count = 0;
+	// Smallest and largest seqnum in the buffer, if not empty
+	u16 m_first = 0;
+	u16 m_last = 0;
+
+	double m_time = 0;
+	// In order of insertion
+	std::deque<TimerEntry> m_buffered;
+	// Indexed by resend count, in order of sending
+	std::vector<std::deque<TimerEntry>> m_resend_wheel;
+	size_t m_timer_entries = 0;
 
 	std::mutex m_list_mutex;
 };
@@ -332,7 +464,7 @@ struct ConnectionCommand
 	Address address;
 	session_t peer_id = PEER_ID_INEXISTENT;
 	u8 channelnum = 0;
-	Buffer<u8> data;
+	PacketData data;
 	bool reliable = false;
 	bool raw = false;
 
@@ -393,10 +525,14 @@ class Channel
 
 	IncomingSplitBuffer incoming_splits;
 
-	Channel() = default;
+	Channel();
 	~Channel() = default;
 
+	void setCongestionControl(std::unique_ptr<CongestionControl> congestion);
+
 	void UpdatePacketLossCounter(unsigned int count);
+	// A reliable packet was acknowledged, `rtt` is negative if unknown
+	void UpdateAck(float rtt, unsigned int bytes);
 	void UpdatePacketTooLateCounter();
 	void UpdateBytesSent(unsigned int bytes,unsigned int packages=1);
 	void UpdateBytesLost(unsigned int bytes);
@@ -428,14 +564,28 @@ class Channel
 
 	u16 getWindowSize() const { return m_window_size; };
 
-	void setWindowSize(long size)
-	{
-		m_window_size = (u16)rangelim(size, MIN_RELIABLE_WINDOW_SIZE, MAX_RELIABLE_WINDOW_SIZE);
-	}
+	// Fraction of the reliable packets that had to be resent recently
+	float getPacketLoss() const
+		{ MutexAutoLock lock(m_internal_mutex); return m_packet_loss_ratio; };
+
+	// Takes the permission to send a new reliable packet now. Always
+	// succeeds if the congestion control doesn't pace the packets.
+	bool takePacingToken();
+	// Seconds until takePacingToken() succeeds again
+	float getPacingDelay();
 
 private:
-	std::mutex m_internal_mutex;
-	u16 m_window_size = MIN_RELIABLE_WINDOW_SIZE;
+	void updateCongestionNoLock();
+	void refillPacingNoLock();
+
+	mutable std::mutex m_internal_mutex;
+	u16 m_window_size = START_RELIABLE_WINDOW_SIZE;
+
+	std::unique_ptr<CongestionControl> m_congestion;
+	float m_pacing_rate = 0.0f;
+	float m_pacing_tokens = 0.0f;
+	u64 m_pacing_last_us = 0;
+	float m_packet_loss_ratio = 0.0f;
 
 	u16 next_incoming_seqnum = SEQNUM_INITIAL;
 
@@ -492,6 +642,8 @@ class UDPPeer final : public Peer
 
 	bool isTimedOut(float timeout, std::string &reason) override;
 
+	float getStat(rtt_stat_type type) const override;
+
 protected:
 	/*
 		Calculates avg_rtt and resend_timeout.
@@ -0,0 +1,213 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "network/mtp/pool.h"
+#include <atomic>
+#include <mutex>
+#include <new>
+#include "threading/mutex_auto_lock.h"
+
+namespace con
+{
+
+// Control blocks, headers and small packets; packets up to the MTU
+static const size_t CLASS_SIZES[] = {64, 256, 640, 1536};
+#define CLASS_COUNT (sizeof(CLASS_SIZES) / sizeof(CLASS_SIZES[0]))
+
+// Free blocks a thread keeps per class, and how many it exchanges at once
+#define CACHE_MAX 128
+#define BATCH_SIZE 64
+// Free blocks in the depot beyond this go back to the heap
+#define DEPOT_MAX_BYTES (4 * 1024 * 1024)
+// Allocations a thread counts before adding them to the global counts
+#define STATS_BATCH 64
+
+static inline int getSizeClass(size_t size)
+{
+	for (size_t i = 0; i < CLASS_COUNT; i++) {
+		if (size <= CLASS_SIZES[i])
+			return i;
+	}
+	return -1;
+}
+
+namespace {
+
+struct FreeBlock
+{
+	FreeBlock *next;
+};
+
+struct FreeList
+{
+	FreeBlock *head = nullptr;
+	u32 count = 0;
+
+	void push(void *p)
+	{
+		FreeBlock *b = static_cast<FreeBlock *>(p);
+		b->next = head;
+		head = b;
+		count++;
+	}
+
+	void *pop()
+	{
+		FreeBlock *b = head;
+		head = b->next;
+		count--;
+		return b;
+	}
+
+	// Moves up to `n` blocks to the front of `dst`
+	void moveTo(FreeList &dst, u32 n)
+	{
+		while (head && n-- > 0)
+			dst.push(pop());
+	}
+};
+
+struct Depot
+{
+	std::mutex mutex;
+	FreeList lists[CLASS_COUNT];
+};
+
+// Only has trivial members, so it can still be used while the thread ends
+struct ThreadCache
+{
+	FreeList lists[CLASS_COUNT];
+	u32 allocations = 0;
+	u32 heap_allocations = 0;
+	bool registered = false;
+	bool ended = false;
+};
+
+// Gives the free blocks of a thread back when it ends
+struct ThreadCacheOwner
+{
+	~ThreadCacheOwner();
+};
+
+}
+
+static std::atomic<u64> g_allocations(0);
+static std::atomic<u64> g_heap_allocations(0);
+
+static thread_local ThreadCache t_cache;
+
+static Depot &getDepot()
+{
+	// Never destroyed, threads may still free blocks after static destruction
+	static Depot *depot = new Depot();
+	return *depot;
+}
+
+static void publishStats(ThreadCache &cache)
+{
+	g_allocations.fetch_add(cache.allocations, std::memory_order_relaxed);
+	g_heap_allocations.fetch_add(cache.heap_allocations, std::memory_order_relaxed);
+	cache.allocations = 0;
+	cache.heap_allocations = 0;
+}
+
+static void releaseBlocks(FreeList &blocks, int cls)
+{
+	if (!blocks.head)
+		return;
+
+	Depot &depot = getDepot();
+	{
+		MutexAutoLock lock(depot.mutex);
+		FreeList &list = depot.lists[cls];
+		const u32 max_count = DEPOT_MAX_BYTES / CLASS_SIZES[cls];
+		if (list.count < max_count)
+			blocks.moveTo(list, max_count - list.count);
+	}
+	while (blocks.head)
+		::operator delete(blocks.pop());
+}
+
+static inline void registerCache(ThreadCache &cache)
+{
+	if (!cache.registered) {
+		static thread_local ThreadCacheOwner owner;
+		cache.registered = true;
+	}
+}
+
+ThreadCacheOwner::~ThreadCacheOwner()
+{
+	ThreadCache &cache = t_cache;
+	for (size_t cls = 0; cls < CLASS_COUNT; cls++)
+		releaseBlocks(cache.lists[cls], cls);
+	publishStats(cache);
+	cache.ended = true;
+}
+
+void *poolAllocate(size_t size)
+{
+	ThreadCache &cache = t_cache;
+	const int cls = getSizeClass(size);
+
+	void *p = nullptr;
+	if (!cache.ended)
+		registerCache(cache);
+	if (cls >= 0 && !cache.ended) {
+		FreeList &list = cache.lists[cls];
+		if (!list.head) {
+			Depot &depot = getDepot();
+			MutexAutoLock lock(depot.mutex);
+			depot.lists[cls].moveTo(list, BATCH_SIZE);
+		}
+		if (list.head)
+			p = list.pop();
+	}
+	if (!p) {
+		p = ::operator new(cls >= 0 ? CLASS_SIZES[cls] : size);
+		cache.heap_allocations++;
+	}
+
+	if (++cache.allocations >= STATS_BATCH || cache.ended)
+		publishStats(cache);
+	return p;
+}
+
+void poolFree(void *p, size_t size)
+{
+	if (!p)
+		return;
+
+	const int cls = getSizeClass(size);
+	if (cls < 0) {
+		::operator delete(p);
+		return;
+	}
+
+	ThreadCache &cache = t_cache;
+	if (cache.ended) {
+		FreeList blocks;
+		blocks.push(p);
+		releaseBlocks(blocks, cls);
+		return;
+	}
+
+	registerCache(cache);
+	FreeList &list = cache.lists[cls];
+	list.push(p);
+	if (list.count > CACHE_MAX) {
+		FreeList blocks;
+		list.moveTo(blocks, BATCH_SIZE);
+		releaseBlocks(blocks, cls);
+	}
+}
+
+PoolStats takePoolStats()
+{
+	PoolStats stats;
+	stats.allocations = g_allocations.exchange(0, std::memory_order_relaxed);
+	stats.heap_allocations = g_heap_allocations.exchange(0, std::memory_order_relaxed);
+	return stats;
+}
+
+}
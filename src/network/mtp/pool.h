@@ -0,0 +1,66 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+/********************************************/
+/* may only be included from in src/network */
+/********************************************/
+
+#include <cstddef>
+#include "irrlichttypes.h"
+
+namespace con
+{
+
+/*
+	Memory for packets and their data. Blocks up to MTU size are kept in
+	size classes and recycled, mostly without locking: every thread has a
+	small cache of free blocks and exchanges them in batches with a shared
+	depot. A block may be freed by another thread than the one that
+	allocated it, like the send thread making a packet and the receive
+	thread dropping it once it is acknowledged.
+	Bigger blocks come from the heap.
+*/
+
+// The block must be freed with the same size
+void *poolAllocate(size_t size);
+void poolFree(void *p, size_t size);
+
+struct PoolStats
+{
+	u64 allocations = 0;
+	// Allocations that didn't come from a free block
+	u64 heap_allocations = 0;
+};
+
+// Counts since the last call, of all threads. Counts of a thread are only
+// added every few allocations and when the thread ends.
+PoolStats takePoolStats();
+
+// For std::allocate_shared and friends
+template <typename T>
+struct PoolAllocator
+{
+	typedef T value_type;
+
+	PoolAllocator() = default;
+	template <typename U>
+	PoolAllocator(const PoolAllocator<U> &) {}
+
+	T *allocate(size_t n)
+	{
+		return static_cast<T *>(poolAllocate(n * sizeof(T)));
+	}
+	void deallocate(T *p, size_t n)
+	{
+		poolFree(p, n * sizeof(T));
+	}
+
+	template <typename U>
+	bool operator==(const PoolAllocator<U> &) const { return true; }
+	template <typename U>
+	bool operator!=(const PoolAllocator<U> &) const { return false; }
+};
+
+}
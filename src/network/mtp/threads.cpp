@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "network/mtp/threads.h"
+#include <cmath>
 #include "log.h"
 #include "profiler.h"
 #include "settings.h"
@@ -45,6 +46,8 @@ namespace con
 #define LOG(a) a
 
 #define MAX_NEW_PEERS_PER_SEC 30
+// Datagrams waiting for a receive worker
+#define MAX_QUEUED_DATAGRAMS 4096
 
 static inline session_t readPeerId(const u8 *packetdata)
 {
@@ -88,8 +91,11 @@ void *ConnectionSendThread::run()
 		BEGIN_DEBUG_EXCEPTION_HANDLER
 		PROFILE(ScopeProfiler sp(g_profiler, ThreadIdentifier.str(), SPT_AVG));
 
-		/* wait for trigger or timeout */
-		m_send_sleep_semaphore.wait(50);
+		/* wait for trigger or timeout, or until paced packets may be sent */
+		u32 wait_ms = 50;
+		if (m_pacing_delay > 0)
+			wait_ms = rangelim((u32)std::ceil(m_pacing_delay * 1000), 1, wait_ms);
+		m_send_sleep_semaphore.wait(wait_ms);
 
 		/* remove all triggers */
 		while (m_send_sleep_semaphore.wait(0)) {
@@ -129,9 +135,23 @@ void *ConnectionSendThread::run()
 		/* send queued packets */
 		sendPackets(dtime, calculate_quota());
 
+		flushSendBatch();
+
+		/* counts of the packet pool, which is shared by all connections */
+		m_pool_stats_timer += dtime;
+		if (m_pool_stats_timer >= 1.0f) {
+			m_pool_stats_timer = 0.0f;
+			PoolStats stats = takePoolStats();
+			g_profiler->add("Connection: packet allocations [#]", stats.allocations);
+			g_profiler->add("Connection: packet heap allocations [#]",
+				stats.heap_allocations);
+		}
+
 		END_DEBUG_EXCEPTION_HANDLER
 	}
 
+	flushSendBatch();
+
 	PROFILE(g_profiler->remove(ThreadIdentifier.str()));
 	return NULL;
 }
@@ -244,7 +264,7 @@ void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 				m_iteration_packets_avaialble = 0;
 
 			for (const auto &k : timed_outs)
-				resendReliable(channel, k.get(), resend_timeout);
+				resendReliable(channel, k, resend_timeout);
 
 			channel.UpdateTimers(dtime);
 		}
@@ -253,7 +273,8 @@ void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 		if (udpPeer->Ping(dtime, data)) {
 			LOG(dout_con << m_connection->getDesc()
 				<< "Sending ping for peer_id: " << udpPeer->id << std::endl);
-			rawSendAsPacket(udpPeer->id, 0, data, true);
+			rawSendAsPacket(udpPeer->id, 0,
+				OutgoingChunk::copy(*data, data.getSize()), true);
 		}
 
 		udpPeer->RunCommandQueues(m_max_packet_size, m_max_packets_requeued);
@@ -267,9 +288,10 @@ void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 	}
 }
 
-void ConnectionSendThread::resendReliable(Channel &channel, const BufferedPacket *k, float resend_timeout)
+void ConnectionSendThread::resendReliable(Channel &channel,
+	ConstSharedPtr<BufferedPacket> k, float resend_timeout)
 {
-	assert(k);
+	assert(k.get());
 	u8 channelnum = readChannel(k->data);
 	u16 seqnum = k->getSeqnum();
 
@@ -294,19 +316,41 @@ void ConnectionSendThread::resendReliable(Channel &channel, const BufferedPacket
 	// lost or really takes more time to transmit
 }
 
-void ConnectionSendThread::rawSend(const BufferedPacket *p)
+void ConnectionSendThread::rawSend(ConstSharedPtr<BufferedPacket> p)
 {
-	assert(p);
-	try {
-		m_connection->m_udpSocket.Send(p->address, p->data, p->size());
-		LOG(dout_con << m_connection->getDesc()
-			<< " rawSend: " << p->size()
-			<< " bytes sent" << std::endl);
-	} catch (SendFailedException &e) {
+	assert(p.get());
+	m_send_batch.push_back(std::move(p));
+
+	// Without batched I/O there is nothing to gain by waiting
+	if (!UDPSocket::hasBatchedIO() || m_send_batch.size() >= UDP_BATCH_SIZE)
+		flushSendBatch();
+}
+
+void ConnectionSendThread::flushSendBatch()
+{
+	if (m_send_batch.empty())
+		return;
+
+	m_send_datagrams.clear();
+	for (const auto &p : m_send_batch) {
+		// The socket doesn't modify the data
+		const PacketData &payload = p->getPayload();
+		m_send_datagrams.push_back({p->address, const_cast<u8 *>(p->data),
+			(int)p->getHeadersSize(), payload.data(), (int)payload.size()});
+	}
+
+	int sent = m_connection->m_udpSocket.SendMany(m_send_datagrams.data(),
+		m_send_datagrams.size());
+	LOG(dout_con << m_connection->getDesc()
+		<< " rawSend: " << sent << " of " << m_send_batch.size()
+		<< " packets sent" << std::endl);
+	if (sent != (int)m_send_batch.size()) {
 		LOG(derr_con << m_connection->getDesc()
-			<< "Connection::rawSend(): SendFailedException: "
-			<< p->address.serializeString() << std::endl);
+			<< "Connection::rawSend(): failed to send "
+			<< (m_send_batch.size() - sent) << " packets" << std::endl);
 	}
+
+	m_send_batch.clear();
 }
 
 void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *channel)
@@ -325,11 +369,11 @@ void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *c
 	}
 
 	// Send the packet
-	rawSend(p.get());
+	rawSend(p);
 }
 
 bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
-	const SharedBuffer<u8> &data, bool reliable)
+	OutgoingChunk data, bool reliable)
 {
 	PeerHelper peer = m_connection->getPeerNoEx(peer_id);
 	if (!peer) {
@@ -347,10 +391,10 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 		if (!have_seqnum)
 			return false;
 
-		SharedBuffer<u8> reliable = makeReliablePacket(data, seqnum);
+		makeReliablePacket(data, seqnum);
 
 		// Add base headers and make a packet
-		BufferedPacketPtr p = con::makePacket(peer->getAddress(), reliable,
+		BufferedPacketPtr p = con::makePacket(peer->getAddress(), data,
 			m_connection->GetProtocolID(), m_connection->GetPeerID(),
 			channelnum);
 
@@ -378,7 +422,7 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 		channelnum);
 
 	// Send the packet
-	rawSend(p.get());
+	rawSend(p);
 	return true;
 }
 
@@ -407,7 +451,8 @@ void ConnectionSendThread::processReliableCommand(ConnectionCommandPtr &c)
 		case CONCMD_CREATE_PEER:
 			LOG(dout_con << m_connection->getDesc()
 				<< "UDP processing reliable CONCMD_CREATE_PEER" << std::endl);
-			if (!rawSendAsPacket(c->peer_id, c->channelnum, c->data, c->reliable)) {
+			if (!rawSendAsPacket(c->peer_id, c->channelnum,
+					OutgoingChunk(c->data), c->reliable)) {
 				/* put to queue if we couldn't send it immediately */
 				sendReliable(c);
 			}
@@ -425,7 +470,7 @@ void ConnectionSendThread::processReliableCommand(ConnectionCommandPtr &c)
 			auto list = channel.outgoing_reliables_sent.getResend(0, 1);
 
 			if (!list.empty())
-				resendReliable(channel, list.front().get(), -1);
+				resendReliable(channel, list.front(), -1);
 
 			return;
 		}
@@ -486,7 +531,7 @@ void ConnectionSendThread::processNonReliableCommand(ConnectionCommandPtr &c_ptr
 		case CONCMD_ACK:
 			LOG(dout_con << m_connection->getDesc()
 				<< " UDP processing CONCMD_ACK" << std::endl);
-			sendAsPacket(c.peer_id, c.channelnum, c.data, true);
+			sendAsPacket(c.peer_id, c.channelnum, OutgoingChunk(c.data), true);
 			return;
 		case CONCMD_CREATE_PEER:
 		case CONNCMD_RESEND_ONE:
@@ -541,9 +586,8 @@ void ConnectionSendThread::disconnect()
 	LOG(dout_con << m_connection->getDesc() << " disconnecting" << std::endl);
 
 	// Create and send DISCO packet
-	SharedBuffer<u8> data(2);
-	writeU8(&data[0], PACKET_TYPE_CONTROL);
-	writeU8(&data[1], CONTROLTYPE_DISCO);
+	const u8 disco[2] = {PACKET_TYPE_CONTROL, CONTROLTYPE_DISCO};
+	const OutgoingChunk data = OutgoingChunk::copy(disco, sizeof(disco));
 
 
 	// Send to all
@@ -559,9 +603,8 @@ void ConnectionSendThread::disconnect_peer(session_t peer_id)
 	LOG(dout_con << m_connection->getDesc() << " disconnecting peer" << std::endl);
 
 	// Create and send DISCO packet
-	SharedBuffer<u8> data(2);
-	writeU8(&data[0], PACKET_TYPE_CONTROL);
-	writeU8(&data[1], CONTROLTYPE_DISCO);
+	const u8 disco[2] = {PACKET_TYPE_CONTROL, CONTROLTYPE_DISCO};
+	const OutgoingChunk data = OutgoingChunk::copy(disco, sizeof(disco));
 	sendAsPacket(peer_id, 0, data, false);
 
 	PeerHelper peer = m_connection->getPeerNoEx(peer_id);
@@ -577,7 +620,7 @@ void ConnectionSendThread::disconnect_peer(session_t peer_id)
 }
 
 void ConnectionSendThread::send(session_t peer_id, u8 channelnum,
-	const SharedBuffer<u8> &data)
+	const PacketData &data)
 {
 	assert(channelnum < CHANNEL_COUNT); // Pre-condition
 
@@ -586,24 +629,24 @@ void ConnectionSendThread::send(session_t peer_id, u8 channelnum,
 		LOG(dout_con << m_connection->getDesc() << " peer: peer_id=" << peer_id
 			<< ">>>NOT<<< found on sending packet"
 			<< ", channel " << (channelnum % 0xFF)
-			<< ", size: " << data.getSize() << std::endl);
+			<< ", size: " << data.size() << std::endl);
 		return;
 	}
 
 	LOG(dout_con << m_connection->getDesc() << " sending to peer_id=" << peer_id
 		<< ", channel " << (channelnum % 0xFF)
-		<< ", size: " << data.getSize() << std::endl);
+		<< ", size: " << data.size() << std::endl);
 
 	u16 split_sequence_number = peer->getNextSplitSequenceNumber(channelnum);
 
 	u32 chunksize_max = m_max_packet_size - BASE_HEADER_SIZE;
-	std::list<SharedBuffer<u8>> originals;
+	std::list<OutgoingChunk> originals;
 
 	makeAutoSplitPacket(data, chunksize_max, split_sequence_number, &originals);
 
 	peer->setNextSplitSequenceNumber(channelnum, split_sequence_number);
 
-	for (const SharedBuffer<u8> &original : originals) {
+	for (const OutgoingChunk &original : originals) {
 		sendAsPacket(peer_id, channelnum, original);
 	}
 }
@@ -617,7 +660,7 @@ void ConnectionSendThread::sendReliable(ConnectionCommandPtr &c)
 	peer->PutReliableSendCommand(c, m_max_packet_size);
 }
 
-void ConnectionSendThread::sendToAll(u8 channelnum, const SharedBuffer<u8> &data)
+void ConnectionSendThread::sendToAll(u8 channelnum, const PacketData &data)
 {
 	std::vector<session_t> peerids = m_connection->getPeerIDs();
 
@@ -646,6 +689,8 @@ void ConnectionSendThread::sendPackets(float dtime, u32 peer_packet_quota)
 	std::vector<session_t> pendingDisconnect;
 	std::map<session_t, bool> pending_unreliable;
 
+	m_pacing_delay = 0;
+
 	for (session_t peerId : peerIds) {
 		PeerHelper peer = m_connection->getPeerNoEx(peerId);
 		//peer may have been removed
@@ -716,7 +761,8 @@ void ConnectionSendThread::sendPackets(float dtime, u32 peer_packet_quota)
 			while (!channel.queued_reliables.empty() &&
 					channel.outgoing_reliables_sent.size()
 					< channel.getWindowSize() &&
-					peer->m_increment_packets_remaining > 0) {
+					peer->m_increment_packets_remaining > 0 &&
+					channel.takePacingToken()) {
 				BufferedPacketPtr p = channel.queued_reliables.front();
 				channel.queued_reliables.pop();
 
@@ -729,6 +775,11 @@ void ConnectionSendThread::sendPackets(float dtime, u32 peer_packet_quota)
 				sendAsPacketReliable(p, &channel);
 				peer->m_increment_packets_remaining--;
 			}
+
+			const float pacing_delay = channel.getPacingDelay();
+			if (!channel.queued_reliables.empty() && pacing_delay > 0 &&
+					(m_pacing_delay == 0 || pacing_delay < m_pacing_delay))
+				m_pacing_delay = pacing_delay;
 		}
 	}
 
@@ -753,7 +804,7 @@ void ConnectionSendThread::sendPackets(float dtime, u32 peer_packet_quota)
 				<< " Outgoing queue: peer_id=" << packet.peer_id
 				<< ">>>NOT<<< found on sending packet"
 				<< ", channel " << (packet.channelnum % 0xFF)
-				<< ", size: " << packet.data.getSize() << std::endl);
+				<< ", size: " << packet.data.size() << std::endl);
 			continue;
 		}
 
@@ -790,7 +841,7 @@ void ConnectionSendThread::sendPackets(float dtime, u32 peer_packet_quota)
 }
 
 void ConnectionSendThread::sendAsPacket(session_t peer_id, u8 channelnum,
-	const SharedBuffer<u8> &data, bool ack)
+	const OutgoingChunk &data, bool ack)
 {
 	OutgoingPacket packet(peer_id, channelnum, data, false, ack);
 	m_outgoing_queue.push(packet);
@@ -801,6 +852,30 @@ ConnectionReceiveThread::ConnectionReceiveThread() :
 {
 }
 
+ConnectionReceiveThread::ConnectionReceiveThread(u32 shard, u32 shard_count) :
+	Thread("ConnectionReceive"),
+	m_is_worker(true),
+	m_shard(shard),
+	m_shard_count(shard_count)
+{
+	assert(shard < shard_count);
+}
+
+u32 ConnectionReceiveThread::getShard(const Address &address, u32 shard_count)
+{
+	u32 hash = address.getPort();
+	if (address.isIPv6()) {
+		const struct in6_addr addr = address.getAddress6();
+		for (u8 byte : addr.s6_addr)
+			hash = hash * 31 + byte;
+	} else {
+		hash = hash * 31 + address.getAddress().s_addr;
+	}
+	// Spread the bits, clients of one host only differ in the port
+	hash *= 2654435761U;
+	return (hash >> 16) % shard_count;
+}
+
 void *ConnectionReceiveThread::run()
 {
 	assert(m_connection);
@@ -816,7 +891,13 @@ void *ConnectionReceiveThread::run()
 	// theoretical reliable upper boundary of a udp packet for all IPv6 enabled
 	// infrastructure
 	const unsigned int packet_maxsize = 1500;
-	SharedBuffer<u8> packetdata(packet_maxsize);
+	const size_t batch_size = UDPSocket::hasBatchedIO() || m_is_worker ?
+		UDP_BATCH_SIZE : 1;
+	if (!m_is_worker) {
+		for (size_t i = 0; i < batch_size; i++)
+			m_recv_buffers.emplace_back(packet_maxsize);
+	}
+	m_recv_datagrams.resize(batch_size);
 
 	bool packet_queued = true;
 
@@ -838,7 +919,7 @@ void *ConnectionReceiveThread::run()
 #endif
 
 		/* receive packets */
-		receive(packetdata, packet_queued);
+		receive(packet_queued);
 
 #ifdef DEBUG_CONNECTION_KBPS
 		debug_print_timer += dtime;
@@ -898,159 +979,230 @@ void *ConnectionReceiveThread::run()
 }
 
 // Receive packets from the network and buffers and create ConnectionEvents
-void ConnectionReceiveThread::receive(SharedBuffer<u8> &packetdata,
-		bool &packet_queued)
+void ConnectionReceiveThread::receive(bool &packet_queued)
+{
+	// The peers belong to the workers, so their buffers are theirs too
+	if (!m_workers.empty()) {
+		dispatchDatagrams(receiveDatagrams());
+		return;
+	}
+
+	// Nothing that is ready may wait for the blocking receive below, be it
+	// on the socket or, for workers, on the datagram queue
+	processBufferedPackets(packet_queued);
+
+	int count = receiveDatagrams();
+	for (int i = 0; i < count; i++) {
+		try {
+			const UDPSocket::Datagram &d = m_recv_datagrams[i];
+			processDatagram(d.address, (const u8 *)d.data, d.size, packet_queued);
+		}
+		catch (InvalidIncomingDataException &e) {
+		}
+		// Buffered packets that this one made processable are handed out
+		// right away, as before batching
+		processBufferedPackets(packet_queued);
+	}
+}
+
+void ConnectionReceiveThread::processBufferedPackets(bool &packet_queued)
 {
+	if (!packet_queued)
+		return;
+
 	try {
-		// First, see if there any buffered packets we can process now
-		if (packet_queued) {
-			session_t peer_id;
-			SharedBuffer<u8> resultdata;
-			while (true) {
-				try {
-					if (!getFromBuffers(peer_id, resultdata))
-						break;
-
-					m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
-				}
-				catch (ProcessedSilentlyException &e) {
-					/* try reading again */
-				}
+		session_t peer_id;
+		SharedBuffer<u8> resultdata;
+		while (true) {
+			try {
+				if (!getFromBuffers(peer_id, resultdata))
+					break;
+
+				m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
+			}
+			catch (ProcessedSilentlyException &e) {
+				/* try reading again */
 			}
-			packet_queued = false;
 		}
+	}
+	catch (InvalidIncomingDataException &e) {
+	}
+	packet_queued = false;
+}
 
-		// Call Receive() to wait for incoming data
-		Address sender;
-		s32 received_size = m_connection->m_udpSocket.Receive(sender,
-			*packetdata, packetdata.getSize());
-		if (received_size < 0)
-			return;
-
-		if ((received_size < BASE_HEADER_SIZE) ||
-				(readU32(&packetdata[0]) != m_connection->GetProtocolID())) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): Invalid incoming packet, "
-				<< "size: " << received_size
-				<< ", protocol: "
-				<< ((received_size >= 4) ? readU32(&packetdata[0]) : -1)
-				<< std::endl);
-			return;
+int ConnectionReceiveThread::receiveDatagrams()
+{
+	if (!m_is_worker) {
+		// Wait for incoming data, then take all that is there at once
+		for (size_t i = 0; i < m_recv_datagrams.size(); i++) {
+			m_recv_datagrams[i].data = *m_recv_buffers[i];
+			m_recv_datagrams[i].size = m_recv_buffers[i].getSize();
 		}
+		return m_connection->m_udpSocket.ReceiveMany(m_recv_datagrams.data(),
+			m_recv_datagrams.size());
+	}
 
-		session_t peer_id = readPeerId(*packetdata);
-		u8 channelnum = readChannel(*packetdata);
+	// Same timeout as the socket
+	m_recv_packets.clear();
+	BufferedPacketPtr p = m_datagram_queue.pop_frontNoEx(500);
+	while (p) {
+		UDPSocket::Datagram &d = m_recv_datagrams[m_recv_packets.size()];
+		d.address = p->address;
+		d.data = p->data;
+		d.size = p->size();
+		m_recv_packets.push_back(std::move(p));
+		if (m_recv_packets.size() == m_recv_datagrams.size())
+			break;
+		p = m_datagram_queue.pop_frontNoEx(0);
+	}
+	return m_recv_packets.size();
+}
 
-		if (channelnum >= CHANNEL_COUNT) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): Invalid channel " << (int)channelnum << std::endl);
-			return;
-		}
+void ConnectionReceiveThread::dispatchDatagrams(int count)
+{
+	for (int i = 0; i < count; i++) {
+		const UDPSocket::Datagram &d = m_recv_datagrams[i];
+		ConnectionReceiveThread *worker =
+			m_workers[getShard(d.address, m_workers.size())];
+		// Drop what a busy worker can't take, as the socket would
+		if (worker->m_datagram_queue.size() >= MAX_QUEUED_DATAGRAMS)
+			continue;
 
-		const bool knew_peer_id = peer_id != PEER_ID_INEXISTENT;
-
-		if (!m_connection->ConnectedToServer()) {
-			// Try to identify peer by sender address
-			if (peer_id == PEER_ID_INEXISTENT) {
-				peer_id = m_connection->lookupPeer(sender);
-				if (peer_id != PEER_ID_INEXISTENT) {
-					/* During join it can happen that the CONTROLTYPE_SET_PEER_ID
-					 * packet is lost. Since resends are not active at this stage
-					 * we need to remind the peer manually. */
-					m_connection->doResendOne(peer_id);
-				}
-			}
+		auto p = std::allocate_shared<BufferedPacket>(
+			PoolAllocator<BufferedPacket>(), d.size);
+		memcpy(p->data, d.data, d.size);
+		p->address = d.address;
+		worker->m_datagram_queue.push_back(std::move(p));
+	}
+}
 
-			// Someone new is trying to talk to us. Add them.
-			if (peer_id == PEER_ID_INEXISTENT) {
-				auto &l = m_new_peer_ratelimit;
-				l.tick();
-				if (++l.counter > MAX_NEW_PEERS_PER_SEC) {
-					if (!l.logged) {
-						warningstream << m_connection->getDesc()
-							<< "Receive(): More than " << MAX_NEW_PEERS_PER_SEC
-							<< " new clients within 1s. Throttling." << std::endl;
-					}
-					l.logged = true;
-					// We simply drop the packet, the client can try again.
-				} else {
-					peer_id = m_connection->createPeer(sender, 0);
-				}
+void ConnectionReceiveThread::processDatagram(const Address &sender,
+		const u8 *packetdata, s32 received_size, bool &packet_queued)
+{
+	if ((received_size < BASE_HEADER_SIZE) ||
+			(readU32(&packetdata[0]) != m_connection->GetProtocolID())) {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): Invalid incoming packet, "
+			<< "size: " << received_size
+			<< ", protocol: "
+			<< ((received_size >= 4) ? readU32(&packetdata[0]) : -1)
+			<< std::endl);
+		return;
+	}
+
+	session_t peer_id = readPeerId(packetdata);
+	u8 channelnum = readChannel(packetdata);
+
+	if (channelnum >= CHANNEL_COUNT) {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): Invalid channel " << (int)channelnum << std::endl);
+		return;
+	}
+
+	const bool knew_peer_id = peer_id != PEER_ID_INEXISTENT;
+
+	if (!m_connection->ConnectedToServer()) {
+		// Try to identify peer by sender address
+		if (peer_id == PEER_ID_INEXISTENT) {
+			peer_id = m_connection->lookupPeer(sender);
+			if (peer_id != PEER_ID_INEXISTENT) {
+				/* During join it can happen that the CONTROLTYPE_SET_PEER_ID
+				 * packet is lost. Since resends are not active at this stage
+				 * we need to remind the peer manually. */
+				m_connection->doResendOne(peer_id);
 			}
 		}
 
-		PeerHelper peer = m_connection->getPeerNoEx(peer_id);
-		if (!peer) {
-			LOG(dout_con << m_connection->getDesc()
-				<< " got packet from unknown peer_id: "
-				<< peer_id << " Ignoring." << std::endl);
-			return;
+		// Someone new is trying to talk to us. Add them.
+		if (peer_id == PEER_ID_INEXISTENT) {
+			auto &l = m_new_peer_ratelimit;
+			l.tick();
+			// Every worker gets its part
+			const int max_new_peers =
+				(MAX_NEW_PEERS_PER_SEC + m_shard_count - 1) / m_shard_count;
+			if (++l.counter > max_new_peers) {
+				if (!l.logged) {
+					warningstream << m_connection->getDesc()
+						<< "Receive(): More than " << MAX_NEW_PEERS_PER_SEC
+						<< " new clients within 1s. Throttling." << std::endl;
+				}
+				l.logged = true;
+				// We simply drop the packet, the client can try again.
+			} else {
+				peer_id = m_connection->createPeer(sender, 0);
+			}
 		}
+	}
 
-		// Validate peer address
+	PeerHelper peer = m_connection->getPeerNoEx(peer_id);
+	if (!peer) {
+		LOG(dout_con << m_connection->getDesc()
+			<< " got packet from unknown peer_id: "
+			<< peer_id << " Ignoring." << std::endl);
+		return;
+	}
 
-		if (sender != peer->getAddress()) {
-			LOG(derr_con << m_connection->getDesc()
-				<< " Peer " << peer_id << " sending from different address."
-				" Ignoring." << std::endl);
-			return;
-		}
+	// Validate peer address
 
-		if (knew_peer_id) {
-			peer->SetFullyOpen();
-			// Setup phase has a fixed timeout
-			peer->ResetTimeout();
-		} else if (!peer->isHalfOpen()) {
-			// If the peer talks to us without a peer ID when it has done so
-			// before something is definitely fishy.
-			LOG(derr_con << m_connection->getDesc()
-				<< " Peer " << peer_id << " sending without peer id?!"
-				" Ignoring." << std::endl);
-			return;
-		}
+	if (sender != peer->getAddress()) {
+		LOG(derr_con << m_connection->getDesc()
+			<< " Peer " << peer_id << " sending from different address."
+			" Ignoring." << std::endl);
+		return;
+	}
 
-		auto *udpPeer = dynamic_cast<UDPPeer *>(&peer);
-		if (!udpPeer) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): peer_id=" << peer_id << " isn't an UDPPeer?!"
-				" Ignoring." << std::endl);
-			return;
-		}
-		Channel *channel = &udpPeer->channels[channelnum];
+	if (knew_peer_id) {
+		peer->SetFullyOpen();
+		// Setup phase has a fixed timeout
+		peer->ResetTimeout();
+	} else if (!peer->isHalfOpen()) {
+		// If the peer talks to us without a peer ID when it has done so
+		// before something is definitely fishy.
+		LOG(derr_con << m_connection->getDesc()
+			<< " Peer " << peer_id << " sending without peer id?!"
+			" Ignoring." << std::endl);
+		return;
+	}
 
-		channel->UpdateBytesReceived(received_size);
+	auto *udpPeer = dynamic_cast<UDPPeer *>(&peer);
+	if (!udpPeer) {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): peer_id=" << peer_id << " isn't an UDPPeer?!"
+			" Ignoring." << std::endl);
+		return;
+	}
+	Channel *channel = &udpPeer->channels[channelnum];
 
-		// Throw the received packet to channel->processPacket()
+	channel->UpdateBytesReceived(received_size);
 
-		// Make a new SharedBuffer from the data without the base headers
-		SharedBuffer<u8> strippeddata(received_size - BASE_HEADER_SIZE);
-		memcpy(*strippeddata, &packetdata[BASE_HEADER_SIZE],
-			strippeddata.getSize());
+	// Throw the received packet to channel->processPacket()
 
-		try {
-			// Process it (the result is some data with no headers made by us)
-			SharedBuffer<u8> resultdata = processPacket
-				(channel, strippeddata, peer_id, channelnum, false);
+	// Make a new SharedBuffer from the data without the base headers
+	SharedBuffer<u8> strippeddata(received_size - BASE_HEADER_SIZE);
+	memcpy(*strippeddata, &packetdata[BASE_HEADER_SIZE],
+		strippeddata.getSize());
 
-			LOG(dout_con << m_connection->getDesc()
-				<< " ProcessPacket from peer_id: " << peer_id
-				<< ", channel: " << (u32)channelnum << ", returned "
-				<< resultdata.getSize() << " bytes" << std::endl);
+	try {
+		// Process it (the result is some data with no headers made by us)
+		SharedBuffer<u8> resultdata = processPacket
+			(channel, strippeddata, peer_id, channelnum, false);
 
-			m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
-		}
-		catch (ProcessedSilentlyException &e) {
-		}
-		catch (ProcessedQueued &e) {
-			// we set it to true anyway (see below)
-		}
+		LOG(dout_con << m_connection->getDesc()
+			<< " ProcessPacket from peer_id: " << peer_id
+			<< ", channel: " << (u32)channelnum << ", returned "
+			<< resultdata.getSize() << " bytes" << std::endl);
 
-		/* Every time we receive a packet it can happen that a previously
-		 * buffered packet is now ready to process. */
-		packet_queued = true;
+		m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
 	}
-	catch (InvalidIncomingDataException &e) {
+	catch (ProcessedSilentlyException &e) {
 	}
+	catch (ProcessedQueued &e) {
+		// we set it to true anyway (see below)
+	}
+
+	/* Every time we receive a packet it can happen that a previously
+	 * buffered packet is now ready to process. */
+	packet_queued = true;
 }
 
 bool ConnectionReceiveThread::getFromBuffers(session_t &peer_id, SharedBuffer<u8> &dst)
@@ -1066,6 +1218,10 @@ bool ConnectionReceiveThread::getFromBuffers(session_t &peer_id, SharedBuffer<u8
 		if (!p)
 			continue;
 
+		// The other peers belong to other workers
+		if (m_is_worker && getShard(p->getAddress(), m_shard_count) != m_shard)
+			continue;
+
 		for (Channel &channel : p->channels) {
 			if (checkIncomingBuffers(&channel, peer_id, dst)) {
 				return true;
@@ -1173,27 +1329,27 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Control(Channel *chan
 			BufferedPacketPtr p = channel->outgoing_reliables_sent.popSeqnum(seqnum);
 
 			// the rtt calculation will be a bit off for re-sent packets but that's okay
+			float rtt = -1.0f;
 			{
 				// Get round trip time
 				u64 current_time = porting::getTimeMs();
 
 				// an overflow is quite unlikely but as it'd result in major
 				// rtt miscalculation we handle it here
-				if (current_time > p->absolute_send_time) {
-					float rtt = (current_time - p->absolute_send_time) / 1000.0;
-
-					// Let peer calculate stuff according to it
-					// (avg_rtt and resend_timeout)
+				if (current_time > p->absolute_send_time)
+					rtt = (current_time - p->absolute_send_time) / 1000.0;
+				else if (p->totaltime > 0)
+					rtt = p->totaltime;
+
+				// Let peer calculate stuff according to it
+				// (avg_rtt and resend_timeout)
+				if (rtt >= 0)
 					dynamic_cast<UDPPeer *>(peer)->reportRTT(rtt);
-				} else if (p->totaltime > 0) {
-					float rtt = p->totaltime;
-
-					// Let peer calculate stuff according to it
-					// (avg_rtt and resend_timeout)
-					dynamic_cast<UDPPeer *>(peer)->reportRTT(rtt);
-				}
 			}
 
+			// Resent packets say nothing about the current delay
+			channel->UpdateAck(p->resend_count == 0 ? rtt : -1.0f, p->size());
+
 			// put bytes for max bandwidth calculation
 			channel->UpdateBytesSent(p->size(), 1);
 			if (channel->outgoing_reliables_sent.size() == 0)
@@ -25,8 +25,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 /********************************************/
 
 #include <cassert>
+#include <vector>
 #include "threading/thread.h"
 #include "network/mtp/internal.h"
+#include "network/socket.h"
 
 namespace con
 {
@@ -37,11 +39,11 @@ struct OutgoingPacket
 {
 	session_t peer_id;
 	u8 channelnum;
-	SharedBuffer<u8> data;
+	OutgoingChunk data;
 	bool reliable;
 	bool ack;
 
-	OutgoingPacket(session_t peer_id_, u8 channelnum_, const SharedBuffer<u8> &data_,
+	OutgoingPacket(session_t peer_id_, u8 channelnum_, const OutgoingChunk &data_,
 			bool reliable_,bool ack_=false):
 		peer_id(peer_id_),
 		channelnum(channelnum_),
@@ -74,10 +76,13 @@ class ConnectionSendThread : public Thread
 
 private:
 	void runTimeouts(float dtime, u32 peer_packet_quota);
-	void resendReliable(Channel &channel, const BufferedPacket *k, float resend_timeout);
-	void rawSend(const BufferedPacket *p);
+	void resendReliable(Channel &channel, ConstSharedPtr<BufferedPacket> k,
+			float resend_timeout);
+	// Queues the packet, it is sent by the next flushSendBatch()
+	void rawSend(ConstSharedPtr<BufferedPacket> p);
+	void flushSendBatch();
 	bool rawSendAsPacket(session_t peer_id, u8 channelnum,
-			const SharedBuffer<u8> &data, bool reliable);
+			OutgoingChunk data, bool reliable);
 
 	void processReliableCommand(ConnectionCommandPtr &c);
 	void processNonReliableCommand(ConnectionCommandPtr &c);
@@ -85,14 +90,14 @@ class ConnectionSendThread : public Thread
 	void connect(Address address);
 	void disconnect();
 	void disconnect_peer(session_t peer_id);
-	void send(session_t peer_id, u8 channelnum, const SharedBuffer<u8> &data);
+	void send(session_t peer_id, u8 channelnum, const PacketData &data);
 	void sendReliable(ConnectionCommandPtr &c);
-	void sendToAll(u8 channelnum, const SharedBuffer<u8> &data);
+	void sendToAll(u8 channelnum, const PacketData &data);
 	void sendToAllReliable(ConnectionCommandPtr &c);
 
 	void sendPackets(float dtime, u32 peer_packet_quota);
 
-	void sendAsPacket(session_t peer_id, u8 channelnum, const SharedBuffer<u8> &data,
+	void sendAsPacket(session_t peer_id, u8 channelnum, const OutgoingChunk &data,
 			bool ack = false);
 
 	void sendAsPacketReliable(BufferedPacketPtr &p, Channel *channel);
@@ -108,12 +113,27 @@ class ConnectionSendThread : public Thread
 	unsigned int m_iteration_packets_avaialble;
 	unsigned int m_max_data_packets_per_iteration;
 	unsigned int m_max_packets_requeued = 256;
+	// Seconds until a paced channel may send again, 0 if none is waiting
+	float m_pacing_delay = 0;
+	float m_pool_stats_timer = 0.0f;
+
+	std::vector<ConstSharedPtr<BufferedPacket>> m_send_batch;
+	std::vector<UDPSocket::Datagram> m_send_datagrams;
 };
 
+/*
+	Reads the socket and processes what it receives. With more than one
+	receive thread, one of them only reads the socket and passes the
+	datagrams on to the others (the workers). Each worker handles the peers
+	of one shard of the addresses, so the packets of a peer are still
+	processed in order.
+*/
 class ConnectionReceiveThread : public Thread
 {
 public:
 	ConnectionReceiveThread();
+	// Worker for the peers of `shard`
+	ConnectionReceiveThread(u32 shard, u32 shard_count);
 
 	void *run();
 
@@ -123,8 +143,23 @@ class ConnectionReceiveThread : public Thread
 		m_connection = parent;
 	}
 
+	// Workers the datagrams are passed on to, instead of processing them
+	void setWorkers(const std::vector<ConnectionReceiveThread *> &workers)
+	{
+		m_workers = workers;
+	}
+
+	static u32 getShard(const Address &address, u32 shard_count);
+
 private:
-	void receive(SharedBuffer<u8> &packetdata, bool &packet_queued);
+	void receive(bool &packet_queued);
+	// Fills m_recv_datagrams, returns their count
+	int receiveDatagrams();
+	void dispatchDatagrams(int count);
+	// Hands out the buffered packets that became processable, if any
+	void processBufferedPackets(bool &packet_queued);
+	void processDatagram(const Address &sender, const u8 *data, s32 size,
+			bool &packet_queued);
 
 	// Returns next data from a buffer if possible
 	// If found, returns true; if not, false.
@@ -186,5 +221,19 @@ class ConnectionReceiveThread : public Thread
 	Connection *m_connection = nullptr;
 
 	RateLimitHelper m_new_peer_ratelimit;
+
+	// One buffer per datagram of a batch
+	std::vector<SharedBuffer<u8>> m_recv_buffers;
+	std::vector<UDPSocket::Datagram> m_recv_datagrams;
+
+	std::vector<ConnectionReceiveThread *> m_workers;
+
+	// Worker only
+	bool m_is_worker = false;
+	u32 m_shard = 0;
+	u32 m_shard_count = 1;
+	MutexedQueue<BufferedPacketPtr> m_datagram_queue;
+	// Datagrams of the batch in m_recv_datagrams
+	std::vector<BufferedPacketPtr> m_recv_packets;
 };
 }
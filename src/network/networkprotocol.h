@@ -224,9 +224,15 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 		Add TOCLIENT_MOVE_PLAYER_REL
 		Move default minimap from client-side C++ to server-side builtin Lua
 		[scheduled bump for 5.9.0]
+	PROTOCOL VERSION 45:
+		AO_CMD_POSITION_KEYFRAME and AO_CMD_POSITION_DELTA instead of
+		AO_CMD_UPDATE_POSITION for entities
+	PROTOCOL VERSION 46:
+		Block compression dictionary, sent as media
+		Add dictionary id to TOSERVER_CLIENT_READY
 */
 
-#define LATEST_PROTOCOL_VERSION 44
+#define LATEST_PROTOCOL_VERSION 46
 #define LATEST_PROTOCOL_VERSION_STRING TOSTRING(LATEST_PROTOCOL_VERSION)
 
 // Server's supported network protocol range
@@ -1071,6 +1077,10 @@ enum ToServerCommand : u16
 		u8 reserved
 		u16 len
 		u8[len] full_version_string
+		u16 formspec_version
+		u32 block_dictionary_id
+			Of the block_dictionary.zstdict media the client loaded, 0 if none.
+			If it matches, TOCLIENT_BLOCKDATA is compressed with it.
 	*/
 
 	TOSERVER_FIRST_SRP = 0x50,
@@ -390,13 +390,23 @@ void Server::handleCommand_ClientReady(NetworkPacket* pkt)
 	u16 formspec_ver = 1; // v1 for clients older than 5.1.0-dev
 	std::string full_ver;
 
+	u32 block_dictionary_id = 0;
 	*pkt >> major_ver >> minor_ver >> patch_ver >> reserved >> full_ver;
 	if (pkt->getRemainingBytes() >= 2)
 		*pkt >> formspec_ver;
+	if (pkt->getRemainingBytes() >= 4)
+		*pkt >> block_dictionary_id;
 
 	m_clients.setClientVersion(peer_id, major_ver, minor_ver, patch_ver,
 		full_ver);
 
+	{
+		ClientInterface::AutoLock lock(m_clients);
+		RemoteClient *client = m_clients.lockedGetClientNoEx(peer_id, CS_InitDone);
+		if (client)
+			client->block_dictionary_id = block_dictionary_id;
+	}
+
 	// Emerge player
 	PlayerSAO* playersao = StageTwoClientInit(peer_id);
 	if (!playersao) {
@@ -41,6 +41,7 @@ typedef int socklen_t;
 #include <cerrno>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <fcntl.h>
 #include <poll.h>
@@ -50,6 +51,10 @@ typedef int socklen_t;
 #define SOCKET_ERR_STR(e) strerror(e)
 #endif
 
+#ifdef __linux__
+#define HAVE_MMSG 1
+#endif
+
 // Set to true to enable verbose debug output
 bool socket_enable_debug_output = false; // yuck
 
@@ -195,17 +200,54 @@ void UDPSocket::Bind(Address addr)
 	}
 }
 
-void UDPSocket::Send(const Address &destination, const void *data, int size)
+// Fills `ss` with the address, in the format of a socket of `family`
+static socklen_t to_sockaddr(const Address &addr, unsigned short family,
+		struct sockaddr_storage *ss)
+{
+	memset(ss, 0, sizeof(*ss));
+	if (family == AF_INET6) {
+		auto *address = reinterpret_cast<struct sockaddr_in6 *>(ss);
+		address->sin6_family = AF_INET6;
+		address->sin6_addr = addr.getAddress6();
+		address->sin6_port = htons(addr.getPort());
+		return sizeof(struct sockaddr_in6);
+	}
+
+	auto *address = reinterpret_cast<struct sockaddr_in *>(ss);
+	address->sin_family = AF_INET;
+	address->sin_addr = addr.getAddress();
+	address->sin_port = htons(addr.getPort());
+	return sizeof(struct sockaddr_in);
+}
+
+static Address from_sockaddr(const struct sockaddr_storage &ss,
+		unsigned short family)
 {
-	bool dumping_packet = false; // for INTERNET_SIMULATOR
+	if (family == AF_INET6) {
+		const auto *address = reinterpret_cast<const struct sockaddr_in6 *>(&ss);
+		u16 address_port = ntohs(address->sin6_port);
+		const auto *bytes = reinterpret_cast<const IPv6AddressBytes*>
+			(address->sin6_addr.s6_addr);
+		return Address(bytes, address_port);
+	}
 
-	if (INTERNET_SIMULATOR)
-		dumping_packet = myrand() % INTERNET_SIMULATOR_PACKET_LOSS == 0;
+	const auto *address = reinterpret_cast<const struct sockaddr_in *>(&ss);
+	u32 address_ip = ntohl(address->sin_addr.s_addr);
+	u16 address_port = ntohs(address->sin_port);
+	return Address(address_ip, address_port);
+}
+
+bool UDPSocket::prepareSend(const Datagram &d)
+{
+	const float loss = m_simulated_loss.load(std::memory_order_relaxed);
+	const bool dumping_packet = loss > 0 && myrand_float() < loss;
 
 	if (socket_enable_debug_output) {
+		const int size = d.size + d.tail_size;
+
 		// Print packet destination and size
 		tracestream << (int)m_handle << " -> ";
-		destination.print(tracestream);
+		d.address.print(tracestream);
 		tracestream << ", size=" << size;
 
 		// Print packet contents
@@ -213,7 +255,8 @@ void UDPSocket::Send(const Address &destination, const void *data, int size)
 		for (int i = 0; i < size && i < 20; i++) {
 			if (i % 2 == 0)
 				tracestream << " ";
-			unsigned int a = ((const unsigned char *)data)[i];
+			unsigned int a = i < d.size ? ((const unsigned char *)d.data)[i] :
+				((const unsigned char *)d.tail)[i - d.size];
 			tracestream << std::hex << std::setw(2) << std::setfill('0') << a;
 		}
 
@@ -221,38 +264,67 @@ void UDPSocket::Send(const Address &destination, const void *data, int size)
 			tracestream << "...";
 
 		if (dumping_packet)
-			tracestream << " (DUMPED BY INTERNET_SIMULATOR)";
+			tracestream << " (DUMPED BY SIMULATED PACKET LOSS)";
 
 		tracestream << std::endl;
 	}
 
 	if (dumping_packet) {
 		// Lol let's forget it
-		tracestream << "UDPSocket::Send(): INTERNET_SIMULATOR: dumping packet."
+		tracestream << "UDPSocket::Send(): simulated packet loss: dumping packet."
 			<< std::endl;
-		return;
+		return false;
 	}
 
-	if (destination.getFamily() != m_addr_family)
+	if (d.address.getFamily() != m_addr_family)
 		throw SendFailedException("Address family mismatch");
 
-	int sent;
-	if (m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address = {};
-		address.sin6_family = AF_INET6;
-		address.sin6_addr = destination.getAddress6();
-		address.sin6_port = htons(destination.getPort());
+	return true;
+}
 
-		sent = sendto(m_handle, (const char *)data, size, 0,
-				(struct sockaddr *)&address, sizeof(struct sockaddr_in6));
-	} else {
-		struct sockaddr_in address = {};
-		address.sin_family = AF_INET;
-		address.sin_addr = destination.getAddress();
-		address.sin_port = htons(destination.getPort());
+void UDPSocket::Send(const Address &destination, const void *data, int size)
+{
+	Datagram d{destination, const_cast<void *>(data), size};
+	if (prepareSend(d))
+		sendDatagram(d);
+}
+
+void UDPSocket::sendDatagram(const Datagram &d)
+{
+	struct sockaddr_storage address;
+	socklen_t address_len = to_sockaddr(d.address, m_addr_family, &address);
 
-		sent = sendto(m_handle, (const char *)data, size, 0,
-				(struct sockaddr *)&address, sizeof(struct sockaddr_in));
+	const int size = MYMAX(d.size, 0) + MYMAX(d.tail_size, 0);
+	int sent;
+	if (d.tail_size <= 0) {
+		sent = sendto(m_handle, (const char *)d.data, size, 0,
+				(struct sockaddr *)&address, address_len);
+	} else {
+#ifdef _WIN32
+		WSABUF bufs[2];
+		bufs[0].buf = (char *)d.data;
+		bufs[0].len = d.size;
+		bufs[1].buf = (char *)d.tail;
+		bufs[1].len = d.tail_size;
+		DWORD bytes_sent = 0;
+		if (WSASendTo(m_handle, bufs, 2, &bytes_sent, 0,
+				(struct sockaddr *)&address, address_len, NULL, NULL) == 0)
+			sent = bytes_sent;
+		else
+			sent = -1;
+#else
+		struct iovec iovs[2];
+		iovs[0].iov_base = d.data;
+		iovs[0].iov_len = MYMAX(d.size, 0);
+		iovs[1].iov_base = const_cast<void *>(d.tail);
+		iovs[1].iov_len = d.tail_size;
+		struct msghdr msg = {};
+		msg.msg_name = &address;
+		msg.msg_namelen = address_len;
+		msg.msg_iov = iovs;
+		msg.msg_iovlen = 2;
+		sent = sendmsg(m_handle, &msg, 0);
+#endif
 	}
 
 	if (sent != size)
@@ -266,65 +338,203 @@ int UDPSocket::Receive(Address &sender, void *data, int size)
 	if (!WaitData(m_timeout_ms))
 		return -1;
 
+	return receiveReady(sender, data, size);
+}
+
+int UDPSocket::receiveReady(Address &sender, void *data, int size)
+{
 	size = MYMAX(size, 0);
 
-	int received;
-	if (m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address;
-		memset(&address, 0, sizeof(address));
-		socklen_t address_len = sizeof(address);
+	struct sockaddr_storage address;
+	socklen_t address_len = sizeof(address);
 
-		received = recvfrom(m_handle, (char *)data, size, 0,
-				(struct sockaddr *)&address, &address_len);
+	int received = recvfrom(m_handle, (char *)data, size, 0,
+			(struct sockaddr *)&address, &address_len);
 
-		if (received < 0)
-			return -1;
+	if (received < 0)
+		return -1;
 
-		u16 address_port = ntohs(address.sin6_port);
-		const auto *bytes = reinterpret_cast<IPv6AddressBytes*>
-			(address.sin6_addr.s6_addr);
-		sender = Address(bytes, address_port);
-	} else {
-		struct sockaddr_in address;
-		memset(&address, 0, sizeof(address));
+	sender = from_sockaddr(address, m_addr_family);
 
-		socklen_t address_len = sizeof(address);
+	if (socket_enable_debug_output)
+		dumpReceived(sender, data, received);
 
-		received = recvfrom(m_handle, (char *)data, size, 0,
-				(struct sockaddr *)&address, &address_len);
+	return received;
+}
 
-		if (received < 0)
-			return -1;
+void UDPSocket::dumpReceived(const Address &sender, const void *data, int size)
+{
+	// Print packet sender and size
+	tracestream << (int)m_handle << " <- ";
+	sender.print(tracestream);
+	tracestream << ", size=" << size;
+
+	// Print packet contents
+	tracestream << ", data=";
+	for (int i = 0; i < size && i < 20; i++) {
+		if (i % 2 == 0)
+			tracestream << " ";
+		unsigned int a = ((const unsigned char *)data)[i];
+		tracestream << std::hex << std::setw(2) << std::setfill('0') << a;
+	}
+	if (size > 20)
+		tracestream << "...";
+
+	tracestream << std::endl;
+}
 
-		u32 address_ip = ntohl(address.sin_addr.s_addr);
-		u16 address_port = ntohs(address.sin_port);
+#ifdef HAVE_MMSG
+
+int UDPSocket::SendMany(const Datagram *datagrams, int count)
+{
+	struct mmsghdr msgs[UDP_BATCH_SIZE];
+	// Data and tail of every datagram
+	struct iovec iovs[UDP_BATCH_SIZE][2];
+	struct sockaddr_storage addresses[UDP_BATCH_SIZE];
+	int sent_total = 0;
+
+	int i = 0;
+	while (i < count) {
+		// Collect a batch
+		int n = 0;
+		for (; i < count && n < UDP_BATCH_SIZE; i++) {
+			const Datagram &d = datagrams[i];
+			try {
+				if (!prepareSend(d))
+					continue;
+			} catch (SendFailedException &e) {
+				continue;
+			}
+
+			iovs[n][0].iov_base = d.data;
+			iovs[n][0].iov_len = MYMAX(d.size, 0);
+			iovs[n][1].iov_base = const_cast<void *>(d.tail);
+			iovs[n][1].iov_len = MYMAX(d.tail_size, 0);
+			memset(&msgs[n], 0, sizeof(msgs[n]));
+			msgs[n].msg_hdr.msg_name = &addresses[n];
+			msgs[n].msg_hdr.msg_namelen =
+				to_sockaddr(d.address, m_addr_family, &addresses[n]);
+			msgs[n].msg_hdr.msg_iov = iovs[n];
+			msgs[n].msg_hdr.msg_iovlen = d.tail_size > 0 ? 2 : 1;
+			n++;
+		}
 
-		sender = Address(address_ip, address_port);
+		// sendmmsg() stops at the first datagram that fails, skip that one
+		int pos = 0;
+		while (pos < n) {
+			int ret = sendmmsg(m_handle, &msgs[pos], n - pos, 0);
+			if (ret < 0) {
+				if (LAST_SOCKET_ERR() == EINTR)
+					continue;
+				pos++;
+				continue;
+			}
+			for (int j = pos; j < pos + ret; j++) {
+				size_t size = iovs[j][0].iov_len;
+				if (msgs[j].msg_hdr.msg_iovlen == 2)
+					size += iovs[j][1].iov_len;
+				if (msgs[j].msg_len == size)
+					sent_total++;
+			}
+			pos += ret;
+		}
 	}
 
-	if (socket_enable_debug_output) {
-		// Print packet sender and size
-		tracestream << (int)m_handle << " <- ";
-		sender.print(tracestream);
-		tracestream << ", size=" << received;
+	return sent_total;
+}
 
-		// Print packet contents
-		tracestream << ", data=";
-		for (int i = 0; i < received && i < 20; i++) {
-			if (i % 2 == 0)
-				tracestream << " ";
-			unsigned int a = ((const unsigned char *)data)[i];
-			tracestream << std::hex << std::setw(2) << std::setfill('0') << a;
+int UDPSocket::ReceiveMany(Datagram *datagrams, int count)
+{
+	assert(m_timeout_ms >= 0);
+	if (count <= 0 || !WaitData(m_timeout_ms))
+		return 0;
+
+	struct mmsghdr msgs[UDP_BATCH_SIZE];
+	struct iovec iovs[UDP_BATCH_SIZE];
+	struct sockaddr_storage addresses[UDP_BATCH_SIZE];
+	int received_total = 0;
+
+	while (received_total < count) {
+		Datagram *batch = &datagrams[received_total];
+		int n = MYMIN(count - received_total, UDP_BATCH_SIZE);
+		for (int i = 0; i < n; i++) {
+			iovs[i].iov_base = batch[i].data;
+			iovs[i].iov_len = MYMAX(batch[i].size, 0);
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name = &addresses[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
 		}
-		if (received > 20)
-			tracestream << "...";
 
-		tracestream << std::endl;
+		// Only take what is already there
+		int ret = recvmmsg(m_handle, msgs, n, MSG_DONTWAIT, nullptr);
+		if (ret <= 0)
+			break;
+
+		for (int i = 0; i < ret; i++) {
+			batch[i].size = msgs[i].msg_len;
+			batch[i].address = from_sockaddr(addresses[i], m_addr_family);
+			if (socket_enable_debug_output)
+				dumpReceived(batch[i].address, batch[i].data, batch[i].size);
+		}
+		received_total += ret;
+
+		if (ret < n)
+			break;
 	}
 
-	return received;
+	return received_total;
 }
 
+bool UDPSocket::hasBatchedIO()
+{
+	return true;
+}
+
+#else
+
+int UDPSocket::SendMany(const Datagram *datagrams, int count)
+{
+	int sent_total = 0;
+	for (int i = 0; i < count; i++) {
+		try {
+			if (!prepareSend(datagrams[i]))
+				continue;
+			sendDatagram(datagrams[i]);
+			sent_total++;
+		} catch (SendFailedException &e) {
+		}
+	}
+	return sent_total;
+}
+
+int UDPSocket::ReceiveMany(Datagram *datagrams, int count)
+{
+	assert(m_timeout_ms >= 0);
+	if (count <= 0 || !WaitData(m_timeout_ms))
+		return 0;
+
+	int received_total = 0;
+	do {
+		Datagram &d = datagrams[received_total];
+		int received = receiveReady(d.address, d.data, d.size);
+		if (received < 0)
+			break;
+		d.size = received;
+		received_total++;
+	} while (received_total < count && WaitData(0));
+
+	return received_total;
+}
+
+bool UDPSocket::hasBatchedIO()
+{
+	return false;
+}
+
+#endif
+
 void UDPSocket::setTimeoutMs(int timeout_ms)
 {
 	m_timeout_ms = timeout_ms;
@@ -19,20 +19,37 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <atomic>
 #include <ostream>
 #include <cstring>
 #include "address.h"
 #include "irrlichttypes.h"
 #include "networkexceptions.h"
+#include "constants.h"
 
 extern bool socket_enable_debug_output;
 
+// Maximum number of datagrams sent or received with one system call
+#define UDP_BATCH_SIZE 64
+
 void sockets_init();
 void sockets_cleanup();
 
 class UDPSocket
 {
 public:
+	struct Datagram
+	{
+		Address address;
+		void *data;
+		// Size of the data. When receiving, the size of the buffer on input.
+		int size;
+		// Sending only: more data that goes into the same datagram, so that
+		// headers and data don't have to be copied together
+		const void *tail = nullptr;
+		int tail_size = 0;
+	};
+
 	UDPSocket() = default;
 	UDPSocket(bool ipv6); // calls init()
 	~UDPSocket();
@@ -43,15 +60,41 @@ class UDPSocket
 	void Send(const Address &destination, const void *data, int size);
 	// Returns -1 if there is no data
 	int Receive(Address &sender, void *data, int size);
+	/*
+		Batched versions of Send() and Receive(), which need only one system
+		call for the whole batch where supported (sendmmsg/recvmmsg on Linux).
+	*/
+	// Returns the number of datagrams sent, failed ones are skipped
+	int SendMany(const Datagram *datagrams, int count);
+	// Waits like Receive(), then receives up to `count` datagrams that are
+	// already there. Returns the number received (0 if there is no data).
+	int ReceiveMany(Datagram *datagrams, int count);
+	// Whether the above really are batched
+	static bool hasBatchedIO();
+
 	void setTimeoutMs(int timeout_ms);
 	// Returns true if there is data, false if timeout occurred
 	bool WaitData(int timeout_ms);
 
 	// Debugging purposes only
 	int GetHandle() const { return m_handle; };
+	// Fraction of sent datagrams that are dropped on purpose, for testing
+	void setSimulatedPacketLoss(float loss) { m_simulated_loss = loss; }
 
 private:
+	// Returns false if the datagram was dropped instead of sent
+	bool prepareSend(const Datagram &d);
+	// Throws SendFailedException if it wasn't sent completely
+	void sendDatagram(const Datagram &d);
+	// Receives a datagram, only call when WaitData() says there is one.
+	// Returns -1 on error.
+	int receiveReady(Address &sender, void *data, int size);
+	void dumpReceived(const Address &sender, const void *data, int size);
+
 	int m_handle = -1;
 	int m_timeout_ms = -1;
 	unsigned short m_addr_family = 0;
+	// Set by tests while the send thread reads it
+	std::atomic<float> m_simulated_loss{INTERNET_SIMULATOR ?
+		1.0f / INTERNET_SIMULATOR_PACKET_LOSS : 0.0f};
 };
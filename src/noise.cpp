@@ -32,6 +32,10 @@
 #include "util/string.h"
 #include "exceptions.h"
 
+#if defined(__x86_64__) || defined(_M_X64)
+	#include <immintrin.h>
+#endif
+
 #define NOISE_MAGIC_X    1619
 #define NOISE_MAGIC_Y    31337
 #define NOISE_MAGIC_Z    52591
@@ -232,6 +236,198 @@ inline float triLinearInterpolation(
 	return linearInterpolation(u, v, z);
 }
 
+/*
+ * Interpolation of one row of a noise map. Within a lattice cell only the
+ * x coordinate changes, so the corner values are constants and the points
+ * can be computed independently. Every implementation does exactly the
+ * same float operations in the same order as biLinearInterpolation() and
+ * triLinearInterpolation(), so they give bit-identical results.
+ */
+typedef void (*InterpRow2DFunc)(float *out, const float *x, u32 n,
+	float v00, float v10, float v01, float v11, float y);
+typedef void (*InterpRow3DFunc)(float *out, const float *x, u32 n,
+	const float v[8], float y, float z);
+
+static void interpRow2D_scalar(float *out, const float *x, u32 n,
+	float v00, float v10, float v01, float v11, float y)
+{
+	for (u32 i = 0; i != n; i++)
+		out[i] = biLinearInterpolation(v00, v10, v01, v11, x[i], y, false);
+}
+
+static void interpRow3D_scalar(float *out, const float *x, u32 n,
+	const float v[8], float y, float z)
+{
+	for (u32 i = 0; i != n; i++) {
+		out[i] = triLinearInterpolation(
+			v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7],
+			x[i], y, z, false);
+	}
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define NOISE_HAVE_X86_SIMD 1
+
+// Mul and add are never fused, to match the scalar code
+
+static void interpRow2D_sse2(float *out, const float *x, u32 n,
+	float v00, float v10, float v01, float v11, float y)
+{
+	const __m128 a0 = _mm_set1_ps(v00), d0 = _mm_set1_ps(v10 - v00);
+	const __m128 a1 = _mm_set1_ps(v01), d1 = _mm_set1_ps(v11 - v01);
+	const __m128 vy = _mm_set1_ps(y);
+	u32 i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 vx = _mm_loadu_ps(x + i);
+		__m128 u = _mm_add_ps(a0, _mm_mul_ps(d0, vx));
+		__m128 v = _mm_add_ps(a1, _mm_mul_ps(d1, vx));
+		_mm_storeu_ps(out + i, _mm_add_ps(u, _mm_mul_ps(_mm_sub_ps(v, u), vy)));
+	}
+	interpRow2D_scalar(out + i, x + i, n - i, v00, v10, v01, v11, y);
+}
+
+static void interpRow3D_sse2(float *out, const float *x, u32 n,
+	const float v[8], float y, float z)
+{
+	const __m128 a0 = _mm_set1_ps(v[0]), d0 = _mm_set1_ps(v[1] - v[0]);
+	const __m128 a1 = _mm_set1_ps(v[2]), d1 = _mm_set1_ps(v[3] - v[2]);
+	const __m128 a2 = _mm_set1_ps(v[4]), d2 = _mm_set1_ps(v[5] - v[4]);
+	const __m128 a3 = _mm_set1_ps(v[6]), d3 = _mm_set1_ps(v[7] - v[6]);
+	const __m128 vy = _mm_set1_ps(y), vz = _mm_set1_ps(z);
+	u32 i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 vx = _mm_loadu_ps(x + i);
+		__m128 u0 = _mm_add_ps(a0, _mm_mul_ps(d0, vx));
+		__m128 v0 = _mm_add_ps(a1, _mm_mul_ps(d1, vx));
+		__m128 r0 = _mm_add_ps(u0, _mm_mul_ps(_mm_sub_ps(v0, u0), vy));
+		__m128 u1 = _mm_add_ps(a2, _mm_mul_ps(d2, vx));
+		__m128 v1 = _mm_add_ps(a3, _mm_mul_ps(d3, vx));
+		__m128 r1 = _mm_add_ps(u1, _mm_mul_ps(_mm_sub_ps(v1, u1), vy));
+		_mm_storeu_ps(out + i, _mm_add_ps(r0, _mm_mul_ps(_mm_sub_ps(r1, r0), vz)));
+	}
+	interpRow3D_scalar(out + i, x + i, n - i, v, y, z);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NOISE_HAVE_AVX2 1
+
+__attribute__((target("avx2")))
+static void interpRow2D_avx2(float *out, const float *x, u32 n,
+	float v00, float v10, float v01, float v11, float y)
+{
+	const __m256 a0 = _mm256_set1_ps(v00), d0 = _mm256_set1_ps(v10 - v00);
+	const __m256 a1 = _mm256_set1_ps(v01), d1 = _mm256_set1_ps(v11 - v01);
+	const __m256 vy = _mm256_set1_ps(y);
+	u32 i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 vx = _mm256_loadu_ps(x + i);
+		__m256 u = _mm256_add_ps(a0, _mm256_mul_ps(d0, vx));
+		__m256 v = _mm256_add_ps(a1, _mm256_mul_ps(d1, vx));
+		_mm256_storeu_ps(out + i,
+			_mm256_add_ps(u, _mm256_mul_ps(_mm256_sub_ps(v, u), vy)));
+	}
+	for (; i != n; i++)
+		out[i] = biLinearInterpolation(v00, v10, v01, v11, x[i], y, false);
+	// Avoid the penalty for mixing AVX and SSE code in the caller
+	_mm256_zeroupper();
+}
+
+__attribute__((target("avx2")))
+static void interpRow3D_avx2(float *out, const float *x, u32 n,
+	const float v[8], float y, float z)
+{
+	const __m256 a0 = _mm256_set1_ps(v[0]), d0 = _mm256_set1_ps(v[1] - v[0]);
+	const __m256 a1 = _mm256_set1_ps(v[2]), d1 = _mm256_set1_ps(v[3] - v[2]);
+	const __m256 a2 = _mm256_set1_ps(v[4]), d2 = _mm256_set1_ps(v[5] - v[4]);
+	const __m256 a3 = _mm256_set1_ps(v[6]), d3 = _mm256_set1_ps(v[7] - v[6]);
+	const __m256 vy = _mm256_set1_ps(y), vz = _mm256_set1_ps(z);
+	u32 i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 vx = _mm256_loadu_ps(x + i);
+		__m256 u0 = _mm256_add_ps(a0, _mm256_mul_ps(d0, vx));
+		__m256 v0 = _mm256_add_ps(a1, _mm256_mul_ps(d1, vx));
+		__m256 r0 = _mm256_add_ps(u0, _mm256_mul_ps(_mm256_sub_ps(v0, u0), vy));
+		__m256 u1 = _mm256_add_ps(a2, _mm256_mul_ps(d2, vx));
+		__m256 v1 = _mm256_add_ps(a3, _mm256_mul_ps(d3, vx));
+		__m256 r1 = _mm256_add_ps(u1, _mm256_mul_ps(_mm256_sub_ps(v1, u1), vy));
+		_mm256_storeu_ps(out + i,
+			_mm256_add_ps(r0, _mm256_mul_ps(_mm256_sub_ps(r1, r0), vz)));
+	}
+	for (; i != n; i++) {
+		out[i] = triLinearInterpolation(
+			v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7],
+			x[i], y, z, false);
+	}
+	_mm256_zeroupper();
+}
+#endif
+#endif
+
+static bool noiseSimdSupported(NoiseSimd impl)
+{
+	switch (impl) {
+	case NoiseSimd::Scalar:
+		return true;
+#ifdef NOISE_HAVE_X86_SIMD
+	case NoiseSimd::SSE2:
+		return true;
+#endif
+#ifdef NOISE_HAVE_AVX2
+	case NoiseSimd::AVX2:
+		// May run before the constructor that usually does this
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+static NoiseSimd g_noise_simd = NoiseSimd::Scalar;
+static InterpRow2DFunc g_interp_row_2d = interpRow2D_scalar;
+static InterpRow3DFunc g_interp_row_3d = interpRow3D_scalar;
+
+NoiseSimd getNoiseSimd()
+{
+	return g_noise_simd;
+}
+
+bool setNoiseSimd(NoiseSimd impl)
+{
+	if (!noiseSimdSupported(impl))
+		return false;
+
+	switch (impl) {
+#ifdef NOISE_HAVE_X86_SIMD
+	case NoiseSimd::SSE2:
+		g_interp_row_2d = interpRow2D_sse2;
+		g_interp_row_3d = interpRow3D_sse2;
+		break;
+#endif
+#ifdef NOISE_HAVE_AVX2
+	case NoiseSimd::AVX2:
+		g_interp_row_2d = interpRow2D_avx2;
+		g_interp_row_3d = interpRow3D_avx2;
+		break;
+#endif
+	default:
+		g_interp_row_2d = interpRow2D_scalar;
+		g_interp_row_3d = interpRow3D_scalar;
+		break;
+	}
+	g_noise_simd = impl;
+	return true;
+}
+
+// Pick the best implementation on startup
+static const bool g_noise_simd_init = [] {
+	for (NoiseSimd impl : {NoiseSimd::AVX2, NoiseSimd::SSE2}) {
+		if (setNoiseSimd(impl))
+			break;
+	}
+	return true;
+}();
+
 float noise2d_gradient(float x, float y, s32 seed, bool eased)
 {
 	// Calculate the integer coordinates
@@ -487,14 +683,34 @@ void Noise::resizeNoiseBuf(bool is3d)
  * values from the previous noise lattice as midpoints in the new lattice for the
  * next octave.
  */
+void Noise::prepareRowInterpolation(float u, float step_x, bool eased)
+{
+	// Steps through the row exactly like the interpolation used to, so that
+	// the coordinates (and thus the results) stay the same
+	interp_x.resize(sx);
+	interp_run_end.clear();
+	for (u32 i = 0; i != sx; i++) {
+		interp_x[i] = eased ? easeCurve(u) : u;
+
+		u += step_x;
+		if (u >= 1.0) {
+			u -= 1.0;
+			interp_run_end.push_back(i + 1);
+		}
+	}
+	if (interp_run_end.empty() || interp_run_end.back() != sx)
+		interp_run_end.push_back(sx);
+}
+
+
 #define idx(x, y) ((y) * nlx + (x))
 void Noise::gradientMap2D(
 		float x, float y,
 		float step_x, float step_y,
 		s32 seed)
 {
-	float v00, v01, v10, v11, u, v, orig_u;
-	u32 index, i, j, noisex, noisey;
+	float u, v;
+	u32 index, i, j, noisey;
 	u32 nlx, nly;
 	s32 x0, y0;
 
@@ -503,7 +719,6 @@ void Noise::gradientMap2D(
 	y0 = std::floor(y);
 	u = x - (float)x0;
 	v = y - (float)y0;
-	orig_u = u;
 
 	//calculate noise point lattice
 	nlx = (u32)(u + sx * step_x) + 2;
@@ -514,30 +729,23 @@ void Noise::gradientMap2D(
 			noise_buf[index++] = noise2d(x0 + i, y0 + j, seed);
 
 	//calculate interpolations
+	prepareRowInterpolation(u, step_x, eased);
+	const InterpRow2DFunc interp_row = g_interp_row_2d;
 	index  = 0;
 	noisey = 0;
 	for (j = 0; j != sy; j++) {
-		v00 = noise_buf[idx(0, noisey)];
-		v10 = noise_buf[idx(1, noisey)];
-		v01 = noise_buf[idx(0, noisey + 1)];
-		v11 = noise_buf[idx(1, noisey + 1)];
-
-		u = orig_u;
-		noisex = 0;
-		for (i = 0; i != sx; i++) {
-			gradient_buf[index++] =
-				biLinearInterpolation(v00, v10, v01, v11, u, v, eased);
-
-			u += step_x;
-			if (u >= 1.0) {
-				u -= 1.0;
-				noisex++;
-				v00 = v10;
-				v01 = v11;
-				v10 = noise_buf[idx(noisex + 1, noisey)];
-				v11 = noise_buf[idx(noisex + 1, noisey + 1)];
-			}
+		const float *row0 = &noise_buf[idx(0, noisey)];
+		const float *row1 = &noise_buf[idx(0, noisey + 1)];
+		float ve = eased ? easeCurve(v) : v;
+
+		u32 start = 0;
+		for (u32 noisex = 0; noisex != interp_run_end.size(); noisex++) {
+			u32 end = interp_run_end[noisex];
+			interp_row(&gradient_buf[index + start], &interp_x[start], end - start,
+				row0[noisex], row0[noisex + 1], row1[noisex], row1[noisex + 1], ve);
+			start = end;
 		}
+		index += sx;
 
 		v += step_y;
 		if (v >= 1.0) {
@@ -555,10 +763,8 @@ void Noise::gradientMap3D(
 		float step_x, float step_y, float step_z,
 		s32 seed)
 {
-	float v000, v010, v100, v110;
-	float v001, v011, v101, v111;
-	float u, v, w, orig_u, orig_v;
-	u32 index, i, j, k, noisex, noisey, noisez;
+	float u, v, w, orig_v;
+	u32 index, i, j, k, noisey, noisez;
 	u32 nlx, nly, nlz;
 	s32 x0, y0, z0;
 
@@ -570,7 +776,6 @@ void Noise::gradientMap3D(
 	u = x - (float)x0;
 	v = y - (float)y0;
 	w = z - (float)z0;
-	orig_u = u;
 	orig_v = v;
 
 	//calculate noise point lattice
@@ -584,45 +789,36 @@ void Noise::gradientMap3D(
 				noise_buf[index++] = noise3d(x0 + i, y0 + j, z0 + k, seed);
 
 	//calculate interpolations
+	prepareRowInterpolation(u, step_x, eased);
+	const InterpRow3DFunc interp_row = g_interp_row_3d;
 	index  = 0;
 	noisey = 0;
 	noisez = 0;
 	for (k = 0; k != sz; k++) {
+		float we = eased ? easeCurve(w) : w;
 		v = orig_v;
 		noisey = 0;
 		for (j = 0; j != sy; j++) {
-			v000 = noise_buf[idx(0, noisey,     noisez)];
-			v100 = noise_buf[idx(1, noisey,     noisez)];
-			v010 = noise_buf[idx(0, noisey + 1, noisez)];
-			v110 = noise_buf[idx(1, noisey + 1, noisez)];
-			v001 = noise_buf[idx(0, noisey,     noisez + 1)];
-			v101 = noise_buf[idx(1, noisey,     noisez + 1)];
-			v011 = noise_buf[idx(0, noisey + 1, noisez + 1)];
-			v111 = noise_buf[idx(1, noisey + 1, noisez + 1)];
-
-			u = orig_u;
-			noisex = 0;
-			for (i = 0; i != sx; i++) {
-				gradient_buf[index++] = triLinearInterpolation(
-					v000, v100, v010, v110,
-					v001, v101, v011, v111,
-					u, v, w,
-					eased);
-
-				u += step_x;
-				if (u >= 1.0) {
-					u -= 1.0;
-					noisex++;
-					v000 = v100;
-					v010 = v110;
-					v100 = noise_buf[idx(noisex + 1, noisey,     noisez)];
-					v110 = noise_buf[idx(noisex + 1, noisey + 1, noisez)];
-					v001 = v101;
-					v011 = v111;
-					v101 = noise_buf[idx(noisex + 1, noisey,     noisez + 1)];
-					v111 = noise_buf[idx(noisex + 1, noisey + 1, noisez + 1)];
-				}
+			const float *row00 = &noise_buf[idx(0, noisey,     noisez)];
+			const float *row10 = &noise_buf[idx(0, noisey + 1, noisez)];
+			const float *row01 = &noise_buf[idx(0, noisey,     noisez + 1)];
+			const float *row11 = &noise_buf[idx(0, noisey + 1, noisez + 1)];
+			float ve = eased ? easeCurve(v) : v;
+
+			u32 start = 0;
+			for (u32 noisex = 0; noisex != interp_run_end.size(); noisex++) {
+				u32 end = interp_run_end[noisex];
+				const float corners[8] = {
+					row00[noisex], row00[noisex + 1],
+					row10[noisex], row10[noisex + 1],
+					row01[noisex], row01[noisex + 1],
+					row11[noisex], row11[noisex + 1],
+				};
+				interp_row(&gradient_buf[index + start], &interp_x[start],
+					end - start, corners, ve, we);
+				start = end;
 			}
+			index += sx;
 
 			v += step_y;
 			if (v >= 1.0) {
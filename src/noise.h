@@ -25,6 +25,7 @@
 
 #pragma once
 
+#include <vector>
 #include "irr_v3d.h"
 #include "exceptions.h"
 #include "util/string.h"
@@ -198,9 +199,29 @@ class Noise {
 	void resizeNoiseBuf(bool is3d);
 	void updateResults(float g, float *gmap, const float *persistence_map,
 			size_t bufsize);
+	// Fills interp_x and interp_run_end for a row of sx points
+	void prepareRowInterpolation(float u, float step_x, bool eased);
 
+	// X coordinate of every point of a row, relative to its lattice cell
+	std::vector<float> interp_x;
+	// Points [interp_run_end[i - 1], interp_run_end[i]) are in lattice cell i
+	std::vector<u32> interp_run_end;
 };
 
+/*
+	Implementations of the interpolation loops of Noise. All of them give
+	bit-identical results, by default the fastest one the CPU supports is used.
+*/
+enum class NoiseSimd {
+	Scalar,
+	SSE2,
+	AVX2,
+};
+
+NoiseSimd getNoiseSimd();
+// Returns false if the CPU doesn't support it
+bool setNoiseSimd(NoiseSimd impl);
+
 float NoisePerlin2D(const NoiseParams *np, float x, float y, s32 seed);
 float NoisePerlin3D(const NoiseParams *np, float x, float y, float z, s32 seed);
 
@@ -0,0 +1,107 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "object_position.h"
+#include <cmath>
+#include "util/numeric.h"
+#include "util/serialize.h"
+
+// Flags of a delta
+#define DELTA_INTERPOLATE    0x01
+#define DELTA_MOVEMENT_END   0x02
+#define DELTA_VELOCITY       0x04
+#define DELTA_ACCELERATION   0x08
+#define DELTA_ROTATION       0x10
+
+void writeObjectPosition(std::ostream &os, const ObjectPosition &pos)
+{
+	writeV3F32(os, pos.position);
+	writeV3F32(os, pos.velocity);
+	writeV3F32(os, pos.acceleration);
+	writeV3F32(os, pos.rotation);
+	writeU8(os, pos.do_interpolate);
+	writeU8(os, pos.is_movement_end);
+	writeF32(os, pos.update_interval);
+}
+
+ObjectPosition readObjectPosition(std::istream &is)
+{
+	ObjectPosition pos;
+	pos.position = readV3F32(is);
+	pos.velocity = readV3F32(is);
+	pos.acceleration = readV3F32(is);
+	pos.rotation = readV3F32(is);
+	pos.do_interpolate = readU8(is);
+	pos.is_movement_end = readU8(is);
+	pos.update_interval = readF32(is);
+	return pos;
+}
+
+static bool quantize(v3f delta, v3s16 *result)
+{
+	const v3f steps = delta / OBJECT_POSITION_STEP;
+	// Also false for NaN
+	if (!(std::fabs(steps.X) <= S16_MAX && std::fabs(steps.Y) <= S16_MAX &&
+			std::fabs(steps.Z) <= S16_MAX))
+		return false;
+	*result = v3s16(std::round(steps.X), std::round(steps.Y), std::round(steps.Z));
+	return true;
+}
+
+static v3f dequantize(v3s16 steps)
+{
+	return v3f(steps.X, steps.Y, steps.Z) * OBJECT_POSITION_STEP;
+}
+
+bool writeObjectPositionDelta(std::ostream &os, const ObjectPosition &keyframe,
+		const ObjectPosition &pos)
+{
+	v3s16 position, velocity, acceleration, rotation;
+	if (!quantize(pos.position - keyframe.position, &position) ||
+			!quantize(pos.velocity - keyframe.velocity, &velocity) ||
+			!quantize(pos.acceleration - keyframe.acceleration, &acceleration) ||
+			!quantize(pos.rotation - keyframe.rotation, &rotation))
+		return false;
+
+	u8 flags = 0;
+	if (pos.do_interpolate)
+		flags |= DELTA_INTERPOLATE;
+	if (pos.is_movement_end)
+		flags |= DELTA_MOVEMENT_END;
+	if (velocity != v3s16())
+		flags |= DELTA_VELOCITY;
+	if (acceleration != v3s16())
+		flags |= DELTA_ACCELERATION;
+	if (rotation != v3s16())
+		flags |= DELTA_ROTATION;
+
+	writeU8(os, flags);
+	writeV3S16(os, position);
+	if (flags & DELTA_VELOCITY)
+		writeV3S16(os, velocity);
+	if (flags & DELTA_ACCELERATION)
+		writeV3S16(os, acceleration);
+	if (flags & DELTA_ROTATION)
+		writeV3S16(os, rotation);
+	// in milliseconds
+	writeU16(os, (u16)rangelim(std::round(pos.update_interval * 1000), 0, U16_MAX));
+	return true;
+}
+
+ObjectPosition readObjectPositionDelta(std::istream &is,
+		const ObjectPosition &keyframe)
+{
+	ObjectPosition pos = keyframe;
+	const u8 flags = readU8(is);
+	pos.do_interpolate = flags & DELTA_INTERPOLATE;
+	pos.is_movement_end = flags & DELTA_MOVEMENT_END;
+	pos.position += dequantize(readV3S16(is));
+	if (flags & DELTA_VELOCITY)
+		pos.velocity += dequantize(readV3S16(is));
+	if (flags & DELTA_ACCELERATION)
+		pos.acceleration += dequantize(readV3S16(is));
+	if (flags & DELTA_ROTATION)
+		pos.rotation += dequantize(readV3S16(is));
+	pos.update_interval = readU16(is) / 1000.0f;
+	return pos;
+}
@@ -0,0 +1,42 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <iostream>
+#include "irrlichttypes_bloated.h"
+
+/*
+	Position of an active object as sent to clients.
+
+	AO_CMD_UPDATE_POSITION sends all of it every time. Since protocol 45
+	the server sends a full AO_CMD_POSITION_KEYFRAME reliably now and then,
+	and AO_CMD_POSITION_DELTA in between: the difference to the keyframe,
+	in steps of OBJECT_POSITION_STEP, leaving out what didn't change.
+	Deltas name their keyframe, clients drop those for a keyframe they
+	don't have (yet). So lost deltas never add up.
+*/
+struct ObjectPosition
+{
+	v3f position;
+	v3f velocity;
+	v3f acceleration;
+	v3f rotation;
+	bool do_interpolate = false;
+	bool is_movement_end = false;
+	f32 update_interval = 0.0f;
+};
+
+// Step of the position, velocity and acceleration (BS units) and rotation
+// (degrees) in deltas; a delta can be up to 32767 steps
+#define OBJECT_POSITION_STEP (1.0f / 64)
+
+// Without the command
+void writeObjectPosition(std::ostream &os, const ObjectPosition &pos);
+ObjectPosition readObjectPosition(std::istream &is);
+
+// Returns false and writes nothing if `pos` is too far from the keyframe
+bool writeObjectPositionDelta(std::ostream &os, const ObjectPosition &keyframe,
+		const ObjectPosition &pos);
+ObjectPosition readObjectPositionDelta(std::istream &is,
+		const ObjectPosition &keyframe);
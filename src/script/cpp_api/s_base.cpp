@@ -28,6 +28,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "porting.h"
 #include "util/string.h"
 #include "server.h"
+#include "util/metricsbackend.h"
 #ifndef SERVER
 #include "client/client.h"
 #endif
@@ -427,6 +428,8 @@ void ScriptApiBase::stackDump(std::ostream &o)
 void ScriptApiBase::setOriginDirect(const char *origin)
 {
 	m_last_run_mod = origin ? origin : "??";
+	if (m_callback_type != ScriptCallbackType::MAX)
+		switchCallbackCounter();
 }
 
 void ScriptApiBase::setOriginFromTableRaw(int index, const char *fxn)
@@ -434,6 +437,87 @@ void ScriptApiBase::setOriginFromTableRaw(int index, const char *fxn)
 	lua_State *L = getStack();
 	m_last_run_mod = lua_istable(L, index) ?
 		getstringfield_default(L, index, "mod_origin", "") : "";
+	if (m_callback_type != ScriptCallbackType::MAX)
+		switchCallbackCounter();
+}
+
+static const char *callback_type_names[] = {
+	"abm",
+	"globalstep",
+	"on_punch",
+	"entity_on_step",
+};
+static_assert(ARRLEN(callback_type_names) == (size_t)ScriptCallbackType::MAX);
+
+void ScriptApiBase::switchCallbackCounter(MetricCounter *counter)
+{
+	u64 now = porting::getTimeUs();
+	if (m_callback_counter)
+		m_callback_counter->increment(now - m_callback_time_us);
+	m_callback_time_us = now;
+	m_callback_counter = counter;
+}
+
+void ScriptApiBase::switchCallbackCounter()
+{
+	if (m_callback_type == ScriptCallbackType::MAX) {
+		switchCallbackCounter(nullptr);
+		return;
+	}
+
+	auto &counters = m_callback_counters[(size_t)m_callback_type];
+	auto it = counters.find(m_last_run_mod);
+	if (it == counters.end()) {
+		const std::string &mod = m_last_run_mod.empty() ? "??" : m_last_run_mod;
+		auto counter = m_callback_metrics->addCounter("minetest_lua_callback_time",
+				"Time spent in Lua callbacks (in microseconds)",
+				{{"mod", mod}, {"callback", callback_type_names[(size_t)m_callback_type]}});
+		it = counters.emplace(m_last_run_mod, std::move(counter)).first;
+	}
+	switchCallbackCounter(it->second.get());
+}
+
+ScriptCallbackTimer::ScriptCallbackTimer(ScriptApiBase *script,
+		ScriptCallbackType type) :
+	m_script(script->m_callback_metrics ? script : nullptr),
+	m_outer_type(script->m_callback_type),
+	m_outer_counter(script->m_callback_counter)
+{
+	if (!m_script)
+		return;
+	m_outer_origin = script->m_last_run_mod;
+	// Stop the outer callback, the counter of this one is picked once the
+	// origin is set
+	m_script->switchCallbackCounter(nullptr);
+	m_script->m_callback_type = type;
+}
+
+ScriptCallbackTimer::~ScriptCallbackTimer()
+{
+	if (!m_script)
+		return;
+	// Account the rest to this callback, then resume the outer one
+	m_script->switchCallbackCounter(m_outer_counter);
+	m_script->m_callback_type = m_outer_type;
+	m_script->m_last_run_mod = std::move(m_outer_origin);
+}
+
+ScriptOriginRestorer::ScriptOriginRestorer(ScriptApiBase *script) :
+	m_script(script->m_callback_type != ScriptCallbackType::MAX ? script : nullptr)
+{
+	if (!m_script)
+		return;
+	m_origin = script->m_last_run_mod;
+	m_counter = script->m_callback_counter;
+}
+
+ScriptOriginRestorer::~ScriptOriginRestorer()
+{
+	if (!m_script)
+		return;
+	m_script->m_last_run_mod = std::move(m_origin);
+	if (m_script->m_callback_counter != m_counter)
+		m_script->switchCallbackCounter(m_counter);
 }
 
 /*
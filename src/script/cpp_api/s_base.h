@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include <iostream>
+#include <memory>
 #include <string>
 #include <thread>
 #include <mutex>
@@ -57,6 +58,15 @@ extern "C" {
 #define setOriginFromTable(index) \
 	setOriginFromTableRaw(index, __FUNCTION__)
 
+// Kinds of callbacks whose run time is accounted, see ScriptCallbackTimer
+enum class ScriptCallbackType : u8 {
+	Abm,
+	Globalstep,
+	Punch,
+	EntityStep,
+	MAX
+};
+
 enum class ScriptingType: u8 {
 	Async, // either mainmenu (client) or ingame (server)
 	Client,
@@ -75,6 +85,8 @@ class Environment;
 class GUIEngine;
 class ServerActiveObject;
 struct PlayerHPChangeReason;
+class MetricsBackend;
+class MetricCounter;
 
 class ScriptApiBase : protected LuaHelper {
 public:
@@ -137,6 +149,9 @@ class ScriptApiBase : protected LuaHelper {
 	// Check things that should be set by the builtin mod.
 	void checkSetByBuiltin();
 
+	// Enables the run time accounting of callbacks, `mb` must outlive this
+	void setCallbackMetrics(MetricsBackend *mb) { m_callback_metrics = mb; }
+
 protected:
 	friend class LuaABM;
 	friend class LuaLBM;
@@ -146,6 +161,8 @@ class ScriptApiBase : protected LuaHelper {
 	friend class ModApiBase;
 	friend class ModApiEnv;
 	friend class LuaVoxelManip;
+	friend class ScriptCallbackTimer;
+	friend class ScriptOriginRestorer;
 	friend class TestMoveAction; // needs getStack()
 
 	/*
@@ -205,4 +222,59 @@ class ScriptApiBase : protected LuaHelper {
 	EmergeThread   *m_emerge = nullptr;
 
 	ScriptingType  m_type;
+
+	// Adds the time since the last call to the counter of the running
+	// callback, then switches to the counter of the current origin
+	void switchCallbackCounter();
+	// Same, but switches to the given counter
+	void switchCallbackCounter(MetricCounter *counter);
+
+	MetricsBackend *m_callback_metrics = nullptr;
+	// Counters by callback type and mod
+	std::unordered_map<std::string, std::shared_ptr<MetricCounter>>
+		m_callback_counters[(size_t)ScriptCallbackType::MAX];
+	// Type of the running callback, MAX if none
+	ScriptCallbackType m_callback_type = ScriptCallbackType::MAX;
+	MetricCounter  *m_callback_counter = nullptr;
+	u64            m_callback_time_us = 0;
+};
+
+/*
+	Accounts the run time of a callback, by the mod it belongs to, for as
+	long as it exists. The mod is taken from the script origin, so time
+	spent after the origin changes (e.g. between the callbacks of
+	core.run_callbacks) goes to the new mod. Nested callbacks are accounted
+	to themselves only, and the outer origin is restored once they end.
+	Construct it right before setting the origin of the callback.
+*/
+class ScriptCallbackTimer
+{
+public:
+	ScriptCallbackTimer(ScriptApiBase *script, ScriptCallbackType type);
+	~ScriptCallbackTimer();
+	DISABLE_CLASS_COPY(ScriptCallbackTimer)
+
+private:
+	ScriptApiBase *m_script;
+	ScriptCallbackType m_outer_type;
+	MetricCounter *m_outer_counter;
+	std::string m_outer_origin;
+};
+
+/*
+	Restores the script origin, and with it the accounted mod, when a
+	callback that is not timed itself (e.g. on_construct run by set_node)
+	returns into a timed one. Only does anything while a timer is running.
+*/
+class ScriptOriginRestorer
+{
+public:
+	ScriptOriginRestorer(ScriptApiBase *script);
+	~ScriptOriginRestorer();
+	DISABLE_CLASS_COPY(ScriptOriginRestorer)
+
+private:
+	ScriptApiBase *m_script;
+	std::string m_origin;
+	MetricCounter *m_counter = nullptr;
 };
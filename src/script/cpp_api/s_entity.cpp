@@ -248,6 +248,7 @@ void ScriptApiEntity::luaentity_Step(u16 id, float dtime,
 	else
 		lua_pushnil(L);
 
+	ScriptCallbackTimer timer(this, ScriptCallbackType::EntityStep);
 	setOriginFromTable(object);
 	PCALL_RES(lua_pcall(L, 3, 0, error_handler));
 
@@ -285,6 +286,7 @@ bool ScriptApiEntity::luaentity_Punch(u16 id,
 	push_v3f(L, dir);
 	lua_pushnumber(L, damage);
 
+	ScriptCallbackTimer timer(this, ScriptCallbackType::Punch);
 	setOriginFromTable(object);
 	PCALL_RES(lua_pcall(L, 6, 1, error_handler));
 
@@ -53,6 +53,7 @@ void ScriptApiEnv::environment_Step(float dtime)
 	lua_getfield(L, -1, "registered_globalsteps");
 	// Call callbacks
 	lua_pushnumber(L, dtime);
+	ScriptCallbackTimer timer(this, ScriptCallbackType::Globalstep);
 	runCallbacks(1, RUN_CALLBACKS_MODE_FIRST);
 }
 
@@ -113,6 +113,8 @@ bool ScriptApiNode::node_on_punch(v3s16 p, MapNode node,
 
 	const NodeDefManager *ndef = getServer()->ndef();
 
+	ScriptCallbackTimer timer(this, ScriptCallbackType::Punch);
+
 	// Push callback function on stack
 	if (!getItemCallback(ndef->get(node).name.c_str(), "on_punch", &p))
 		return false;
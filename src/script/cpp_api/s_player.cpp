@@ -76,6 +76,7 @@ bool ScriptApiPlayer::on_punchplayer(ServerActiveObject *player,
 	push_tool_capabilities(L, *toolcap);
 	push_v3f(L, dir);
 	lua_pushnumber(L, damage);
+	ScriptCallbackTimer timer(this, ScriptCallbackType::Punch);
 	runCallbacks(6, RUN_CALLBACKS_MODE_OR);
 	return readParam<bool>(L, -1);
 }
@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include <algorithm>
+#include <optional>
 #include "lua_api/l_env.h"
 #include "lua_api/l_internal.h"
 #include "lua_api/l_nodemeta.h"
@@ -91,6 +92,7 @@ void LuaABM::trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 		FATAL_ERROR("");
 	lua_remove(L, -2); // Remove registered_abms
 
+	ScriptCallbackTimer timer(scriptIface, ScriptCallbackType::Abm);
 	scriptIface->setOriginFromTable(-1);
 
 	// Call action
@@ -134,6 +136,7 @@ void LuaLBM::trigger(ServerEnvironment *env, v3s16 p,
 	FATAL_ERROR_IF(lua_isnil(L, -1), "Entry with given id not found in registered_lbms table");
 	lua_remove(L, -2); // Remove registered_lbms
 
+	ScriptOriginRestorer origin_restorer(scriptIface);
 	scriptIface->setOriginFromTable(-1);
 
 	// Call action
@@ -293,6 +296,11 @@ int ModApiEnv::l_bulk_set_node(lua_State *L)
 
 	MapNode n = readnode(L, 2);
 
+	// Relight all the nodes in one go at the end
+	std::optional<MapLightingBatch> lighting_batch;
+	if (len > 1)
+		lighting_batch.emplace(&env->getMap());
+
 	// Do it
 	bool succeeded = true;
 	for (s32 i = 1; i <= len; i++) {
@@ -238,6 +238,18 @@ int ModApiServer::l_get_player_information(lua_State *L)
 		lua_settable(L, table);
 	}
 
+	float cwnd, packet_loss;
+	if (getConInfo(con::CWND, &cwnd) &&
+			getConInfo(con::PACKET_LOSS, &packet_loss)) {
+		lua_pushstring(L, "cwnd");
+		lua_pushnumber(L, cwnd);
+		lua_settable(L, table);
+
+		lua_pushstring(L, "packet_loss");
+		lua_pushnumber(L, packet_loss);
+		lua_settable(L, table);
+	}
+
 	lua_pushstring(L,"connection_uptime");
 	lua_pushnumber(L, info.uptime);
 	lua_settable(L, table);
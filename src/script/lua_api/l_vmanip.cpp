@@ -17,7 +17,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <cstring>
 #include <map>
+#include <memory>
+#include <optional>
 #include "lua_api/l_vmanip.h"
 #include "lua_api/l_mapgen.h"
 #include "lua_api/l_internal.h"
@@ -321,6 +324,246 @@ int LuaVoxelManip::l_set_param2_data(lua_State *L)
 	return 0;
 }
 
+/*
+	Packed string variants of the above: content IDs take two bytes per node
+	in native byte order, light and param2 one byte each.
+*/
+
+int LuaVoxelManip::l_get_data_string(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelManip *o = checkObject<LuaVoxelManip>(L, 1);
+	MMVManip *vm = o->vm;
+
+	u32 volume = vm->m_area.getVolume();
+	std::unique_ptr<content_t[]> data(new content_t[volume]);
+	for (u32 i = 0; i != volume; i++)
+		data[i] = vm->m_data[i].getContent();
+
+	lua_pushlstring(L, reinterpret_cast<const char *>(data.get()),
+		volume * sizeof(content_t));
+	return 1;
+}
+
+int LuaVoxelManip::l_set_data_string(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelManip *o = checkObject<LuaVoxelManip>(L, 1);
+	MMVManip *vm = o->vm;
+
+	if (lua_type(L, 2) != LUA_TSTRING)
+		throw LuaError("VoxelManip:set_data_string called with missing "
+				"parameter");
+
+	u32 volume = vm->m_area.getVolume();
+	size_t len;
+	const char *data = lua_tolstring(L, 2, &len);
+	if (len != volume * sizeof(content_t))
+		throw LuaError("VoxelManip:set_data_string called with data of "
+				"wrong length");
+
+	for (u32 i = 0; i != volume; i++) {
+		content_t c;
+		memcpy(&c, data + i * sizeof(content_t), sizeof(content_t));
+		vm->m_data[i].setContent(c);
+	}
+
+	return 0;
+}
+
+static int push_param_string(lua_State *L, MMVManip *vm, u8 MapNode::*param)
+{
+	u32 volume = vm->m_area.getVolume();
+	std::string data(volume, '\0');
+	for (u32 i = 0; i != volume; i++)
+		data[i] = vm->m_data[i].*param;
+
+	lua_pushlstring(L, data.c_str(), data.size());
+	return 1;
+}
+
+static void read_param_string(lua_State *L, MMVManip *vm, u8 MapNode::*param,
+	const char *method)
+{
+	if (lua_type(L, 2) != LUA_TSTRING)
+		throw LuaError(std::string("VoxelManip:") + method +
+				" called with missing parameter");
+
+	u32 volume = vm->m_area.getVolume();
+	size_t len;
+	const char *data = lua_tolstring(L, 2, &len);
+	if (len != volume)
+		throw LuaError(std::string("VoxelManip:") + method +
+				" called with data of wrong length");
+
+	for (u32 i = 0; i != volume; i++)
+		vm->m_data[i].*param = data[i];
+}
+
+int LuaVoxelManip::l_get_light_data_string(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelManip *o = checkObject<LuaVoxelManip>(L, 1);
+
+	return push_param_string(L, o->vm, &MapNode::param1);
+}
+
+int LuaVoxelManip::l_set_light_data_string(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelManip *o = checkObject<LuaVoxelManip>(L, 1);
+
+	read_param_string(L, o->vm, &MapNode::param1, "set_light_data_string");
+	return 0;
+}
+
+int LuaVoxelManip::l_get_param2_data_string(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelManip *o = checkObject<LuaVoxelManip>(L, 1);
+
+	return push_param_string(L, o->vm, &MapNode::param2);
+}
+
+int LuaVoxelManip::l_set_param2_data_string(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelManip *o = checkObject<LuaVoxelManip>(L, 1);
+
+	read_param_string(L, o->vm, &MapNode::param2, "set_param2_data_string");
+	return 0;
+}
+
+// Reads the area given by the positions at idx and idx + 1
+static VoxelArea read_vm_area(lua_State *L, MMVManip *vm, int idx)
+{
+	v3s16 pmin = check_v3s16(L, idx);
+	v3s16 pmax = check_v3s16(L, idx + 1);
+	sortBoxVerticies(pmin, pmax);
+
+	VoxelArea area(pmin, pmax);
+	if (!vm->m_area.contains(area))
+		throw LuaError("Specified voxel area out of VoxelManipulator bounds");
+	return area;
+}
+
+// Reads a content ID or a list of them
+static std::vector<bool> read_content_set(lua_State *L, int idx)
+{
+	std::vector<bool> contents;
+	auto add = [&] (lua_Integer c) {
+		if (c < 0 || c > U16_MAX)
+			throw LuaError("Invalid content ID");
+		if ((size_t)c >= contents.size())
+			contents.resize(c + 1, false);
+		contents[c] = true;
+	};
+
+	if (lua_istable(L, idx)) {
+		lua_pushnil(L);
+		while (lua_next(L, idx) != 0) {
+			add(luaL_checkinteger(L, -1));
+			lua_pop(L, 1);
+		}
+	} else {
+		add(luaL_checkinteger(L, idx));
+	}
+	return contents;
+}
+
+static content_t read_content_id(lua_State *L, int idx)
+{
+	lua_Integer c = luaL_checkinteger(L, idx);
+	if (c < 0 || c > U16_MAX)
+		throw LuaError("Invalid content ID");
+	return c;
+}
+
+static std::optional<u8> read_optional_param2(lua_State *L, int idx)
+{
+	if (lua_isnoneornil(L, idx))
+		return std::nullopt;
+	return (u8)luaL_checkinteger(L, idx);
+}
+
+int LuaVoxelManip::l_fill(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelManip *o = checkObject<LuaVoxelManip>(L, 1);
+	MMVManip *vm = o->vm;
+
+	VoxelArea area = read_vm_area(L, vm, 2);
+	content_t c = read_content_id(L, 4);
+	std::optional<u8> param2 = read_optional_param2(L, 5);
+	std::optional<u8> where_param2 = read_optional_param2(L, 6);
+
+	lua_pushinteger(L, vm->fillArea(area, c, param2, nullptr, where_param2));
+	return 1;
+}
+
+int LuaVoxelManip::l_replace(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelManip *o = checkObject<LuaVoxelManip>(L, 1);
+	MMVManip *vm = o->vm;
+
+	VoxelArea area = read_vm_area(L, vm, 2);
+	std::vector<bool> from = read_content_set(L, 4);
+	content_t to = read_content_id(L, 5);
+
+	lua_pushinteger(L, vm->fillArea(area, to, std::nullopt, &from));
+	return 1;
+}
+
+int LuaVoxelManip::l_count_contents(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelManip *o = checkObject<LuaVoxelManip>(L, 1);
+	MMVManip *vm = o->vm;
+
+	VoxelArea area = read_vm_area(L, vm, 2);
+	std::vector<u32> counts;
+	vm->countContents(area, counts);
+
+	lua_newtable(L);
+	for (size_t c = 0; c < counts.size(); c++) {
+		if (counts[c] == 0)
+			continue;
+		lua_pushinteger(L, counts[c]);
+		lua_rawseti(L, -2, c);
+	}
+	return 1;
+}
+
+int LuaVoxelManip::l_find_contents(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelManip *o = checkObject<LuaVoxelManip>(L, 1);
+	MMVManip *vm = o->vm;
+
+	VoxelArea area = read_vm_area(L, vm, 2);
+	std::vector<bool> contents = read_content_set(L, 4);
+	std::vector<v3s16> found;
+	vm->findContents(area, contents, found);
+
+	lua_createtable(L, found.size(), 0);
+	for (size_t i = 0; i < found.size(); i++) {
+		push_v3s16(L, found[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
 int LuaVoxelManip::l_update_map(lua_State *L)
 {
 	return 0;
@@ -456,6 +699,16 @@ const luaL_Reg LuaVoxelManip::methods[] = {
 	luamethod(LuaVoxelManip, set_light_data),
 	luamethod(LuaVoxelManip, get_param2_data),
 	luamethod(LuaVoxelManip, set_param2_data),
+	luamethod(LuaVoxelManip, get_data_string),
+	luamethod(LuaVoxelManip, set_data_string),
+	luamethod(LuaVoxelManip, get_light_data_string),
+	luamethod(LuaVoxelManip, set_light_data_string),
+	luamethod(LuaVoxelManip, get_param2_data_string),
+	luamethod(LuaVoxelManip, set_param2_data_string),
+	luamethod(LuaVoxelManip, fill),
+	luamethod(LuaVoxelManip, replace),
+	luamethod(LuaVoxelManip, count_contents),
+	luamethod(LuaVoxelManip, find_contents),
 	luamethod(LuaVoxelManip, was_modified),
 	luamethod(LuaVoxelManip, get_emerged_area),
 	{0,0}
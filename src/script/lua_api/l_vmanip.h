@@ -57,6 +57,18 @@ class LuaVoxelManip : public ModApiBase
 	static int l_get_param2_data(lua_State *L);
 	static int l_set_param2_data(lua_State *L);
 
+	static int l_get_data_string(lua_State *L);
+	static int l_set_data_string(lua_State *L);
+	static int l_get_light_data_string(lua_State *L);
+	static int l_set_light_data_string(lua_State *L);
+	static int l_get_param2_data_string(lua_State *L);
+	static int l_set_param2_data_string(lua_State *L);
+
+	static int l_fill(lua_State *L);
+	static int l_replace(lua_State *L);
+	static int l_count_contents(lua_State *L);
+	static int l_find_contents(lua_State *L);
+
 	static int l_was_modified(lua_State *L);
 	static int l_get_emerged_area(lua_State *L);
 
@@ -21,8 +21,16 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "irrlichttypes.h"
 #include "exceptions.h"
+#include "util/basic_macros.h"
 #include <iostream>
+#include <mutex>
+#include <string>
 #include <string_view>
+#include <unordered_map>
+#include <vector>
+
+typedef struct ZSTD_CDict_s ZSTD_CDict;
+typedef struct ZSTD_DDict_s ZSTD_DDict;
 
 /*
 	Map format serialization version
@@ -93,17 +101,59 @@ inline void compressZlib(std::string_view data, std::ostream &os, int level = -1
 }
 void decompressZlib(std::istream &is, std::ostream &os, size_t limit = 0);
 
-void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level = 0);
-inline void compressZstd(std::string_view data, std::ostream &os, int level = 0)
+/*
+	A zstd dictionary, trained from samples of the data to compress.
+	Things as small as a map block compress a lot better with it, since zstd
+	finds little redundancy within them alone. Data compressed with a
+	dictionary can only be decompressed with the same one.
+*/
+class ZstdDictionary
+{
+public:
+	// Throws SerializationError if the dictionary is invalid
+	ZstdDictionary(std::string data);
+	~ZstdDictionary();
+	DISABLE_CLASS_COPY(ZstdDictionary)
+
+	// Identifies the dictionary, never 0
+	u32 getId() const { return m_id; }
+	const std::string &getData() const { return m_data; }
+
+	// Prepared for compressing at a (zstd) level, created on first use
+	const ZSTD_CDict *getCDict(int level) const;
+	const ZSTD_DDict *getDDict() const { return m_ddict; }
+
+	// Returns an empty string if there are too few samples
+	static std::string train(const std::vector<std::string> &samples,
+			size_t max_size);
+
+private:
+	const std::string m_data;
+	u32 m_id;
+	mutable std::mutex m_cdicts_mutex;
+	mutable std::unordered_map<int, ZSTD_CDict *> m_cdicts;
+	ZSTD_DDict *m_ddict = nullptr;
+};
+
+void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level = 0,
+		const ZstdDictionary *dict = nullptr);
+inline void compressZstd(std::string_view data, std::ostream &os, int level = 0,
+		const ZstdDictionary *dict = nullptr)
 {
-	compressZstd(reinterpret_cast<const u8*>(data.data()), data.size(), os, level);
+	compressZstd(reinterpret_cast<const u8*>(data.data()), data.size(), os, level, dict);
 }
-void decompressZstd(std::istream &is, std::ostream &os);
+void decompressZstd(std::istream &is, std::ostream &os,
+		const ZstdDictionary *dict = nullptr);
 
-// These choose between zstd, zlib and a self-made one according to version
-void compress(const u8 *data, u32 size, std::ostream &os, u8 version, int level = -1);
-inline void compress(std::string_view data, std::ostream &os, u8 version, int level = -1)
+// These choose between zstd, zlib and a self-made one according to version.
+// The dictionary is only used with zstd.
+void compress(const u8 *data, u32 size, std::ostream &os, u8 version, int level = -1,
+		const ZstdDictionary *dict = nullptr);
+inline void compress(std::string_view data, std::ostream &os, u8 version, int level = -1,
+		const ZstdDictionary *dict = nullptr)
 {
-	compress(reinterpret_cast<const u8*>(data.data()), data.size(), os, version, level);
+	compress(reinterpret_cast<const u8*>(data.data()), data.size(), os, version,
+			level, dict);
 }
-void decompress(std::istream &is, std::ostream &os, u8 version);
+void decompress(std::istream &is, std::ostream &os, u8 version,
+		const ZstdDictionary *dict = nullptr);
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "server.h"
 #include <iostream>
+#include <cfloat>
 #include <queue>
 #include <algorithm>
 #include "network/connection.h"
@@ -34,6 +35,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "version.h"
 #include "filesys.h"
 #include "mapblock.h"
+#include "serialization.h"
 #include "server/serveractiveobject.h"
 #include "settings.h"
 #include "profiler.h"
@@ -64,6 +66,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "chat_interface.h"
 #include "remoteplayer.h"
 #include "server/player_sao.h"
+#include "server/serialized_block_cache.h"
+#include "threading/worker_pool.h"
 #include "server/serverinventorymgr.h"
 #include "translation.h"
 #include "database/database-sqlite3.h"
@@ -304,6 +308,17 @@ Server::Server(
 				{{"type", aom_types[i]}});
 	}
 
+	const std::string client_stats[] = {"min", "avg", "max"};
+	for (u32 i = 0; i < ARRLEN(client_stats); i++) {
+		m_aom_client_rate_gauge[i] = m_metrics_backend->addGauge(
+				"minetest_core_aom_client_bytes_per_second",
+				"Active object messages sent to the clients (in bytes per second)",
+				{{"stat", client_stats[i]}});
+	}
+	m_aom_waiting_gauge = m_metrics_backend->addGauge(
+			"minetest_core_aom_waiting_updates",
+			"Position updates of active objects that wait for their turn");
+
 	m_packet_recv_counter = m_metrics_backend->addCounter(
 			"minetest_core_server_packet_recv",
 			"Processable packets received");
@@ -316,6 +331,34 @@ Server::Server(
 			"minetest_core_map_edit_events",
 			"Number of map edit events");
 
+	// Per peer series could never be removed again, so only the spread
+	// over all peers is exported
+	const std::string peer_stats[] = {"min", "avg", "max"};
+	for (u32 i = 0; i < ARRLEN(peer_stats); i++) {
+		m_peer_rtt_gauge[i] = m_metrics_backend->addGauge(
+				"minetest_network_peer_rtt_seconds",
+				"Average round trip time of the peers",
+				{{"stat", peer_stats[i]}});
+		m_peer_cwnd_gauge[i] = m_metrics_backend->addGauge(
+				"minetest_network_peer_cwnd",
+				"Congestion window (in packets) of the peers",
+				{{"stat", peer_stats[i]}});
+		m_peer_packet_loss_gauge[i] = m_metrics_backend->addGauge(
+				"minetest_network_peer_packet_loss",
+				"Fraction of reliable packets the peers had to resend",
+				{{"stat", peer_stats[i]}});
+	}
+
+	u32 block_cache_mb = g_settings->getU32("serialized_block_cache_size");
+	if (block_cache_mb > 0) {
+		m_block_cache = std::make_unique<SerializedBlockCache>(
+				(size_t)block_cache_mb * 1024 * 1024, m_metrics_backend.get());
+	}
+
+	u16 block_send_threads = g_settings->getU16("block_send_threads");
+	if (block_send_threads > 0)
+		m_block_send_pool = std::make_unique<WorkerPool>("BlockSend", block_send_threads);
+
 	m_lag_gauge->set(g_settings->getFloat("dedicated_server_step"));
 
 	m_path_mod_data = porting::path_user + DIR_DELIM "mod_data";
@@ -464,6 +507,7 @@ void Server::init()
 	infostream << "Server: Initializing Lua" << std::endl;
 
 	m_script = std::make_unique<ServerScripting>(this);
+	m_script->setCallbackMetrics(m_metrics_backend.get());
 
 	// Must be created before mod loading because we have some inventory creation
 	m_inventory_mgr = std::make_unique<ServerInventoryManager>();
@@ -475,6 +519,19 @@ void Server::init()
 
 	m_script->saveGlobals();
 
+	// Blocks are sent compressed with the world's dictionary, if it has one
+	const std::string dict_path = m_path_world + DIR_DELIM BLOCK_DICTIONARY_NAME;
+	std::string dict_data;
+	if (fs::ReadFile(dict_path, dict_data)) {
+		try {
+			m_block_dictionary = std::make_unique<ZstdDictionary>(std::move(dict_data));
+			infostream << "Server: Using block dictionary " << dict_path << std::endl;
+		} catch (SerializationError &e) {
+			errorstream << "Server: Ignoring block dictionary " << dict_path
+					<< ": " << e.what() << std::endl;
+		}
+	}
+
 	// Read Textures and calculate sha1 sums
 	fillMediaCache();
 
@@ -606,6 +663,28 @@ void Server::step()
 	}
 }
 
+// Update rate tier of an object for a player, see ObjectUpdateQueue
+static int getObjectUpdateTier(PlayerSAO *player, ServerActiveObject *sao)
+{
+	static thread_local const f32 full_rate_range =
+		g_settings->getU16("active_object_full_rate_range") * MAP_BLOCKSIZE * BS;
+	if (!player || full_rate_range <= 0)
+		return 0;
+
+	const v3f offset = sao->getBasePosition() - player->getEyePosition();
+	const f32 distance = offset.getLength();
+	int tier = distance < full_rate_range ? 0 :
+		distance < 2 * full_rate_range ? 1 :
+		distance < 4 * full_rate_range ? 2 : 3;
+
+	// Objects behind the player are only seen when turning around
+	const f32 yaw = player->getRadYawDep();
+	if (distance > full_rate_range / 2 &&
+			offset.X * std::cos(yaw) + offset.Z * std::sin(yaw) < 0)
+		tier++;
+	return MYMIN(tier, OBJECT_UPDATE_TIERS - 1);
+}
+
 void Server::AsyncRunStep(float dtime, bool initial_step)
 {
 	{
@@ -793,6 +872,7 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 			ScopeProfiler sp(g_profiler, "Server: update objects within range");
 
 			m_player_gauge->set(clients.size());
+			updatePeerStatMetrics(clients);
 			for (const auto &client_it : clients) {
 				RemoteClient *client = client_it.second;
 
@@ -859,6 +939,13 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 		{
 			ClientInterface::AutoLock clientlock(m_clients);
 			const RemoteClientMap &clients = m_clients.getClientList();
+			// Budget for one step and client, 0 = no limit
+			static thread_local const u32 bytes_per_second =
+				g_settings->getU32("active_object_bytes_per_second");
+			const u32 budget = bytes_per_second > 0 ?
+				std::max<u32>(bytes_per_second * dtime, 1) : 0;
+			float rate_min = clients.empty() ? 0 : FLT_MAX, rate_max = 0, rate_sum = 0;
+			size_t waiting = 0;
 			// Route data to every client
 			std::string reliable_data, unreliable_data;
 			for (const auto &client_it : clients) {
@@ -878,8 +965,12 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 					std::vector<ActiveObjectMessage>* list = buffered_message.second;
 					// Go through every message
 					for (const ActiveObjectMessage &aom : *list) {
+						const std::string &data = aom.getData(client->net_proto_version);
+						const bool is_position = data[0] == AO_CMD_UPDATE_POSITION ||
+								data[0] == AO_CMD_POSITION_KEYFRAME ||
+								data[0] == AO_CMD_POSITION_DELTA;
 						// Send position updates to players who do not see the attachment
-						if (aom.datastring[0] == AO_CMD_UPDATE_POSITION) {
+						if (is_position) {
 							if (sao->getId() == player->getId())
 								continue;
 
@@ -889,6 +980,13 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 							if (parent && client->m_known_objects.find(parent->getId()) !=
 									client->m_known_objects.end())
 								continue;
+
+							// Far objects get fewer of them
+							if (!aom.reliable) {
+								client->m_object_updates.push(aom.id, data);
+								continue;
+							}
+							client->m_object_updates.sent(aom.id);
 						}
 
 						// Add full new data to appropriate buffer
@@ -898,9 +996,23 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 						// u16 id
 						// std::string data
 						buffer.append(idbuf, sizeof(idbuf));
-						buffer.append(serializeString16(aom.datastring));
+						buffer.append(serializeString16(data));
 					}
 				}
+
+				// Position updates that are due, as far as the budget allows
+				u32 left = 0;
+				if (budget > 0) {
+					const u32 used = reliable_data.size() + unreliable_data.size();
+					left = used < budget ? budget - used : 1;
+				}
+				client->m_object_updates.pop(dtime, left, [&] (u16 id) -> int {
+					if (client->m_known_objects.find(id) == client->m_known_objects.end())
+						return -1;
+					ServerActiveObject *sao = m_env->getActiveObject(id);
+					return sao ? getObjectUpdateTier(player, sao) : -1;
+				}, &unreliable_data);
+
 				/*
 					reliable_data and unreliable_data are now ready.
 					Send them.
@@ -912,7 +1024,20 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 				if (!unreliable_data.empty()) {
 					SendActiveObjectMessages(client->peer_id, unreliable_data, false);
 				}
+
+				ObjectUpdateQueue &updates = client->m_object_updates;
+				updates.countBytes(reliable_data.size() + unreliable_data.size());
+				const float rate = updates.getBytesPerSecond();
+				rate_min = std::min(rate_min, rate);
+				rate_max = std::max(rate_max, rate);
+				rate_sum += rate;
+				waiting += updates.getWaitingCount();
 			}
+
+			m_aom_client_rate_gauge[0]->set(rate_min);
+			m_aom_client_rate_gauge[1]->set(clients.empty() ? 0 : rate_sum / clients.size());
+			m_aom_client_rate_gauge[2]->set(rate_max);
+			m_aom_waiting_gauge->set(waiting);
 		}
 
 		// Clear buffered_messages
@@ -2023,6 +2148,35 @@ void Server::SendPlayerFormspecPrepend(session_t peer_id)
 	Send(&pkt);
 }
 
+void Server::updatePeerStatMetrics(const RemoteClientMap &clients)
+{
+	const struct {
+		con::rtt_stat_type type;
+		MetricGaugePtr *gauges;
+	} stats[] = {
+		{con::AVG_RTT, m_peer_rtt_gauge},
+		{con::CWND, m_peer_cwnd_gauge},
+		{con::PACKET_LOSS, m_peer_packet_loss_gauge},
+	};
+
+	for (const auto &stat : stats) {
+		float min = 0, max = 0, sum = 0;
+		u32 count = 0;
+		for (const auto &client_it : clients) {
+			float value = m_con->getPeerStat(client_it.first, stat.type);
+			if (value < 0)
+				continue;
+			min = count == 0 ? value : std::min(min, value);
+			max = std::max(max, value);
+			sum += value;
+			count++;
+		}
+		stat.gauges[0]->set(min);
+		stat.gauges[1]->set(count > 0 ? sum / count : 0);
+		stat.gauges[2]->set(max);
+	}
+}
+
 void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersao)
 {
 	// Radius inside which objects are active
@@ -2364,35 +2518,47 @@ void Server::sendMetadataChanged(const std::unordered_set<v3s16> &positions, flo
 	}
 }
 
+const ZstdDictionary *Server::getBlockDictionary(u32 *dictionary_id) const
+{
+	if (m_block_dictionary && *dictionary_id == m_block_dictionary->getId())
+		return m_block_dictionary.get();
+	*dictionary_id = 0;
+	return nullptr;
+}
+
+void Server::SendBlockData(session_t peer_id, v3s16 pos, const std::string &data)
+{
+	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + data.size(), peer_id);
+	pkt << pos;
+	pkt.putRawString(data);
+	Send(&pkt);
+}
+
 void Server::SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
-		u16 net_proto_version, SerializedBlockCache *cache)
+		u16 net_proto_version, SerializedBlockCache *cache, u32 dictionary_id)
 {
 	thread_local const int net_compression_level = rangelim(g_settings->getS16("map_compression_level_net"), -1, 9);
-	std::string s, *sptr = nullptr;
+	SerializedBlockCache::Data data;
 
-	if (cache) {
-		auto it = cache->find({block->getPos(), ver});
-		if (it != cache->end())
-			sptr = &it->second;
-	}
+	// Only if the client has the same one
+	const ZstdDictionary *dict = getBlockDictionary(&dictionary_id);
+
+	if (cache)
+		data = cache->get(block, ver, dictionary_id);
 
 	// Serialize the block in the right format
-	if (!sptr) {
+	if (!data) {
 		std::ostringstream os(std::ios_base::binary);
-		block->serialize(os, ver, false, net_compression_level);
+		block->serialize(os, ver, false, net_compression_level, dict);
 		block->serializeNetworkSpecific(os);
-		s = os.str();
-		sptr = &s;
-	}
+		data = std::make_shared<const std::string>(os.str());
 
-	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + sptr->size(), peer_id);
-	pkt << block->getPos();
-	pkt.putRawString(*sptr);
-	Send(&pkt);
+		// Store away in cache
+		if (cache)
+			cache->put(block, ver, data, dictionary_id);
+	}
 
-	// Store away in cache
-	if (cache && sptr == &s)
-		(*cache)[{block->getPos(), ver}] = std::move(s);
+	SendBlockData(peer_id, block->getPos(), *data);
 }
 
 void Server::SendBlocks(float dtime)
@@ -2402,14 +2568,14 @@ void Server::SendBlocks(float dtime)
 
 	std::vector<PrioritySortedBlockTransfer> queue;
 
-	u32 total_sending = 0, unique_clients = 0;
-
+	u32 total_sending = 0;
 	{
 		ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Collect list");
 
 		std::vector<session_t> clients = m_clients.getClientIDs();
 
 		ClientInterface::AutoLock clientlock(m_clients);
+		std::vector<RemoteClient*> active_clients;
 		for (const session_t client_id : clients) {
 			RemoteClient *client = m_clients.lockedGetClientNoEx(client_id, CS_Active);
 
@@ -2417,9 +2583,28 @@ void Server::SendBlocks(float dtime)
 				continue;
 
 			total_sending += client->getSendingCount();
-			const auto old_count = queue.size();
-			client->GetNextBlocks(m_env, m_emerge.get(), dtime, queue);
-			unique_clients += queue.size() > old_count ? 1 : 0;
+			active_clients.push_back(client);
+		}
+
+		// The selection only reads the map (which can't change while we hold
+		// the env lock), so the clients can be handled in parallel.
+		std::vector<std::vector<PrioritySortedBlockTransfer>> lists(active_clients.size());
+		std::vector<std::vector<MapBlock*>> used_blocks(active_clients.size());
+		auto select_blocks = [&] (size_t i) {
+			active_clients[i]->GetNextBlocks(m_env, m_emerge.get(), dtime,
+					lists[i], used_blocks[i]);
+		};
+		if (m_block_send_pool) {
+			m_block_send_pool->forEach(active_clients.size(), select_blocks);
+		} else {
+			for (size_t i = 0; i < active_clients.size(); i++)
+				select_blocks(i);
+		}
+
+		for (size_t i = 0; i < active_clients.size(); i++) {
+			queue.insert(queue.end(), lists[i].begin(), lists[i].end());
+			for (MapBlock *block : used_blocks[i])
+				block->resetUsageTimer();
 		}
 	}
 
@@ -2428,40 +2613,130 @@ void Server::SendBlocks(float dtime)
 	// Lowest is most important.
 	std::sort(queue.begin(), queue.end());
 
-	ClientInterface::AutoLock clientlock(m_clients);
-
 	// Maximal total count calculation
 	// The per-client block sends is halved with the maximal online users
 	u32 max_blocks_to_send = (m_env->getPlayerCount() + g_settings->getU32("max_users")) *
 		g_settings->getU32("max_simultaneous_block_sends_per_client") / 4 + 1;
 
 	ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Send to clients");
-	Map &map = m_env->getMap();
+	// Not thread_local, the block send threads only see what is captured
+	const int net_compression_level =
+		rangelim(g_settings->getS16("map_compression_level_net"), -1, 9);
 
-	SerializedBlockCache cache, *cache_ptr = nullptr;
-	if (unique_clients > 1) {
-		// caching is pointless with a single client
-		cache_ptr = &cache;
-	}
+	/*
+		Blocks that aren't cached are serialized while the map can't change.
+		Compressing them, most of the work, happens after the env lock is
+		released, on the block send threads if there are any.
+	*/
+	struct BlockData
+	{
+		v3s16 pos;
+		u64 modification_counter;
+		u8 ver;
+		u32 dictionary_id;
+		// To compress, if data is null
+		std::string raw;
+		std::string network_specific;
+		SerializedBlockCache::Data data;
+	};
+	std::vector<BlockData> blocks;
+	// Index in blocks by position, version and dictionary
+	std::map<std::tuple<v3s16, u8, u32>, size_t> block_indices;
+	// Peer id and index in blocks
+	std::vector<std::pair<session_t, size_t>> sends;
 
-	for (const PrioritySortedBlockTransfer &block_to_send : queue) {
-		if (total_sending >= max_blocks_to_send)
-			break;
+	{
+		ClientInterface::AutoLock clientlock(m_clients);
+		Map &map = m_env->getMap();
 
-		MapBlock *block = map.getBlockNoCreateNoEx(block_to_send.pos);
-		if (!block)
-			continue;
+		for (const PrioritySortedBlockTransfer &block_to_send : queue) {
+			if (total_sending >= max_blocks_to_send)
+				break;
 
-		RemoteClient *client = m_clients.lockedGetClientNoEx(block_to_send.peer_id,
-				CS_Active);
-		if (!client)
-			continue;
+			MapBlock *block = map.getBlockNoCreateNoEx(block_to_send.pos);
+			if (!block)
+				continue;
+
+			RemoteClient *client = m_clients.lockedGetClientNoEx(block_to_send.peer_id,
+					CS_Active);
+			if (!client)
+				continue;
+
+			const u8 ver = client->serialization_version;
+			u32 dictionary_id = client->block_dictionary_id;
+			getBlockDictionary(&dictionary_id);
+
+			// Same block for several clients
+			auto key = std::make_tuple(block_to_send.pos, ver, dictionary_id);
+			auto it = block_indices.find(key);
+			if (it == block_indices.end()) {
+				BlockData data;
+				data.pos = block_to_send.pos;
+				data.modification_counter = block->getModificationCounter();
+				data.ver = ver;
+				data.dictionary_id = dictionary_id;
+				if (m_block_cache)
+					data.data = m_block_cache->get(block, ver, dictionary_id);
+				if (!data.data && ver >= 29) {
+					std::ostringstream os(std::ios_base::binary);
+					block->serializeUncompressed(os, ver, false);
+					data.raw = os.str();
+					os.str("");
+					block->serializeNetworkSpecific(os);
+					data.network_specific = os.str();
+				} else if (!data.data) {
+					// Compressed in parts, which can't be deferred
+					std::ostringstream os(std::ios_base::binary);
+					block->serialize(os, ver, false, net_compression_level);
+					block->serializeNetworkSpecific(os);
+					data.data = std::make_shared<const std::string>(os.str());
+					if (m_block_cache)
+						m_block_cache->put(block, ver, data.data, dictionary_id);
+				}
+				it = block_indices.emplace(key, blocks.size()).first;
+				blocks.push_back(std::move(data));
+			}
+			sends.emplace_back(block_to_send.peer_id, it->second);
+
+			client->SentBlock(block_to_send.pos);
+			total_sending++;
+		}
+	}
+
+	envlock.unlock();
 
-		SendBlockNoLock(block_to_send.peer_id, block, client->serialization_version,
-				client->net_proto_version, cache_ptr);
+	{
+		ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Compress");
+
+		auto compress_block = [&, net_compression_level] (size_t i) {
+			BlockData &data = blocks[i];
+			if (data.data)
+				return;
+
+			u32 dictionary_id = data.dictionary_id;
+			std::ostringstream os(std::ios_base::binary);
+			compress(data.raw, os, data.ver, net_compression_level,
+					getBlockDictionary(&dictionary_id));
+			os << data.network_specific;
+			data.data = std::make_shared<const std::string>(os.str());
+			data.raw.clear();
+
+			if (m_block_cache) {
+				m_block_cache->put(data.pos, data.modification_counter, data.ver,
+						data.data, data.dictionary_id);
+			}
+		};
+		if (m_block_send_pool) {
+			m_block_send_pool->forEach(blocks.size(), compress_block);
+		} else {
+			for (size_t i = 0; i < blocks.size(); i++)
+				compress_block(i);
+		}
+	}
 
-		client->SentBlock(block_to_send.pos);
-		total_sending++;
+	for (const auto &send : sends) {
+		const BlockData &data = blocks[send.second];
+		SendBlockData(send.first, data.pos, *data.data);
 	}
 }
 
@@ -2476,7 +2751,8 @@ bool Server::SendBlock(session_t peer_id, const v3s16 &blockpos)
 	if (!client || client->isBlockSent(blockpos))
 		return false;
 	SendBlockNoLock(peer_id, block, client->serialization_version,
-			client->net_proto_version);
+			client->net_proto_version, m_block_cache.get(),
+			client->block_dictionary_id);
 
 	return true;
 }
@@ -2498,6 +2774,8 @@ bool Server::addMediaFile(const std::string &filename,
 		".x", ".b3d", ".obj",
 		// Custom translation file format
 		".tr",
+		// Block compression dictionary
+		".zstdict",
 		NULL
 	};
 	if (removeStringEnd(filename, supported_ext).empty()) {
@@ -2549,6 +2827,11 @@ void Server::fillMediaCache()
 {
 	infostream << "Server: Calculating media file checksums" << std::endl;
 
+	if (m_block_dictionary) {
+		addMediaFile(BLOCK_DICTIONARY_NAME,
+				m_path_world + DIR_DELIM BLOCK_DICTIONARY_NAME);
+	}
+
 	// Collect all media file paths
 	std::vector<std::string> paths;
 
@@ -2582,12 +2865,15 @@ void Server::sendMediaAnnouncement(session_t peer_id, const std::string &lang_co
 {
 	std::string lang_suffix = ".";
 	lang_suffix.append(lang_code).append(".tr");
+	const bool send_dictionary = m_clients.getProtocolVersion(peer_id) >= 46;
 
 	auto include = [&] (const std::string &name, const MediaInfo &info) -> bool {
 		if (info.no_announce)
 			return false;
 		if (str_ends_with(name, ".tr") && !str_ends_with(name, lang_suffix))
 			return false;
+		if (str_ends_with(name, ".zstdict") && !send_dictionary)
+			return false;
 		return true;
 	};
 
@@ -74,6 +74,9 @@ struct Lighting;
 class ServerThread;
 class ServerModManager;
 class ServerInventoryManager;
+class SerializedBlockCache;
+class ZstdDictionary;
+class WorkerPool;
 struct PackedValue;
 struct ParticleParameters;
 struct ParticleSpawnerParameters;
@@ -161,6 +164,9 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	~Server();
 	DISABLE_CLASS_COPY(Server);
 
+	// Loads the world and the mods. Called by start(), and on its own by
+	// offline tools that need the game's definitions.
+	void init();
 	void start();
 	void stop();
 	// Actual processing is done in another thread.
@@ -470,17 +476,6 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 		std::unordered_set<session_t> waiting_players;
 	};
 
-	// The standard library does not implement std::hash for pairs so we have this:
-	struct SBCHash {
-		size_t operator() (const std::pair<v3s16, u16> &p) const {
-			return std::hash<v3s16>()(p.first) ^ p.second;
-		}
-	};
-
-	typedef std::unordered_map<std::pair<v3s16, u16>, std::string, SBCHash> SerializedBlockCache;
-
-	void init();
-
 	void SendMovement(session_t peer_id);
 	void SendHP(session_t peer_id, u16 hp, bool effect);
 	void SendBreath(session_t peer_id, u16 breath);
@@ -536,10 +531,14 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	void sendMetadataChanged(const std::unordered_set<v3s16> &positions,
 			float far_d_nodes = 100);
 
+	// The block dictionary if the client has it. Sets the id to 0 if not.
+	const ZstdDictionary *getBlockDictionary(u32 *dictionary_id) const;
+	// Serialized block, see SendBlockNoLock
+	void SendBlockData(session_t peer_id, v3s16 pos, const std::string &data);
 	// Environment and Connection must be locked when called
-	// `cache` may only be very short lived! (invalidation not handeled)
 	void SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
-		u16 net_proto_version, SerializedBlockCache *cache = nullptr);
+		u16 net_proto_version, SerializedBlockCache *cache = nullptr,
+		u32 dictionary_id = 0);
 
 	// Sends blocks to clients (locks env and con on its own)
 	void SendBlocks(float dtime);
@@ -563,6 +562,8 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 		const ParticleParameters &p);
 
 	void SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersao);
+	// Updates the connection metrics of all peers, needs the client lock
+	void updatePeerStatMetrics(const RemoteClientMap &clients);
 	void SendActiveObjectMessages(session_t peer_id, const std::string &datas,
 		bool reliable = true);
 	void SendCSMRestrictionFlags(session_t peer_id);
@@ -747,15 +748,31 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	// Global server metrics backend
 	std::unique_ptr<MetricsBackend> m_metrics_backend;
 
+	// Serialized blocks, kept across SendBlocks() calls. May be null.
+	std::unique_ptr<SerializedBlockCache> m_block_cache;
+	// Compresses blocks for clients that have it. May be null.
+	std::unique_ptr<ZstdDictionary> m_block_dictionary;
+
+	// Selects the blocks to send for several clients at once, and compresses
+	// them. May be null.
+	std::unique_ptr<WorkerPool> m_block_send_pool;
+
 	// Server metrics
 	MetricCounterPtr m_uptime_counter;
 	MetricGaugePtr m_player_gauge;
 	MetricGaugePtr m_timeofday_gauge;
 	MetricGaugePtr m_lag_gauge;
 	MetricCounterPtr m_aom_buffer_counter[2]; // [0] = rel, [1] = unrel
+	// Over all clients: [0] = min, [1] = avg, [2] = max
+	MetricGaugePtr m_aom_client_rate_gauge[3];
+	MetricGaugePtr m_aom_waiting_gauge;
 	MetricCounterPtr m_packet_recv_counter;
 	MetricCounterPtr m_packet_recv_processed_counter;
 	MetricCounterPtr m_map_edit_event_counter;
+	// Over all peers: [0] = min, [1] = avg, [2] = max
+	MetricGaugePtr m_peer_rtt_gauge[3];
+	MetricGaugePtr m_peer_cwnd_gauge[3];
+	MetricGaugePtr m_peer_packet_loss_gauge[3];
 };
 
 /*
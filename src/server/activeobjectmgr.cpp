@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include <log.h>
+#include <algorithm>
 #include "mapblock.h"
 #include "profiler.h"
 #include "activeobjectmgr.h"
@@ -34,6 +35,13 @@ ActiveObjectMgr::~ActiveObjectMgr()
 	}
 }
 
+void ActiveObjectMgr::clear()
+{
+	::ActiveObjectMgr<ServerActiveObject>::clear();
+	m_spatial_map.removeAll();
+	m_player_ids.clear();
+}
+
 void ActiveObjectMgr::clearIf(const std::function<bool(ServerActiveObject *, u16)> &cb)
 {
 	for (auto &it : m_active_objects.iter()) {
@@ -41,6 +49,7 @@ void ActiveObjectMgr::clearIf(const std::function<bool(ServerActiveObject *, u16
 			continue;
 		if (cb(it.second.get(), it.first)) {
 			// Remove reference from m_active_objects
+			forgetObject(it.first);
 			m_active_objects.remove(it.first);
 		}
 	}
@@ -92,6 +101,9 @@ bool ActiveObjectMgr::registerObject(std::unique_ptr<ServerActiveObject> obj)
 	}
 
 	auto obj_id = obj->getId();
+	m_spatial_map.insert(obj_id, obj->getBasePosition());
+	if (obj->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+		m_player_ids.push_back(obj_id);
 	m_active_objects.put(obj_id, std::move(obj));
 
 	auto new_size = m_active_objects.size();
@@ -110,6 +122,8 @@ void ActiveObjectMgr::removeObject(u16 id)
 	verbosestream << "Server::ActiveObjectMgr::removeObject(): "
 			<< "id=" << id << std::endl;
 
+	forgetObject(id);
+
 	// this will take the object out of the map and then destruct it
 	bool ok = m_active_objects.remove(id);
 	if (!ok) {
@@ -128,13 +142,38 @@ void ActiveObjectMgr::invalidateActiveObjectObserverCaches()
 	}
 }
 
+void ActiveObjectMgr::updateObjectPos(u16 id, const v3f &pos)
+{
+	m_spatial_map.updatePosition(id, pos);
+}
+
+void ActiveObjectMgr::forgetObject(u16 id)
+{
+	m_spatial_map.remove(id);
+	auto it = std::find(m_player_ids.begin(), m_player_ids.end(), id);
+	if (it != m_player_ids.end())
+		m_player_ids.erase(it);
+}
+
+void ActiveObjectMgr::getCandidateIds(const aabb3f &box, std::vector<u16> &ids) const
+{
+	m_spatial_map.getRelevantObjectIds(box, ids);
+	// Keep the id order of a full walk over m_active_objects (see #10985)
+	std::sort(ids.begin(), ids.end());
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+}
+
 void ActiveObjectMgr::getObjectsInsideRadius(const v3f &pos, float radius,
 		std::vector<ServerActiveObject *> &result,
 		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
 {
+	// The callback may add, move or remove objects, so collect ids first
+	std::vector<u16> ids;
+	getCandidateIds(aabb3f(pos - radius, pos + radius), ids);
+
 	float r2 = radius * radius;
-	for (auto &activeObject : m_active_objects.iter()) {
-		ServerActiveObject *obj = activeObject.second.get();
+	for (u16 id : ids) {
+		ServerActiveObject *obj = m_active_objects.get(id).get();
 		if (!obj)
 			continue;
 		const v3f &objectpos = obj->getBasePosition();
@@ -150,8 +189,11 @@ void ActiveObjectMgr::getObjectsInArea(const aabb3f &box,
 		std::vector<ServerActiveObject *> &result,
 		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
 {
-	for (auto &activeObject : m_active_objects.iter()) {
-		ServerActiveObject *obj = activeObject.second.get();
+	std::vector<u16> ids;
+	getCandidateIds(box, ids);
+
+	for (u16 id : ids) {
+		ServerActiveObject *obj = m_active_objects.get(id).get();
 		if (!obj)
 			continue;
 		const v3f &objectpos = obj->getBasePosition();
@@ -170,18 +212,24 @@ void ActiveObjectMgr::getAddedActiveObjectsAroundPos(
 		std::vector<u16> &added_objects)
 {
 	/*
-		Go through the object list,
+		Go through the objects near the player and all players,
 		- discard removed/deactivated objects,
 		- discard objects that are too far away,
 		- discard objects that are found in current_objects,
 		- discard objects that are not observed by the player.
 		- add remaining objects to added_objects
 	*/
-	for (auto &ao_it : m_active_objects.iter()) {
-		u16 id = ao_it.first;
+	std::vector<u16> ids;
+	if (player_radius == 0) {
+		// Players are sent regardless of distance
+		ids = m_player_ids;
+	}
+	f32 max_radius = std::max(radius, player_radius);
+	getCandidateIds(aabb3f(player_pos - max_radius, player_pos + max_radius), ids);
 
+	for (u16 id : ids) {
 		// Get object
-		ServerActiveObject *object = ao_it.second.get();
+		ServerActiveObject *object = m_active_objects.get(id).get();
 		if (!object)
 			continue;
 
@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <vector>
 #include "../activeobjectmgr.h"
 #include "serveractiveobject.h"
+#include "spatial_map.h"
 
 namespace server
 {
@@ -31,6 +32,7 @@ class ActiveObjectMgr final : public ::ActiveObjectMgr<ServerActiveObject>
 public:
 	~ActiveObjectMgr() override;
 
+	void clear();
 	// If cb returns true, the obj will be deleted
 	void clearIf(const std::function<bool(ServerActiveObject *, u16)> &cb);
 	void step(float dtime,
@@ -40,6 +42,9 @@ class ActiveObjectMgr final : public ::ActiveObjectMgr<ServerActiveObject>
 
 	void invalidateActiveObjectObserverCaches();
 
+	// Keeps the spatial index in sync, called when an object moves
+	void updateObjectPos(u16 id, const v3f &pos);
+
 	void getObjectsInsideRadius(const v3f &pos, float radius,
 			std::vector<ServerActiveObject *> &result,
 			std::function<bool(ServerActiveObject *obj)> include_obj_cb);
@@ -51,5 +56,15 @@ class ActiveObjectMgr final : public ::ActiveObjectMgr<ServerActiveObject>
 			f32 radius, f32 player_radius,
 			const std::set<u16> &current_objects,
 			std::vector<u16> &added_objects);
+
+private:
+	// Removes the object from the lookup structures (not from m_active_objects)
+	void forgetObject(u16 id);
+	// Appends candidates for objects within box, then sorts and dedups ids
+	void getCandidateIds(const aabb3f &box, std::vector<u16> &ids) const;
+
+	SpatialMap m_spatial_map;
+	// Players are tracked separately since they may be sent at any range
+	std::vector<u16> m_player_ids;
 };
 } // namespace server
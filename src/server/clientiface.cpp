@@ -73,7 +73,8 @@ RemoteClient::RemoteClient() :
 	m_block_optimize_distance(g_settings->getS16("block_send_optimize_distance")),
 	m_block_cull_optimize_distance(g_settings->getS16("block_cull_optimize_distance")),
 	m_max_gen_distance(g_settings->getS16("max_block_generate_distance")),
-	m_occ_cull(g_settings->getBool("server_side_occlusion_culling"))
+	m_occ_cull(g_settings->getBool("server_side_occlusion_culling")),
+	m_occ_rand(myrand())
 {
 }
 
@@ -98,7 +99,8 @@ void RemoteClient::GetNextBlocks (
 		ServerEnvironment *env,
 		EmergeManager * emerge,
 		float dtime,
-		std::vector<PrioritySortedBlockTransfer> &dest)
+		std::vector<PrioritySortedBlockTransfer> &dest,
+		std::vector<MapBlock*> &used_blocks)
 {
 	// Increment timers
 	m_nothing_to_send_pause_timer -= dtime;
@@ -313,10 +315,10 @@ void RemoteClient::GetNextBlocks (
 			/*
 				Check if map has this block
 			*/
-			MapBlock *block = env->getMap().getBlockNoCreateNoEx(p);
+			MapBlock *block = env->getMap().getBlockNoCreateNoExNoCache(p);
 			if (block) {
 				// First: Reset usage timer, this block will be of use in the future.
-				block->resetUsageTimer();
+				used_blocks.push_back(block);
 			}
 
 			// Don't select too many blocks for sending
@@ -347,7 +349,7 @@ void RemoteClient::GetNextBlocks (
 					If block is not close, don't send it if it
 					consists of air only.
 				*/
-				if (d >= d_opt && block->isAir())
+				if (d >= d_opt && block->isAirNoCacheUpdate())
 						continue;
 			}
 			/*
@@ -360,7 +362,8 @@ void RemoteClient::GetNextBlocks (
 				Note that we do this even before the block is loaded as this does not depend on its contents.
 			 */
 			if (m_occ_cull &&
-					env->getMap().isBlockOccluded(p * MAP_BLOCKSIZE, cam_pos_nodes, d >= d_cull_opt)) {
+					env->getMap().isBlockOccluded(p * MAP_BLOCKSIZE, cam_pos_nodes,
+						d >= d_cull_opt, &m_occ_rand)) {
 				m_blocks_occ.insert(p);
 				continue;
 			}
@@ -29,6 +29,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "porting.h"
 #include "threading/mutex_auto_lock.h"
 #include "clientdynamicinfo.h"
+#include "noise.h"
+#include "server/object_update_queue.h"
 
 #include <list>
 #include <vector>
@@ -236,6 +238,8 @@ class RemoteClient
 	u8 serialization_version = SER_FMT_VER_INVALID;
 	//
 	u16 net_proto_version = 0;
+	// Id of the block compression dictionary the client has, 0 if none
+	u32 block_dictionary_id = 0;
 
 	/* Authentication information */
 	std::string enc_pwd = "";
@@ -258,9 +262,15 @@ class RemoteClient
 		Finds block that should be sent next to the client.
 		Environment should be locked when this is called.
 		dtime is used for resetting send radius at slow interval
+
+		The map is only read, so this may run for several clients at once
+		as long as nothing modifies the map in the meantime. For the same
+		reason the usage timers of the blocks that were looked at are not
+		reset here; they are appended to used_blocks instead.
 	*/
 	void GetNextBlocks(ServerEnvironment *env, EmergeManager* emerge,
-			float dtime, std::vector<PrioritySortedBlockTransfer> &dest);
+			float dtime, std::vector<PrioritySortedBlockTransfer> &dest,
+			std::vector<MapBlock*> &used_blocks);
 
 	void GotBlock(v3s16 p);
 
@@ -308,6 +318,9 @@ class RemoteClient
 	*/
 	std::set<u16> m_known_objects;
 
+	// Position updates of the known objects that may wait
+	ObjectUpdateQueue m_object_updates;
+
 	ClientState getState() const { return m_state; }
 
 	const std::string &getName() const { return m_name; }
@@ -393,6 +406,8 @@ class RemoteClient
 	const s16 m_block_cull_optimize_distance;
 	const s16 m_max_gen_distance;
 	const bool m_occ_cull;
+	// For the server side occlusion culling (the global one isn't thread-safe)
+	PcgRandom m_occ_rand;
 
 	/*
 		Set of media files the client has already requested
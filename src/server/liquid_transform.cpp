@@ -0,0 +1,546 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "liquid_transform.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include "log.h"
+#include "map.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "threading/worker_pool.h"
+
+#define WATER_DROP_BOOST 4
+
+const static v3s16 liquid_6dirs[6] = {
+	// order: upper before same level before lower
+	v3s16( 0, 1, 0),
+	v3s16( 0, 0, 1),
+	v3s16( 1, 0, 0),
+	v3s16( 0, 0,-1),
+	v3s16(-1, 0, 0),
+	v3s16( 0,-1, 0)
+};
+
+enum NeighborType : u8 {
+	NEIGHBOR_UPPER,
+	NEIGHBOR_SAME_LEVEL,
+	NEIGHBOR_LOWER
+};
+
+struct NodeNeighbor {
+	MapNode n;
+	NeighborType t;
+	v3s16 p;
+
+	NodeNeighbor()
+		: n(CONTENT_AIR), t(NEIGHBOR_SAME_LEVEL)
+	{ }
+
+	NodeNeighbor(const MapNode &node, NeighborType n_type, const v3s16 &pos)
+		: n(node),
+		  t(n_type),
+		  p(pos)
+	{ }
+};
+
+static s8 get_max_liquid_level(NodeNeighbor nb, s8 current_max_node_level)
+{
+	s8 max_node_level = current_max_node_level;
+	u8 nb_liquid_level = (nb.n.param2 & LIQUID_LEVEL_MASK);
+	switch (nb.t) {
+		case NEIGHBOR_UPPER:
+			if (nb_liquid_level + WATER_DROP_BOOST > current_max_node_level) {
+				max_node_level = LIQUID_LEVEL_MAX;
+				if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
+					max_node_level = nb_liquid_level + WATER_DROP_BOOST;
+			} else if (nb_liquid_level > current_max_node_level) {
+				max_node_level = nb_liquid_level;
+			}
+			break;
+		case NEIGHBOR_LOWER:
+			break;
+		case NEIGHBOR_SAME_LEVEL:
+			if ((nb.n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
+					nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
+				max_node_level = nb_liquid_level - 1;
+			break;
+	}
+	return max_node_level;
+}
+
+struct LiquidTransformer::Change
+{
+	v3s16 p;
+	MapNode oldnode;
+	MapNode newnode;
+	// Whether newnode replaces a floodable node (on_flood applies)
+	bool floods = false;
+	// Neighbours to queue once the node is changed
+	v3s16 queue_after[6];
+	u8 queue_after_count = 0;
+};
+
+/*
+	The nodes of one map block (or all nodes, without a pool) and
+	everything that came out of handling them.
+*/
+struct LiquidTransformer::Region
+{
+	std::vector<v3s16> nodes;
+
+	std::vector<v3s16> queued;
+	std::vector<v3s16> must_reflow;
+	std::vector<Change> floods;
+	std::map<v3s16, MapBlock *> modified_blocks;
+	std::vector<std::pair<v3s16, MapNode>> changed_nodes;
+	std::vector<v3s16> check_for_falling;
+
+	// The last block looked up. Lookups go around the sector cache of the
+	// map, which is not thread-safe.
+	bool cache_valid = false;
+	v3s16 cache_blockpos;
+	MapBlock *cache_block = nullptr;
+
+	MapBlock *getBlock(Map *map, v3s16 blockpos)
+	{
+		if (!cache_valid || blockpos != cache_blockpos) {
+			cache_block = map->getBlockNoCreateNoExNoCache(blockpos);
+			cache_blockpos = blockpos;
+			cache_valid = true;
+		}
+		return cache_block;
+	}
+
+	MapNode getNode(Map *map, v3s16 p)
+	{
+		v3s16 blockpos, relpos;
+		getNodeBlockPosWithOffset(p, blockpos, relpos);
+		MapBlock *block = getBlock(map, blockpos);
+		if (!block)
+			return {CONTENT_IGNORE};
+		return block->getNodeNoCheck(relpos);
+	}
+};
+
+LiquidTransformer::LiquidTransformer(Map *map, const NodeDefManager *ndef,
+		WorkerPool *pool, const FloodCallback &on_flood) :
+	m_map(map),
+	m_ndef(ndef),
+	m_pool(pool),
+	m_on_flood(on_flood)
+{
+}
+
+bool LiquidTransformer::decide(Region &r, v3s16 p0, Change &change)
+{
+	MapNode n0 = r.getNode(m_map, p0);
+
+	/*
+		Collect information about current node
+	 */
+	s8 liquid_level = -1;
+	// The liquid node which will be placed there if
+	// the liquid flows into this node.
+	content_t liquid_kind = CONTENT_IGNORE;
+	// The node which will be placed there if liquid
+	// can't flow into this node.
+	content_t floodable_node = CONTENT_AIR;
+	const ContentFeatures &cf = m_ndef->get(n0);
+	LiquidType liquid_type = cf.liquid_type;
+	switch (liquid_type) {
+		case LIQUID_SOURCE:
+			liquid_level = LIQUID_LEVEL_SOURCE;
+			liquid_kind = cf.liquid_alternative_flowing_id;
+			break;
+		case LIQUID_FLOWING:
+			liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
+			liquid_kind = n0.getContent();
+			break;
+		case LIQUID_NONE:
+			// if this node is 'floodable', it *could* be transformed
+			// into a liquid, otherwise, continue with the next node.
+			if (!cf.floodable)
+				return false;
+			floodable_node = n0.getContent();
+			liquid_kind = CONTENT_AIR;
+			break;
+		case LiquidType_END:
+			break;
+	}
+
+	/*
+		Collect information about the environment
+	 */
+	NodeNeighbor sources[6]; // surrounding sources
+	int num_sources = 0;
+	NodeNeighbor flows[6]; // surrounding flowing liquid nodes
+	int num_flows = 0;
+	NodeNeighbor airs[6]; // surrounding air
+	int num_airs = 0;
+	NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
+	int num_neutrals = 0;
+	bool flowing_down = false;
+	bool ignored_sources = false;
+	bool floating_node_above = false;
+	for (u16 i = 0; i < 6; i++) {
+		NeighborType nt = NEIGHBOR_SAME_LEVEL;
+		switch (i) {
+			case 0:
+				nt = NEIGHBOR_UPPER;
+				break;
+			case 5:
+				nt = NEIGHBOR_LOWER;
+				break;
+			default:
+				break;
+		}
+		v3s16 npos = p0 + liquid_6dirs[i];
+		NodeNeighbor nb(r.getNode(m_map, npos), nt, npos);
+		const ContentFeatures &cfnb = m_ndef->get(nb.n);
+		if (nt == NEIGHBOR_UPPER && cfnb.floats)
+			floating_node_above = true;
+		switch (cfnb.liquid_type) {
+			case LIQUID_NONE:
+				if (cfnb.floodable) {
+					airs[num_airs++] = nb;
+					// if the current node is a water source the neighbor
+					// should be enqueded for transformation regardless of whether the
+					// current node changes or not.
+					if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
+						r.queued.push_back(npos);
+					// if the current node happens to be a flowing node, it will start to flow down here.
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				} else {
+					neutrals[num_neutrals++] = nb;
+					if (nb.n.getContent() == CONTENT_IGNORE) {
+						// If node below is ignore prevent water from
+						// spreading outwards and otherwise prevent from
+						// flowing away as ignore node might be the source
+						if (nb.t == NEIGHBOR_LOWER)
+							flowing_down = true;
+						else
+							ignored_sources = true;
+					}
+				}
+				break;
+			case LIQUID_SOURCE:
+				// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+				if (liquid_kind == CONTENT_AIR)
+					liquid_kind = cfnb.liquid_alternative_flowing_id;
+				if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					// Do not count bottom source, it will screw things up
+					if(nt != NEIGHBOR_LOWER)
+						sources[num_sources++] = nb;
+				}
+				break;
+			case LIQUID_FLOWING:
+				if (nb.t != NEIGHBOR_SAME_LEVEL ||
+					(nb.n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK) {
+					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+					// but exclude falling liquids on the same level, they cannot flow here anyway
+
+					// used to determine if the neighbor can even flow into this node
+					s8 max_level_from_neighbor = get_max_liquid_level(nb, -1);
+					u8 range = m_ndef->get(cfnb.liquid_alternative_flowing_id).liquid_range;
+
+					if (liquid_kind == CONTENT_AIR &&
+							max_level_from_neighbor >= (LIQUID_LEVEL_MAX + 1 - range))
+						liquid_kind = cfnb.liquid_alternative_flowing_id;
+				}
+				if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					flows[num_flows++] = nb;
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				}
+				break;
+			case LiquidType_END:
+				break;
+		}
+	}
+
+	/*
+		decide on the type (and possibly level) of the current node
+	 */
+	content_t new_node_content;
+	s8 new_node_level = -1;
+	s8 max_node_level = -1;
+
+	u8 range = m_ndef->get(liquid_kind).liquid_range;
+	if (range > LIQUID_LEVEL_MAX + 1)
+		range = LIQUID_LEVEL_MAX + 1;
+
+	if ((num_sources >= 2 && m_ndef->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
+		// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
+		// or the flowing alternative of the first of the surrounding sources (if it's air), so
+		// it's perfectly safe to use liquid_kind here to determine the new node content.
+		new_node_content = m_ndef->get(liquid_kind).liquid_alternative_source_id;
+	} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
+		// liquid_kind is set properly, see above
+		max_node_level = new_node_level = LIQUID_LEVEL_MAX;
+		if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
+	} else if (ignored_sources && liquid_level >= 0) {
+		// Maybe there are neighboring sources that aren't loaded yet
+		// so prevent flowing away.
+		new_node_level = liquid_level;
+		new_node_content = liquid_kind;
+	} else {
+		// no surrounding sources, so get the maximum level that can flow into this node
+		for (u16 i = 0; i < num_flows; i++) {
+			max_node_level = get_max_liquid_level(flows[i], max_node_level);
+		}
+
+		u8 viscosity = m_ndef->get(liquid_kind).liquid_viscosity;
+		if (viscosity > 1 && max_node_level != liquid_level) {
+			// amount to gain, limited by viscosity
+			// must be at least 1 in absolute value
+			s8 level_inc = max_node_level - liquid_level;
+			if (level_inc < -viscosity || level_inc > viscosity)
+				new_node_level = liquid_level + level_inc/viscosity;
+			else if (level_inc < 0)
+				new_node_level = liquid_level - 1;
+			else if (level_inc > 0)
+				new_node_level = liquid_level + 1;
+			if (new_node_level != max_node_level)
+				r.must_reflow.push_back(p0);
+		} else {
+			new_node_level = max_node_level;
+		}
+
+		if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
+
+	}
+
+	/*
+		check if anything has changed. if not, just continue with the next node.
+	 */
+	if (new_node_content == n0.getContent() &&
+			(m_ndef->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
+			((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
+			((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
+			== flowing_down)))
+		return false;
+
+	/*
+		check if there is a floating node above that needs to be updated.
+	 */
+	if (floating_node_above && new_node_content == CONTENT_AIR)
+		r.check_for_falling.push_back(p0);
+
+	/*
+		the new node
+	 */
+	change.p = p0;
+	change.oldnode = n0;
+	change.floods = floodable_node != CONTENT_AIR;
+	MapNode &n = change.newnode;
+	n = n0;
+	//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
+	if (m_ndef->get(new_node_content).liquid_type == LIQUID_FLOWING) {
+		// set level to last 3 bits, flowing down bit to 4th bit
+		n.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
+	} else {
+		// set the liquid level and flow bits to 0
+		n.param2 &= ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
+	}
+	n.setContent(new_node_content);
+
+	/*
+		neighbors to enqueue for update once the node is changed
+	 */
+	switch (m_ndef->get(new_node_content).liquid_type) {
+		case LIQUID_SOURCE:
+		case LIQUID_FLOWING:
+			// make sure source flows into all neighboring nodes
+			for (u16 i = 0; i < num_flows; i++)
+				if (flows[i].t != NEIGHBOR_UPPER)
+					change.queue_after[change.queue_after_count++] = flows[i].p;
+			for (u16 i = 0; i < num_airs; i++)
+				if (airs[i].t != NEIGHBOR_UPPER)
+					change.queue_after[change.queue_after_count++] = airs[i].p;
+			break;
+		case LIQUID_NONE:
+			// this flow has turned to air; neighboring flows might need to do the same
+			for (u16 i = 0; i < num_flows; i++)
+				change.queue_after[change.queue_after_count++] = flows[i].p;
+			break;
+		case LiquidType_END:
+			break;
+	}
+	return true;
+}
+
+void LiquidTransformer::apply(Region &r, const Change &change)
+{
+	MapNode n = change.newnode;
+
+	// Ignore light (because calling voxalgo::update_lighting_nodes)
+	ContentLightingFlags f = m_ndef->getLightingFlags(n);
+	n.setLight(LIGHTBANK_DAY, 0, f);
+	n.setLight(LIGHTBANK_NIGHT, 0, f);
+
+	v3s16 blockpos, relpos;
+	getNodeBlockPosWithOffset(change.p, blockpos, relpos);
+	MapBlock *block = r.getBlock(m_map, blockpos);
+	if (!block)
+		return;
+
+	// Never allow placing CONTENT_IGNORE, it causes problems
+	if (n.getContent() == CONTENT_IGNORE) {
+		errorstream << "Not allowing liquid to place CONTENT_IGNORE at "
+				<< change.p << std::endl;
+	} else {
+		block->setNodeNoCheck(relpos, n);
+	}
+
+	r.modified_blocks[blockpos] = block;
+	r.changed_nodes.emplace_back(change.p, change.oldnode);
+
+	for (u8 i = 0; i < change.queue_after_count; i++)
+		r.queued.push_back(change.queue_after[i]);
+}
+
+void LiquidTransformer::transformNode(Region &r, v3s16 p0, bool defer_floods)
+{
+	Change change;
+	if (!decide(r, p0, change))
+		return;
+
+	if (change.floods && m_on_flood) {
+		if (defer_floods) {
+			r.floods.push_back(change);
+			return;
+		}
+		bool keep = m_on_flood(change.p, change.oldnode, change.newnode);
+		// The callback may have added blocks
+		r.cache_valid = false;
+		if (keep)
+			return;
+	}
+
+	apply(r, change);
+}
+
+u32 LiquidTransformer::transform(UniqueQueue<v3s16> &queue, u32 max_count,
+		std::map<v3s16, MapBlock *> &modified_blocks,
+		std::vector<std::pair<v3s16, MapNode>> &changed_nodes,
+		std::vector<v3s16> &check_for_falling)
+{
+	// Nodes queued while handling these wait for the next call
+	u32 count = std::min(queue.size(), max_count);
+	if (count == 0)
+		return 0;
+
+	if (m_pool)
+		return transformParallel(queue, count, modified_blocks, changed_nodes,
+				check_for_falling);
+	return transformSerial(queue, count, modified_blocks, changed_nodes,
+			check_for_falling);
+}
+
+u32 LiquidTransformer::transformSerial(UniqueQueue<v3s16> &queue, u32 count,
+		std::map<v3s16, MapBlock *> &modified_blocks,
+		std::vector<std::pair<v3s16, MapNode>> &changed_nodes,
+		std::vector<v3s16> &check_for_falling)
+{
+	Region r;
+	for (u32 i = 0; i < count; i++) {
+		v3s16 p0 = queue.front();
+		queue.pop_front();
+
+		transformNode(r, p0, false);
+
+		for (v3s16 p : r.queued)
+			queue.push_back(p);
+		r.queued.clear();
+	}
+
+	for (v3s16 p : r.must_reflow)
+		queue.push_back(p);
+
+	modified_blocks.insert(r.modified_blocks.begin(), r.modified_blocks.end());
+	changed_nodes.insert(changed_nodes.end(), r.changed_nodes.begin(),
+			r.changed_nodes.end());
+	check_for_falling.insert(check_for_falling.end(),
+			r.check_for_falling.begin(), r.check_for_falling.end());
+	return count;
+}
+
+u32 LiquidTransformer::transformParallel(UniqueQueue<v3s16> &queue, u32 count,
+		std::map<v3s16, MapBlock *> &modified_blocks,
+		std::vector<std::pair<v3s16, MapNode>> &changed_nodes,
+		std::vector<v3s16> &check_for_falling)
+{
+	// Group the nodes by block, blocks in order of their first node
+	std::vector<Region> regions;
+	std::vector<v3s16> region_blockpos;
+	std::unordered_map<v3s16, size_t> region_index;
+	for (u32 i = 0; i < count; i++) {
+		v3s16 p0 = queue.front();
+		queue.pop_front();
+
+		v3s16 blockpos = getNodeBlockPos(p0);
+		auto it = region_index.emplace(blockpos, regions.size());
+		if (it.second) {
+			regions.emplace_back();
+			region_blockpos.push_back(blockpos);
+		}
+		regions[it.first->second].nodes.push_back(p0);
+	}
+
+	// Blocks of one set never touch
+	std::vector<size_t> sets[8];
+	for (size_t i = 0; i < regions.size(); i++) {
+		v3s16 bp = region_blockpos[i];
+		sets[(bp.X & 1) | (bp.Y & 1) << 1 | (bp.Z & 1) << 2].push_back(i);
+	}
+
+	for (const std::vector<size_t> &set : sets) {
+		m_pool->forEach(set.size(), [&] (size_t j) {
+			Region &r = regions[set[j]];
+			for (v3s16 p0 : r.nodes)
+				transformNode(r, p0, true);
+		});
+	}
+
+	// Merge, and replace flooded nodes now that we are alone again
+	std::vector<v3s16> must_reflow;
+	for (const std::vector<size_t> &set : sets)
+	for (size_t i : set) {
+		Region &r = regions[i];
+		r.cache_valid = false;
+		for (const Change &change : r.floods) {
+			bool keep = m_on_flood(change.p, change.oldnode, change.newnode);
+			r.cache_valid = false;
+			if (!keep)
+				apply(r, change);
+		}
+
+		for (v3s16 p : r.queued)
+			queue.push_back(p);
+		must_reflow.insert(must_reflow.end(), r.must_reflow.begin(),
+				r.must_reflow.end());
+		modified_blocks.insert(r.modified_blocks.begin(), r.modified_blocks.end());
+		changed_nodes.insert(changed_nodes.end(), r.changed_nodes.begin(),
+				r.changed_nodes.end());
+		check_for_falling.insert(check_for_falling.end(),
+				r.check_for_falling.begin(), r.check_for_falling.end());
+	}
+
+	for (v3s16 p : must_reflow)
+		queue.push_back(p);
+
+	return count;
+}
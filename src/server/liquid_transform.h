@@ -0,0 +1,87 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+#include "irrlichttypes_bloated.h"
+#include "mapnode.h"
+#include "util/basic_macros.h"
+#include "util/container.h"
+
+class Map;
+class MapBlock;
+class NodeDefManager;
+class WorkerPool;
+
+/*
+	Flowing liquid simulation, as run by ServerMap::transformLiquids().
+
+	transform() takes nodes from the front of the queue, turns each into
+	whatever the liquids around it make of it and queues the neighbours that
+	have to follow.
+
+	Without a pool the nodes are handled one after the other, in queue order.
+	With a pool they are grouped by map block first. The blocks fall into
+	eight sets by the parity of their coordinates, so no two blocks of a set
+	touch, not even at a corner. Handling a node reads the node and its face
+	neighbours and writes only the node itself, which makes it safe to
+	handle the blocks of a set concurrently. The sets are handled one after
+	the other and the nodes of each block in queue order. The outputs of the
+	blocks are then merged in set order and block order, so the result does
+	not depend on the number of threads.
+*/
+class LiquidTransformer
+{
+public:
+	// Called before a floodable node is replaced by liquid. Returning true
+	// keeps the old node.
+	typedef std::function<bool(v3s16 p, MapNode oldnode, MapNode newnode)>
+		FloodCallback;
+
+	// `pool` may be null
+	LiquidTransformer(Map *map, const NodeDefManager *ndef, WorkerPool *pool,
+			const FloodCallback &on_flood);
+	DISABLE_CLASS_COPY(LiquidTransformer)
+
+	/*
+		Handles up to max_count nodes of the queue and returns how many it
+		handled. Changed nodes are added to changed_nodes along with their
+		old node, their light is left for the caller to update.
+
+		With a pool, floodable nodes are replaced (and on_flood is called)
+		after all blocks are done, in merge order.
+	*/
+	u32 transform(UniqueQueue<v3s16> &queue, u32 max_count,
+			std::map<v3s16, MapBlock *> &modified_blocks,
+			std::vector<std::pair<v3s16, MapNode>> &changed_nodes,
+			std::vector<v3s16> &check_for_falling);
+
+private:
+	struct Change;
+	struct Region;
+
+	// Decides what becomes of the node at p0. Returns false if it stays.
+	bool decide(Region &r, v3s16 p0, Change &change);
+	void apply(Region &r, const Change &change);
+	// Handles one node, or defers the change if defer_floods is set and it
+	// floods a node
+	void transformNode(Region &r, v3s16 p0, bool defer_floods);
+
+	u32 transformSerial(UniqueQueue<v3s16> &queue, u32 count,
+			std::map<v3s16, MapBlock *> &modified_blocks,
+			std::vector<std::pair<v3s16, MapNode>> &changed_nodes,
+			std::vector<v3s16> &check_for_falling);
+	u32 transformParallel(UniqueQueue<v3s16> &queue, u32 count,
+			std::map<v3s16, MapBlock *> &modified_blocks,
+			std::vector<std::pair<v3s16, MapNode>> &changed_nodes,
+			std::vector<v3s16> &check_for_falling);
+
+	Map *m_map;
+	const NodeDefManager *m_ndef;
+	WorkerPool *m_pool;
+	FloodCallback m_on_flood;
+};
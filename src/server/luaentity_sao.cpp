@@ -28,6 +28,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "server.h"
 #include "serverenvironment.h"
 
+// Seconds between full position updates, deltas are sent in between
+#define POSITION_KEYFRAME_INTERVAL 2.0f
+
 LuaEntitySAO::LuaEntitySAO(ServerEnvironment *env, v3f pos, const std::string &data)
 	: UnitSAO(env, pos)
 {
@@ -156,13 +159,14 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 	}
 
 	m_last_sent_position_timer += dtime;
+	m_keyframe_timer += dtime;
 
 	collisionMoveResult moveresult, *moveresult_p = nullptr;
 
 	// Each frame, parent position is copied if the object is attached, otherwise it's calculated normally
 	// If the object gets detached this comes into effect automatically from the last known origin
 	if (auto *parent = getParent()) {
-		m_base_position = parent->getBasePosition();
+		setBasePosition(parent->getBasePosition());
 		m_velocity = v3f(0,0,0);
 		m_acceleration = v3f(0,0,0);
 	} else {
@@ -181,11 +185,12 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 			moveresult_p = &moveresult;
 
 			// Apply results
-			m_base_position = p_pos;
+			setBasePosition(p_pos);
 			m_velocity = p_velocity;
 			m_acceleration = p_acceleration;
 		} else {
-			m_base_position += (m_velocity + m_acceleration * 0.5f * dtime) * dtime;
+			setBasePosition(m_base_position +
+					(m_velocity + m_acceleration * 0.5f * dtime) * dtime);
 			m_velocity += dtime * m_acceleration;
 		}
 
@@ -279,6 +284,16 @@ std::string LuaEntitySAO::getClientInitializationData(u16 protocol_version)
 	msg_os << serializeString32(generateSetTextureModCommand());
 	message_count++;
 
+	// Deltas refer to the keyframe
+	if (protocol_version >= 45 && m_keyframe_sent) {
+		msg_os << serializeString32(m_keyframe_command);
+		message_count++;
+		if (!m_last_delta_command.empty()) {
+			msg_os << serializeString32(m_last_delta_command);
+			message_count++;
+		}
+	}
+
 	writeU8(os, message_count);
 	std::string serialized = msg_os.str();
 	os.write(serialized.c_str(), serialized.size());
@@ -381,7 +396,7 @@ void LuaEntitySAO::setPos(const v3f &pos)
 {
 	if(isAttached())
 		return;
-	m_base_position = pos;
+	setBasePosition(pos);
 	sendPosition(false, true);
 }
 
@@ -389,7 +404,7 @@ void LuaEntitySAO::moveTo(v3f pos, bool continuous)
 {
 	if(isAttached())
 		return;
-	m_base_position = pos;
+	setBasePosition(pos);
 	if(!continuous)
 		sendPosition(true, true);
 }
@@ -527,19 +542,49 @@ void LuaEntitySAO::sendPosition(bool do_interpolate, bool is_movement_end)
 	//m_last_sent_acceleration = m_acceleration;
 	m_last_sent_rotation = m_rotation;
 
-	float update_interval = m_env->getSendRecommendedInterval();
+	ObjectPosition pos;
+	pos.position = m_base_position;
+	pos.velocity = m_velocity;
+	pos.acceleration = m_acceleration;
+	pos.rotation = m_rotation;
+	pos.do_interpolate = do_interpolate;
+	pos.is_movement_end = is_movement_end;
+	pos.update_interval = m_env->getSendRecommendedInterval();
+
+	// Older clients get everything every time
+	std::string legacy = generateUpdatePositionCommand(pos);
+
+	if (m_keyframe_sent && m_keyframe_timer < POSITION_KEYFRAME_INTERVAL) {
+		std::ostringstream os(std::ios::binary);
+		writeU8(os, AO_CMD_POSITION_DELTA);
+		writeU8(os, m_keyframe_id);
+		if (writeObjectPositionDelta(os, m_keyframe, pos)) {
+			m_last_delta_command = os.str();
+			m_messages_out.emplace(getId(), false, m_last_delta_command, legacy);
+			return;
+		}
+	}
 
-	std::string str = generateUpdatePositionCommand(
-		m_base_position,
-		m_velocity,
-		m_acceleration,
-		m_rotation,
-		do_interpolate,
-		is_movement_end,
-		update_interval
-	);
-	// create message and add to list
-	m_messages_out.emplace(getId(), false, str);
+	// Too far from the last keyframe, or it is time for a new one
+	m_keyframe = pos;
+	m_keyframe_id++;
+	m_keyframe_sent = true;
+	m_keyframe_timer = 0.0f;
+	m_last_delta_command.clear();
+
+	std::ostringstream os(std::ios::binary);
+	writeU8(os, AO_CMD_POSITION_KEYFRAME);
+	writeU8(os, m_keyframe_id);
+	writeObjectPosition(os, pos);
+	m_messages_out.emplace(getId(), true, os.str(), legacy);
+
+	// Clients that start to see the object jump there
+	pos.do_interpolate = false;
+	os.str("");
+	writeU8(os, AO_CMD_POSITION_KEYFRAME);
+	writeU8(os, m_keyframe_id);
+	writeObjectPosition(os, pos);
+	m_keyframe_command = os.str();
 }
 
 bool LuaEntitySAO::getCollisionBox(aabb3f *toset) const
@@ -110,6 +110,15 @@ class LuaEntitySAO : public UnitSAO
 	float m_last_sent_position_timer = 0.0f;
 	float m_last_sent_move_precision = 0.0f;
 
+	// Position updates since protocol 45, see object_position.h
+	ObjectPosition m_keyframe;
+	u8 m_keyframe_id = 0;
+	bool m_keyframe_sent = false;
+	float m_keyframe_timer = 0.0f;
+	// For clients that start to see the object
+	std::string m_keyframe_command;
+	std::string m_last_delta_command;
+
 	std::string m_texture_modifier;
 	bool m_texture_modifier_sent = false;
 };
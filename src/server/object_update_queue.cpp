@@ -0,0 +1,96 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "object_update_queue.h"
+#include <queue>
+#include "util/numeric.h"
+#include "util/serialize.h"
+
+float ObjectUpdateQueue::getTierInterval(int tier)
+{
+	static const float intervals[OBJECT_UPDATE_TIERS] = {0.0f, 0.25f, 0.5f, 1.0f};
+	return intervals[rangelim(tier, 0, OBJECT_UPDATE_TIERS - 1)];
+}
+
+void ObjectUpdateQueue::push(u16 id, const std::string &data)
+{
+	m_objects[id].data = data;
+}
+
+void ObjectUpdateQueue::sent(u16 id)
+{
+	Object &object = m_objects[id];
+	object.last_sent = m_time;
+	object.data.clear();
+}
+
+u32 ObjectUpdateQueue::pop(float dtime, u32 budget, const TierFunction &get_tier,
+		std::string *out)
+{
+	m_time += dtime;
+
+	m_bytes_timer += dtime;
+	if (m_bytes_timer >= 1.0f) {
+		m_bytes_per_second = m_bytes / m_bytes_timer;
+		m_bytes = 0;
+		m_bytes_timer = 0.0f;
+	}
+
+	struct Due
+	{
+		int tier;
+		float last_sent;
+		u16 id;
+
+		// Lowest tier first, then the one that waits longest
+		bool operator<(const Due &other) const
+		{
+			if (tier != other.tier)
+				return tier > other.tier;
+			return last_sent > other.last_sent;
+		}
+	};
+	std::priority_queue<Due> due;
+
+	for (auto it = m_objects.begin(); it != m_objects.end();) {
+		const int tier = get_tier(it->first);
+		if (tier < 0) {
+			it = m_objects.erase(it);
+			continue;
+		}
+		const Object &object = it->second;
+		if (!object.data.empty() &&
+				m_time - object.last_sent >= getTierInterval(tier))
+			due.push({tier, object.last_sent, it->first});
+		++it;
+	}
+
+	u32 size = 0;
+	char idbuf[2];
+	while (!due.empty()) {
+		Object &object = m_objects[due.top().id];
+		// u16 id, std::string data
+		const u32 message_size = sizeof(idbuf) + 2 + object.data.size();
+		// Something always goes, or big updates would never fit
+		if (budget > 0 && size > 0 && size + message_size > budget)
+			break;
+
+		writeU16((u8 *)idbuf, due.top().id);
+		out->append(idbuf, sizeof(idbuf));
+		out->append(serializeString16(object.data));
+		size += message_size;
+
+		object.last_sent = m_time;
+		object.data.clear();
+		due.pop();
+	}
+	return size;
+}
+
+size_t ObjectUpdateQueue::getWaitingCount() const
+{
+	size_t count = 0;
+	for (const auto &it : m_objects)
+		count += !it.second.data.empty();
+	return count;
+}
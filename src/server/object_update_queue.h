@@ -0,0 +1,63 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include "irrlichttypes.h"
+
+#define OBJECT_UPDATE_TIERS 4
+
+/*
+	Unreliable position updates of active objects for one client.
+
+	Every object is in a tier, by how far away from the player it is and
+	whether it is behind them. Updates of tier 0 go out at once, the others
+	at most every getTierInterval() seconds. Newer updates replace waiting
+	ones, which works since position updates are absolute (or relative to
+	a keyframe, see object_position.h).
+	Within a byte budget, the lowest tier goes first, then the longest
+	waiting object. The rest waits for the next step.
+*/
+class ObjectUpdateQueue
+{
+public:
+	// Returns the tier of an object, or -1 if the client doesn't know it
+	typedef std::function<int(u16 id)> TierFunction;
+
+	static float getTierInterval(int tier);
+
+	// An update to send when it is due
+	void push(u16 id, const std::string &data);
+	// An update of the object was sent some other way, e.g. reliably
+	void sent(u16 id);
+
+	// Appends the due updates as in TOCLIENT_ACTIVE_OBJECT_MESSAGES,
+	// returns their size. A budget of 0 means no limit.
+	u32 pop(float dtime, u32 budget, const TierFunction &get_tier,
+			std::string *out);
+
+	size_t getWaitingCount() const;
+
+	// Bytes per second sent to the client, over the last whole second
+	void countBytes(u32 bytes) { m_bytes += bytes; }
+	float getBytesPerSecond() const { return m_bytes_per_second; }
+
+private:
+	struct Object
+	{
+		// m_time of the last update that was sent
+		float last_sent = -1000.0f;
+		// Waiting update, empty if none
+		std::string data;
+	};
+
+	std::unordered_map<u16, Object> m_objects;
+	float m_time = 0.0f;
+
+	u32 m_bytes = 0;
+	float m_bytes_timer = 0.0f;
+	float m_bytes_per_second = 0.0f;
+};
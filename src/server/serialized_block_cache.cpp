@@ -0,0 +1,99 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "serialized_block_cache.h"
+#include "mapblock.h"
+
+SerializedBlockCache::SerializedBlockCache(size_t max_bytes, MetricsBackend *mb) :
+	m_max_bytes(max_bytes)
+{
+	if (!mb)
+		return;
+
+	m_hit_counter = mb->addCounter(
+			"minetest_core_serialized_block_cache_hits",
+			"Number of block sends served from the serialized block cache");
+	m_miss_counter = mb->addCounter(
+			"minetest_core_serialized_block_cache_misses",
+			"Number of block sends that had to serialize the block");
+	m_bytes_gauge = mb->addGauge(
+			"minetest_core_serialized_block_cache_bytes",
+			"Size of the serialized block cache (in bytes)");
+}
+
+SerializedBlockCache::Data SerializedBlockCache::get(MapBlock *block, u8 ver,
+		u32 dict_id)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto it = m_entries.find({block->getPos(), ver, dict_id});
+	if (it != m_entries.end() &&
+			it->second.modification_counter != block->getModificationCounter()) {
+		// Outdated
+		eraseNoLock(it);
+		it = m_entries.end();
+	}
+
+	if (it == m_entries.end()) {
+		if (m_miss_counter)
+			m_miss_counter->increment();
+		return nullptr;
+	}
+
+	if (m_hit_counter)
+		m_hit_counter->increment();
+	m_lru.splice(m_lru.begin(), m_lru, it->second.lru_it);
+	return it->second.data;
+}
+
+void SerializedBlockCache::put(MapBlock *block, u8 ver, Data data, u32 dict_id)
+{
+	put(block->getPos(), block->getModificationCounter(), ver, std::move(data),
+			dict_id);
+}
+
+void SerializedBlockCache::put(v3s16 pos, u64 modification_counter, u8 ver,
+		Data data, u32 dict_id)
+{
+	if (!data || data->size() > m_max_bytes)
+		return;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	const Key key{pos, ver, dict_id};
+	auto it = m_entries.find(key);
+	if (it != m_entries.end())
+		eraseNoLock(it);
+
+	m_bytes += data->size();
+	m_lru.push_front(key);
+	m_entries.emplace(key, Entry{modification_counter,
+			std::move(data), m_lru.begin()});
+
+	while (m_bytes > m_max_bytes)
+		eraseNoLock(m_entries.find(m_lru.back()));
+
+	if (m_bytes_gauge)
+		m_bytes_gauge->set(m_bytes);
+}
+
+void SerializedBlockCache::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_entries.clear();
+	m_lru.clear();
+	m_bytes = 0;
+	if (m_bytes_gauge)
+		m_bytes_gauge->set(0);
+}
+
+void SerializedBlockCache::eraseNoLock(
+		std::unordered_map<Key, Entry, KeyHash>::iterator it)
+{
+	m_bytes -= it->second.data->size();
+	m_lru.erase(it->second.lru_it);
+	m_entries.erase(it);
+	if (m_bytes_gauge)
+		m_bytes_gauge->set(m_bytes);
+}
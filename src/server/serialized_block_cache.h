@@ -0,0 +1,91 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "irrlichttypes_bloated.h"
+#include "util/basic_macros.h"
+#include "util/metricsbackend.h"
+
+class MapBlock;
+
+/*
+	Cache of network-serialized (and compressed) map blocks, keyed by block
+	position, serialization version and compression dictionary (0 = none).
+
+	Entries are tagged with the block's modification counter and are only
+	returned while the block is unchanged, so the cache can live as long as
+	the server does. Least recently used entries are dropped once the total
+	size exceeds the limit.
+*/
+class SerializedBlockCache
+{
+public:
+	typedef std::shared_ptr<const std::string> Data;
+
+	// `mb` may be null if no metrics are wanted
+	SerializedBlockCache(size_t max_bytes, MetricsBackend *mb = nullptr);
+	DISABLE_CLASS_COPY(SerializedBlockCache)
+
+	// Returns null if nothing current is cached for this block
+	Data get(MapBlock *block, u8 ver, u32 dict_id = 0);
+	void put(MapBlock *block, u8 ver, Data data, u32 dict_id = 0);
+	// For data serialized while the block had this modification counter
+	void put(v3s16 pos, u64 modification_counter, u8 ver, Data data,
+			u32 dict_id = 0);
+
+	void clear();
+
+	size_t getBytes() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_bytes;
+	}
+
+private:
+	struct Key
+	{
+		v3s16 pos;
+		u8 ver;
+		u32 dict_id;
+
+		bool operator==(const Key &other) const
+		{
+			return pos == other.pos && ver == other.ver &&
+				dict_id == other.dict_id;
+		}
+	};
+
+	struct KeyHash
+	{
+		size_t operator()(const Key &k) const
+		{
+			return std::hash<v3s16>()(k.pos) ^ k.ver ^ ((size_t)k.dict_id << 8);
+		}
+	};
+
+	struct Entry
+	{
+		u64 modification_counter;
+		Data data;
+		std::list<Key>::iterator lru_it;
+	};
+
+	void eraseNoLock(std::unordered_map<Key, Entry, KeyHash>::iterator it);
+
+	mutable std::mutex m_mutex;
+	std::unordered_map<Key, Entry, KeyHash> m_entries;
+	// Most recently used at the front
+	std::list<Key> m_lru;
+	size_t m_bytes = 0;
+	const size_t m_max_bytes;
+
+	MetricCounterPtr m_hit_counter;
+	MetricCounterPtr m_miss_counter;
+	MetricGaugePtr m_bytes_gauge;
+};
@@ -0,0 +1,121 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "spatial_map.h"
+#include <cmath>
+#include "constants.h"
+#include "util/numeric.h"
+
+namespace server
+{
+
+static constexpr f32 CELL_SIZE = MAP_BLOCKSIZE * BS;
+
+static s16 toCell(f32 v)
+{
+	if (std::isnan(v))
+		return 0;
+	f32 c = std::floor(v / CELL_SIZE);
+	return rangelim(c, (f32)S16_MIN, (f32)S16_MAX);
+}
+
+v3s16 SpatialMap::getCell(const v3f &pos)
+{
+	return v3s16(toCell(pos.X), toCell(pos.Y), toCell(pos.Z));
+}
+
+void SpatialMap::insert(u16 id, const v3f &pos)
+{
+	v3s16 cell = getCell(pos);
+	auto it = m_cell_of.find(id);
+	if (it != m_cell_of.end()) {
+		if (it->second == cell)
+			return;
+		removeFromCell(id, it->second);
+		it->second = cell;
+	} else {
+		m_cell_of.emplace(id, cell);
+	}
+	m_cells[cell].push_back(id);
+}
+
+void SpatialMap::remove(u16 id)
+{
+	auto it = m_cell_of.find(id);
+	if (it == m_cell_of.end())
+		return;
+	removeFromCell(id, it->second);
+	m_cell_of.erase(it);
+}
+
+void SpatialMap::updatePosition(u16 id, const v3f &pos)
+{
+	auto it = m_cell_of.find(id);
+	if (it == m_cell_of.end())
+		return; // not indexed (yet)
+
+	v3s16 cell = getCell(pos);
+	if (it->second == cell)
+		return;
+	removeFromCell(id, it->second);
+	it->second = cell;
+	m_cells[cell].push_back(id);
+}
+
+void SpatialMap::removeAll()
+{
+	m_cells.clear();
+	m_cell_of.clear();
+}
+
+void SpatialMap::removeFromCell(u16 id, v3s16 cell)
+{
+	auto it = m_cells.find(cell);
+	if (it == m_cells.end())
+		return;
+	auto &ids = it->second;
+	for (size_t i = 0; i < ids.size(); i++) {
+		if (ids[i] != id)
+			continue;
+		ids[i] = ids.back();
+		ids.pop_back();
+		break;
+	}
+	if (ids.empty())
+		m_cells.erase(it);
+}
+
+void SpatialMap::getRelevantObjectIds(const aabb3f &box,
+		std::vector<u16> &result) const
+{
+	const v3s16 min = getCell(box.MinEdge);
+	const v3s16 max = getCell(box.MaxEdge);
+	if (min.X > max.X || min.Y > max.Y || min.Z > max.Z)
+		return;
+
+	const u64 volume = (u64)(max.X - min.X + 1) * (max.Y - min.Y + 1) *
+			(max.Z - min.Z + 1);
+
+	// For huge boxes walking the occupied cells is cheaper than the lookups
+	if (volume > m_cells.size()) {
+		for (auto &it : m_cells) {
+			const v3s16 &c = it.first;
+			if (c.X < min.X || c.Y < min.Y || c.Z < min.Z ||
+					c.X > max.X || c.Y > max.Y || c.Z > max.Z)
+				continue;
+			result.insert(result.end(), it.second.begin(), it.second.end());
+		}
+		return;
+	}
+
+	// (s32 so that the loops terminate at the edge of the s16 range)
+	for (s32 z = min.Z; z <= max.Z; z++)
+	for (s32 y = min.Y; y <= max.Y; y++)
+	for (s32 x = min.X; x <= max.X; x++) {
+		auto it = m_cells.find(v3s16(x, y, z));
+		if (it != m_cells.end())
+			result.insert(result.end(), it->second.begin(), it->second.end());
+	}
+}
+
+} // namespace server
@@ -0,0 +1,43 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include "irrlichttypes_bloated.h"
+
+namespace server
+{
+
+/*
+	Coarse spatial index of active object ids.
+
+	Objects are bucketed by the mapblock-sized cell their base position
+	lies in, so a range query only has to look at the cells touching the
+	queried box instead of every active object. Results are candidates:
+	callers still need to check the exact position.
+*/
+class SpatialMap
+{
+public:
+	void insert(u16 id, const v3f &pos);
+	void remove(u16 id);
+	void updatePosition(u16 id, const v3f &pos);
+	void removeAll();
+
+	size_t size() const { return m_cell_of.size(); }
+
+	// Appends the ids of all objects in cells touching the box
+	void getRelevantObjectIds(const aabb3f &box, std::vector<u16> &result) const;
+
+private:
+	static v3s16 getCell(const v3f &pos);
+
+	void removeFromCell(u16 id, v3s16 cell);
+
+	std::unordered_map<v3s16, std::vector<u16>> m_cells;
+	std::unordered_map<u16, v3s16> m_cell_of;
+};
+
+} // namespace server
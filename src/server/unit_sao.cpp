@@ -373,24 +373,24 @@ std::string UnitSAO::generateUpdateArmorGroupsCommand() const
 std::string UnitSAO::generateUpdatePositionCommand(const v3f &position,
 		const v3f &velocity, const v3f &acceleration, const v3f &rotation,
 		bool do_interpolate, bool is_movement_end, f32 update_interval)
+{
+	ObjectPosition pos;
+	pos.position = position;
+	pos.velocity = velocity;
+	pos.acceleration = acceleration;
+	pos.rotation = rotation;
+	pos.do_interpolate = do_interpolate;
+	pos.is_movement_end = is_movement_end;
+	pos.update_interval = update_interval;
+	return generateUpdatePositionCommand(pos);
+}
+
+std::string UnitSAO::generateUpdatePositionCommand(const ObjectPosition &pos)
 {
 	std::ostringstream os(std::ios::binary);
 	// command
 	writeU8(os, AO_CMD_UPDATE_POSITION);
-	// pos
-	writeV3F32(os, position);
-	// velocity
-	writeV3F32(os, velocity);
-	// acceleration
-	writeV3F32(os, acceleration);
-	// rotation
-	writeV3F32(os, rotation);
-	// do_interpolate
-	writeU8(os, do_interpolate);
-	// is_end_position (for interpolation)
-	writeU8(os, is_movement_end);
-	// update_interval (for interpolation)
-	writeF32(os, update_interval);
+	writeObjectPosition(os, pos);
 	return os.str();
 }
 
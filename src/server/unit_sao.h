@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include "object_position.h"
 #include "object_properties.h"
 #include "serveractiveobject.h"
 #include <quaternion.h>
@@ -102,6 +103,7 @@ class UnitSAO : public ServerActiveObject
 	static std::string generateUpdatePositionCommand(const v3f &position,
 			const v3f &velocity, const v3f &acceleration, const v3f &rotation,
 			bool do_interpolate, bool is_movement_end, f32 update_interval);
+	static std::string generateUpdatePositionCommand(const ObjectPosition &pos);
 	std::string generateSetPropertiesCommand(const ObjectProperties &prop) const;
 	static std::string generateUpdateBoneOverrideCommand(
 			const std::string &bone, const BoneOverride &props);
@@ -38,6 +38,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/basic_macros.h"
 #include "util/pointedthing.h"
 #include "threading/mutex_auto_lock.h"
+#include "threading/worker_pool.h"
 #include "filesys.h"
 #include "gameparams.h"
 #include "database/database-dummy.h"
@@ -259,16 +260,66 @@ void LBMManager::applyLBMs(ServerEnvironment *env, MapBlock *block,
 	v3s16 pos;
 	MapNode n;
 	content_t c;
+
+	// Runs the LBMs of the node at `pos`, returns false if the block is gone
+	auto run_lbms = [&] (const std::vector<LoadingBlockModifierDef *> &lbm_list) -> bool {
+		for (auto lbmdef : lbm_list) {
+			lbmdef->trigger(env, pos + pos_of_block, n, dtime_s);
+			if (block->isOrphan())
+				return false;
+			n = block->getNodeNoCheck(pos);
+			if (n.getContent() != c)
+				break; // The node was changed and the LBMs no longer apply
+		}
+		return true;
+	};
+
 	auto it = getLBMsIntroducedAfter(stamp);
 	for (; it != m_lbm_lookup.end(); ++it) {
+		// Use the content position index of the block to visit only the
+		// matching nodes, in the same order as a full scan would
+		u32 start = 0;
+		std::vector<u16> candidates;
+		bool use_index = false;
+		if (const auto *positions = block->getContentPositions()) {
+			use_index = true;
+			for (const auto &cp : *positions) {
+				if (!it->second.lookup(cp.content))
+					continue;
+				if (cp.dense) {
+					use_index = false;
+					break;
+				}
+				candidates.insert(candidates.end(), cp.indices.begin(), cp.indices.end());
+			}
+		}
+		if (use_index) {
+			std::sort(candidates.begin(), candidates.end());
+			const u64 counter = block->getModificationCounter();
+			start = MapBlock::nodecount;
+			for (u16 i : candidates) {
+				pos = v3s16(i % MAP_BLOCKSIZE, (i / MAP_BLOCKSIZE) % MAP_BLOCKSIZE,
+					i / (MAP_BLOCKSIZE * MAP_BLOCKSIZE));
+				n = block->getNodeNoCheck(pos);
+				c = n.getContent();
+				if (!run_lbms(*it->second.lookup(c)))
+					return;
+				// Changed by the LBM, scan the rest of the block instead
+				if (block->getModificationCounter() != counter) {
+					start = i + 1;
+					break;
+				}
+			}
+		}
+
 		// Cache previous version to speedup lookup which has a very high performance
 		// penalty on each call
 		content_t previous_c = CONTENT_IGNORE;
 		const std::vector<LoadingBlockModifierDef *> *lbm_list = nullptr;
 
-		for (pos.Z = 0; pos.Z < MAP_BLOCKSIZE; pos.Z++)
-		for (pos.Y = 0; pos.Y < MAP_BLOCKSIZE; pos.Y++)
-		for (pos.X = 0; pos.X < MAP_BLOCKSIZE; pos.X++) {
+		for (u32 i = start; i < MapBlock::nodecount; i++) {
+			pos = v3s16(i % MAP_BLOCKSIZE, (i / MAP_BLOCKSIZE) % MAP_BLOCKSIZE,
+				i / (MAP_BLOCKSIZE * MAP_BLOCKSIZE));
 			n = block->getNodeNoCheck(pos);
 			c = n.getContent();
 
@@ -280,14 +331,8 @@ void LBMManager::applyLBMs(ServerEnvironment *env, MapBlock *block,
 
 			if (!lbm_list)
 				continue;
-			for (auto lbmdef : *lbm_list) {
-				lbmdef->trigger(env, pos + pos_of_block, n, dtime_s);
-				if (block->isOrphan())
-					return;
-				n = block->getNodeNoCheck(pos);
-				if (n.getContent() != c)
-					break; // The node was changed and the LBMs no longer apply
-			}
+			if (!run_lbms(*lbm_list))
+				return;
 		}
 	}
 }
@@ -448,6 +493,10 @@ ServerEnvironment::ServerEnvironment(std::unique_ptr<ServerMap> map,
 
 	m_active_object_gauge = mb->addGauge(
 		"minetest_env_active_objects", "Number of active objects");
+
+	u16 abm_scan_threads = g_settings->getU16("abm_scan_threads");
+	if (abm_scan_threads > 0)
+		m_abm_scan_pool = std::make_unique<WorkerPool>("ABMScan", abm_scan_threads);
 }
 
 void ServerEnvironment::init()
@@ -903,27 +952,79 @@ class ABMHandler
 		wider += wider_unknown_count * wider / wider_known_count;
 		return active_object_count;
 	}
+	// Result of scanning a block for ABMs, see scan() and applyScanned()
+	struct BlockScan
+	{
+		MapBlock *block = nullptr;
+		u64 modification_counter = 0;
+		// Whether the content cache was used and whether it ruled out ABMs
+		bool was_cached = false;
+		bool needs_abms = false;
+		bool want_contents_cached = false;
+		// Index at which content caching was given up, if it was
+		u32 cache_abandoned_at = MapBlock::nodecount;
+		// Indices of all nodes that have ABMs, in scan order
+		std::vector<u16> candidates;
+	};
+
 	void apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached)
 	{
-		if (m_aabms.empty())
+		BlockScan scan;
+		scan.block = block;
+		this->scan(scan);
+		applyScanned(scan, blocks_scanned, abms_run, blocks_cached);
+	}
+
+	/*
+		apply() is split in two parts:
+		scan() only reads the block (and fills its content caches), so it can
+		run on a worker thread for many blocks at once. applyScanned() then
+		runs on the server thread in block order and does the chance rolls,
+		neighbor checks and triggers, drawing random numbers in node order.
+	*/
+	void scan(BlockScan &scan)
+	{
+		MapBlock *block = scan.block;
+		scan.modification_counter = block->getModificationCounter();
+		if (m_aabms.empty() || !needsABMs(block, scan.was_cached))
 			return;
+		scan.needs_abms = true;
 
-		// Check the content type cache first
-		// to see whether there are any ABMs
-		// to be run at all for this block.
-		if (!block->contents.empty()) {
-			assert(!block->do_not_cache_contents); // invariant
-			blocks_cached++;
-			bool run_abms = false;
-			for (content_t c : block->contents) {
-				if (c < m_aabms.size() && m_aabms[c]) {
-					run_abms = true;
-					break;
-				}
+		// If the content cache is valid, we can look the nodes up directly
+		if (scan.was_cached && findCandidates(block, scan.candidates))
+			return;
+
+		scan.want_contents_cached = block->contents.empty() && !block->do_not_cache_contents;
+		bool want_contents_cached = scan.want_contents_cached;
+
+		const MapNode *data = block->getData();
+		for (u32 i = 0; i < MapBlock::nodecount; i++) {
+			content_t c = data[i].getContent();
+
+			if (want_contents_cached) {
+				cacheContent(block, c, want_contents_cached);
+				if (!want_contents_cached)
+					scan.cache_abandoned_at = i;
 			}
-			if (!run_abms)
-				return;
+
+			if (c < m_aabms.size() && m_aabms[c])
+				scan.candidates.push_back(i);
 		}
+	}
+
+	void applyScanned(BlockScan &scan, int &blocks_scanned, int &abms_run, int &blocks_cached)
+	{
+		MapBlock *block = scan.block;
+
+		// ABMs of previous blocks may have changed this one
+		if (block->getModificationCounter() != scan.modification_counter) {
+			apply(block, blocks_scanned, abms_run, blocks_cached);
+			return;
+		}
+
+		blocks_cached += scan.was_cached;
+		if (!scan.needs_abms)
+			return;
 		blocks_scanned++;
 
 		ServerMap *map = &m_env->getServerMap();
@@ -932,89 +1033,172 @@ class ABMHandler
 		u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
 		m_env->m_added_objects = 0;
 
-		bool want_contents_cached = block->contents.empty() && !block->do_not_cache_contents;
+		for (u16 i : scan.candidates) {
+			v3s16 p0(i % MAP_BLOCKSIZE, (i / MAP_BLOCKSIZE) % MAP_BLOCKSIZE,
+				i / (MAP_BLOCKSIZE * MAP_BLOCKSIZE));
+			if (!runNodeABMs(block, p0, block->getNodeNoCheck(p0),
+					active_object_count, active_object_count_wider, abms_run))
+				return;
+
+			if (block->getModificationCounter() == scan.modification_counter)
+				continue;
+
+			// The ABMs changed the block, so continue the way apply() would.
+			// The modification emptied the content cache, but apply() would
+			// not have given up caching in the part that is not scanned yet.
+			bool want_contents_cached = scan.want_contents_cached;
+			if (scan.cache_abandoned_at <= i) {
+				want_contents_cached = false;
+			} else if (scan.cache_abandoned_at != MapBlock::nodecount) {
+				block->do_not_cache_contents = false;
+			}
+			scanAndRun(block, i + 1, want_contents_cached, active_object_count,
+				active_object_count_wider, abms_run);
+			return;
+		}
+	}
+
+private:
+	// Collects the nodes with ABMs from the block's content position index.
+	// Returns false if the index can't be used for this block.
+	bool findCandidates(MapBlock *block, std::vector<u16> &candidates)
+	{
+		const auto *positions = block->getContentPositions();
+		if (!positions)
+			return false;
+
+		for (const auto &cp : *positions) {
+			if (cp.content >= m_aabms.size() || !m_aabms[cp.content])
+				continue;
+			if (cp.dense) {
+				candidates.clear();
+				return false;
+			}
+			candidates.insert(candidates.end(), cp.indices.begin(), cp.indices.end());
+		}
+		// Keep the node order of a full scan
+		std::sort(candidates.begin(), candidates.end());
+		return true;
+	}
 
-		v3s16 p0;
-		for(p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++)
-		for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
-		for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
-		{
+	// Checks the content type cache to see whether there are any ABMs to be
+	// run at all for this block.
+	bool needsABMs(MapBlock *block, bool &was_cached)
+	{
+		was_cached = !block->contents.empty();
+		if (!was_cached)
+			return true;
+
+		assert(!block->do_not_cache_contents); // invariant
+		for (content_t c : block->contents) {
+			if (c < m_aabms.size() && m_aabms[c])
+				return true;
+		}
+		return false;
+	}
+
+	// Cache content types as we go
+	static void cacheContent(MapBlock *block, content_t c, bool &want_contents_cached)
+	{
+		if (CONTAINS(block->contents, c))
+			return;
+		if (block->contents.size() >= CONTENT_TYPE_CACHE_MAX) {
+			// Too many different nodes... don't try to cache
+			want_contents_cached = false;
+			block->do_not_cache_contents = true;
+			block->contents.clear();
+			block->contents.shrink_to_fit();
+		} else {
+			block->contents.push_back(c);
+		}
+	}
+
+	// Scans the nodes of the block from the given index on and runs their ABMs
+	void scanAndRun(MapBlock *block, u32 start, bool want_contents_cached,
+		u32 &active_object_count, u32 &active_object_count_wider, int &abms_run)
+	{
+		for (u32 i = start; i < MapBlock::nodecount; i++) {
+			v3s16 p0(i % MAP_BLOCKSIZE, (i / MAP_BLOCKSIZE) % MAP_BLOCKSIZE,
+				i / (MAP_BLOCKSIZE * MAP_BLOCKSIZE));
 			MapNode n = block->getNodeNoCheck(p0);
 			content_t c = n.getContent();
 
-			// Cache content types as we go
-			if (want_contents_cached && !CONTAINS(block->contents, c)) {
-				if (block->contents.size() >= CONTENT_TYPE_CACHE_MAX) {
-					// Too many different nodes... don't try to cache
-					want_contents_cached = false;
-					block->do_not_cache_contents = true;
-					block->contents.clear();
-					block->contents.shrink_to_fit();
-				} else {
-					block->contents.push_back(c);
-				}
-			}
+			if (want_contents_cached)
+				cacheContent(block, c, want_contents_cached);
 
 			if (c >= m_aabms.size() || !m_aabms[c])
 				continue;
 
-			v3s16 p = p0 + block->getPosRelative();
-			for (ActiveABM &aabm : *m_aabms[c]) {
-				if ((p.Y < aabm.min_y) || (p.Y > aabm.max_y))
-					continue;
+			if (!runNodeABMs(block, p0, n, active_object_count,
+					active_object_count_wider, abms_run))
+				return;
+		}
+	}
 
-				if (myrand() % aabm.chance != 0)
-					continue;
+	// Runs the ABMs of a single node. Returns false if the block was deleted.
+	bool runNodeABMs(MapBlock *block, v3s16 p0, MapNode n,
+		u32 &active_object_count, u32 &active_object_count_wider, int &abms_run)
+	{
+		ServerMap *map = &m_env->getServerMap();
+		content_t c = n.getContent();
+
+		v3s16 p = p0 + block->getPosRelative();
+		for (ActiveABM &aabm : *m_aabms[c]) {
+			if ((p.Y < aabm.min_y) || (p.Y > aabm.max_y))
+				continue;
 
-				// Check neighbors
-				if (aabm.check_required_neighbors) {
-					v3s16 p1;
-					for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
-					for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
-					for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
-					{
-						if(p1 == p0)
-							continue;
-						content_t c;
-						if (block->isValidPosition(p1)) {
-							// if the neighbor is found on the same map block
-							// get it straight from there
-							const MapNode &n = block->getNodeNoCheck(p1);
-							c = n.getContent();
-						} else {
-							// otherwise consult the map
-							MapNode n = map->getNode(p1 + block->getPosRelative());
-							c = n.getContent();
-						}
-						if (CONTAINS(aabm.required_neighbors, c))
-							goto neighbor_found;
+			if (myrand() % aabm.chance != 0)
+				continue;
+
+			// Check neighbors
+			if (aabm.check_required_neighbors) {
+				v3s16 p1;
+				for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
+				for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
+				for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
+				{
+					if(p1 == p0)
+						continue;
+					content_t c;
+					if (block->isValidPosition(p1)) {
+						// if the neighbor is found on the same map block
+						// get it straight from there
+						const MapNode &n = block->getNodeNoCheck(p1);
+						c = n.getContent();
+					} else {
+						// otherwise consult the map
+						MapNode n = map->getNode(p1 + block->getPosRelative());
+						c = n.getContent();
 					}
-					// No required neighbor found
-					continue;
+					if (CONTAINS(aabm.required_neighbors, c))
+						goto neighbor_found;
 				}
-				neighbor_found:
-
-				abms_run++;
-				// Call all the trigger variations
-				aabm.abm->trigger(m_env, p, n);
-				aabm.abm->trigger(m_env, p, n,
-					active_object_count, active_object_count_wider);
+				// No required neighbor found
+				continue;
+			}
+			neighbor_found:
 
-				if (block->isOrphan())
-					return;
+			abms_run++;
+			// Call all the trigger variations
+			aabm.abm->trigger(m_env, p, n);
+			aabm.abm->trigger(m_env, p, n,
+				active_object_count, active_object_count_wider);
 
-				// Count surrounding objects again if the abms added any
-				if(m_env->m_added_objects > 0) {
-					active_object_count = countObjects(block, map, active_object_count_wider);
-					m_env->m_added_objects = 0;
-				}
+			if (block->isOrphan())
+				return false;
 
-				// Update and check node after possible modification
-				n = block->getNodeNoCheck(p0);
-				if (n.getContent() != c)
-					break;
+			// Count surrounding objects again if the abms added any
+			if(m_env->m_added_objects > 0) {
+				active_object_count = countObjects(block, map, active_object_count_wider);
+				m_env->m_added_objects = 0;
 			}
+
+			// Update and check node after possible modification
+			n = block->getNodeNoCheck(p0);
+			if (n.getContent() != c)
+				break;
 		}
+		return true;
 	}
 };
 
@@ -1525,11 +1709,23 @@ void ServerEnvironment::step(float dtime)
 		std::copy(m_active_blocks.m_abm_list.begin(), m_active_blocks.m_abm_list.end(), output.begin());
 		std::shuffle(output.begin(), output.end(), MyRandGenerator());
 
+		// Scan all blocks up front on the worker threads, if enabled
+		std::vector<ABMHandler::BlockScan> scans;
+		if (m_abm_scan_pool) {
+			scans.resize(output.size());
+			for (size_t j = 0; j < output.size(); j++)
+				scans[j].block = m_map->getBlockNoCreateNoEx(output[j]);
+			m_abm_scan_pool->forEach(scans.size(), [&] (size_t j) {
+				if (scans[j].block)
+					abmhandler.scan(scans[j]);
+			});
+		}
+
 		int i = 0;
 		// determine the time budget for ABMs
 		u32 max_time_ms = m_cache_abm_interval * 1000 * m_cache_abm_time_budget;
-		for (const v3s16 &p : output) {
-			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
+		for (size_t j = 0; j < output.size(); j++) {
+			MapBlock *block = m_map->getBlockNoCreateNoEx(output[j]);
 			if (!block)
 				continue;
 
@@ -1539,7 +1735,10 @@ void ServerEnvironment::step(float dtime)
 			block->setTimestampNoChangedFlag(m_game_time);
 
 			/* Handle ActiveBlockModifiers */
-			abmhandler.apply(block, blocks_scanned, abms_run, blocks_cached);
+			if (!scans.empty() && scans[j].block == block)
+				abmhandler.applyScanned(scans[j], blocks_scanned, abms_run, blocks_cached);
+			else
+				abmhandler.apply(block, blocks_scanned, abms_run, blocks_cached);
 
 			u32 time_ms = timer.getTimerTime();
 
@@ -42,6 +42,7 @@ struct StaticObject;
 class ServerActiveObject;
 class Server;
 class ServerScripting;
+class WorkerPool;
 enum AccessDeniedCode : u8;
 typedef u16 session_t;
 
@@ -350,6 +351,12 @@ class ServerEnvironment final : public Environment
 		return m_ao_manager.getObjectsInArea(box, objects, include_obj_cb);
 	}
 
+	// Called by ServerActiveObject when its base position changes
+	void updateObjectPos(u16 id, const v3f &pos)
+	{
+		m_ao_manager.updateObjectPos(id, pos);
+	}
+
 	// Clear objects, loading and going through every MapBlock
 	void clearObjects(ClearObjectsMode mode);
 
@@ -488,6 +495,8 @@ class ServerEnvironment final : public Environment
 	u32 m_last_clear_objects_time = 0;
 	// Active block modifiers
 	std::vector<ABMWithState> m_abms;
+	// Threads scanning active blocks for ABMs, null if done on this thread
+	std::unique_ptr<WorkerPool> m_abm_scan_pool;
 	LBMManager m_lbm_mgr;
 	// An interval for generally sending object positions and stuff
 	float m_recommended_send_interval = 0.1f;
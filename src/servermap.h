@@ -21,8 +21,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <vector>
 #include <memory>
+#include <mutex>
 
 #include "map.h"
+#include "nameidmapping.h"
 #include "util/container.h"
 #include "util/metricsbackend.h"
 #include "map_settings_manager.h"
@@ -32,6 +34,7 @@ class MapDatabase;
 class IRollbackManager;
 class EmergeManager;
 class ServerEnvironment;
+class WorkerPool;
 struct BlockMakeData;
 
 class MetricsBackend;
@@ -118,6 +121,30 @@ class ServerMap : public Map
 	// Database version
 	void loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load=false);
 
+	/*
+		loadBlock(p) in two steps, so that the slow part (database access
+		and decompression) doesn't need to hold the env lock:
+		readBlock() fetches and deserializes the block without touching the
+		map or the node definitions and may be called from any thread.
+		finishLoadBlock() (env lock required) corrects the node ids and
+		inserts the block, unless it has appeared in the map meanwhile.
+		Returns the block in the map, or null if there is none.
+	*/
+	struct ReadBlockData
+	{
+		v3s16 pos;
+		// Data from the database, empty if the block isn't stored
+		std::string blob;
+		// Deserialized block with the stored node ids. Null if the block
+		// has to be deserialized by finishLoadBlock().
+		std::unique_ptr<MapBlock> block;
+		NameIdMapping nimap;
+		// m_db_write_count when the block was read
+		u32 db_write_count = 0;
+	};
+	void readBlock(v3s16 p, ReadBlockData &data);
+	MapBlock *finishLoadBlock(ReadBlockData &data);
+
 	// Blocks are removed from the map but not deleted from memory until
 	// deleteDetachedBlocks() is called, since pointers to them may still exist
 	// when deleteBlock() is called.
@@ -179,17 +206,29 @@ class ServerMap : public Map
 	u32 m_unprocessed_count = 0;
 	u64 m_inc_trending_up_start_time = 0; // milliseconds
 	bool m_queue_size_timer_started = false;
+	// Null if liquids are transformed on the server thread only
+	std::unique_ptr<WorkerPool> m_liquid_pool;
 
 	/*
 		Metadata is re-written on disk only if this is true.
 		This is reset to false when written on disk.
 	*/
 	bool m_map_metadata_changed = true;
+	// Guards dbase and dbase_ro, since readBlock() doesn't need the env lock
+	std::mutex m_db_mutex;
 	MapDatabase *dbase = nullptr;
 	MapDatabase *dbase_ro = nullptr;
+	// Bumped whenever a block in the database is changed, so that
+	// finishLoadBlock() can tell whether the data it was given is current
+	u32 m_db_write_count = 0;
 
 	// Map metrics
 	MetricGaugePtr m_loaded_blocks_gauge;
 	MetricCounterPtr m_save_time_counter;
 	MetricCounterPtr m_save_count_counter;
+
+	// Liquid metrics
+	MetricGaugePtr m_liquid_queue_gauge;
+	MetricCounterPtr m_liquid_nodes_counter;
+	MetricCounterPtr m_liquid_time_counter;
 };
@@ -0,0 +1,114 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "worker_pool.h"
+#include "debug.h"
+
+WorkerPool::WorkerPool(const std::string &name, unsigned int num_threads)
+{
+	for (unsigned int i = 0; i < num_threads; i++) {
+		m_workers.emplace_back(std::make_unique<Worker>(
+				name + std::to_string(i), this));
+		m_workers.back()->start();
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	for (auto &worker : m_workers)
+		worker->stop();
+	m_work_cv.notify_all();
+	for (auto &worker : m_workers)
+		worker->wait();
+}
+
+void *WorkerPool::Worker::run()
+{
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	m_pool->workerLoop();
+
+	END_DEBUG_EXCEPTION_HANDLER
+
+	return nullptr;
+}
+
+void WorkerPool::workerLoop()
+{
+	u32 seen_generation = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true) {
+		m_work_cv.wait(lock, [&] {
+			return m_stop || m_generation != seen_generation;
+		});
+		if (m_stop)
+			return;
+		seen_generation = m_generation;
+		// The job may already be finished if we woke up late
+		if (!m_job)
+			continue;
+
+		const auto *job = m_job;
+		size_t count = m_job_count;
+		m_busy++;
+		lock.unlock();
+
+		runJobs(*job, count);
+
+		lock.lock();
+		if (--m_busy == 0)
+			m_done_cv.notify_all();
+	}
+}
+
+void WorkerPool::runJobs(const std::function<void(size_t)> &f, size_t count)
+{
+	size_t i;
+	while ((i = m_next_index.fetch_add(1)) < count) {
+		try {
+			f(i);
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_error)
+				m_error = std::current_exception();
+		}
+	}
+}
+
+void WorkerPool::forEach(size_t count, const std::function<void(size_t)> &f)
+{
+	if (count == 0)
+		return;
+	if (m_workers.empty() || count == 1) {
+		for (size_t i = 0; i < count; i++)
+			f(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		sanity_check(!m_job);
+		m_job = &f;
+		m_job_count = count;
+		m_next_index = 0;
+		m_error = nullptr;
+		m_generation++;
+	}
+	m_work_cv.notify_all();
+
+	runJobs(f, count);
+
+	std::exception_ptr error;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done_cv.wait(lock, [&] { return m_busy == 0; });
+		m_job = nullptr;
+		std::swap(error, m_error);
+	}
+	if (error)
+		std::rethrow_exception(error);
+}
@@ -0,0 +1,71 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "irrlichttypes.h"
+#include "threading/thread.h"
+
+/*
+	A fixed set of threads for running data-parallel loops.
+
+	forEach() hands out the indices of a loop to the workers and to the
+	calling thread and returns once every call has finished. Only one
+	thread may use a pool at a time.
+*/
+class WorkerPool
+{
+public:
+	WorkerPool(const std::string &name, unsigned int num_threads);
+	~WorkerPool();
+	DISABLE_CLASS_COPY(WorkerPool)
+
+	// Number of threads besides the calling thread
+	unsigned int size() const { return m_workers.size(); }
+
+	// Calls f(i) for every i in [0, count). The first exception thrown by
+	// f is rethrown after all calls have finished.
+	void forEach(size_t count, const std::function<void(size_t)> &f);
+
+private:
+	class Worker : public Thread
+	{
+	public:
+		Worker(const std::string &name, WorkerPool *pool) :
+			Thread(name), m_pool(pool)
+		{}
+
+	protected:
+		void *run() override;
+
+	private:
+		WorkerPool *m_pool;
+	};
+
+	void workerLoop();
+	void runJobs(const std::function<void(size_t)> &f, size_t count);
+
+	std::vector<std::unique_ptr<Worker>> m_workers;
+
+	std::mutex m_mutex;
+	std::condition_variable m_work_cv;
+	std::condition_variable m_done_cv;
+
+	// Protected by m_mutex
+	const std::function<void(size_t)> *m_job = nullptr;
+	size_t m_job_count = 0;
+	u32 m_generation = 0;
+	u32 m_busy = 0;
+	bool m_stop = false;
+	std::exception_ptr m_error;
+
+	std::atomic<size_t> m_next_index{0};
+};
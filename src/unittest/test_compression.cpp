@@ -38,6 +38,7 @@ class TestCompression : public TestBase {
 	void testZlibCompression();
 	void testZlibLargeData();
 	void testZstdLargeData();
+	void testZstdDictionary();
 	void testZlibLimit();
 	void _testZlibLimit(u32 size, u32 limit);
 };
@@ -50,6 +51,7 @@ void TestCompression::runTests(IGameDef *gamedef)
 	TEST(testZlibCompression);
 	TEST(testZlibLargeData);
 	TEST(testZstdLargeData);
+	TEST(testZstdDictionary);
 	TEST(testZlibLimit);
 }
 
@@ -212,6 +214,55 @@ void TestCompression::testZstdLargeData()
 	}
 }
 
+// Similar to each other, like map blocks
+static std::string make_dictionary_sample(PseudoRandom &pr)
+{
+	std::string sample;
+	const char *words[] = {"default:stone", "default:dirt", "air", "default:water"};
+	for (int i = 0; i < 100; i++) {
+		sample.append(words[pr.range(0, 3)]);
+		sample.push_back(pr.range(0, 15));
+	}
+	return sample;
+}
+
+void TestCompression::testZstdDictionary()
+{
+	PseudoRandom pr(1234);
+	std::vector<std::string> samples;
+	for (int i = 0; i < 100; i++)
+		samples.push_back(make_dictionary_sample(pr));
+
+	std::string dict_data = ZstdDictionary::train(samples, 4096);
+	UASSERT(!dict_data.empty());
+	UASSERT(dict_data.size() <= 4096);
+	ZstdDictionary dict(dict_data);
+	UASSERT(dict.getId() != 0);
+
+	const std::string data = make_dictionary_sample(pr);
+	std::ostringstream os_plain(std::ios::binary), os_dict(std::ios::binary);
+	compressZstd(data, os_plain, 0);
+	compressZstd(data, os_dict, 0, &dict);
+	UASSERT(os_dict.str().size() < os_plain.str().size());
+
+	// Roundtrip, and data without dictionary reads fine with one
+	for (const std::string &compressed : {os_dict.str(), os_plain.str()}) {
+		std::istringstream is(compressed, std::ios::binary);
+		std::ostringstream os(std::ios::binary);
+		decompressZstd(is, os, &dict);
+		UASSERT(os.str() == data);
+	}
+
+	// It is needed though
+	std::istringstream is(os_dict.str(), std::ios::binary);
+	std::ostringstream os(std::ios::binary);
+	EXCEPTION_CHECK(SerializationError, decompressZstd(is, os));
+
+	// Too few samples
+	UASSERT(ZstdDictionary::train({data}, 4096).empty());
+	EXCEPTION_CHECK(SerializationError, ZstdDictionary("not a dictionary"));
+}
+
 void TestCompression::testZlibLimit()
 {
 	// edge cases
@@ -0,0 +1,204 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "test.h"
+
+#include <algorithm>
+#include <deque>
+#include "noise.h"
+#include "network/mtp/congestion.h"
+#include "network/mtp/internal.h"
+
+class TestCongestion : public TestBase
+{
+public:
+	TestCongestion() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestCongestion"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testCreate();
+	void testLegacy();
+	void testCubic();
+	void testBbr();
+};
+
+static TestCongestion g_test_instance;
+
+void TestCongestion::runTests(IGameDef *gamedef)
+{
+	TEST(testCreate);
+	TEST(testLegacy);
+	TEST(testCubic);
+	TEST(testBbr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+/*
+	A sender that always has data, behind a bottleneck link with a queue,
+	simulated in steps of one millisecond. Lost packets are noticed after
+	a fixed timeout, like the resend timer of a channel does.
+*/
+struct LinkModel
+{
+	float rate = 2000;        // packets per second through the bottleneck
+	float rtt = 0.05f;        // without queueing
+	u32 queue_limit = 100;    // packets waiting at the bottleneck
+	float random_loss = 0;    // lost independently of the queue
+	float loss_timeout = 0.2f;
+
+	struct Result
+	{
+		float goodput;   // fraction of the link rate delivered
+		float avg_queue; // packets
+	};
+
+	Result run(con::CongestionControl *cc, float duration, u32 seed = 42)
+	{
+		const float dt = 0.001f;
+		PcgRandom rand(seed);
+
+		std::deque<float> queue;       // send times of queued packets
+		std::deque<std::pair<float, float>> acks; // arrival time, rtt
+		std::deque<float> losses;      // when losses are noticed
+		u32 in_flight = 0;
+		float service_credit = 0;
+		float pacing_tokens = 0;
+		u64 delivered = 0, queue_sum = 0, steps = 0;
+
+		for (float t = 0; t < duration; t += dt) {
+			while (!acks.empty() && acks.front().first <= t) {
+				cc->onAck(acks.front().second, 512);
+				acks.pop_front();
+				in_flight--;
+			}
+			while (!losses.empty() && losses.front() <= t) {
+				losses.pop_front();
+				in_flight--;
+				cc->onLoss(1);
+			}
+			cc->step(dt, in_flight);
+
+			// Same token bucket as Channel::takePacingToken()
+			const float pacing = cc->getPacingRate();
+			pacing_tokens = std::min(pacing_tokens + pacing * dt,
+				std::max(8.0f, pacing * 0.005f));
+			while (in_flight < cc->getWindow() && (pacing <= 0 || pacing_tokens >= 1)) {
+				if (pacing > 0)
+					pacing_tokens -= 1;
+				in_flight++;
+				if (queue.size() >= queue_limit ||
+						rand.range(0, 9999) < random_loss * 10000)
+					losses.push_back(t + loss_timeout);
+				else
+					queue.push_back(t);
+			}
+
+			// The bottleneck
+			service_credit = std::min(service_credit + rate * dt, 1.0f + rate * dt);
+			while (!queue.empty() && service_credit >= 1) {
+				service_credit -= 1;
+				const float sent = queue.front();
+				queue.pop_front();
+				acks.emplace_back(t + rtt, t + rtt - sent);
+				delivered++;
+			}
+			queue_sum += queue.size();
+			steps++;
+		}
+		return {delivered / (rate * duration), (float)queue_sum / steps};
+	}
+};
+
+}
+
+void TestCongestion::testCreate()
+{
+	for (const char *name : {"legacy", "cubic", "bbr"}) {
+		auto cc = con::CongestionControl::create(name);
+		UASSERT(cc);
+		UASSERTEQ(std::string, cc->getName(), name);
+		UASSERT(cc->getWindow() >= MIN_RELIABLE_WINDOW_SIZE);
+		UASSERT(cc->getWindow() <= MAX_RELIABLE_WINDOW_SIZE);
+	}
+	UASSERT(!con::CongestionControl::create("reno"));
+	UASSERT(!con::CongestionControl::create(""));
+}
+
+void TestCongestion::testLegacy()
+{
+	// Behaves like the window logic that used to be in Channel
+	auto cc = con::CongestionControl::create("legacy");
+	UASSERTEQ(u32, cc->getWindow(), START_RELIABLE_WINDOW_SIZE);
+	UASSERTEQ(float, cc->getPacingRate(), 0);
+
+	// Only losses: shrinks once per second
+	cc->onLoss(5);
+	cc->step(0.5f, 0);
+	UASSERTEQ(u32, cc->getWindow(), START_RELIABLE_WINDOW_SIZE);
+	cc->step(0.6f, 0);
+	UASSERTEQ(u32, cc->getWindow(), START_RELIABLE_WINDOW_SIZE - 10);
+
+	// Grows only if a good part of the window was used
+	for (int i = 0; i < 10; i++)
+		cc->onAck(0.05f, 10);
+	cc->step(1.0f, 0);
+	UASSERTEQ(u32, cc->getWindow(), START_RELIABLE_WINDOW_SIZE - 10);
+	for (u32 i = 0; i < START_RELIABLE_WINDOW_SIZE; i++)
+		cc->onAck(0.05f, 512);
+	cc->step(1.0f, 0);
+	UASSERTEQ(u32, cc->getWindow(), START_RELIABLE_WINDOW_SIZE + 90);
+
+	// Never leaves the limits
+	for (int i = 0; i < 1000; i++) {
+		cc->onLoss(1);
+		cc->step(1.0f, 0);
+	}
+	UASSERTEQ(u32, cc->getWindow(), MIN_RELIABLE_WINDOW_SIZE);
+}
+
+void TestCongestion::testCubic()
+{
+	LinkModel link;
+	auto cc = con::CongestionControl::create("cubic");
+	auto result = link.run(cc.get(), 20.0f);
+	infostream << "cubic: goodput=" << result.goodput
+		<< " avg_queue=" << result.avg_queue << std::endl;
+	UASSERT(result.goodput > 0.8f);
+
+	// Backs off after a loss
+	const u32 window = cc->getWindow();
+	cc->step(1.0f, window);
+	cc->onLoss(1);
+	UASSERT(cc->getWindow() < window);
+	UASSERT(cc->getWindow() >= MIN_RELIABLE_WINDOW_SIZE);
+}
+
+void TestCongestion::testBbr()
+{
+	LinkModel link;
+	auto cc = con::CongestionControl::create("bbr");
+	auto result = link.run(cc.get(), 20.0f);
+	infostream << "bbr: goodput=" << result.goodput
+		<< " avg_queue=" << result.avg_queue << std::endl;
+	UASSERT(result.goodput > 0.8f);
+	// Doesn't keep the queue of the bottleneck full, unlike loss based ones
+	UASSERT(result.avg_queue < link.queue_limit / 4);
+	auto cubic = con::CongestionControl::create("cubic");
+	UASSERT(result.avg_queue < link.run(cubic.get(), 20.0f).avg_queue);
+
+	// Random loss is not taken as congestion
+	link.random_loss = 0.01f;
+	cc = con::CongestionControl::create("bbr");
+	result = link.run(cc.get(), 20.0f);
+	infostream << "bbr with 1% loss: goodput=" << result.goodput << std::endl;
+	UASSERT(result.goodput > 0.7f);
+
+	cubic = con::CongestionControl::create("cubic");
+	auto cubic_result = link.run(cubic.get(), 20.0f);
+	infostream << "cubic with 1% loss: goodput=" << cubic_result.goodput << std::endl;
+	UASSERT(result.goodput > cubic_result.goodput);
+}
@@ -19,12 +19,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <thread>
 #include "log.h"
 #include "porting.h"
 #include "settings.h"
 #include "util/serialize.h"
 #include "network/peerhandler.h"
 #include "network/mtp/internal.h"
+#include "network/mtp/threads.h"
 #include "network/networkpacket.h"
 #include "network/socket.h"
 
@@ -42,7 +44,13 @@ class TestConnection : public TestBase {
 
 	void testNetworkPacketSerialize();
 	void testHelpers();
+	void testReliablePacketBuffer();
+	void testReliablePacketBufferTimers();
+	void testPacketPool();
 	void testConnectSendReceive();
+	void testReliableUnderLoss(const std::string &congestion_control);
+	void testReceiveWorkers();
+	void testReorderedDelivery(const char *receive_threads, u16 port);
 };
 
 static TestConnection g_test_instance;
@@ -51,7 +59,16 @@ void TestConnection::runTests(IGameDef *gamedef)
 {
 	TEST(testNetworkPacketSerialize);
 	TEST(testHelpers);
+	TEST(testReliablePacketBuffer);
+	TEST(testReliablePacketBufferTimers);
+	TEST(testPacketPool);
 	TEST(testConnectSendReceive);
+	TEST(testReliableUnderLoss, "legacy");
+	TEST(testReliableUnderLoss, "cubic");
+	TEST(testReliableUnderLoss, "bbr");
+	TEST(testReceiveWorkers);
+	TEST(testReorderedDelivery, "0", 30004);
+	TEST(testReorderedDelivery, "2", 30005);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -100,6 +117,11 @@ void TestConnection::testNetworkPacketSerialize()
 		auto buf = pkt.oldForgePacket();
 		UASSERTEQ(int, buf.getSize(), sizeof(expected));
 		UASSERT(!memcmp(expected, &buf[0], buf.getSize()));
+
+		// what the connection sends
+		con::PacketData data(pkt);
+		UASSERTEQ(int, data.size(), sizeof(expected));
+		UASSERT(!memcmp(expected, data.data(), data.size()));
 	}
 
 	{
@@ -141,22 +163,229 @@ void TestConnection::testHelpers()
 	UASSERT(readU8(&p1->data[6]) == channel);
 	UASSERT(readU8(&p1->data[7]) == data1[0]);
 
-	//infostream<<"initial data1[0]="<<((u32)data1[0]&0xff)<<std::endl;
+	con::OutgoingChunk c2 = con::OutgoingChunk::copy(*data1, data1.getSize());
+	con::makeReliablePacket(c2, seqnum);
+
+	UASSERT(c2.size() == 3 + data1.getSize());
+	UASSERT(readU8(&c2.getHeaders()[0]) == con::PACKET_TYPE_RELIABLE);
+	UASSERT(readU16(&c2.getHeaders()[1]) == seqnum);
+	UASSERT(readU8(&c2.getHeaders()[3]) == data1[0]);
 
-	SharedBuffer<u8> p2 = con::makeReliablePacket(data1, seqnum);
+	/*
+		Splitting and adding headers must not copy the data
+	*/
+	Buffer<u8> big(1000);
+	for (u32 i = 0; i < big.getSize(); i++)
+		big[i] = i & 0xff;
+	const con::PacketData data3(std::move(big));
+	const u32 chunksize_max = 100;
+	const u32 chunk_data_max = chunksize_max - SPLIT_HEADER_SIZE;
+	const u32 chunk_count = (data3.size() + chunk_data_max - 1) / chunk_data_max;
+
+	std::list<con::OutgoingChunk> chunks;
+	u16 split_seqnum = 7;
+	con::makeAutoSplitPacket(data3, chunksize_max, split_seqnum, &chunks);
+	UASSERT(split_seqnum == 8);
+	UASSERT(chunks.size() == chunk_count);
+	u32 chunk_num = 0, total = 0;
+	for (con::OutgoingChunk &chunk : chunks) {
+		const u8 *header = chunk.getHeaders();
+		UASSERT(chunk.getHeadersSize() == SPLIT_HEADER_SIZE);
+		UASSERT(readU8(&header[0]) == con::PACKET_TYPE_SPLIT);
+		UASSERT(readU16(&header[1]) == 7);
+		UASSERT(readU16(&header[3]) == chunk_count);
+		UASSERT(readU16(&header[5]) == chunk_num);
+		UASSERT(chunk.size() <= chunksize_max);
+		UASSERT(chunk.getData().data() == data3.data() + total);
+		total += chunk.getData().size();
+		chunk_num++;
+	}
+	UASSERT(total == data3.size());
+
+	// All headers of the first chunk in front of its data
+	con::OutgoingChunk &first = chunks.front();
+	con::makeReliablePacket(first, seqnum);
+	con::BufferedPacketPtr p3 = con::makePacket(a, first, proto_id, peer_id, channel);
+	UASSERT(p3->getHeadersSize() == BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE + SPLIT_HEADER_SIZE);
+	UASSERT(p3->size() == p3->getHeadersSize() + chunk_data_max);
+	UASSERT(readU32(&p3->data[0]) == proto_id);
+	UASSERT(readU8(&p3->data[BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE]) == con::PACKET_TYPE_SPLIT);
+	UASSERT(p3->getSeqnum() == seqnum);
+	UASSERT(p3->getPayload().data() == data3.data());
+
+	// Small enough for one packet
+	chunks.clear();
+	con::makeAutoSplitPacket(data3.slice(10, 50), chunksize_max, split_seqnum, &chunks);
+	UASSERT(split_seqnum == 8);
+	UASSERT(chunks.size() == 1);
+	UASSERT(chunks.front().getHeadersSize() == ORIGINAL_HEADER_SIZE);
+	UASSERT(readU8(chunks.front().getHeaders()) == con::PACKET_TYPE_ORIGINAL);
+	UASSERT(chunks.front().getData().data() == data3.data() + 10);
+}
 
-	/*infostream<<"p2.getSize()="<<p2.getSize()<<", data1.getSize()="
-			<<data1.getSize()<<std::endl;
-	infostream<<"readU8(&p2[3])="<<readU8(&p2[3])
-			<<" p2[3]="<<((u32)p2[3]&0xff)<<std::endl;
-	infostream<<"data1[0]="<<((u32)data1[0]&0xff)<<std::endl;*/
 
-	UASSERT(p2.getSize() == 3 + data1.getSize());
-	UASSERT(readU8(&p2[0]) == con::PACKET_TYPE_RELIABLE);
-	UASSERT(readU16(&p2[1]) == seqnum);
-	UASSERT(readU8(&p2[3]) == data1[0]);
+static con::BufferedPacketPtr make_reliable(u16 seqnum)
+{
+	SharedBuffer<u8> data(1);
+	data[0] = seqnum & 0xff;
+	con::OutgoingChunk chunk = con::OutgoingChunk::copy(*data, data.getSize());
+	con::makeReliablePacket(chunk, seqnum);
+	return con::makePacket(Address(127, 0, 0, 1, 10), chunk, 0x12345678, 123, 0);
 }
 
+static void insert_reliable(con::ReliablePacketBuffer &buf, u16 seqnum,
+		u16 next_expected)
+{
+	con::BufferedPacketPtr p = make_reliable(seqnum);
+	buf.insert(p, next_expected);
+}
+
+void TestConnection::testReliablePacketBuffer()
+{
+	{
+		// Out of order
+		con::ReliablePacketBuffer buf;
+		for (u16 s : {105, 102, 110, 101})
+			insert_reliable(buf, s, 100);
+		// Resent
+		insert_reliable(buf, 102, 100);
+		UASSERTEQ(u32, buf.size(), 4);
+
+		u16 first;
+		UASSERT(buf.getFirstSeqnum(first) && first == 101);
+		for (u16 s : {101, 102, 105, 110})
+			UASSERTEQ(u16, buf.popFirst()->getSeqnum(), s);
+		UASSERT(buf.empty());
+		UASSERT(!buf.getFirstSeqnum(first));
+	}
+
+	{
+		// Wrapping around
+		con::ReliablePacketBuffer buf;
+		for (u16 s : {3, 65533, 0})
+			insert_reliable(buf, s, 65530);
+		u16 first;
+		UASSERT(buf.getFirstSeqnum(first) && first == 65533);
+
+		// Acks in any order
+		UASSERTEQ(u16, buf.popSeqnum(0)->getSeqnum(), 0);
+		EXCEPTION_CHECK(con::NotFoundException, buf.popSeqnum(0));
+		UASSERTEQ(u16, buf.popSeqnum(65533)->getSeqnum(), 65533);
+		UASSERT(buf.getFirstSeqnum(first) && first == 3);
+		UASSERTEQ(u16, buf.popSeqnum(3)->getSeqnum(), 3);
+		UASSERT(buf.empty());
+	}
+
+	{
+		// The whole window, across the wrap-around
+		con::ReliablePacketBuffer buf;
+		const u16 start = 50000;
+		for (u32 i = 1; i < MAX_RELIABLE_WINDOW_SIZE; i++)
+			insert_reliable(buf, start + i, start);
+		UASSERTEQ(u32, buf.size(), MAX_RELIABLE_WINDOW_SIZE - 1);
+		// Outside of the window
+		insert_reliable(buf, (u16)(start + MAX_RELIABLE_WINDOW_SIZE), start);
+		UASSERTEQ(u32, buf.size(), MAX_RELIABLE_WINDOW_SIZE - 1);
+
+		// Ack every other packet, newest first
+		for (s32 i = MAX_RELIABLE_WINDOW_SIZE - 1; i >= 1; i -= 2)
+			buf.popSeqnum(start + i);
+		UASSERTEQ(u32, buf.size(), MAX_RELIABLE_WINDOW_SIZE / 2 - 1);
+		u16 first;
+		UASSERT(buf.getFirstSeqnum(first) && first == start + 2);
+		u16 expected = start + 2;
+		while (!buf.empty()) {
+			UASSERTEQ(u16, buf.popFirst()->getSeqnum(), expected);
+			expected += 2;
+		}
+	}
+}
+
+void TestConnection::testReliablePacketBufferTimers()
+{
+	con::ReliablePacketBuffer buf;
+	for (u16 s = 1; s <= 3; s++)
+		insert_reliable(buf, s, 0);
+
+	buf.incrementTimeouts(0.5f);
+	UASSERT(buf.getResend(1.0f, 10).empty());
+	buf.incrementTimeouts(0.6f);
+	auto resend = buf.getResend(1.0f, 2);
+	UASSERTEQ(size_t, resend.size(), 2);
+	UASSERTEQ(u16, resend[0]->getSeqnum(), 1);
+	UASSERTEQ(u32, resend[0]->resend_count, 1);
+	resend = buf.getResend(1.0f, 10);
+	UASSERTEQ(size_t, resend.size(), 1);
+	UASSERTEQ(u16, resend[0]->getSeqnum(), 3);
+
+	// The next resend takes 1.5 times as long
+	buf.incrementTimeouts(1.0f);
+	UASSERT(buf.getResend(1.0f, 10).empty());
+	buf.popSeqnum(2);
+	buf.incrementTimeouts(0.6f);
+	resend = buf.getResend(1.0f, 10);
+	UASSERTEQ(size_t, resend.size(), 2);
+	UASSERTEQ(u32, resend[0]->resend_count, 2);
+
+	// Timeouts count from the insertion
+	insert_reliable(buf, 4, 0);
+	UASSERTEQ(u32, buf.getTimedOuts(2.5f), 2);
+	UASSERTEQ(u32, buf.getTimedOuts(0.0f), 3);
+	buf.incrementTimeouts(0.25f);
+	con::BufferedPacketPtr p = buf.popSeqnum(4);
+	UASSERT(std::fabs(p->totaltime - 0.25f) < 0.001f);
+	UASSERT(std::fabs(p->time - 0.25f) < 0.001f);
+
+	// Resending everything right away
+	resend = buf.getResend(0.0f, 10);
+	UASSERTEQ(size_t, resend.size(), 2);
+}
+
+void TestConnection::testPacketPool()
+{
+	// A freed block is used again by the same thread
+	void *p = con::poolAllocate(500);
+	con::poolFree(p, 500);
+	UASSERT(con::poolAllocate(400) == p);
+	con::poolFree(p, 400);
+
+	// Too big for the pool
+	p = con::poolAllocate(64 * 1024);
+	memset(p, 0xaa, 64 * 1024);
+	con::poolFree(p, 64 * 1024);
+
+	// Blocks freed by another thread than the one that allocated them,
+	// like packets that are acknowledged, go back to the pool
+	const int count = 300;
+	std::vector<void *> blocks(count);
+	std::thread allocator([&] () {
+		for (void *&block : blocks)
+			block = con::poolAllocate(1000);
+	});
+	allocator.join();
+	for (void *block : blocks)
+		con::poolFree(block, 1000);
+
+	con::takePoolStats();
+	std::thread user([] () {
+		std::vector<void *> blocks(count);
+		for (void *&block : blocks)
+			block = con::poolAllocate(1000);
+		for (void *block : blocks)
+			con::poolFree(block, 1000);
+	});
+	user.join();
+	// The counts of a thread are complete once it ended
+	con::PoolStats stats = con::takePoolStats();
+	UASSERT(stats.allocations >= count);
+	UASSERT(stats.heap_allocations < count / 2);
+
+	// Packets and their data
+	con::BufferedPacketPtr packet = con::makePacket(Address(127, 0, 0, 1, 10),
+		SharedBuffer<u8>(100), 0x12345678, 123, 0);
+	UASSERT(packet->size() == 100 + BASE_HEADER_SIZE);
+	UASSERT(readU32(packet->data) == 0x12345678);
+}
 
 void TestConnection::testConnectSendReceive()
 {
@@ -375,3 +604,244 @@ void TestConnection::testConnectSendReceive()
 	UASSERT(hand_server.count == 1);
 	UASSERT(hand_server.last_id >= 2);
 }
+
+void TestConnection::testReliableUnderLoss(const std::string &congestion_control)
+{
+	Settings *conf = g_settings;
+	const std::string old_setting = conf->get("congestion_control");
+	conf->set("congestion_control", congestion_control);
+
+	Handler hand_server("server");
+	Handler hand_client("client");
+
+	Address address(0, 0, 0, 0, 30002);
+	Address server_address(127, 0, 0, 1, 30002);
+	try {
+		Address bind_addr(0, 0, 0, 0, 30002);
+		bind_addr.Resolve(conf->get("bind_address").c_str());
+		if (!bind_addr.isIPv6() && bind_addr != address)
+			address = server_address = bind_addr;
+	} catch (ResolveError &e) {
+	}
+
+	con::Connection server(512, 5.0f, false, &hand_server);
+	con::Connection client(512, 5.0f, false, &hand_client);
+	conf->set("congestion_control", old_setting);
+	UASSERTEQ(std::string, server.getCongestionControl(), congestion_control);
+
+	server.Serve(address);
+	sleep_ms(50);
+	client.Connect(server_address);
+
+	// Both sides have to see the other before anything is lost
+	const u64 connect_start = porting::getTimeMs();
+	while (!client.Connected() || hand_server.count == 0) {
+		UASSERT(porting::getTimeMs() - connect_start < 5000);
+		NetworkPacket pkt;
+		client.TryReceive(&pkt);
+		server.TryReceive(&pkt);
+		sleep_ms(10);
+	}
+	const session_t peer_id_client = hand_server.last_id;
+
+	server.setSimulatedPacketLoss(0.1f);
+	client.setSimulatedPacketLoss(0.1f);
+
+	// More than fit into the start window, some of them split
+	const u32 count = 500;
+	for (u32 i = 0; i < count; i++) {
+		NetworkPacket pkt(0x42, 0);
+		pkt << i;
+		pkt.putRawString(std::string(i % 50 == 0 ? 2000 : 100, 'x'));
+		server.Send(peer_id_client, 0, &pkt, true);
+	}
+
+	// Everything arrives, in order
+	u32 next = 0;
+	const u64 start = porting::getTimeMs();
+	while (next < count && porting::getTimeMs() - start < 20000) {
+		NetworkPacket pkt;
+		if (!client.TryReceive(&pkt)) {
+			sleep_ms(5);
+			continue;
+		}
+		u32 i;
+		pkt >> i;
+		UASSERTEQ(u32, i, next);
+		next++;
+	}
+	UASSERTEQ(u32, next, count);
+
+	UASSERT(server.getPeerStat(peer_id_client, con::CWND) >= MIN_RELIABLE_WINDOW_SIZE);
+	float loss = server.getPeerStat(peer_id_client, con::PACKET_LOSS);
+	UASSERT(loss >= 0 && loss <= 1);
+
+	server.setSimulatedPacketLoss(0);
+	client.setSimulatedPacketLoss(0);
+}
+
+void TestConnection::testReceiveWorkers()
+{
+	// Clients of one host are spread over the workers
+	std::vector<u32> per_shard(4);
+	for (u16 port = 30000; port < 30064; port++)
+		per_shard[con::ConnectionReceiveThread::getShard(Address(127, 0, 0, 1, port), 4)]++;
+	for (u32 n : per_shard)
+		UASSERT(n > 0);
+
+	Settings *conf = g_settings;
+	const std::string old_setting = conf->get("receive_threads");
+	conf->set("receive_threads", "3");
+
+	Handler hand_server("server");
+	Address address(0, 0, 0, 0, 30003);
+	Address server_address(127, 0, 0, 1, 30003);
+	try {
+		Address bind_addr(0, 0, 0, 0, 30003);
+		bind_addr.Resolve(conf->get("bind_address").c_str());
+		if (!bind_addr.isIPv6() && bind_addr != address)
+			address = server_address = bind_addr;
+	} catch (ResolveError &e) {
+	}
+
+	con::Connection server(512, 5.0f, false, &hand_server);
+	conf->set("receive_threads", old_setting);
+	server.Serve(address);
+	sleep_ms(50);
+
+	const u32 client_count = 4;
+	std::vector<std::unique_ptr<Handler>> handlers;
+	std::vector<std::unique_ptr<con::Connection>> clients;
+	for (u32 i = 0; i < client_count; i++) {
+		handlers.emplace_back(new Handler("client"));
+		clients.emplace_back(new con::Connection(512, 5.0f, false, handlers[i].get()));
+		clients[i]->Connect(server_address);
+	}
+
+	const u64 connect_start = porting::getTimeMs();
+	for (auto &client : clients) {
+		while (!client->Connected()) {
+			UASSERT(porting::getTimeMs() - connect_start < 5000);
+			NetworkPacket pkt;
+			client->TryReceive(&pkt);
+			server.TryReceive(&pkt);
+			sleep_ms(10);
+		}
+		// Reordered by the loss
+		client->setSimulatedPacketLoss(0.05f);
+	}
+
+	// Every client sends a numbered stream, some packets of it split
+	const u32 count = 200;
+	for (u32 i = 0; i < count; i++) {
+		for (auto &client : clients) {
+			NetworkPacket pkt(0x42, 0);
+			pkt << i;
+			pkt.putRawString(std::string(i % 50 == 0 ? 2000 : 100, 'x'));
+			client->Send(PEER_ID_SERVER, 0, &pkt, true);
+		}
+	}
+
+	// The stream of every client arrives in order
+	std::map<session_t, u32> next;
+	u32 received = 0;
+	const u64 start = porting::getTimeMs();
+	while (received < count * client_count && porting::getTimeMs() - start < 20000) {
+		NetworkPacket pkt;
+		if (!server.TryReceive(&pkt)) {
+			sleep_ms(5);
+			continue;
+		}
+		if (pkt.getCommand() != 0x42)
+			continue;
+		u32 i;
+		pkt >> i;
+		UASSERTEQ(u32, i, next[pkt.getPeerId()]);
+		next[pkt.getPeerId()]++;
+		received++;
+	}
+	UASSERTEQ(u32, received, count * client_count);
+	UASSERTEQ(size_t, next.size(), client_count);
+
+	for (auto &client : clients)
+		client->setSimulatedPacketLoss(0);
+}
+
+// Sends a reliable packet with command 0x42 and the number i, as a peer that
+// never learned its peer id
+static void send_raw_reliable(UDPSocket &socket, const Address &to, u16 seqnum, u32 i)
+{
+	u8 data[BASE_HEADER_SIZE + 3 + 1 + 2 + 4];
+	writeU32(&data[0], PROTOCOL_ID);
+	writeU16(&data[4], PEER_ID_INEXISTENT);
+	writeU8(&data[6], 0);
+	writeU8(&data[7], con::PACKET_TYPE_RELIABLE);
+	writeU16(&data[8], seqnum);
+	writeU8(&data[10], con::PACKET_TYPE_ORIGINAL);
+	writeU16(&data[11], 0x42);
+	writeU32(&data[13], i);
+	socket.Send(to, data, sizeof(data));
+}
+
+void TestConnection::testReorderedDelivery(const char *receive_threads, u16 port)
+{
+	Settings *conf = g_settings;
+	const std::string old_setting = conf->get("receive_threads");
+	conf->set("receive_threads", receive_threads);
+
+	Handler hand_server("server");
+	Address address(0, 0, 0, 0, port);
+	Address server_address(127, 0, 0, 1, port);
+	try {
+		Address bind_addr(0, 0, 0, 0, port);
+		bind_addr.Resolve(conf->get("bind_address").c_str());
+		if (!bind_addr.isIPv6() && bind_addr != address)
+			address = server_address = bind_addr;
+	} catch (ResolveError &e) {
+	}
+
+	con::Connection server(512, 5.0f, false, &hand_server);
+	conf->set("receive_threads", old_setting);
+	server.Serve(address);
+	sleep_ms(50);
+
+	UDPSocket socket(false);
+	socket.Bind(Address(0, 0, 0, 0, 0));
+
+	// The first packet creates the peer
+	send_raw_reliable(socket, server_address, SEQNUM_INITIAL, 0);
+	const u64 connect_start = porting::getTimeMs();
+	while (true) {
+		UASSERT(porting::getTimeMs() - connect_start < 5000);
+		NetworkPacket pkt;
+		if (server.TryReceive(&pkt))
+			break;
+		sleep_ms(5);
+	}
+
+	// Buffered until the one before it is there
+	send_raw_reliable(socket, server_address, SEQNUM_INITIAL + 2, 2);
+	sleep_ms(100);
+	{
+		NetworkPacket pkt;
+		UASSERT(!server.TryReceive(&pkt));
+	}
+
+	// Both arrive, without waiting for the receive timeout or another datagram
+	const u64 start = porting::getTimeMs();
+	send_raw_reliable(socket, server_address, SEQNUM_INITIAL + 1, 1);
+	u32 next = 1;
+	while (next <= 2 && porting::getTimeMs() - start < 5000) {
+		NetworkPacket pkt;
+		if (!server.TryReceive(&pkt)) {
+			sleep_ms(5);
+			continue;
+		}
+		u32 i;
+		pkt >> i;
+		UASSERTEQ(u32, i, next);
+		next++;
+	}
+	UASSERTEQ(u32, next, 3);
+	UASSERT(porting::getTimeMs() - start < 250);
+}
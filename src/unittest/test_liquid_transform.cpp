@@ -0,0 +1,164 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "test.h"
+
+#include "dummygamedef.h"
+#include "dummymap.h"
+#include "server/liquid_transform.h"
+#include "threading/worker_pool.h"
+
+class TestLiquidTransform : public TestBase
+{
+public:
+	TestLiquidTransform() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestLiquidTransform"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testSpread();
+	void testRecede();
+	void testThreads();
+};
+
+static TestLiquidTransform g_test_instance;
+
+void TestLiquidTransform::runTests(IGameDef *gamedef)
+{
+	TEST(testSpread);
+	TEST(testRecede);
+	TEST(testThreads);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// A floor of stone across 3x1x3 blocks with room for liquid above it
+class LiquidTestWorld
+{
+public:
+	LiquidTestWorld() :
+		map(&gamedef, v3s16(-1, 0, -1), v3s16(1, 0, 1))
+	{
+		NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+		{
+			ContentFeatures f;
+			f.name = "stone";
+			c_stone = ndef->set(f.name, f);
+		}
+		for (int i = 0; i < 2; i++) {
+			ContentFeatures f;
+			f.name = i == 0 ? "water_source" : "water_flowing";
+			f.walkable = false;
+			f.buildable_to = true;
+			f.liquid_type = i == 0 ? LIQUID_SOURCE : LIQUID_FLOWING;
+			f.liquid_alternative_source = "water_source";
+			f.liquid_alternative_flowing = "water_flowing";
+			f.liquid_range = 4;
+			content_t c = ndef->set(f.name, f);
+			(i == 0 ? c_source : c_flowing) = c;
+		}
+		ndef->resolveCrossrefs();
+
+		for (s16 z = -16; z < 32; z++)
+		for (s16 y = 0; y < 16; y++)
+		for (s16 x = -16; x < 32; x++)
+			map.setNode(v3s16(x, y, z), MapNode(y == 0 ? c_stone : CONTENT_AIR));
+	}
+
+	void setSource(v3s16 p, bool set)
+	{
+		map.setNode(p, MapNode(set ? c_source : CONTENT_AIR));
+		queue.push_back(p);
+	}
+
+	// Transforms until the queue is empty, returns the number of steps
+	int settle(WorkerPool *pool)
+	{
+		LiquidTransformer transformer(&map, gamedef.getNodeDefManager(),
+				pool, nullptr);
+		int steps = 0;
+		while (queue.size() > 0) {
+			std::map<v3s16, MapBlock *> modified_blocks;
+			std::vector<std::pair<v3s16, MapNode>> changed_nodes;
+			std::vector<v3s16> check_for_falling;
+			transformer.transform(queue, 100000, modified_blocks,
+					changed_nodes, check_for_falling);
+			steps++;
+		}
+		return steps;
+	}
+
+	DummyGameDef gamedef;
+	DummyMap map;
+	UniqueQueue<v3s16> queue;
+	content_t c_stone, c_source, c_flowing;
+};
+
+}
+
+void TestLiquidTransform::testSpread()
+{
+	LiquidTestWorld w;
+	w.setSource(v3s16(8, 1, 8), true);
+	w.settle(nullptr);
+
+	// Levels fall by one per node, down to the range of the liquid
+	for (s16 d = 1; d <= 4; d++) {
+		MapNode n = w.map.getNode(v3s16(8 + d, 1, 8));
+		UASSERTEQ(content_t, n.getContent(), w.c_flowing);
+		UASSERTEQ(int, n.param2 & LIQUID_LEVEL_MASK, LIQUID_LEVEL_MAX + 1 - d);
+	}
+	UASSERTEQ(content_t, w.map.getNode(v3s16(13, 1, 8)).getContent(), CONTENT_AIR);
+	UASSERTEQ(content_t, w.map.getNode(v3s16(8, 2, 8)).getContent(), CONTENT_AIR);
+
+	// Across block borders too
+	w.setSource(v3s16(0, 1, 0), true);
+	w.settle(nullptr);
+	MapNode n = w.map.getNode(v3s16(-2, 1, -1));
+	UASSERTEQ(content_t, n.getContent(), w.c_flowing);
+	UASSERTEQ(int, n.param2 & LIQUID_LEVEL_MASK, LIQUID_LEVEL_MAX - 2);
+}
+
+void TestLiquidTransform::testRecede()
+{
+	LiquidTestWorld w;
+	w.setSource(v3s16(15, 1, 15), true);
+	w.settle(nullptr);
+	UASSERTEQ(content_t, w.map.getNode(v3s16(16, 1, 15)).getContent(), w.c_flowing);
+
+	w.setSource(v3s16(15, 1, 15), false);
+	w.settle(nullptr);
+	for (s16 z = 10; z <= 20; z++)
+	for (s16 x = 10; x <= 20; x++)
+		UASSERTEQ(content_t, w.map.getNode(v3s16(x, 1, z)).getContent(), CONTENT_AIR);
+}
+
+void TestLiquidTransform::testThreads()
+{
+	const v3s16 sources[] = {{0, 1, 0}, {15, 1, 16}, {20, 3, 5}, {-9, 1, 27}};
+
+	LiquidTestWorld worlds[3];
+	WorkerPool pool1("LiquidTest", 1), pool3("LiquidTest", 3);
+	WorkerPool *pools[3] = {nullptr, &pool1, &pool3};
+	for (int i = 0; i < 3; i++) {
+		for (v3s16 p : sources)
+			worlds[i].setSource(p, true);
+		worlds[i].settle(pools[i]);
+	}
+
+	// Same result with any number of threads, and once settled, also the
+	// same as without a pool
+	for (s16 z = -16; z < 32; z++)
+	for (s16 y = 1; y < 16; y++)
+	for (s16 x = -16; x < 32; x++) {
+		v3s16 p(x, y, z);
+		MapNode n = worlds[0].map.getNode(p);
+		for (int i = 1; i < 3; i++) {
+			MapNode n2 = worlds[i].map.getNode(p);
+			UASSERTEQ(content_t, n2.getContent(), n.getContent());
+			UASSERTEQ(int, n2.param2, n.param2);
+		}
+	}
+}
@@ -7,9 +7,12 @@
 #include "gamedef.h"
 #include "nodedef.h"
 #include "mapblock.h"
+#include "nameidmapping.h"
 #include "serialization.h"
 #include "noise.h"
 #include "inventory.h"
+#include "settings.h"
+#include "threading/worker_pool.h"
 
 class TestMapBlock : public TestBase
 {
@@ -26,6 +29,10 @@ class TestMapBlock : public TestBase
 
 	void testSave29(IGameDef *gamedef);
 
+	void testSaveUncompressed(IGameDef *gamedef);
+
+	void testCompressInPool(IGameDef *gamedef);
+
 	void testLoad29(IGameDef *gamedef);
 
 	// Tests loading a MapBlock from Minetest-c55 0.3
@@ -33,6 +40,8 @@ class TestMapBlock : public TestBase
 
 	// Tests loading a non-standard MapBlock
 	void testLoadNonStd(IGameDef *gamedef);
+
+	void testContentPositions(IGameDef *gamedef);
 };
 
 static TestMapBlock g_test_instance;
@@ -42,9 +51,12 @@ void TestMapBlock::runTests(IGameDef *gamedef)
 	TEST(testSaveLoad, gamedef, SER_FMT_VER_HIGHEST_WRITE);
 	TEST(testSaveLoadLowest, gamedef);
 	TEST(testSave29, gamedef);
+	TEST(testSaveUncompressed, gamedef);
+	TEST(testCompressInPool, gamedef);
 	TEST(testLoad29, gamedef);
 	TEST(testLoad20, gamedef);
 	TEST(testLoadNonStd, gamedef);
+	TEST(testContentPositions, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -77,6 +89,7 @@ void TestMapBlock::testSaveLoad(IGameDef *gamedef, const u8 version)
 		// Serialize
 		block.serialize(ss, version, true, -1);
 	}
+	const std::string serialized = ss.str();
 
 	{
 		MapBlock block({}, gamedef);
@@ -92,6 +105,23 @@ void TestMapBlock::testSaveLoad(IGameDef *gamedef, const u8 version)
 			UASSERT(block.getData()[i] == expect);
 		}
 	}
+
+	{
+		MapBlock block({}, gamedef);
+		// Deserialize with the node ids corrected afterwards
+		std::istringstream iss(serialized, std::ios_base::binary);
+		NameIdMapping nimap;
+		block.deSerialize(iss, version, true, &nimap);
+		block.correctNodeIds(nimap);
+
+		PcgRandom r(seed);
+		for (size_t i = 0; i < MapBlock::nodecount; ++i) {
+			u32 rval = r.next();
+			auto expect =
+				MapNode(rval % max, (rval >> 16) & 0xff, (rval >> 24) & 0xff);
+			UASSERT(block.getData()[i] == expect);
+		}
+	}
 }
 
 #define SS2_CHECK() UASSERT(!ss2.fail())
@@ -163,6 +193,56 @@ void TestMapBlock::testSave29(IGameDef *gamedef)
 
 #undef SS2_CHECK
 
+void TestMapBlock::testSaveUncompressed(IGameDef *gamedef)
+{
+	MapBlock block({}, gamedef);
+	for (size_t i = 0; i < MapBlock::nodecount; ++i)
+		block.getData()[i] = MapNode(CONTENT_AIR);
+	block.setNode({1, 2, 3}, MapNode(t_CONTENT_STONE));
+
+	// Compressing it later gives the same as serializing right away
+	for (bool disk : {false, true}) {
+		std::ostringstream os(std::ios_base::binary), os_raw(std::ios_base::binary);
+		block.serialize(os, 29, disk, 3);
+		block.serializeUncompressed(os_raw, 29, disk);
+
+		std::ostringstream os2(std::ios_base::binary);
+		compress(os_raw.str(), os2, 29, 3);
+		UASSERT(os.str() == os2.str());
+	}
+}
+
+void TestMapBlock::testCompressInPool(IGameDef *gamedef)
+{
+	// Read like Server::SendBlocks() does it
+	const int level = rangelim(g_settings->getS16("map_compression_level_net"), -1, 9);
+
+	std::vector<std::string> raw(16), serial(raw.size()), pooled(raw.size());
+	PcgRandom r(1);
+	for (size_t i = 0; i < raw.size(); i++) {
+		MapBlock block({}, gamedef);
+		for (size_t j = 0; j < MapBlock::nodecount; ++j)
+			block.getData()[j] = MapNode(r.range(0, 1) ? t_CONTENT_STONE : CONTENT_AIR);
+
+		std::ostringstream os(std::ios_base::binary);
+		block.serialize(os, 29, false, level);
+		serial[i] = os.str();
+		os.str("");
+		block.serializeUncompressed(os, 29, false);
+		raw[i] = os.str();
+	}
+
+	// The workers must compress at the same level as the calling thread
+	WorkerPool pool("TestCompress", 3);
+	pool.forEach(raw.size(), [&, level] (size_t i) {
+		std::ostringstream os(std::ios_base::binary);
+		compress(raw[i], os, 29, level);
+		pooled[i] = os.str();
+	});
+	for (size_t i = 0; i < raw.size(); i++)
+		UASSERT(pooled[i] == serial[i]);
+}
+
 // The array was generated with: minetestmapper -i testworld --dumpblock 6,0,0 |
 // python -c 'import sys;d=bytes.fromhex(sys.stdin.read().strip());print(",".join("%d"%c for c in d))'
 
@@ -356,3 +436,43 @@ void TestMapBlock::testLoadNonStd(IGameDef *gamedef)
 	for (s16 i = 0; i < 16; i++)
 		UASSERTEQ(int, block.getNodeNoEx({i, 1, 0}).param2, data_lo[i]);
 }
+
+void TestMapBlock::testContentPositions(IGameDef *gamedef)
+{
+	MapBlock block({}, gamedef);
+	for (size_t i = 0; i < MapBlock::nodecount; ++i)
+		block.getData()[i] = MapNode(CONTENT_AIR);
+	block.setNode({1, 2, 3}, MapNode(t_CONTENT_STONE));
+	block.setNode({15, 0, 0}, MapNode(t_CONTENT_STONE));
+
+	auto find = [&] (content_t c) -> const MapBlock::ContentPositions * {
+		const auto *positions = block.getContentPositions();
+		UASSERT(positions);
+		for (const auto &cp : *positions) {
+			if (cp.content == c)
+				return &cp;
+		}
+		return nullptr;
+	};
+
+	// Air is everywhere, so it is not listed
+	const auto *air = find(CONTENT_AIR);
+	UASSERT(air && air->dense && air->indices.empty());
+
+	const auto *stone = find(t_CONTENT_STONE);
+	UASSERT(stone && !stone->dense);
+	UASSERTEQ(size_t, stone->indices.size(), 2);
+	UASSERTEQ(u16, stone->indices[0], 15);
+	UASSERTEQ(u16, stone->indices[1], 3 * MapBlock::zstride + 2 * MapBlock::ystride + 1);
+
+	UASSERT(!find(t_CONTENT_WATER));
+
+	// Modifying the block drops the index
+	u64 counter = block.getModificationCounter();
+	block.setNode({4, 4, 4}, MapNode(t_CONTENT_WATER));
+	UASSERT(block.getModificationCounter() != counter);
+	const auto *water = find(t_CONTENT_WATER);
+	UASSERT(water && water->indices.size() == 1);
+	stone = find(t_CONTENT_STONE);
+	UASSERT(stone && stone->indices.size() == 2);
+}
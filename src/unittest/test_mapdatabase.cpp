@@ -0,0 +1,173 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "test.h"
+
+#include <algorithm>
+#include "database/database-mmap.h"
+#include "database/database-sqlite3.h"
+#include "filesys.h"
+
+class TestMapDatabase : public TestBase
+{
+public:
+	TestMapDatabase() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapDatabase"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testSQLite3(bool write_behind);
+	void testSQLite3Reopen(bool write_behind);
+	void testMmap();
+};
+
+static TestMapDatabase g_test_instance;
+
+void TestMapDatabase::runTests(IGameDef *gamedef)
+{
+	rawstream << "-------- SQLite3 map database" << std::endl;
+	TEST(testSQLite3, false);
+	TEST(testSQLite3Reopen, false);
+	rawstream << "-------- SQLite3 map database (write-behind)" << std::endl;
+	TEST(testSQLite3, true);
+	TEST(testSQLite3Reopen, true);
+	rawstream << "-------- Memory-mapped map database" << std::endl;
+	TEST(testMmap);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static std::string block_data(int i)
+{
+	return "block" + std::to_string(i);
+}
+
+static std::string load(MapDatabase *db, v3s16 pos)
+{
+	std::string ret;
+	db->loadBlock(pos, &ret);
+	return ret;
+}
+
+void TestMapDatabase::testSQLite3(bool write_behind)
+{
+	const std::string test_dir = getTestTempDirectory();
+	fs::DeleteSingleFileOrEmptyDirectory(test_dir + DIR_DELIM + "map.sqlite");
+
+	MapDatabaseSQLite3 db(test_dir, write_behind);
+
+	// Direct save
+	UASSERT(db.saveBlock(v3s16(0, 0, 0), "direct"));
+	UASSERTEQ(std::string, load(&db, v3s16(0, 0, 0)), "direct");
+
+	// Enough blocks to use the multi-row statement more than once
+	const int count = MapDatabaseSQLite3::WRITE_BATCH_ROWS * 2 + 5;
+	db.beginSave();
+	for (int i = 0; i < count; i++)
+		db.saveBlock(v3s16(i, 1, 0), block_data(i));
+	// Saved twice in the same batch
+	db.saveBlock(v3s16(3, 1, 0), "newer");
+	// Visible before the save ends
+	UASSERTEQ(std::string, load(&db, v3s16(5, 1, 0)), block_data(5));
+	UASSERTEQ(std::string, load(&db, v3s16(3, 1, 0)), "newer");
+	db.endSave();
+
+	// Visible while (possibly) still being written
+	UASSERTEQ(std::string, load(&db, v3s16(count - 1, 1, 0)), block_data(count - 1));
+	UASSERTEQ(std::string, load(&db, v3s16(3, 1, 0)), "newer");
+	UASSERTEQ(std::string, load(&db, v3s16(0, 2, 0)), "");
+
+	// Deleting a block that is still pending
+	db.beginSave();
+	db.saveBlock(v3s16(1, 1, 0), "deleted");
+	UASSERT(db.deleteBlock(v3s16(1, 1, 0)));
+	UASSERTEQ(std::string, load(&db, v3s16(1, 1, 0)), "");
+	db.endSave();
+
+	db.flush();
+	UASSERTEQ(std::string, load(&db, v3s16(1, 1, 0)), "");
+	UASSERTEQ(std::string, load(&db, v3s16(3, 1, 0)), "newer");
+
+	// Listing includes blocks of an unfinished save exactly once
+	db.beginSave();
+	db.saveBlock(v3s16(0, 3, 0), "x");
+	db.saveBlock(v3s16(2, 1, 0), "y");
+	std::vector<v3s16> list;
+	db.listAllLoadableBlocks(list);
+	db.endSave();
+	// count blocks + the direct one + (0,3,0) - the deleted one
+	UASSERTEQ(size_t, list.size(), (size_t)count + 1);
+	UASSERT(std::count(list.begin(), list.end(), v3s16(2, 1, 0)) == 1);
+	UASSERT(std::count(list.begin(), list.end(), v3s16(0, 3, 0)) == 1);
+	UASSERT(std::count(list.begin(), list.end(), v3s16(1, 1, 0)) == 0);
+}
+
+void TestMapDatabase::testSQLite3Reopen(bool write_behind)
+{
+	const std::string test_dir = getTestTempDirectory();
+	fs::DeleteSingleFileOrEmptyDirectory(test_dir + DIR_DELIM + "map.sqlite");
+
+	{
+		MapDatabaseSQLite3 db(test_dir, write_behind);
+		db.beginSave();
+		for (int i = 0; i < 100; i++)
+			db.saveBlock(v3s16(0, i, 0), block_data(i));
+		db.endSave();
+		// Saved outside of beginSave()/endSave()
+		db.saveBlock(v3s16(0, 5, 0), "last");
+		// Everything must be written when the database is closed
+	}
+
+	MapDatabaseSQLite3 db(test_dir);
+	for (int i = 0; i < 100; i++) {
+		UASSERTEQ(std::string, load(&db, v3s16(0, i, 0)),
+			i == 5 ? "last" : block_data(i));
+	}
+}
+
+void TestMapDatabase::testMmap()
+{
+	const std::string test_dir = getTestTempDirectory() + DIR_DELIM + "mmap";
+	fs::RecursiveDelete(test_dir);
+
+	{
+		MapDatabaseMmapWriter writer(test_dir);
+		// Not sorted, and one block twice
+		for (int i = 99; i >= 0; i--)
+			UASSERT(writer.saveBlock(v3s16(i, -i, 7), block_data(i)));
+		UASSERT(writer.saveBlock(v3s16(10, -10, 7), "newer"));
+		UASSERT(writer.finish());
+	}
+
+	MapDatabaseMmap db(test_dir);
+	UASSERTEQ(std::string, load(&db, v3s16(0, 0, 7)), block_data(0));
+	UASSERTEQ(std::string, load(&db, v3s16(99, -99, 7)), block_data(99));
+	UASSERTEQ(std::string, load(&db, v3s16(10, -10, 7)), "newer");
+	UASSERTEQ(std::string, load(&db, v3s16(100, -100, 7)), "");
+
+	// Changes go to the overlay
+	db.beginSave();
+	UASSERT(db.saveBlock(v3s16(5, -5, 7), "changed"));
+	UASSERT(db.saveBlock(v3s16(0, 1, 0), "new"));
+	db.endSave();
+	UASSERT(db.deleteBlock(v3s16(6, -6, 7)));
+	UASSERTEQ(std::string, load(&db, v3s16(5, -5, 7)), "changed");
+	UASSERTEQ(std::string, load(&db, v3s16(0, 1, 0)), "new");
+	UASSERTEQ(std::string, load(&db, v3s16(6, -6, 7)), "");
+
+	std::vector<v3s16> list;
+	db.listAllLoadableBlocks(list);
+	// 100 blocks + the new one - the deleted one
+	UASSERTEQ(size_t, list.size(), (size_t)100);
+	UASSERT(std::count(list.begin(), list.end(), v3s16(5, -5, 7)) == 1);
+	UASSERT(std::count(list.begin(), list.end(), v3s16(0, 1, 0)) == 1);
+	UASSERT(std::count(list.begin(), list.end(), v3s16(6, -6, 7)) == 0);
+
+	// Without a block file everything is in the overlay
+	const std::string empty_dir = test_dir + "_empty";
+	fs::RecursiveDelete(empty_dir);
+	MapDatabaseMmap empty(empty_dir);
+	UASSERTEQ(std::string, load(&empty, v3s16(0, 0, 7)), "");
+	UASSERT(empty.saveBlock(v3s16(1, 2, 3), "x"));
+	UASSERTEQ(std::string, load(&empty, v3s16(1, 2, 3)), "x");
+}
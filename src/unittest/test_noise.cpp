@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include <cmath>
+#include <cstring>
 #include "exceptions.h"
 #include "noise.h"
 
@@ -41,6 +42,7 @@ class TestNoise : public TestBase {
 	void testNoise3dPoint();
 	void testNoise3dBulk();
 	void testNoiseInvalidParams();
+	void testNoiseSimd();
 
 	static const float expected_2d_results[10 * 10];
 	static const float expected_3d_results[10 * 10 * 10];
@@ -61,6 +63,7 @@ void TestNoise::runTests(IGameDef *gamedef)
 	TEST(testNoise3dPoint);
 	TEST(testNoise3dBulk);
 	TEST(testNoiseInvalidParams);
+	TEST(testNoiseSimd);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -175,6 +178,44 @@ void TestNoise::testNoiseInvalidParams()
 	UASSERT(exception_thrown);
 }
 
+void TestNoise::testNoiseSimd()
+{
+	// Mapgen-like sizes and parameters, with steps that aren't exact
+	NoiseParams np_2d(0, 1, v3f(250, 350, 250), 5934, 6, 0.6, 2.0);
+	NoiseParams np_3d(0, 1, v3f(96, 48, 96), 1337, 5, 0.63, 2.0,
+		NOISE_FLAG_EASED);
+	Noise noise_2d(&np_2d, 42, 80, 80);
+	Noise noise_3d(&np_3d, 42, 80, 82, 80);
+	const size_t size_2d = 80 * 80;
+	const size_t size_3d = 80 * 82 * 80;
+
+	auto run = [&] (std::vector<float> &out_2d, std::vector<float> &out_3d) {
+		float *r = noise_2d.perlinMap2D(-1213, 7731);
+		out_2d.assign(r, r + size_2d);
+		r = noise_3d.perlinMap3D(-1213, -33, 7731);
+		out_3d.assign(r, r + size_3d);
+	};
+
+	const NoiseSimd orig = getNoiseSimd();
+	std::vector<float> expected_2d, expected_3d, actual_2d, actual_3d;
+	UASSERT(setNoiseSimd(NoiseSimd::Scalar));
+	run(expected_2d, expected_3d);
+
+	// Results must be bit-identical, or there would be seams between chunks
+	for (NoiseSimd impl : {NoiseSimd::SSE2, NoiseSimd::AVX2}) {
+		if (!setNoiseSimd(impl))
+			continue;
+		run(actual_2d, actual_3d);
+		setNoiseSimd(orig);
+		UASSERT(memcmp(actual_2d.data(), expected_2d.data(),
+			sizeof(float) * size_2d) == 0);
+		UASSERT(memcmp(actual_3d.data(), expected_3d.data(),
+			sizeof(float) * size_3d) == 0);
+	}
+
+	setNoiseSimd(orig);
+}
+
 const float TestNoise::expected_2d_results[10 * 10] = {
 	19.11726, 18.49626, 16.48476, 15.02135, 14.75713, 16.26008, 17.54822,
 	18.06860, 18.57016, 18.48407, 18.49649, 17.89160, 15.94162, 14.54901,
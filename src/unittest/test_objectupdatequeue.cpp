@@ -0,0 +1,175 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "test.h"
+
+#include <map>
+#include <sstream>
+#include "server/object_update_queue.h"
+#include "util/serialize.h"
+
+class TestObjectUpdateQueue : public TestBase
+{
+public:
+	TestObjectUpdateQueue() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestObjectUpdateQueue"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testTiers();
+	void testReplace();
+	void testBudget();
+	void testUnknown();
+};
+
+static TestObjectUpdateQueue g_test_instance;
+
+void TestObjectUpdateQueue::runTests(IGameDef *gamedef)
+{
+	TEST(testTiers);
+	TEST(testReplace);
+	TEST(testBudget);
+	TEST(testUnknown);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Object id -> data, in the order they were sent
+static std::vector<std::pair<u16, std::string>> read_messages(const std::string &data)
+{
+	std::vector<std::pair<u16, std::string>> messages;
+	std::istringstream is(data, std::ios::binary);
+	while (is.peek() != EOF) {
+		u16 id = readU16(is);
+		messages.emplace_back(id, deSerializeString16(is));
+	}
+	return messages;
+}
+
+void TestObjectUpdateQueue::testTiers()
+{
+	ObjectUpdateQueue queue;
+	std::map<u16, int> tiers = {{1, 0}, {2, 2}};
+	auto get_tier = [&] (u16 id) { return tiers.at(id); };
+	std::string out;
+
+	// The first update always goes out
+	queue.push(1, "a");
+	queue.push(2, "b");
+	queue.pop(0.1f, 0, get_tier, &out);
+	UASSERTEQ(size_t, read_messages(out).size(), 2);
+
+	// Tier 2 waits for its interval
+	float time = 0.0f;
+	for (int i = 0; i < 4; i++) {
+		out.clear();
+		queue.push(1, "a");
+		queue.push(2, "b");
+		queue.pop(0.1f, 0, get_tier, &out);
+		time += 0.1f;
+		auto messages = read_messages(out);
+		UASSERT(!messages.empty() && messages[0].first == 1);
+		UASSERTEQ(size_t, messages.size(), 1);
+	}
+	UASSERTEQ(size_t, queue.getWaitingCount(), 1);
+
+	out.clear();
+	queue.pop(ObjectUpdateQueue::getTierInterval(2) - time, 0, get_tier, &out);
+	auto messages = read_messages(out);
+	UASSERTEQ(size_t, messages.size(), 1);
+	UASSERTEQ(u16, messages[0].first, 2);
+	UASSERT(messages[0].second == "b");
+	UASSERTEQ(size_t, queue.getWaitingCount(), 0);
+}
+
+void TestObjectUpdateQueue::testReplace()
+{
+	ObjectUpdateQueue queue;
+	auto get_tier = [] (u16 id) { return 3; };
+	std::string out;
+
+	queue.push(5, "old");
+	queue.pop(0.1f, 0, get_tier, &out);
+	out.clear();
+
+	// Only the newest waiting update is sent
+	queue.push(5, "older");
+	queue.push(5, "newer");
+	queue.pop(0.5f, 0, get_tier, &out);
+	UASSERT(out.empty());
+	queue.pop(0.5f, 0, get_tier, &out);
+	auto messages = read_messages(out);
+	UASSERTEQ(size_t, messages.size(), 1);
+	UASSERT(messages[0].second == "newer");
+
+	// Updates sent some other way restart the interval
+	out.clear();
+	queue.push(5, "delta");
+	queue.sent(5);
+	queue.pop(1.0f, 0, get_tier, &out);
+	UASSERT(out.empty());
+	UASSERTEQ(size_t, queue.getWaitingCount(), 0);
+}
+
+void TestObjectUpdateQueue::testBudget()
+{
+	ObjectUpdateQueue queue;
+	std::map<u16, int> tiers = {{1, 1}, {2, 0}, {3, 1}};
+	auto get_tier = [&] (u16 id) { return tiers.at(id); };
+	const std::string data(10, 'x');
+	// u16 id, u16 length, data
+	const u32 message_size = 4 + data.size();
+	std::string out;
+
+	// Lowest tier first
+	for (u16 id = 1; id <= 3; id++)
+		queue.push(id, data);
+	UASSERTEQ(u32, queue.pop(0.1f, message_size, get_tier, &out), message_size);
+	auto messages = read_messages(out);
+	UASSERTEQ(size_t, messages.size(), 1);
+	UASSERTEQ(u16, messages[0].first, 2);
+
+	// Then the one that waited longest
+	out.clear();
+	queue.pop(0.1f, 2 * message_size, get_tier, &out);
+	messages = read_messages(out);
+	UASSERTEQ(size_t, messages.size(), 2);
+
+	queue.push(1, data);
+	queue.push(3, data);
+	out.clear();
+	queue.pop(1.0f, message_size, get_tier, &out);
+	queue.pop(0.1f, message_size, get_tier, &out);
+	messages = read_messages(out);
+	UASSERTEQ(size_t, messages.size(), 2);
+	UASSERT(messages[0].first != messages[1].first);
+
+	// A budget too small still lets one through
+	queue.push(2, data);
+	out.clear();
+	UASSERTEQ(u32, queue.pop(0.1f, 1, get_tier, &out), message_size);
+
+	queue.countBytes(1000);
+	queue.pop(1.0f, 0, get_tier, &out);
+	UASSERT(queue.getBytesPerSecond() > 0);
+}
+
+void TestObjectUpdateQueue::testUnknown()
+{
+	ObjectUpdateQueue queue;
+	int tier = 0;
+	auto get_tier = [&] (u16 id) { return tier; };
+	std::string out;
+
+	queue.push(7, "a");
+	tier = -1;
+	queue.pop(0.1f, 0, get_tier, &out);
+	UASSERT(out.empty());
+	UASSERTEQ(size_t, queue.getWaitingCount(), 0);
+
+	// Forgotten objects start over
+	tier = 3;
+	queue.push(7, "b");
+	queue.pop(0.1f, 0, get_tier, &out);
+	UASSERTEQ(size_t, read_messages(out).size(), 1);
+}
@@ -21,6 +21,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "mock_server.h"
 #include "server/luaentity_sao.h"
+#include "object_position.h"
+#include "util/serialize.h"
 #include "emerge.h"
 
 /*
@@ -41,6 +43,7 @@ class TestSAO : public TestBase
 	void testActivate(ServerEnvironment *env);
 	void testStaticToFalse(ServerEnvironment *env);
 	void testStaticToTrue(ServerEnvironment *env);
+	void testPositionUpdates(ServerEnvironment *env);
 
 private:
 	// enough for both removeRemovedObjects and deactivateFarObjects to be called
@@ -100,6 +103,7 @@ void TestSAO::runTests(IGameDef *gamedef)
 	TEST(testActivate, &env);
 	TEST(testStaticToFalse, &env);
 	TEST(testStaticToTrue, &env);
+	TEST(testPositionUpdates, &env);
 
 	env.deactivateBlocksAndObjects();
 }
@@ -313,3 +317,59 @@ void TestSAO::testStaticToTrue(ServerEnvironment *env)
 	UASSERTEQ(size_t, block->m_static_objects.getStoredSize(), 1);
 	UASSERTEQ(size_t, block->m_static_objects.getActiveSize(), 0);
 }
+
+static ActiveObjectMessage pop_position_message(ServerActiveObject *obj)
+{
+	std::queue<ActiveObjectMessage> queue;
+	obj->dumpAOMessagesToQueue(queue);
+	UASSERT(!queue.empty());
+	ActiveObjectMessage last = queue.back();
+	return last;
+}
+
+void TestSAO::testPositionUpdates(ServerEnvironment *env)
+{
+	const v3f testpos(10 * BS, -66 * BS, 0);
+	auto obj = add_entity(env, testpos, "test:non_static");
+	UASSERT(obj);
+
+	// First a keyframe, reliably, and full updates for old clients
+	obj->setPos(testpos);
+	ActiveObjectMessage aom = pop_position_message(obj);
+	UASSERT(aom.reliable);
+	UASSERTEQ(int, aom.getData(45)[0], AO_CMD_POSITION_KEYFRAME);
+	UASSERTEQ(int, aom.getData(44)[0], AO_CMD_UPDATE_POSITION);
+	std::istringstream is(aom.datastring.substr(1), std::ios::binary);
+	const u8 keyframe_id = readU8(is);
+	const ObjectPosition keyframe = readObjectPosition(is);
+	UASSERT(keyframe.position == testpos);
+
+	// Then small deltas against it
+	const v3f moved = testpos + v3f(1.23f, -4.56f, 7.89f);
+	obj->moveTo(moved, false);
+	aom = pop_position_message(obj);
+	UASSERT(!aom.reliable);
+	UASSERTEQ(int, aom.getData(45)[0], AO_CMD_POSITION_DELTA);
+	UASSERTEQ(int, aom.getData(44)[0], AO_CMD_UPDATE_POSITION);
+	UASSERT(aom.datastring.size() * 3 < aom.legacy_datastring.size());
+	is.str(aom.datastring.substr(1));
+	is.clear();
+	UASSERTEQ(int, readU8(is), keyframe_id);
+	const ObjectPosition pos = readObjectPositionDelta(is, keyframe);
+	UASSERT(pos.position.getDistanceFrom(moved) < OBJECT_POSITION_STEP);
+	UASSERT(pos.do_interpolate && pos.is_movement_end);
+	UASSERT(pos.velocity == keyframe.velocity);
+
+	// New clients get both
+	UASSERT(obj->getClientInitializationData(45).size() >
+		obj->getClientInitializationData(44).size() + aom.datastring.size());
+
+	// Too far for a delta
+	obj->setPos(testpos + v3f(1000 * BS, 0, 0));
+	aom = pop_position_message(obj);
+	UASSERT(aom.reliable);
+	UASSERTEQ(int, aom.datastring[0], AO_CMD_POSITION_KEYFRAME);
+	UASSERTEQ(int, aom.datastring[1], (u8)(keyframe_id + 1));
+
+	obj->markForRemoval();
+}
@@ -0,0 +1,110 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "test.h"
+
+#include <map>
+#include "filesys.h"
+#include "mock_server.h"
+#include "porting.h"
+#include "scripting_server.h"
+
+class TestScriptMetrics : public TestBase
+{
+public:
+	TestScriptMetrics() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestScriptMetrics"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testCallbackTime();
+};
+
+static TestScriptMetrics g_test_instance;
+
+void TestScriptMetrics::runTests(IGameDef *gamedef)
+{
+	TEST(testCallbackTime);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Keeps the counters it hands out, by "callback/mod"
+class RecordingMetricsBackend : public MetricsBackend
+{
+public:
+	MetricCounterPtr addCounter(const std::string &name,
+			const std::string &help_str, Labels labels) override
+	{
+		std::map<std::string, std::string> l(labels.begin(), labels.end());
+		auto counter = MetricsBackend::addCounter(name, help_str, labels);
+		counters[l["callback"] + "/" + l["mod"]] = counter;
+		return counter;
+	}
+
+	double get(const std::string &key) const
+	{
+		auto it = counters.find(key);
+		return it == counters.end() ? -1 : it->second->get();
+	}
+
+	std::map<std::string, MetricCounterPtr> counters;
+};
+
+}
+
+void TestScriptMetrics::testCallbackTime()
+{
+	MockServer server(getTestTempDirectory());
+	server.createScripting();
+	ServerScripting *script = server.getScriptIface();
+
+	RecordingMetricsBackend mb;
+	script->setCallbackMetrics(&mb);
+
+	// An auth handler of mod_e, run untimed through getAuth()
+	std::string path = getTestTempFile();
+	UASSERT(fs::safeWriteToFile(path,
+		"core.registered_auth_handler = { mod_origin = \"mod_e\",\n"
+		"	get_auth = function()\n"
+		"		local t = core.get_us_time()\n"
+		"		while core.get_us_time() - t < 20000 do end\n"
+		"	end,\n"
+		"}\n"));
+	script->loadScript(path);
+
+	{
+		ScriptCallbackTimer timer(script, ScriptCallbackType::Globalstep);
+		script->setOriginDirect("mod_a");
+		sleep_ms(20);
+		// Like core.run_callbacks moving on to the next callback
+		script->setOriginDirect("mod_b");
+		sleep_ms(20);
+		{
+			ScriptCallbackTimer timer2(script, ScriptCallbackType::Punch);
+			script->setOriginDirect("mod_c");
+			sleep_ms(20);
+		}
+		// Back in the callback of mod_b
+		sleep_ms(20);
+		// Like set_node running on_construct of a node of mod_e
+		UASSERT(!script->getAuth("player", nullptr, nullptr, nullptr));
+		UASSERTEQ(std::string, script->getOrigin(), "mod_b");
+		sleep_ms(20);
+	}
+	// Not within a callback
+	script->setOriginDirect("mod_d");
+	sleep_ms(20);
+
+	UASSERT(mb.get("globalstep/mod_a") >= 20000);
+	UASSERT(mb.get("globalstep/mod_b") >= 60000);
+	UASSERT(mb.get("on_punch/mod_c") >= 20000);
+	// An untimed nested callback counts for its mod, within the outer one
+	UASSERT(mb.get("globalstep/mod_e") >= 20000);
+	// The nested callback only counts for itself
+	UASSERTEQ(double, mb.get("globalstep/mod_c"), -1);
+	UASSERTEQ(double, mb.get("on_punch/mod_b"), -1);
+	UASSERTEQ(size_t, mb.counters.size(), 4);
+}
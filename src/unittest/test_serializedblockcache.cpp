@@ -0,0 +1,99 @@
+// Minetest
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "test.h"
+
+#include "mapblock.h"
+#include "server/serialized_block_cache.h"
+
+class TestSerializedBlockCache : public TestBase
+{
+public:
+	TestSerializedBlockCache() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestSerializedBlockCache"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testGetPut(IGameDef *gamedef);
+	void testInvalidation(IGameDef *gamedef);
+	void testEviction(IGameDef *gamedef);
+};
+
+static TestSerializedBlockCache g_test_instance;
+
+void TestSerializedBlockCache::runTests(IGameDef *gamedef)
+{
+	TEST(testGetPut, gamedef);
+	TEST(testInvalidation, gamedef);
+	TEST(testEviction, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static SerializedBlockCache::Data make_data(size_t size)
+{
+	return std::make_shared<const std::string>(size, 'x');
+}
+
+void TestSerializedBlockCache::testGetPut(IGameDef *gamedef)
+{
+	SerializedBlockCache cache(1024);
+	MapBlock block({1, 2, 3}, gamedef);
+
+	UASSERT(!cache.get(&block, 29));
+
+	auto data = make_data(100);
+	cache.put(&block, 29, data);
+	UASSERT(cache.get(&block, 29) == data);
+	UASSERTEQ(size_t, cache.getBytes(), 100);
+
+	// Other serialization versions and dictionaries are separate
+	UASSERT(!cache.get(&block, 28));
+	UASSERT(!cache.get(&block, 29, 1234));
+
+	cache.clear();
+	UASSERT(!cache.get(&block, 29));
+	UASSERTEQ(size_t, cache.getBytes(), 0);
+}
+
+void TestSerializedBlockCache::testInvalidation(IGameDef *gamedef)
+{
+	SerializedBlockCache cache(1024);
+	{
+		MapBlock block({0, 0, 0}, gamedef);
+		cache.put(&block, 29, make_data(100));
+		UASSERT(cache.get(&block, 29));
+
+		block.setNode({0, 0, 0}, MapNode(t_CONTENT_STONE));
+		UASSERT(!cache.get(&block, 29));
+		UASSERTEQ(size_t, cache.getBytes(), 0);
+
+		cache.put(&block, 29, make_data(100));
+	}
+
+	// A new block object at the same position (e.g. after reloading) must
+	// not get the data of the old one
+	MapBlock block({0, 0, 0}, gamedef);
+	UASSERT(!cache.get(&block, 29));
+}
+
+void TestSerializedBlockCache::testEviction(IGameDef *gamedef)
+{
+	SerializedBlockCache cache(250);
+	MapBlock a({0, 0, 0}, gamedef), b({0, 0, 1}, gamedef), c({0, 0, 2}, gamedef);
+
+	cache.put(&a, 29, make_data(100));
+	cache.put(&b, 29, make_data(100));
+	// Touch a, so b is the least recently used one
+	UASSERT(cache.get(&a, 29));
+	cache.put(&c, 29, make_data(100));
+
+	UASSERT(cache.get(&a, 29));
+	UASSERT(!cache.get(&b, 29));
+	UASSERT(cache.get(&c, 29));
+	UASSERTEQ(size_t, cache.getBytes(), 200);
+
+	// Too large entries are not stored at all
+	cache.put(&b, 29, make_data(300));
+	UASSERT(!cache.get(&b, 29));
+}
@@ -40,6 +40,8 @@ class TestServerActiveObjectMgr : public TestBase
 	void testRemoveObject();
 	void testGetObjectsInsideRadius();
 	void testGetAddedActiveObjectsAroundPos();
+	void testGetObjectsInArea();
+	void testUpdateObjectPos();
 };
 
 static TestServerActiveObjectMgr g_test_instance;
@@ -51,6 +53,8 @@ void TestServerActiveObjectMgr::runTests(IGameDef *gamedef)
 	TEST(testRemoveObject)
 	TEST(testGetObjectsInsideRadius);
 	TEST(testGetAddedActiveObjectsAroundPos);
+	TEST(testGetObjectsInArea);
+	TEST(testUpdateObjectPos);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -185,3 +189,71 @@ void TestServerActiveObjectMgr::testGetAddedActiveObjectsAroundPos()
 
 	saomgr.clear();
 }
+
+void TestServerActiveObjectMgr::testGetObjectsInArea()
+{
+	server::ActiveObjectMgr saomgr;
+	static const v3f sao_pos[] = {
+			v3f(10, 40, 10),
+			v3f(740, 100, -304),
+			v3f(-200, 100, -304),
+			v3f(740, -740, -304),
+			v3f(1500, -740, -304),
+	};
+
+	for (const auto &p : sao_pos) {
+		saomgr.registerObject(std::make_unique<MockServerActiveObject>(nullptr, p));
+	}
+
+	std::vector<ServerActiveObject *> result;
+	saomgr.getObjectsInArea(aabb3f(v3f(0, 0, 0), v3f(20, 50, 20)), result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	result.clear();
+	saomgr.getObjectsInArea(aabb3f(v3f(-300, 0, -400), v3f(800, 200, 20)), result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 3);
+
+	result.clear();
+	saomgr.getObjectsInArea(aabb3f(v3f(-1e6), v3f(1e6)), result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 5);
+
+	// Results are ordered by id
+	for (size_t i = 1; i < result.size(); i++)
+		UASSERT(result[i - 1]->getId() < result[i]->getId());
+
+	saomgr.clear();
+}
+
+void TestServerActiveObjectMgr::testUpdateObjectPos()
+{
+	server::ActiveObjectMgr saomgr;
+	auto sao_u = std::make_unique<MockServerActiveObject>(nullptr, v3f(10, 40, 10));
+	auto sao = sao_u.get();
+	UASSERT(saomgr.registerObject(std::move(sao_u)));
+
+	std::vector<ServerActiveObject *> result;
+	saomgr.getObjectsInsideRadius(v3f(), 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	// Move it several blocks away, the index must follow
+	const v3f new_pos(5000, -700, 3000);
+	sao->setBasePosition(new_pos);
+	saomgr.updateObjectPos(sao->getId(), new_pos);
+
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(), 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	result.clear();
+	saomgr.getObjectsInsideRadius(new_pos, 1, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+	UASSERT(result[0] == sao);
+
+	// Removed objects must not show up anymore
+	saomgr.removeObject(sao->getId());
+	result.clear();
+	saomgr.getObjectsInsideRadius(new_pos, 1, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	saomgr.clear();
+}
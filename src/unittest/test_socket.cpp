@@ -19,6 +19,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <vector>
+
 #include "log.h"
 #include "settings.h"
 #include "network/socket.h"
@@ -37,6 +39,7 @@ class TestSocket : public TestBase {
 
 	void testIPv4Socket();
 	void testIPv6Socket();
+	void testBatchedIO();
 
 	static const int port = 30003;
 };
@@ -46,6 +49,7 @@ static TestSocket g_test_instance;
 void TestSocket::runTests(IGameDef *gamedef)
 {
 	TEST(testIPv4Socket);
+	TEST(testBatchedIO);
 
 	if (g_settings->getBool("enable_ipv6"))
 		TEST(testIPv6Socket);
@@ -147,3 +151,54 @@ void TestSocket::testIPv6Socket()
 				Address(&bytes, 0).getAddress6().s6_addr, 16) == 0);
 	}
 }
+
+void TestSocket::testBatchedIO()
+{
+	UDPSocket socket(false);
+	socket.Bind(Address(127, 0, 0, 1, port + 1));
+	socket.setTimeoutMs(50);
+
+	// More than one batch of the underlying system call
+	const int count = 100;
+	const Address dest(127, 0, 0, 1, port + 1);
+	std::vector<std::string> payloads;
+	std::vector<UDPSocket::Datagram> datagrams;
+	for (int i = 0; i < count; i++)
+		payloads.push_back("datagram " + std::to_string(i));
+	for (int i = 0; i < count; i++) {
+		std::string &payload = payloads[i];
+		if (i % 2 == 0) {
+			datagrams.push_back({dest, payload.data(), (int)payload.size()});
+		} else {
+			// Sent in two parts, arrives as one
+			datagrams.push_back({dest, payload.data(), 4,
+				payload.data() + 4, (int)payload.size() - 4});
+		}
+	}
+
+	UASSERTEQ(int, socket.SendMany(datagrams.data(), count), count);
+
+	char buffers[count][64];
+	int received = 0;
+	while (received < count) {
+		std::vector<UDPSocket::Datagram> rcv(count - received);
+		for (size_t i = 0; i < rcv.size(); i++)
+			rcv[i] = {Address(), buffers[received + i], sizeof(buffers[0])};
+		int n = socket.ReceiveMany(rcv.data(), rcv.size());
+		if (n == 0)
+			break;
+		for (int i = 0; i < n; i++) {
+			// Loopback keeps the order
+			UASSERTEQ(std::string, std::string(buffers[received + i], rcv[i].size),
+				payloads[received + i]);
+			UASSERT(rcv[i].address.getAddress().s_addr == dest.getAddress().s_addr);
+		}
+		received += n;
+	}
+	UASSERTEQ(int, received, count);
+
+	// Nothing left
+	UDPSocket::Datagram d{Address(), buffers[0], sizeof(buffers[0])};
+	socket.setTimeoutMs(0);
+	UASSERTEQ(int, socket.ReceiveMany(&d, 1), 0);
+}
@@ -23,6 +23,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <iostream>
 #include "threading/semaphore.h"
 #include "threading/thread.h"
+#include "threading/worker_pool.h"
+#include "exceptions.h"
 
 
 class TestThreading : public TestBase {
@@ -34,6 +36,7 @@ class TestThreading : public TestBase {
 	void testStartStopWait();
 	void testAtomicSemaphoreThread();
 	void testTLS();
+	void testWorkerPool();
 };
 
 static TestThreading g_test_instance;
@@ -43,6 +46,7 @@ void TestThreading::runTests(IGameDef *gamedef)
 	TEST(testStartStopWait);
 	TEST(testAtomicSemaphoreThread);
 	TEST(testTLS);
+	TEST(testWorkerPool);
 }
 
 class SimpleTestThread : public Thread {
@@ -242,3 +246,37 @@ void TestThreading::testTLS()
 		}
 	}
 }
+
+
+void TestThreading::testWorkerPool()
+{
+	WorkerPool pool("TestPool", 3);
+	UASSERTEQ(unsigned int, pool.size(), 3);
+
+	// Run a few rounds to make sure workers pick up every new job
+	for (int round = 0; round < 20; round++) {
+		std::vector<int> out(1000, 0);
+		pool.forEach(out.size(), [&] (size_t i) {
+			out[i] += (int)i + round;
+		});
+		for (size_t i = 0; i < out.size(); i++)
+			UASSERTEQ(int, out[i], (int)i + round);
+	}
+
+	// Exceptions are passed to the caller
+	bool caught = false;
+	try {
+		pool.forEach(100, [] (size_t i) {
+			if (i == 42)
+				throw BaseException("expected");
+		});
+	} catch (BaseException &e) {
+		caught = true;
+	}
+	UASSERT(caught);
+
+	// The pool is still usable afterwards
+	std::atomic<size_t> sum(0);
+	pool.forEach(100, [&] (size_t i) { sum += i; });
+	UASSERTEQ(size_t, sum, 4950);
+}
@@ -34,6 +34,7 @@ class TestVoxelAlgorithms : public TestBase {
 
 	void testVoxelLineIterator();
 	void testLighting(IGameDef *gamedef);
+	void testLightingBatch(IGameDef *gamedef);
 };
 
 static TestVoxelAlgorithms g_test_instance;
@@ -42,6 +43,7 @@ void TestVoxelAlgorithms::runTests(IGameDef *gamedef)
 {
 	TEST(testVoxelLineIterator);
 	TEST(testLighting, gamedef);
+	TEST(testLightingBatch, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -101,31 +103,33 @@ void TestVoxelAlgorithms::testVoxelLineIterator()
 	}
 }
 
+// Makes a 21x21x21 hollow box centered at the origin.
+static void make_hollow_box(DummyMap &map, v3s16 bpmin, v3s16 bpmax)
+{
+	std::map<v3s16, MapBlock*> modified_blocks;
+	MMVManip vm(&map);
+	vm.initialEmerge(bpmin, bpmax, false);
+	s32 volume = vm.m_area.getVolume();
+	for (s32 i = 0; i < volume; i++)
+		vm.m_data[i] = MapNode(CONTENT_AIR);
+	for (s16 z = -10; z <= 10; z++)
+	for (s16 y = -10; y <= 10; y++)
+	for (s16 x = -10; x <= 10; x++)
+		vm.setNodeNoEmerge(v3s16(x, y, z), MapNode(t_CONTENT_STONE));
+	for (s16 z = -9; z <= 9; z++)
+	for (s16 y = -9; y <= 9; y++)
+	for (s16 x = -9; x <= 9; x++)
+		vm.setNodeNoEmerge(v3s16(x, y, z), MapNode(CONTENT_AIR));
+	voxalgo::blit_back_with_light(&map, &vm, &modified_blocks);
+}
+
 void TestVoxelAlgorithms::testLighting(IGameDef *gamedef)
 {
 	v3s16 pmin(-32, -32, -32);
 	v3s16 pmax(31, 31, 31);
 	v3s16 bpmin = getNodeBlockPos(pmin), bpmax = getNodeBlockPos(pmax);
 	DummyMap map(gamedef, bpmin, bpmax);
-
-	// Make a 21x21x21 hollow box centered at the origin.
-	{
-		std::map<v3s16, MapBlock*> modified_blocks;
-		MMVManip vm(&map);
-		vm.initialEmerge(bpmin, bpmax, false);
-		s32 volume = vm.m_area.getVolume();
-		for (s32 i = 0; i < volume; i++)
-			vm.m_data[i] = MapNode(CONTENT_AIR);
-		for (s16 z = -10; z <= 10; z++)
-		for (s16 y = -10; y <= 10; y++)
-		for (s16 x = -10; x <= 10; x++)
-			vm.setNodeNoEmerge(v3s16(x, y, z), MapNode(t_CONTENT_STONE));
-		for (s16 z = -9; z <= 9; z++)
-		for (s16 y = -9; y <= 9; y++)
-		for (s16 x = -9; x <= 9; x++)
-			vm.setNodeNoEmerge(v3s16(x, y, z), MapNode(CONTENT_AIR));
-		voxalgo::blit_back_with_light(&map, &vm, &modified_blocks);
-	}
+	make_hollow_box(map, bpmin, bpmax);
 
 	// Place two holes on the edges a torch in the center.
 	{
@@ -168,3 +172,52 @@ void TestVoxelAlgorithms::testLighting(IGameDef *gamedef)
 		UASSERTEQ(int, n.getParam1(), 153);
 	}
 }
+
+void TestVoxelAlgorithms::testLightingBatch(IGameDef *gamedef)
+{
+	v3s16 pmin(-32, -32, -32);
+	v3s16 pmax(31, 31, 31);
+	v3s16 bpmin = getNodeBlockPos(pmin), bpmax = getNodeBlockPos(pmax);
+	DummyMap map(gamedef, bpmin, bpmax), batched_map(gamedef, bpmin, bpmax);
+	make_hollow_box(map, bpmin, bpmax);
+	make_hollow_box(batched_map, bpmin, bpmax);
+
+	std::map<v3s16, MapBlock*> modified_blocks;
+	map.addNodeAndUpdate(v3s16(6, 6, 6), MapNode(t_CONTENT_TORCH), modified_blocks);
+	batched_map.addNodeAndUpdate(v3s16(6, 6, 6), MapNode(t_CONTENT_TORCH),
+			modified_blocks);
+
+	// Holes in the roof and a wall, torches, a torch that is gone again and
+	// nodes that are set more than once
+	const std::pair<v3s16, content_t> changes[] = {
+		{{6, 6, 6}, t_CONTENT_STONE},
+		{{6, 6, 6}, CONTENT_AIR},
+		{{0, 10, 0}, CONTENT_AIR},
+		{{0, 9, 0}, t_CONTENT_STONE},
+		{{-10, 0, 0}, CONTENT_AIR},
+		{{3, 0, 3}, t_CONTENT_TORCH},
+		{{-5, -9, 5}, t_CONTENT_TORCH},
+		{{4, 4, -4}, t_CONTENT_TORCH},
+		{{9, 10, -9}, t_CONTENT_WATER},
+		{{4, 4, -4}, CONTENT_AIR},
+		{{0, 9, 0}, CONTENT_AIR},
+		{{0, 9, 0}, t_CONTENT_LAVA},
+	};
+
+	for (const auto &change : changes)
+		map.addNodeAndUpdate(change.first, MapNode(change.second), modified_blocks);
+	{
+		MapLightingBatch batch(&batched_map);
+		for (const auto &change : changes)
+			batched_map.addNodeAndUpdate(change.first, MapNode(change.second),
+					modified_blocks);
+	}
+
+	// Relighting everything at once gives the same light
+	for (s16 z = -12; z <= 12; z++)
+	for (s16 y = -12; y <= 12; y++)
+	for (s16 x = -12; x <= 12; x++) {
+		v3s16 p(x, y, z);
+		UASSERTEQ(int, batched_map.getNode(p).getParam1(), map.getNode(p).getParam1());
+	}
+}
@@ -34,6 +34,7 @@ class TestVoxelManipulator : public TestBase {
 
 	void testVoxelArea();
 	void testVoxelManipulator(const NodeDefManager *nodedef);
+	void testBulkOperations();
 };
 
 static TestVoxelManipulator g_test_instance;
@@ -42,6 +43,7 @@ void TestVoxelManipulator::runTests(IGameDef *gamedef)
 {
 	TEST(testVoxelArea);
 	TEST(testVoxelManipulator, gamedef->getNodeDefManager());
+	TEST(testBulkOperations);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -106,3 +108,44 @@ void TestVoxelManipulator::testVoxelManipulator(const NodeDefManager *nodedef)
 	UASSERT(v.getNode(v3s16(-1,0,-1)).getContent() == t_CONTENT_GRASS);
 	EXCEPTION_CHECK(InvalidPositionException, v.getNode(v3s16(0,1,1)));
 }
+
+void TestVoxelManipulator::testBulkOperations()
+{
+	VoxelManipulator v;
+	VoxelArea all(v3s16(-2,-2,-2), v3s16(2,2,2));
+	v.addArea(all);
+	UASSERTEQ(u32, v.fillArea(all, t_CONTENT_STONE, 0), 125);
+
+	// A 3x1x2 box of grass with param2 = 5 in its middle
+	VoxelArea box(v3s16(-1,0,0), v3s16(1,0,1));
+	UASSERTEQ(u32, v.fillArea(box, t_CONTENT_GRASS, 5), 6);
+	UASSERT(v.getNodeRefUnsafe(v3s16(1,0,1)).getContent() == t_CONTENT_GRASS);
+	UASSERT(v.getNodeRefUnsafe(v3s16(1,0,1)).param2 == 5);
+	UASSERT(v.getNodeRefUnsafe(v3s16(2,0,1)).getContent() == t_CONTENT_STONE);
+
+	std::vector<u32> counts;
+	v.countContents(all, counts);
+	UASSERT(counts.size() > std::max(t_CONTENT_STONE, t_CONTENT_GRASS));
+	UASSERTEQ(u32, counts[t_CONTENT_STONE], 119);
+	UASSERTEQ(u32, counts[t_CONTENT_GRASS], 6);
+
+	std::vector<bool> grass(t_CONTENT_GRASS + 1, false);
+	grass[t_CONTENT_GRASS] = true;
+	std::vector<v3s16> found;
+	v.findContents(VoxelArea(v3s16(0,-2,-2), v3s16(2,2,2)), grass, found);
+	UASSERTEQ(size_t, found.size(), 4);
+	UASSERT(std::find(found.begin(), found.end(), v3s16(1,0,0)) != found.end());
+	UASSERT(std::find(found.begin(), found.end(), v3s16(-1,0,0)) == found.end());
+
+	// Replace only matching content, and only where param2 matches
+	std::vector<bool> stone(t_CONTENT_STONE + 1, false);
+	stone[t_CONTENT_STONE] = true;
+	UASSERTEQ(u32, v.fillArea(all, t_CONTENT_BRICK, std::nullopt, &stone, 5), 0);
+	UASSERTEQ(u32, v.fillArea(all, t_CONTENT_BRICK, std::nullopt, &grass, 5), 6);
+	UASSERTEQ(u32, v.fillArea(all, t_CONTENT_TORCH, std::nullopt, &stone), 119);
+	counts.clear();
+	v.countContents(all, counts);
+	UASSERTEQ(u32, counts[t_CONTENT_BRICK], 6);
+	UASSERTEQ(u32, counts[t_CONTENT_TORCH], 119);
+	UASSERT(v.getNodeRefUnsafe(v3s16(0,0,0)).param2 == 5);
+}
@@ -142,6 +142,12 @@ class MutexedQueue
 		return m_queue.empty();
 	}
 
+	size_t size() const
+	{
+		MutexAutoLock lock(m_mutex);
+		return m_queue.size();
+	}
+
 	void push_back(const T &t)
 	{
 		MutexAutoLock lock(m_mutex);
@@ -319,6 +319,82 @@ void VoxelManipulator::clearFlag(u8 flags)
 			<<volume<<" nodes"<<std::endl;*/
 }
 
+static inline bool in_content_set(const std::vector<bool> &set, content_t c)
+{
+	return c < set.size() && set[c];
+}
+
+u32 VoxelManipulator::fillArea(const VoxelArea &area, content_t c,
+		std::optional<u8> param2, const std::vector<bool> *contents,
+		std::optional<u8> where_param2)
+{
+	assert(m_area.contains(area));
+
+	const s16 width = area.getExtent().X;
+	u32 count = 0;
+	for (s16 z = area.MinEdge.Z; z <= area.MaxEdge.Z; z++)
+	for (s16 y = area.MinEdge.Y; y <= area.MaxEdge.Y; y++) {
+		// Rows along X are contiguous in m_data
+		MapNode *row = &m_data[m_area.index(area.MinEdge.X, y, z)];
+		if (!contents && !where_param2) {
+			for (s16 x = 0; x < width; x++)
+				row[x].setContent(c);
+			if (param2) {
+				for (s16 x = 0; x < width; x++)
+					row[x].param2 = *param2;
+			}
+			count += width;
+			continue;
+		}
+		for (s16 x = 0; x < width; x++) {
+			MapNode &n = row[x];
+			if (contents && !in_content_set(*contents, n.getContent()))
+				continue;
+			if (where_param2 && n.param2 != *where_param2)
+				continue;
+			n.setContent(c);
+			if (param2)
+				n.param2 = *param2;
+			count++;
+		}
+	}
+	return count;
+}
+
+void VoxelManipulator::countContents(const VoxelArea &area,
+		std::vector<u32> &counts) const
+{
+	assert(m_area.contains(area));
+
+	const s16 width = area.getExtent().X;
+	for (s16 z = area.MinEdge.Z; z <= area.MaxEdge.Z; z++)
+	for (s16 y = area.MinEdge.Y; y <= area.MaxEdge.Y; y++) {
+		const MapNode *row = &m_data[m_area.index(area.MinEdge.X, y, z)];
+		for (s16 x = 0; x < width; x++) {
+			content_t c = row[x].getContent();
+			if (c >= counts.size())
+				counts.resize(c + 1, 0);
+			counts[c]++;
+		}
+	}
+}
+
+void VoxelManipulator::findContents(const VoxelArea &area,
+		const std::vector<bool> &contents, std::vector<v3s16> &found) const
+{
+	assert(m_area.contains(area));
+
+	const s16 width = area.getExtent().X;
+	for (s16 z = area.MinEdge.Z; z <= area.MaxEdge.Z; z++)
+	for (s16 y = area.MinEdge.Y; y <= area.MaxEdge.Y; y++) {
+		const MapNode *row = &m_data[m_area.index(area.MinEdge.X, y, z)];
+		for (s16 x = 0; x < width; x++) {
+			if (in_content_set(contents, row[x].getContent()))
+				found.emplace_back(area.MinEdge.X + x, y, z);
+		}
+	}
+}
+
 const MapNode VoxelManipulator::ContentIgnoreNode = MapNode(CONTENT_IGNORE);
 
 //END
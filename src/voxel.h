@@ -27,6 +27,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapnode.h"
 #include <set>
 #include <list>
+#include <optional>
+#include <vector>
 #include "irrlicht_changes/printing.h"
 
 class NodeDefManager;
@@ -507,6 +509,27 @@ class VoxelManipulator
 
 	void clearFlag(u8 flag);
 
+	/*
+		Bulk operations on the nodes in `area`, which must lie within
+		m_area. Sets of content IDs hold a flag per ID; IDs past the end
+		of a set are not in it.
+	*/
+
+	// Sets the content, and param2 if given, of the nodes whose content is
+	// in `contents` (of all nodes if it is null) and whose param2 equals
+	// `where_param2` (if given). Returns the number of nodes set.
+	u32 fillArea(const VoxelArea &area, content_t c, std::optional<u8> param2,
+			const std::vector<bool> *contents = nullptr,
+			std::optional<u8> where_param2 = std::nullopt);
+
+	// Adds the number of nodes with content c to counts[c], growing counts
+	// as needed
+	void countContents(const VoxelArea &area, std::vector<u32> &counts) const;
+
+	// Appends the positions of the nodes whose content is in `contents`
+	void findContents(const VoxelArea &area, const std::vector<bool> &contents,
+			std::vector<v3s16> &found) const;
+
 	/*
 		Member variables
 	*/